@@ -6,15 +6,23 @@
 #
 # By default, this script edits header files in-place. It's recommended that
 # you commit any header file changes before running this script.
+#
+# In incremental mode, a manifest of content hashes is kept for each annotated
+# header, covering the header itself, the descriptions of the symbols it
+# declares, and the formatter. Headers are only rewritten if one of these has
+# changed since the last incremental run.
 
 from abc import ABC
 import argparse
+from concurrent.futures import ProcessPoolExecutor
 import fnmatch
+import hashlib
+import json
 import os
 import re
 import subprocess
 import textwrap
-from typing import Dict, Optional
+from typing import cast, Dict, Iterable, Optional
 import yaml
 
 from symbol_check import (
@@ -22,8 +30,12 @@ from symbol_check import (
     DataList,
     HeaderSymbolList,
     ROOT_DIR,
+    HEADERS_ROOT_DIR,
+    YAML_LOADER,
 )
 
+MANIFEST_FILE = os.path.join(HEADERS_ROOT_DIR, ".docstring_manifest.json")
+
 
 class Formatter(ABC):
     def format_docstring(self, text: str) -> str:
@@ -32,6 +44,10 @@ class Formatter(ABC):
     def format_file(self, filename: str):
         raise NotImplementedError
 
+    def cache_key(self) -> str:
+        """Identifier for the formatter's output style, for incremental runs"""
+        return type(self).__name__
+
     def sanitize_comment(self, comment: str) -> str:
         # Break up any end-of-comment delimiters in the raw comment text
         return comment.replace("*/", "* /")
@@ -66,6 +82,9 @@ class TextWrapFormatter(Formatter):
         except Exception:
             pass
 
+    def cache_key(self) -> str:
+        return f"{super().cache_key()}:{self.linewidth}"
+
     def format_docstring(self, text: str) -> str:
         prefix = " * "
         # Text wrapping needs to be done line-by-line to properly preserve
@@ -91,24 +110,186 @@ class TextWrapFormatter(Formatter):
         return
 
 
+def load_symbol_descriptions(symbol_file: str) -> Dict[str, Dict[str, str]]:
+    """
+    Load the descriptions of all symbols in a symbol table file, in the form
+    {symbol list key -> {symbol name -> description}}.
+    """
+    with open(symbol_file, "r") as f:
+        contents = yaml.load(f, Loader=YAML_LOADER)
+    descriptions: Dict[str, Dict[str, str]] = {"functions": {}, "data": {}}
+    for block in contents.values():
+        for key, symbol_descriptions in descriptions.items():
+            symbol_descriptions.update(
+                (symbol["name"], symbol["description"])
+                for symbol in block.get(key, [])
+                if "description" in symbol
+            )
+    return descriptions
+
+
+class SymbolDescriptions:
+    """
+    Symbol descriptions for each symbol table file, loaded lazily. Each symbol
+    table is parsed at most once.
+    """
+
+    def __init__(self):
+        self.descriptions: Dict[str, Dict[str, Dict[str, str]]] = {}
+
+    def prefetch(self, symbol_files: Iterable[str]):
+        """Load descriptions for the given symbol table files in parallel"""
+        symbol_files = [
+            f for f in dict.fromkeys(symbol_files) if f not in self.descriptions
+        ]
+        if len(symbol_files) <= 1:
+            for f in symbol_files:
+                self.descriptions[f] = load_symbol_descriptions(f)
+            return
+        with ProcessPoolExecutor() as executor:
+            self.descriptions.update(
+                zip(symbol_files, executor.map(load_symbol_descriptions, symbol_files))
+            )
+
+    def get(self, symbol_file: str, key: str) -> Dict[str, str]:
+        self.prefetch([symbol_file])
+        return self.descriptions[symbol_file][key]
+
+
+class DocstringManifest:
+    """
+    Manifest of content hashes for annotated header files, used to skip headers
+    whose inputs haven't changed since they were last annotated.
+    """
+
+    FORMAT_VERSION = 1
+
+    def __init__(self, path: str = MANIFEST_FILE):
+        self.path = path
+        # {output file -> {"input": hash, "symbol_file": path, "symbols": hash,
+        # "formatter": key, "docstrings": hash, "output": hash}}
+        self.entries: Dict[str, Dict[str, str]] = {}
+        try:
+            with open(path, "r") as f:
+                contents = json.load(f)
+            if contents.get("format_version") == DocstringManifest.FORMAT_VERSION:
+                self.entries = contents["entries"]
+        except (OSError, ValueError, KeyError):
+            pass
+
+    def save(self):
+        with open(self.path, "w") as f:
+            json.dump(
+                {
+                    "format_version": DocstringManifest.FORMAT_VERSION,
+                    "entries": self.entries,
+                },
+                f,
+                indent=1,
+                sort_keys=True,
+            )
+
+    @staticmethod
+    def file_hash(filename: str) -> Optional[str]:
+        try:
+            with open(filename, "rb") as f:
+                return hashlib.sha256(f.read()).hexdigest()
+        except FileNotFoundError:
+            return None
+
+    @staticmethod
+    def key(filename: str) -> str:
+        return os.path.relpath(filename, HEADERS_ROOT_DIR).replace(os.sep, "/")
+
+    def symbol_file_changed(self, symbol_file: str) -> bool:
+        """
+        Check whether a symbol table file has changed since the last run, for
+        any of the header files annotated from it.
+        """
+        symbols = self.file_hash(symbol_file)
+        entries = [
+            e for e in self.entries.values() if e["symbol_file"] == self.key(symbol_file)
+        ]
+        return not entries or any(e["symbols"] != symbols for e in entries)
+
+    def is_current(
+        self,
+        adder: "HeaderDocstringAdder",
+        input_file: str,
+        output_file: str,
+    ) -> bool:
+        """
+        Check whether an output file is up to date with respect to its input
+        header file and the docstrings for its symbols.
+        """
+        entry = self.entries.get(self.key(output_file))
+        if entry is None or entry["formatter"] != adder.formatter.cache_key():
+            return False
+        if self.file_hash(output_file) != entry["output"]:
+            return False
+        # When annotating in-place, the input file is the previous output
+        if input_file != output_file and self.file_hash(input_file) != entry["input"]:
+            return False
+        symbols = self.file_hash(adder.slist.symbol_file)
+        if symbols == entry["symbols"]:
+            return True
+        # The symbol table changed, but that only matters if the descriptions
+        # for symbols declared in this header changed
+        if adder.docstrings_hash() == entry["docstrings"]:
+            entry["symbols"] = cast(str, symbols)
+            return True
+        return False
+
+    def record(
+        self, adder: "HeaderDocstringAdder", input_hash: str, output_file: str
+    ):
+        self.entries[self.key(output_file)] = {
+            "input": input_hash,
+            "symbol_file": self.key(adder.slist.symbol_file),
+            "symbols": cast(str, self.file_hash(adder.slist.symbol_file)),
+            "formatter": adder.formatter.cache_key(),
+            "docstrings": adder.docstrings_hash(),
+            "output": cast(str, self.file_hash(output_file)),
+        }
+
+
 class HeaderDocstringAdder:
     PREAMBLE_LINE = "/// THIS DOCSTRING WAS GENERATED AUTOMATICALLY\n"
 
     def __init__(
-        self, symbol_list: HeaderSymbolList, *, formatter: Optional[Formatter] = None
+        self,
+        symbol_list: HeaderSymbolList,
+        *,
+        formatter: Optional[Formatter] = None,
+        descriptions: Optional[SymbolDescriptions] = None,
     ):
         self.slist = symbol_list
         self.formatter = formatter if formatter is not None else TextWrapFormatter()
         # Parse symbol names from the header file
         self.symbol_names = set(symbol_list.names_from_header_file())
-        # Parse symbol descriptions from the YAML symbol table
-        with open(symbol_list.symbol_file, "r") as f:
-            self.symbol_descriptions: Dict[str, str] = {
-                symbol["name"]: symbol["description"]
-                for block in yaml.safe_load(f).values()
-                for symbol in block[symbol_list.SYMBOL_LIST_KEY]
-                if "description" in symbol
-            }
+        self.descriptions = (
+            descriptions if descriptions is not None else SymbolDescriptions()
+        )
+
+    @property
+    def symbol_descriptions(self) -> Dict[str, str]:
+        # Parse symbol descriptions from the YAML symbol table on first use
+        return self.descriptions.get(
+            self.slist.symbol_file, self.slist.SYMBOL_LIST_KEY
+        )
+
+    def docstrings_hash(self) -> str:
+        """
+        Hash of everything besides the header file itself that affects the
+        annotated output: the descriptions of the symbols declared in the
+        header, and the formatter.
+        """
+        h = hashlib.sha256(self.formatter.cache_key().encode())
+        for name in sorted(self.symbol_names):
+            description = self.symbol_descriptions.get(name)
+            if description is not None:
+                h.update(json.dumps([name, description]).encode())
+        return h.hexdigest()
 
     def get_docstring(self, symbol: str) -> Optional[str]:
         if symbol not in self.symbol_descriptions:
@@ -162,19 +343,32 @@ def add_header_docstrings(
     formatter: Optional[Formatter],
     filter: Optional[str],
     verbose: bool,
+    descriptions: Optional[SymbolDescriptions] = None,
+    manifest: Optional[DocstringManifest] = None,
 ):
     for header_file in symbol_list.headers():
         if filter is not None and not fnmatch.fnmatch(header_file, filter):
             continue
         try:
-            HeaderDocstringAdder(
-                symbol_list(header_file), formatter=formatter
-            ).add_docstrings(extension)
-            if verbose:
-                print(f"Annotated {header_file}")
+            slist = symbol_list(header_file)
         except ValueError:
             # File doesn't correspond to a symbol file; skip
-            pass
+            continue
+        adder = HeaderDocstringAdder(
+            slist, formatter=formatter, descriptions=descriptions
+        )
+        output_file = header_file + extension
+        if manifest is not None:
+            if manifest.is_current(adder, header_file, output_file):
+                if verbose:
+                    print(f"Skipped {header_file} (unchanged)")
+                continue
+            input_hash = cast(str, manifest.file_hash(header_file))
+        adder.add_docstrings(extension)
+        if manifest is not None:
+            manifest.record(adder, input_hash, output_file)
+        if verbose:
+            print(f"Annotated {header_file}")
 
 
 if __name__ == "__main__":
@@ -192,6 +386,12 @@ if __name__ == "__main__":
         "--filter",
         help="Unix filename path filter for header files to process",
     )
+    parser.add_argument(
+        "-i",
+        "--incremental",
+        action="store_true",
+        help="only annotate headers whose contents or symbol descriptions changed since the last incremental run",
+    )
     parser.add_argument("-v", "--verbose", action="store_true", help="verbose output")
     args = parser.parse_args()
 
@@ -208,12 +408,27 @@ if __name__ == "__main__":
                 + f"using textwrap for formatting (linewidth={formatter.linewidth})"
             )
 
+    # Load symbol descriptions up front in a single parallel pass, so each
+    # symbol table is only parsed once. In incremental mode, only symbol tables
+    # that changed since the last run are loaded eagerly; the rest will only be
+    # loaded if an edited header needs them.
+    manifest = DocstringManifest() if args.incremental else None
+    descriptions = SymbolDescriptions()
+    descriptions.prefetch(
+        f
+        for symbol_list in (FunctionList, DataList)
+        for f in map(symbol_list.get_symbol_file, symbol_list.headers())
+        if f is not None and (manifest is None or manifest.symbol_file_changed(f))
+    )
+
     add_header_docstrings(
         FunctionList,
         args.extension,
         formatter=formatter,
         filter=args.filter,
         verbose=args.verbose,
+        descriptions=descriptions,
+        manifest=manifest,
     )
     add_header_docstrings(
         DataList,
@@ -221,4 +436,8 @@ if __name__ == "__main__":
         formatter=formatter,
         filter=args.filter,
         verbose=args.verbose,
+        descriptions=descriptions,
+        manifest=manifest,
     )
+    if manifest is not None:
+        manifest.save()
@@ -0,0 +1,758 @@
+#!/usr/bin/env python3
+
+# Script to generate struct layout databases from the C headers.
+#
+# The headers are compiled once per game version with debug info, and the
+# DWARF type information emitted by the compiler (as dumped by readelf) is
+# flattened into a compact layout database with the offset, size, bit position
+# and type of every field in every struct and union, along with all enum
+# definitions and the types of all global data symbols. Each database is
+# written both as a binary file (for tools that decode raw memory at runtime)
+# and as a generated C table (for tools written in C).
+#
+# Since the layouts come from the compiler itself, they're exactly the layouts
+# checked by ASSERT_SIZE, with no separate parsing of the headers.
+
+import argparse
+import os
+import re
+import struct
+import subprocess
+import tempfile
+from typing import Dict, Iterator, List, NamedTuple, Optional, Tuple
+
+from symbol_check import find_c_compiler
+
+HEADERS_ROOT_DIR = os.path.relpath(os.path.dirname(__file__))
+OUTPUT_DIR = os.path.join(HEADERS_ROOT_DIR, "build")
+VERSIONED_HEADERS = {
+    "NA": "pmdsky_na.h",
+    "EU": "pmdsky_eu.h",
+    "JP": "pmdsky_jp.h",
+}
+# Same target flags as the headers-aligned Makefile target. DWARF 5 is
+# requested explicitly for its bitfield representation (DW_AT_data_bit_offset).
+COMPILE_FLAGS = [
+    "-m32",
+    "-fshort-wchar",
+    "-mno-ms-bitfields",
+    "-gdwarf-5",
+    "-fno-eliminate-unused-debug-types",
+    "-w",
+]
+
+# Binary database format. All integers are little-endian.
+#
+#   header:      magic, format version, version name, then the number of types,
+#                fields, enumerators, globals, and the string table size
+#   types:       kind, flags, name, size, ref, count
+#   fields:      name, byte offset, type, bit offset, bit size
+#   enumerators: name, value
+#   globals:     name, type
+#   strings:     NUL-terminated UTF-8 strings, referenced by byte offset
+#
+# Type, field and enumerator references are indexes into the respective
+# tables. See LayoutType for the meaning of ref and count for each kind.
+MAGIC = b"PMDSKYLT"
+FORMAT_VERSION = 1
+HEADER_FORMAT = struct.Struct("<8sHH4sIIIII")
+TYPE_FORMAT = struct.Struct("<BBHIIII")
+FIELD_FORMAT = struct.Struct("<IIIBBH")
+ENUMERATOR_FORMAT = struct.Struct("<Iq")
+GLOBAL_FORMAT = struct.Struct("<II")
+# Null reference (e.g., the target of a void pointer, or an unnamed type)
+NONE = 0xFFFFFFFF
+
+
+class Kind:
+    """Type kinds in the layout database"""
+
+    VOID = 0
+    BASE = 1
+    STRUCT = 2
+    UNION = 3
+    ENUM = 4
+    TYPEDEF = 5
+    POINTER = 6
+    ARRAY = 7
+    FUNCTION = 8
+
+    NAMES = ["void", "base", "struct", "union", "enum", "typedef", "pointer"]
+    NAMES += ["array", "function"]
+    # Kinds with a tag that's part of the type name in C
+    TAGGED = {STRUCT: "struct", UNION: "union", ENUM: "enum"}
+
+
+# Type flags
+FLAG_SIGNED = 0x1
+FLAG_CONST = 0x2
+
+
+class LayoutType(NamedTuple):
+    """
+    A type in the layout database.
+
+    The meaning of ref and count depends on the kind:
+        - struct/union: index of the first field, and number of fields
+        - enum: index of the first enumerator, and number of enumerators
+        - typedef/pointer: index of the target type (NONE for void), count 0
+        - array: index of the element type, and number of elements (0 for
+          arrays with no explicit size)
+        - everything else: ref NONE, count 0
+    """
+
+    kind: int
+    flags: int
+    name: Optional[str]
+    size: int
+    ref: int
+    count: int
+
+    @property
+    def c_name(self) -> Optional[str]:
+        if self.name is None:
+            return None
+        tag = Kind.TAGGED.get(self.kind)
+        return f"{tag} {self.name}" if tag else self.name
+
+    @property
+    def signed(self) -> bool:
+        return bool(self.flags & FLAG_SIGNED)
+
+
+class LayoutField(NamedTuple):
+    """
+    A struct or union field in the layout database.
+
+    For bitfields, bit_size is nonzero, and the field occupies bit_size bits
+    starting at bit bit_offset (counting from the least significant bit) of the
+    little-endian value starting at byte offset.
+    """
+
+    name: Optional[str]
+    offset: int
+    type: int
+    bit_offset: int
+    bit_size: int
+
+
+class LayoutDatabase:
+    """Struct layouts and related type information for one game version"""
+
+    def __init__(
+        self,
+        version: str,
+        types: List[LayoutType],
+        fields: List[LayoutField],
+        enumerators: List[Tuple[str, int]],
+        globals_: List[Tuple[str, int]],
+    ):
+        self.version = version
+        self.types = types
+        self.fields = fields
+        self.enumerators = enumerators
+        self.globals = dict(globals_)
+        # The first definition of a name wins, since DWARF output can contain
+        # redundant entries for incomplete (forward-declared) types
+        self.type_index: Dict[str, int] = {}
+        for i, t in enumerate(types):
+            if t.c_name is not None:
+                self.type_index.setdefault(t.c_name, i)
+        self._field_maps: Dict[int, Dict[str, LayoutField]] = {}
+
+    def lookup(self, name: str) -> int:
+        """Look up a type index by C type name (e.g., "struct dungeon")."""
+        return self.type_index[name]
+
+    def resolve(self, index: int) -> int:
+        """Strip typedefs from a type."""
+        while index != NONE and self.types[index].kind == Kind.TYPEDEF:
+            index = self.types[index].ref
+        return index
+
+    def members(self, index: int) -> List[LayoutField]:
+        """Get the fields of a struct or union type."""
+        t = self.types[self.resolve(index)]
+        if t.kind not in (Kind.STRUCT, Kind.UNION):
+            raise ValueError(f"{self.type_name(index)} is not a struct or union")
+        return self.fields[t.ref : t.ref + t.count]
+
+    def field_map(self, index: int) -> Dict[str, LayoutField]:
+        """Get the fields of a struct or union type by name.
+
+        Members of anonymous structs and unions are included directly, with
+        offsets relative to the parent type, like in C.
+        """
+        index = self.resolve(index)
+        fields = self._field_maps.get(index)
+        if fields is None:
+            fields = {}
+            for f in self.members(index):
+                if f.name is not None:
+                    fields[f.name] = f
+                else:
+                    for name, sub in self.field_map(f.type).items():
+                        fields[name] = sub._replace(offset=f.offset + sub.offset)
+            self._field_maps[index] = fields
+        return fields
+
+    def enum_values(self, index: int) -> List[Tuple[str, int]]:
+        """Get the enumerators of an enum type."""
+        t = self.types[self.resolve(index)]
+        if t.kind != Kind.ENUM:
+            raise ValueError(f"{self.type_name(index)} is not an enum")
+        return self.enumerators[t.ref : t.ref + t.count]
+
+    def type_name(self, index: int) -> str:
+        """Format a type in C syntax (without a declarator name)."""
+        if index == NONE:
+            return "void"
+        t = self.types[index]
+        const = "const " if t.flags & FLAG_CONST else ""
+        if t.c_name is not None:
+            return const + t.c_name
+        if t.kind == Kind.POINTER:
+            return self.type_name(t.ref) + "*"
+        if t.kind == Kind.ARRAY:
+            return f"{self.type_name(t.ref)}[{t.count or ''}]"
+        if t.kind == Kind.FUNCTION:
+            return "function"
+        return const + f"{Kind.TAGGED.get(t.kind, Kind.NAMES[t.kind])} <anonymous>"
+
+    @staticmethod
+    def from_bytes(data: bytes) -> "LayoutDatabase":
+        (
+            magic,
+            format_version,
+            _,
+            version,
+            n_types,
+            n_fields,
+            n_enumerators,
+            n_globals,
+            strings_size,
+        ) = HEADER_FORMAT.unpack_from(data)
+        if magic != MAGIC or format_version != FORMAT_VERSION:
+            raise ValueError("not a layout database, or unsupported format version")
+
+        pos = HEADER_FORMAT.size
+
+        def read_table(fmt: struct.Struct, n: int) -> Iterator[tuple]:
+            nonlocal pos
+            start, pos = pos, pos + fmt.size * n
+            return fmt.iter_unpack(data[start:pos])
+
+        raw_types = list(read_table(TYPE_FORMAT, n_types))
+        raw_fields = list(read_table(FIELD_FORMAT, n_fields))
+        raw_enumerators = list(read_table(ENUMERATOR_FORMAT, n_enumerators))
+        raw_globals = list(read_table(GLOBAL_FORMAT, n_globals))
+        strings = data[pos : pos + strings_size]
+
+        def string(offset: int) -> Optional[str]:
+            if offset == NONE:
+                return None
+            return strings[offset : strings.index(b"\0", offset)].decode()
+
+        return LayoutDatabase(
+            version.rstrip(b"\0").decode(),
+            [
+                LayoutType(kind, flags, string(name), size, ref, count)
+                for kind, flags, _, name, size, ref, count in raw_types
+            ],
+            [
+                LayoutField(string(name), offset, type_, bit_offset, bit_size)
+                for name, offset, type_, bit_offset, bit_size, _ in raw_fields
+            ],
+            [(string(name), value) for name, value in raw_enumerators],
+            [(string(name), type_) for name, type_ in raw_globals],
+        )
+
+    @staticmethod
+    def load(path: str) -> "LayoutDatabase":
+        with open(path, "rb") as f:
+            return LayoutDatabase.from_bytes(f.read())
+
+    def to_bytes(self) -> bytes:
+        strings = bytearray()
+        string_offsets: Dict[str, int] = {}
+
+        def string(s: Optional[str]) -> int:
+            if s is None:
+                return NONE
+            if s not in string_offsets:
+                string_offsets[s] = len(strings)
+                strings.extend(s.encode() + b"\0")
+            return string_offsets[s]
+
+        body = bytearray()
+        for t in self.types:
+            body += TYPE_FORMAT.pack(
+                t.kind, t.flags, 0, string(t.name), t.size, t.ref, t.count
+            )
+        for f in self.fields:
+            body += FIELD_FORMAT.pack(
+                string(f.name), f.offset, f.type, f.bit_offset, f.bit_size, 0
+            )
+        for name, value in self.enumerators:
+            body += ENUMERATOR_FORMAT.pack(string(name), value)
+        for name, type_ in self.globals.items():
+            body += GLOBAL_FORMAT.pack(string(name), type_)
+        header = HEADER_FORMAT.pack(
+            MAGIC,
+            FORMAT_VERSION,
+            0,
+            self.version.encode(),
+            len(self.types),
+            len(self.fields),
+            len(self.enumerators),
+            len(self.globals),
+            len(strings),
+        )
+        return header + bytes(body) + bytes(strings)
+
+    def save(self, path: str):
+        with open(path, "wb") as f:
+            f.write(self.to_bytes())
+
+
+class DebugInfoEntry:
+    """A DWARF debugging information entry, as printed by readelf"""
+
+    def __init__(self, offset: int, tag: str):
+        self.offset = offset
+        self.tag = tag
+        self.attrs: Dict[str, str] = {}
+        self.children: List["DebugInfoEntry"] = []
+
+    def name(self) -> Optional[str]:
+        name = self.attrs.get("DW_AT_name")
+        if name is None:
+            return None
+        # Strings can be printed with a prefix like
+        # "(indirect string, offset: 0x1234): "
+        if name.startswith("("):
+            name = name[name.index("): ") + 3 :]
+        return name.strip()
+
+    def int_attr(self, attr: str) -> Optional[int]:
+        value = self.attrs.get(attr)
+        if value is None:
+            return None
+        # Constant values can be followed by a description in parentheses,
+        # and member locations can also be expressions like
+        # "2 byte block: 23 8 (DW_OP_plus_uconst: 8)"
+        m = re.search(r"DW_OP_plus_uconst: (\d+)", value)
+        if m:
+            return int(m.group(1))
+        return int(value.split()[0], 0)
+
+    def ref_attr(self, attr: str) -> Optional[int]:
+        value = self.attrs.get(attr)
+        if value is None:
+            return None
+        # References can be followed by the name of the referenced entry,
+        # e.g., "<0x2a>, unsigned char"
+        return int(re.search(r"<0x([0-9a-f]+)>", value).group(1), 16)
+
+
+def parse_debug_info(dump: str) -> List[DebugInfoEntry]:
+    """Parse the output of readelf --debug-dump=info into a list of top-level
+    entries within compilation units."""
+    die_regex = re.compile(
+        r"\s*<(\d+)><([0-9a-f]+)>: Abbrev Number: (\d+)(?: \((DW_TAG_\w+)\))?"
+    )
+    attr_regex = re.compile(r"\s*<[0-9a-f]+>\s+(DW_AT_\w+)\s*: ?(.*)")
+
+    top_level: List[DebugInfoEntry] = []
+    stack: List[DebugInfoEntry] = []
+    current: Optional[DebugInfoEntry] = None
+    for line in dump.splitlines():
+        m = die_regex.match(line)
+        if m:
+            depth, offset, abbrev, tag = m.groups()
+            depth = int(depth)
+            if abbrev == "0":
+                # End of a list of children
+                current = None
+                continue
+            current = DebugInfoEntry(int(offset, 16), tag)
+            del stack[depth:]
+            if depth == 1:
+                top_level.append(current)
+            elif depth > 1:
+                stack[depth - 1].children.append(current)
+            stack.append(current)
+            continue
+        m = attr_regex.match(line)
+        if m and current is not None:
+            # Some versions of readelf print the attribute form before the
+            # value, e.g., "(data1) 42"
+            current.attrs[m.group(1)] = re.sub(r"^\(\w+\) ", "", m.group(2))
+    return top_level
+
+
+class LayoutBuilder:
+    """Builds a LayoutDatabase from parsed DWARF entries"""
+
+    TYPE_TAGS = {
+        "DW_TAG_base_type",
+        "DW_TAG_structure_type",
+        "DW_TAG_union_type",
+        "DW_TAG_enumeration_type",
+        "DW_TAG_typedef",
+        "DW_TAG_pointer_type",
+        "DW_TAG_array_type",
+        "DW_TAG_subroutine_type",
+        "DW_TAG_const_type",
+        "DW_TAG_volatile_type",
+    }
+
+    def __init__(self, entries: List[DebugInfoEntry]):
+        self.dies: Dict[int, DebugInfoEntry] = {}
+        for die in entries:
+            if die.tag in self.TYPE_TAGS:
+                self.dies[die.offset] = die
+        self.types: List[Optional[LayoutType]] = []
+        self.fields: List[LayoutField] = []
+        self.enumerators: List[Tuple[str, int]] = []
+        # DIE offset (with any qualifier flags) -> type index
+        self.type_index: Dict[Tuple[int, int], int] = {}
+        self.globals: List[Tuple[str, int]] = []
+
+        for die in entries:
+            if die.tag in self.TYPE_TAGS:
+                self.type_ref(die.offset)
+        for die in entries:
+            if die.tag == "DW_TAG_variable" and die.name() is not None:
+                self.globals.append(
+                    (die.name(), self.type_ref(die.ref_attr("DW_AT_type")))
+                )
+
+    def type_ref(self, die_offset: Optional[int], flags: int = 0) -> int:
+        """Get the type index for a DIE, adding it to the database if needed."""
+        if die_offset is None:
+            return NONE
+        die = self.dies[die_offset]
+        if die.tag in ("DW_TAG_const_type", "DW_TAG_volatile_type"):
+            # Qualifiers are folded into the qualified type
+            if die.tag == "DW_TAG_const_type":
+                flags |= FLAG_CONST
+            return self.type_ref(die.ref_attr("DW_AT_type"), flags)
+        key = (die_offset, flags)
+        if key in self.type_index:
+            return self.type_index[key]
+
+        index = len(self.types)
+        self.type_index[key] = index
+        self.types.append(None)  # placeholder, in case of recursive types
+        self.types[index] = self.build_type(die, flags)
+        return index
+
+    def build_type(self, die: DebugInfoEntry, flags: int) -> LayoutType:
+        name = die.name()
+        size = die.int_attr("DW_AT_byte_size") or 0
+        if die.tag == "DW_TAG_base_type":
+            # DW_ATE_signed (5) and DW_ATE_signed_char (6)
+            if die.int_attr("DW_AT_encoding") in (5, 6):
+                flags |= FLAG_SIGNED
+            return LayoutType(Kind.BASE, flags, name, size, NONE, 0)
+        if die.tag in ("DW_TAG_structure_type", "DW_TAG_union_type"):
+            kind = Kind.STRUCT if die.tag == "DW_TAG_structure_type" else Kind.UNION
+            members = [c for c in die.children if c.tag == "DW_TAG_member"]
+            # Reserve the field range up front, since member types can add
+            # more fields while they're being built
+            first = len(self.fields)
+            self.fields.extend([None] * len(members))
+            for i, member in enumerate(members):
+                self.fields[first + i] = self.build_field(member)
+            return LayoutType(kind, flags, name, size, first, len(members))
+        if die.tag == "DW_TAG_enumeration_type":
+            base = self.dies.get(die.ref_attr("DW_AT_type"))
+            if die.int_attr("DW_AT_encoding") == 5 or (
+                base is not None and base.int_attr("DW_AT_encoding") in (5, 6)
+            ):
+                flags |= FLAG_SIGNED
+            first = len(self.enumerators)
+            for e in die.children:
+                if e.tag == "DW_TAG_enumerator":
+                    self.enumerators.append((e.name(), e.int_attr("DW_AT_const_value")))
+            count = len(self.enumerators) - first
+            return LayoutType(Kind.ENUM, flags, name, size, first, count)
+        if die.tag == "DW_TAG_typedef":
+            target = self.type_ref(die.ref_attr("DW_AT_type"))
+            return LayoutType(Kind.TYPEDEF, flags, name, 0, target, 0)
+        if die.tag == "DW_TAG_pointer_type":
+            target = self.type_ref(die.ref_attr("DW_AT_type"))
+            return LayoutType(Kind.POINTER, flags, None, size or 4, target, 0)
+        if die.tag == "DW_TAG_array_type":
+            # Multidimensional arrays are flattened into nested array types,
+            # innermost dimension first
+            counts = []
+            for sub in die.children:
+                if sub.tag == "DW_TAG_subrange_type":
+                    count = sub.int_attr("DW_AT_count")
+                    upper = sub.int_attr("DW_AT_upper_bound")
+                    if count is None and upper is not None:
+                        count = upper + 1
+                    counts.append(count or 0)
+            element = self.type_ref(die.ref_attr("DW_AT_type"))
+            for count in reversed(counts[1:]):
+                element = self.append_array(element, count)
+            return self.array_type(element, counts[0] if counts else 0)
+        if die.tag == "DW_TAG_subroutine_type":
+            return LayoutType(Kind.FUNCTION, flags, None, 0, NONE, 0)
+        raise ValueError(f"unsupported DWARF tag {die.tag}")
+
+    def type_size(self, index: int) -> int:
+        while index != NONE and self.types[index].kind == Kind.TYPEDEF:
+            index = self.types[index].ref
+        return 0 if index == NONE else self.types[index].size
+
+    def array_type(self, element: int, count: int) -> LayoutType:
+        return LayoutType(
+            Kind.ARRAY, 0, None, self.type_size(element) * count, element, count
+        )
+
+    def append_array(self, element: int, count: int) -> int:
+        self.types.append(self.array_type(element, count))
+        return len(self.types) - 1
+
+    def build_field(self, die: DebugInfoEntry) -> LayoutField:
+        type_ = self.type_ref(die.ref_attr("DW_AT_type"))
+        bit_size = die.int_attr("DW_AT_bit_size") or 0
+        offset = die.int_attr("DW_AT_data_member_location") or 0
+        bit_offset = 0
+        if bit_size:
+            data_bit_offset = die.int_attr("DW_AT_data_bit_offset")
+            if data_bit_offset is None:
+                # Pre-DWARF 4 representation: bit offset of the most
+                # significant bit within a storage unit of byte_size bytes
+                storage_size = die.int_attr("DW_AT_byte_size") or self.type_size(
+                    type_
+                )
+                data_bit_offset = (
+                    offset * 8
+                    + storage_size * 8
+                    - die.int_attr("DW_AT_bit_offset")
+                    - bit_size
+                )
+            offset, bit_offset = divmod(data_bit_offset, 8)
+        return LayoutField(die.name(), offset, type_, bit_offset, bit_size)
+
+    def database(self, version: str) -> LayoutDatabase:
+        return LayoutDatabase(
+            version, self.types, self.fields, self.enumerators, self.globals
+        )
+
+
+def build_layout_database(version: str, cc: str, readelf: str) -> LayoutDatabase:
+    """Compile the headers for a game version and extract the struct layouts."""
+    with tempfile.TemporaryDirectory() as tmpdir:
+        obj = os.path.join(tmpdir, "layouts.o")
+        subprocess.run(
+            [cc, *COMPILE_FLAGS, "-x", "c", "-c", VERSIONED_HEADERS[version]]
+            + ["-o", obj],
+            cwd=HEADERS_ROOT_DIR or ".",
+            check=True,
+        )
+        dump = subprocess.run(
+            [readelf, "--debug-dump=info", obj],
+            check=True,
+            stdout=subprocess.PIPE,
+            text=True,
+        ).stdout
+    return LayoutBuilder(parse_debug_info(dump)).database(version)
+
+
+def c_string(s: Optional[str]) -> str:
+    return "NULL" if s is None else f'"{s}"'
+
+
+def generate_c_header() -> str:
+    kinds = "\n".join(
+        f"    PMDSKY_LAYOUT_{name.upper()} = {i},"
+        for i, name in enumerate(Kind.NAMES)
+    )
+    externs = "\n".join(
+        f"extern const struct pmdsky_layout_db pmdsky_layouts_{v.lower()};"
+        for v in VERSIONED_HEADERS
+    )
+    return f"""\
+// Generated by struct_layouts.py. Do not edit.
+#ifndef HEADERS_BUILD_LAYOUTS_H_
+#define HEADERS_BUILD_LAYOUTS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PMDSKY_LAYOUT_NONE 0x{NONE:X}u
+#define PMDSKY_LAYOUT_FLAG_SIGNED 0x{FLAG_SIGNED:X}
+#define PMDSKY_LAYOUT_FLAG_CONST 0x{FLAG_CONST:X}
+
+enum pmdsky_layout_kind {{
+{kinds}
+}};
+
+// For structs/unions, ref and count are the first field index and the number
+// of fields. For enums, they're the first enumerator index and the number of
+// enumerators. For typedefs, pointers and arrays, ref is the target type index
+// and count is the array length (0 for non-arrays and unsized arrays).
+struct pmdsky_layout_type {{
+    const char* name;
+    uint8_t kind;
+    uint8_t flags;
+    uint32_t size;
+    uint32_t ref;
+    uint32_t count;
+}};
+
+// Bitfields occupy bit_size bits starting at bit bit_offset of the
+// little-endian value at offset. bit_size is 0 for non-bitfields.
+struct pmdsky_layout_field {{
+    const char* name;
+    uint32_t offset;
+    uint32_t type;
+    uint8_t bit_offset;
+    uint8_t bit_size;
+}};
+
+struct pmdsky_layout_enumerator {{
+    const char* name;
+    int64_t value;
+}};
+
+struct pmdsky_layout_global {{
+    const char* name;
+    uint32_t type;
+}};
+
+struct pmdsky_layout_db {{
+    const char* version;
+    const struct pmdsky_layout_type* types;
+    size_t n_types;
+    const struct pmdsky_layout_field* fields;
+    size_t n_fields;
+    const struct pmdsky_layout_enumerator* enumerators;
+    size_t n_enumerators;
+    const struct pmdsky_layout_global* globals;
+    size_t n_globals;
+}};
+
+{externs}
+
+#endif
+"""
+
+
+def generate_c_table(db: LayoutDatabase) -> str:
+    v = db.version.lower()
+    lines = ["// Generated by struct_layouts.py. Do not edit.", '#include "layouts.h"']
+    lines.append("")
+    lines.append("static const struct pmdsky_layout_type TYPES[] = {")
+    for i, t in enumerate(db.types):
+        lines.append(
+            f"    {{{c_string(t.name)}, {t.kind}, {t.flags}, {t.size}, {t.ref}u,"
+            + f" {t.count}}}, // {i}"
+        )
+    lines.append("};")
+    lines.append("")
+    lines.append("static const struct pmdsky_layout_field FIELDS[] = {")
+    for f in db.fields:
+        lines.append(
+            f"    {{{c_string(f.name)}, {f.offset}, {f.type}u, {f.bit_offset},"
+            + f" {f.bit_size}}},"
+        )
+    lines.append("};")
+    lines.append("")
+    lines.append("static const struct pmdsky_layout_enumerator ENUMERATORS[] = {")
+    for name, value in db.enumerators:
+        lines.append(f"    {{{c_string(name)}, {value}LL}},")
+    lines.append("};")
+    lines.append("")
+    lines.append("static const struct pmdsky_layout_global GLOBALS[] = {")
+    for name, type_ in db.globals.items():
+        lines.append(f"    {{{c_string(name)}, {type_}u}},")
+    lines.append("};")
+    lines.append("")
+    lines.append(f"const struct pmdsky_layout_db pmdsky_layouts_{v} = {{")
+    lines.append(f'    "{db.version}",')
+    for table in ["TYPES", "FIELDS", "ENUMERATORS", "GLOBALS"]:
+        lines.append(f"    {table},")
+        lines.append(f"    sizeof({table}) / sizeof({table}[0]),")
+    lines.append("};")
+    return "\n".join(lines) + "\n"
+
+
+def print_layout(db: LayoutDatabase, type_name: str):
+    index = db.lookup(type_name)
+    t = db.types[db.resolve(index)]
+    print(f"{type_name}: size 0x{t.size:X}")
+    if t.kind == Kind.ENUM:
+        for name, value in db.enum_values(index):
+            print(f"    {name} = {value}")
+        return
+    for f in db.members(index):
+        position = f"0x{f.offset:X}"
+        if f.bit_size:
+            position += f".{f.bit_offset}:{f.bit_size}"
+        print(f"    {position:<12} {db.type_name(f.type)} {f.name or '<anonymous>'}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Generate struct layout databases from the C headers"
+    )
+    parser.add_argument(
+        "-o",
+        "--output-dir",
+        default=OUTPUT_DIR,
+        help=f"output directory (default: {OUTPUT_DIR})",
+    )
+    parser.add_argument(
+        "-v",
+        "--version",
+        choices=VERSIONED_HEADERS.keys(),
+        type=str.upper,
+        action="append",
+        help="game version to generate a database for (defaults to all versions)",
+    )
+    parser.add_argument(
+        "-p",
+        "--print",
+        metavar="TYPE",
+        help='print the layout of a type (e.g., "struct dungeon") from an existing'
+        + " database instead of generating databases",
+    )
+    args = parser.parse_args()
+    versions = args.version or list(VERSIONED_HEADERS)
+
+    if args.print is not None:
+        for version in versions:
+            db = LayoutDatabase.load(
+                os.path.join(args.output_dir, f"layouts_{version.lower()}.bin")
+            )
+            print(f"[{version}] ", end="")
+            print_layout(db, args.print)
+    else:
+        cc = find_c_compiler()
+        if cc is None:
+            raise SystemExit("C compiler not found")
+        readelf = os.environ.get("READELF", "readelf")
+        os.makedirs(args.output_dir, exist_ok=True)
+        with open(os.path.join(args.output_dir, "layouts.h"), "w") as f:
+            f.write(generate_c_header())
+        for version in versions:
+            db = build_layout_database(version, cc, readelf)
+            basename = os.path.join(args.output_dir, f"layouts_{version.lower()}")
+            db.save(basename + ".bin")
+            with open(basename + ".c", "w") as f:
+                f.write(generate_c_table(db))
+            n_aggregates = sum(
+                1
+                for t in db.types
+                if t.kind in (Kind.STRUCT, Kind.UNION) and t.name is not None
+            )
+            print(
+                f"{version}: {n_aggregates} named structs/unions, {len(db.types)}"
+                + f" types, {len(db.fields)} fields -> {basename}.{{bin,c}}"
+            )
@@ -2,17 +2,342 @@
 
 # Script to check that all function and data symbol names present in the C
 # headers are also present in the symbol tables.
+#
+# Symbol names are extracted from the C headers by running them through the C
+# preprocessor and parsing the resulting top-level declarations. Parsed header
+# declarations and symbol table names are cached on disk by content hash, so
+# repeated runs only need to re-parse files that have changed.
 
 from abc import ABC
 import argparse
+from concurrent.futures import ProcessPoolExecutor
 import difflib
+import hashlib
+import json
 import os
 import re
-from typing import Dict, Generator, List, Optional
+import shutil
+import subprocess
+from typing import Dict, Generator, Iterable, List, Optional
 import yaml
 
 ROOT_DIR = os.path.relpath(os.path.join(os.path.dirname(__file__), ".."))
 SYMBOLS_DIR = os.path.join(ROOT_DIR, "symbols")
+HEADERS_ROOT_DIR = os.path.join(ROOT_DIR, "headers")
+# Top-level header that (transitively) includes all the other headers
+ENTRY_HEADER = "pmdsky.h"
+CACHE_FILE = os.path.join(HEADERS_ROOT_DIR, ".symbol_check_cache.json")
+# Use the LibYAML-based loader if it's available, since it's much faster
+YAML_LOADER = getattr(yaml, "CSafeLoader", yaml.SafeLoader)
+
+
+def find_c_compiler() -> Optional[str]:
+    """
+    Find a C compiler to use as the preprocessor, with the same preference
+    order as the Makefile, unless overridden by the CC environment variable.
+    """
+    for cc in [os.environ.get("CC"), "clang", "gcc"]:
+        if cc and shutil.which(cc):
+            return cc
+    return None
+
+
+class DeclarationParser:
+    """
+    Parser for the top-level declarations in preprocessed C source.
+
+    This understands just enough of the C declaration grammar to find the
+    declarator names: declaration specifiers (storage classes, qualifiers, and
+    a type) are skipped, and the first identifier after them in each
+    declarator is the declared name. This handles things like pointers to
+    arrays `int (*x)[10]` and functions returning function pointers
+    `void (*f(int))(void)` without relying on formatting.
+    """
+
+    TOKEN_REGEX = re.compile(
+        r'"(?:\\.|[^"\\])*"'  # string literal
+        + r"|'(?:\\.|[^'\\])*'"  # character literal
+        + r"|[A-Za-z_]\w*"  # identifier or keyword
+        + r"|\d\w*"  # number
+        + r"|\.\.\.|->|[^\s\w]"  # punctuator
+    )
+    # Preprocessor line markers: # <line> "<file>" <flags>
+    LINE_MARKER_REGEX = re.compile(r'#\s*\d+\s+"((?:\\.|[^"\\])*)"')
+    IDENTIFIER_REGEX = re.compile(r"[A-Za-z_]\w*")
+
+    TYPE_KEYWORDS = {
+        "void",
+        "char",
+        "short",
+        "int",
+        "long",
+        "float",
+        "double",
+        "signed",
+        "unsigned",
+        "_Bool",
+    }
+    TAG_KEYWORDS = {"struct", "union", "enum"}
+    # Storage classes, qualifiers and other specifiers that aren't types
+    NON_TYPE_KEYWORDS = {
+        "extern",
+        "static",
+        "auto",
+        "register",
+        "inline",
+        "__inline",
+        "__inline__",
+        "const",
+        "volatile",
+        "restrict",
+        "__restrict",
+        "_Noreturn",
+        "__extension__",
+    }
+    # Declarations starting with these tokens don't declare symbols
+    SKIPPED_DECLARATIONS = {"typedef", "_Static_assert"}
+    ATTRIBUTE_KEYWORDS = {"__attribute__", "__attribute", "__declspec"}
+
+    @classmethod
+    def declarator_names(cls, tokens: List[str]) -> List[str]:
+        """Get the names declared by a single top-level declaration.
+
+        Args:
+            tokens (List[str]): declaration tokens, excluding the terminating
+                semicolon and the contents of any braces
+
+        Returns:
+            List[str]: declared names, in order
+        """
+        if not tokens or tokens[0] in cls.SKIPPED_DECLARATIONS:
+            return []
+        names: List[str] = []
+        type_seen = False
+        name_seen = False
+        depth = 0
+        i = 0
+        while i < len(tokens):
+            tok = tokens[i]
+            i += 1
+            if tok in cls.ATTRIBUTE_KEYWORDS:
+                # Skip the attribute argument list
+                attr_depth = 0
+                while i < len(tokens):
+                    attr_depth += {"(": 1, ")": -1}.get(tokens[i], 0)
+                    i += 1
+                    if attr_depth == 0:
+                        break
+            elif tok in ("(", "["):
+                depth += 1
+            elif tok in (")", "]"):
+                depth -= 1
+            elif tok == "," and depth == 0:
+                # Start of the next declarator in the same declaration
+                name_seen = False
+            elif name_seen or not cls.IDENTIFIER_REGEX.fullmatch(tok):
+                # Everything after the name in a declarator (like parameter
+                # lists and array sizes) is irrelevant
+                continue
+            elif tok in cls.TAG_KEYWORDS:
+                type_seen = True
+                # Skip the tag name, if there is one
+                if i < len(tokens) and cls.IDENTIFIER_REGEX.fullmatch(tokens[i]):
+                    i += 1
+            elif tok in cls.TYPE_KEYWORDS:
+                type_seen = True
+            elif tok in cls.NON_TYPE_KEYWORDS:
+                continue
+            elif not type_seen:
+                # Must be a typedef name
+                type_seen = True
+            else:
+                names.append(tok)
+                name_seen = True
+        return names
+
+    @classmethod
+    def parse(cls, source: str) -> Dict[str, List[str]]:
+        """Parse preprocessed C source into declared names per source file.
+
+        Args:
+            source (str): preprocessed C source, with line markers
+
+        Returns:
+            Dict[str, List[str]]: mapping of {source file name -> list of
+                declared names, in order}, with file names as they appear in
+                the line markers
+        """
+        names: Dict[str, List[str]] = {}
+        current_file = ""
+        decl_file = None
+        decl: List[str] = []
+        brace_depth = 0
+        for line in source.splitlines():
+            if line.startswith("#"):
+                marker = cls.LINE_MARKER_REGEX.match(line)
+                if marker:
+                    current_file = marker[1]
+                # Other directives (like #pragma) don't contain declarations
+                continue
+            for tok in cls.TOKEN_REGEX.findall(line):
+                if tok == "{":
+                    brace_depth += 1
+                elif tok == "}":
+                    brace_depth -= 1
+                elif brace_depth > 0:
+                    continue
+                elif tok == ";":
+                    if decl_file is not None:
+                        names.setdefault(decl_file, []).extend(
+                            cls.declarator_names(decl)
+                        )
+                    decl = []
+                    decl_file = None
+                else:
+                    if decl_file is None:
+                        decl_file = current_file
+                    decl.append(tok)
+        return names
+
+
+def load_symbol_names(symbol_file: str) -> Dict[str, List[str]]:
+    """
+    Load the names of all symbols in a symbol table file, by symbol list key.
+    """
+    with open(symbol_file, "r") as f:
+        contents = yaml.load(f, Loader=YAML_LOADER)
+    names: Dict[str, List[str]] = {}
+    for block in contents.values():
+        for key in ("functions", "data"):
+            names.setdefault(key, []).extend(
+                symbol["name"] for symbol in block.get(key, [])
+            )
+    return names
+
+
+class SymbolCheckCache:
+    """
+    On-disk cache of the names declared in the C headers and the names of
+    symbols in the symbol tables, keyed by file content hashes.
+    """
+
+    FORMAT_VERSION = 1
+
+    def __init__(self, path: Optional[str] = CACHE_FILE):
+        self.path = path
+        self.dirty = False
+        # {"key": hash of all headers, "names": {header path -> names}}
+        self.headers: Dict = {}
+        # {symbol file path -> {"hash": content hash, "names": {key -> names}}}
+        self.symbols: Dict[str, Dict] = {}
+        if path is None:
+            return
+        try:
+            with open(path, "r") as f:
+                contents = json.load(f)
+            if contents.get("format_version") == SymbolCheckCache.FORMAT_VERSION:
+                self.headers = contents["headers"]
+                self.symbols = contents["symbols"]
+        except (OSError, ValueError, KeyError):
+            pass
+
+    def save(self):
+        if self.path is None or not self.dirty:
+            return
+        with open(self.path, "w") as f:
+            json.dump(
+                {
+                    "format_version": SymbolCheckCache.FORMAT_VERSION,
+                    "headers": self.headers,
+                    "symbols": self.symbols,
+                },
+                f,
+                separators=(",", ":"),
+            )
+        self.dirty = False
+
+    @staticmethod
+    def file_hash(filename: str) -> str:
+        with open(filename, "rb") as f:
+            return hashlib.sha256(f.read()).hexdigest()
+
+    @staticmethod
+    def header_key(cc: str) -> str:
+        """Hash of the contents of all header files and the compiler"""
+        h = hashlib.sha256(cc.encode())
+        for root, dirs, files in os.walk(HEADERS_ROOT_DIR):
+            dirs.sort()
+            for f in sorted(files):
+                if f.endswith(".h"):
+                    path = os.path.join(root, f)
+                    h.update(os.path.relpath(path, HEADERS_ROOT_DIR).encode())
+                    with open(path, "rb") as hf:
+                        h.update(hashlib.sha256(hf.read()).digest())
+        return h.hexdigest()
+
+    def header_names(self) -> Optional[Dict[str, List[str]]]:
+        """
+        Get the names declared in each header file, keyed by path relative to
+        the headers directory. Returns None if no C compiler is available.
+        """
+        cc = find_c_compiler()
+        if cc is None:
+            return None
+        key = self.header_key(cc)
+        if self.headers.get("key") != key:
+            preprocessed = subprocess.run(
+                [cc, "-E", "-m32", "-fshort-wchar", ENTRY_HEADER],
+                cwd=HEADERS_ROOT_DIR,
+                capture_output=True,
+                check=True,
+            ).stdout.decode()
+            self.headers = {
+                "key": key,
+                "names": {
+                    os.path.normpath(f).replace(os.sep, "/"): names
+                    for f, names in DeclarationParser.parse(preprocessed).items()
+                },
+            }
+            self.dirty = True
+        return self.headers["names"]
+
+    def prefetch_symbol_names(self, symbol_files: Iterable[str]):
+        """
+        Make sure the symbol names for the given symbol files are cached,
+        loading any stale files in parallel.
+        """
+        hashes = {f: self.file_hash(f) for f in symbol_files}
+        stale = [f for f, h in hashes.items() if self.symbols.get(f, {}).get("hash") != h]
+        if not stale:
+            return
+        if len(stale) == 1:
+            loaded = [load_symbol_names(stale[0])]
+        else:
+            with ProcessPoolExecutor() as executor:
+                loaded = list(executor.map(load_symbol_names, stale))
+        for f, names in zip(stale, loaded):
+            self.symbols[f] = {"hash": hashes[f], "names": names}
+        self.dirty = True
+
+    def symbol_names(self, symbol_file: str, key: str) -> List[str]:
+        self.prefetch_symbol_names([symbol_file])
+        return self.symbols[symbol_file]["names"].get(key, [])
+
+
+# Shared cache instance, created on first use
+_cache: Optional[SymbolCheckCache] = None
+
+
+def get_cache() -> SymbolCheckCache:
+    global _cache
+    if _cache is None:
+        _cache = SymbolCheckCache()
+    return _cache
+
+
+def set_cache(cache: SymbolCheckCache):
+    global _cache
+    _cache = cache
 
 
 class HeaderSymbolList(ABC):
@@ -82,36 +407,45 @@ class HeaderSymbolList(ABC):
 
     def names_from_header_file(self) -> List[str]:
         if self.cached_header_names is None:
-            with open(self.header_file, "r") as f:
-                self.cached_header_names = self.NAME_REGEX.findall(
-                    self.header_file_strip_comments(f.read())
-                )
+            header_names = get_cache().header_names()
+            header_path = os.path.relpath(self.header_file, HEADERS_ROOT_DIR).replace(
+                os.sep, "/"
+            )
+            if header_names is not None and header_path in header_names:
+                self.cached_header_names = header_names[header_path]
+            else:
+                # Either there's no C compiler, or this header isn't reachable
+                # from the top-level header. Fall back to scraping the header
+                # text directly.
+                with open(self.header_file, "r") as f:
+                    self.cached_header_names = self.NAME_REGEX.findall(
+                        self.header_file_strip_comments(f.read())
+                    )
         return list(self.cached_header_names)
 
     def names_from_symbol_file(self) -> List[str]:
         if self.cached_symbol_names is None:
-            with open(self.symbol_file, "r") as f:
-                self.cached_symbol_names = [
-                    symbol["name"]
-                    for block in yaml.safe_load(f).values()
-                    for symbol in block[self.SYMBOL_LIST_KEY]
-                ]
+            self.cached_symbol_names = get_cache().symbol_names(
+                self.symbol_file, self.SYMBOL_LIST_KEY
+            )
         return list(self.cached_symbol_names)
 
     def missing_symbols(self) -> List[str]:
         """
         Find symbols that are in the C headers but not in the symbol tables.
         """
+        symbol_names = set(self.names_from_symbol_file())
         return list(
-            set(self.names_from_header_file()) - set(self.names_from_symbol_file())
+            dict.fromkeys(n for n in self.names_from_header_file() if n not in symbol_names)
         )
 
     def extra_symbols(self) -> List[str]:
         """
         Find symbols that are in the symbol tables but not in the C headers.
         """
+        header_names = set(self.names_from_header_file())
         return list(
-            set(self.names_from_symbol_file()) - set(self.names_from_header_file())
+            dict.fromkeys(n for n in self.names_from_symbol_file() if n not in header_names)
         )
 
     def order_diff(self) -> List[str]:
@@ -169,6 +503,10 @@ def run_symbol_check(
     verbose: bool = False,
 ) -> bool:
     passed = True
+    # Load all the symbol tables up front so stale ones can be loaded in parallel
+    get_cache().prefetch_symbol_names(
+        f for f in map(symbol_list.get_symbol_file, symbol_list.headers()) if f
+    )
     for header_file in symbol_list.headers():
         try:
             slist = symbol_list(header_file)
@@ -235,9 +573,17 @@ if __name__ == "__main__":
         action="store_true",
         help="check sort order in the C headers based on symbol table order",
     )
+    parser.add_argument(
+        "--no-cache",
+        action="store_true",
+        help="ignore and don't update the on-disk cache of parsed files",
+    )
     parser.add_argument("-v", "--verbose", action="store_true", help="verbose output")
     args = parser.parse_args()
 
+    if args.no_cache:
+        set_cache(SymbolCheckCache(None))
+
     functions_passed = run_symbol_check(
         FunctionList,
         "functions",
@@ -252,5 +598,6 @@ if __name__ == "__main__":
         check_order=args.sort_order,
         verbose=args.verbose,
     )
+    get_cache().save()
     if not functions_passed or not data_passed:
         raise SystemExit(1)
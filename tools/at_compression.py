@@ -0,0 +1,534 @@
+#!/usr/bin/env python3
+
+"""
+`at_compression.py` is a library and command line utility for decompressing
+and compressing the AT containers that EoS reads with DecompressAtNormal,
+DecompressAtHalf and DecompressAtFromMemoryPointer (see the arm9 symbol
+table), such as the AT4PX and PKDPX files inside Pack archives.
+
+The containers share a 5-byte magic and a 16-bit container length (the length
+of the whole container, header included). The compressed formats follow it
+with 9 control flags and the decompressed length:
+    - PKDPX, ATUPX: 9 flags, 32-bit decompressed length (20-byte header)
+    - AT4PX, AT3PX: 9 flags, 16-bit decompressed length (18-byte header)
+    - AT4PN: no flags; the data after the header is stored as is
+The compressed data is a sequence of command bytes, each followed by up to 8
+tokens, one per command bit (most significant bit first):
+    - A set bit is a literal byte.
+    - Otherwise, the token starts with a byte whose high nibble is compared
+      against the control flags. If it matches flag i, the token expands to
+      2 bytes (4 nibbles) built from the low nibble n: 4 copies of n for
+      flag 0, 4 copies of n+1 with nibble i-1 decremented for flags 1-4, and
+      4 copies of n-1 with nibble i-5 incremented for flags 5-8.
+    - Otherwise, it's a back-reference to high+3 bytes starting
+      0x1000 - ((low << 8) | next byte) bytes before the end of the output.
+DecompressAtHalf stores each decompressed nibble in its own byte (low nibble
+first), with a given high nibble.
+
+Decompression is table-driven: the flag index of every possible high nibble
+and the expansion of every (flag, nibble) pair are looked up from precomputed
+tables, and runs of literals (0xFF command bytes) are copied 8 at a time. A
+streaming decompressor (`PxDecompressor`) consumes input in arbitrary chunks
+and produces output incrementally, keeping only the 4 KiB back-reference
+window. The compressor is greedy, with hash chains for finding matches; it
+reserves 7 high nibbles for back-references (lengths 3, 4, 5, 6, 8, 12 and 18)
+and uses the other 9 as control flags.
+
+The `bench` command measures throughput over real assets (AT containers, or
+Pack archives whose AT entries are all measured), and the `unpack` command
+decompresses every entry of a Pack archive in parallel.
+
+Example usage:
+
+python3 at_compression.py decompress monster.at4px monster.bin
+python3 at_compression.py decompress --half 0 font.atupx font.bin
+python3 at_compression.py compress --format AT4PX monster.bin monster.at4px
+python3 at_compression.py bench /path/to/rom/MONSTER/monster.bin
+python3 at_compression.py unpack /path/to/rom/MONSTER/monster.bin -o monster/
+"""
+
+import argparse
+from collections import defaultdict
+from pathlib import Path
+import struct
+import time
+from typing import Dict, List, NamedTuple, Optional, Sequence, Tuple, Union
+
+from pack_archive import PackArchive, extract
+from worker_pool import add_jobs_argument
+
+# Back-references reach up to this many bytes back
+WINDOW_SIZE = 0x1000
+NUM_FLAGS = 9
+# Back-reference lengths used by the compressor, by high nibble (length - 3).
+# The remaining high nibbles are used as control flags.
+COPY_NIBBLES = (0, 1, 2, 3, 5, 9, 15)
+COMPRESSOR_FLAGS = tuple(n for n in range(16) if n not in COPY_NIBBLES)
+MAX_COPY_LENGTH = max(COPY_NIBBLES) + 3
+# Candidate positions kept per hash chain
+MAX_CHAIN = 32
+
+
+class AtFormat(NamedTuple):
+    magic: bytes
+    header_size: int
+    # struct format of the decompressed length, or None if uncompressed
+    length_format: Optional[str]
+
+
+AT_FORMATS: Dict[bytes, AtFormat] = {
+    fmt.magic: fmt
+    for fmt in (
+        AtFormat(b"PKDPX", 20, "<I"),
+        AtFormat(b"ATUPX", 20, "<I"),
+        AtFormat(b"AT4PX", 18, "<H"),
+        AtFormat(b"AT3PX", 18, "<H"),
+        AtFormat(b"AT4PN", 7, None),
+    )
+}
+MAGIC_SIZE = 5
+FLAGS_OFFSET = 7
+
+
+class AtHeader(NamedTuple):
+    format: AtFormat
+    container_length: int
+    flags: bytes
+    decompressed_length: int
+
+
+def is_at(data: bytes) -> bool:
+    return bytes(data[:MAGIC_SIZE]) in AT_FORMATS
+
+
+def parse_header(data: bytes) -> AtHeader:
+    """Parse the header of an AT container."""
+    fmt = AT_FORMATS.get(bytes(data[:MAGIC_SIZE]))
+    if fmt is None:
+        raise ValueError(f"not an AT container: magic {bytes(data[:MAGIC_SIZE])!r}")
+    (container_length,) = struct.unpack_from("<H", data, MAGIC_SIZE)
+    if fmt.length_format is None:
+        return AtHeader(fmt, container_length, b"", container_length - fmt.header_size)
+    flags = bytes(data[FLAGS_OFFSET : FLAGS_OFFSET + NUM_FLAGS])
+    (decompressed_length,) = struct.unpack_from(
+        fmt.length_format, data, FLAGS_OFFSET + NUM_FLAGS
+    )
+    return AtHeader(fmt, container_length, flags, decompressed_length)
+
+
+def _pattern(index: int, n: int) -> bytes:
+    """Expand a control flag token into 2 bytes."""
+    if index == 0:
+        nibbles = [n] * 4
+    elif index <= 4:
+        nibbles = [n + 1] * 4
+        nibbles[index - 1] -= 1
+    else:
+        nibbles = [n - 1] * 4
+        nibbles[index - 5] += 1
+    nibbles = [x & 0xF for x in nibbles]
+    return bytes([(nibbles[0] << 4) | nibbles[1], (nibbles[2] << 4) | nibbles[3]])
+
+
+# Expansions of control flag tokens, indexed by (flag index << 4) | low nibble
+PATTERNS = [_pattern(i, n) for i in range(NUM_FLAGS) for n in range(16)]
+
+
+def flag_table(flags: bytes) -> List[int]:
+    """Map each high nibble to the index of the first matching flag, or -1."""
+    table = [-1] * 16
+    for i, flag in reversed(list(enumerate(flags))):
+        table[flag & 0xF] = i
+    return table
+
+
+def px_decompress(payload: bytes, flags: bytes, length: int) -> bytes:
+    """Decompress PX-compressed data.
+
+    Args:
+        payload (bytes): compressed data (after the container header)
+        flags (bytes): the 9 control flags
+        length (int): decompressed length
+
+    Returns:
+        bytes: decompressed data
+    """
+    flag_index = flag_table(flags)
+    patterns = PATTERNS
+    out = bytearray()
+    i = 0
+    n = len(payload)
+    try:
+        while len(out) < length and i < n:
+            command = payload[i]
+            i += 1
+            if command == 0xFF:
+                out += payload[i : i + 8]
+                i += 8
+                continue
+            for bit in (0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01):
+                if len(out) >= length:
+                    break
+                if command & bit:
+                    out.append(payload[i])
+                    i += 1
+                    continue
+                b = payload[i]
+                i += 1
+                index = flag_index[b >> 4]
+                if index >= 0:
+                    out += patterns[(index << 4) | (b & 0xF)]
+                    continue
+                start = len(out) - WINDOW_SIZE + (((b & 0xF) << 8) | payload[i])
+                i += 1
+                count = (b >> 4) + 3
+                if start < 0:
+                    raise ValueError("back-reference before the start of the output")
+                if start + count <= len(out):
+                    out += out[start : start + count]
+                else:
+                    # Overlapping copy
+                    for j in range(start, start + count):
+                        out.append(out[j])
+    except IndexError:
+        raise ValueError("truncated compressed data") from None
+    if len(out) < length:
+        raise ValueError(f"decompressed {len(out)} bytes, expected {length}")
+    return bytes(out[:length])
+
+
+class PxDecompressor:
+    """
+    A streaming PX decompressor.
+
+    Input can be fed in arbitrary chunks; each call to feed() returns the
+    output that could be decompressed so far. Only the back-reference window
+    of the output is retained.
+    """
+
+    def __init__(self, flags: bytes, length: int):
+        self.flag_index = flag_table(flags)
+        self.remaining = length
+        self.pending = bytearray()
+        self.window = bytearray()
+        # The current command byte, and the bits of it that are left
+        self.command = 0
+        self.bit = 0
+
+    @property
+    def done(self) -> bool:
+        return self.remaining == 0
+
+    def feed(self, chunk: bytes) -> bytes:
+        self.pending += chunk
+        data = self.pending
+        i = 0
+        out = bytearray()
+        history = self.window
+        while self.remaining > len(out):
+            if not self.bit:
+                if i >= len(data):
+                    break
+                self.command = data[i]
+                self.bit = 0x80
+                i += 1
+            if self.command & self.bit:
+                if i >= len(data):
+                    break
+                out.append(data[i])
+                i += 1
+            else:
+                if i >= len(data):
+                    break
+                b = data[i]
+                index = self.flag_index[b >> 4]
+                if index >= 0:
+                    out += PATTERNS[(index << 4) | (b & 0xF)]
+                    i += 1
+                else:
+                    if i + 1 >= len(data):
+                        break
+                    back = WINDOW_SIZE - (((b & 0xF) << 8) | data[i + 1])
+                    i += 2
+                    for _ in range((b >> 4) + 3):
+                        if back <= len(out):
+                            out.append(out[-back])
+                        else:
+                            out.append(history[len(out) - back])
+            self.bit >>= 1
+        del data[:i]
+        out = out[: self.remaining]
+        self.remaining -= len(out)
+        self.window = (history + out)[-WINDOW_SIZE:]
+        return bytes(out)
+
+
+def decompress(data: bytes, half: Optional[int] = None) -> bytes:
+    """Decompress an AT container (DecompressAtNormal).
+
+    Args:
+        data (bytes): AT container
+        half (Optional[int]): if given, store each nibble in its own byte with
+            this high nibble, like DecompressAtHalf
+
+    Returns:
+        bytes: decompressed data
+    """
+    header = parse_header(data)
+    payload = data[header.format.header_size : header.container_length]
+    if header.format.length_format is None:
+        out = bytes(payload)
+    else:
+        out = px_decompress(payload, header.flags, header.decompressed_length)
+    if half is not None:
+        return expand_half(out, half)
+    return out
+
+
+def expand_half(data: bytes, high_nibble: int) -> bytes:
+    """Store each nibble in its own byte (low nibble first)."""
+    high = (high_nibble & 0xF) << 4
+    low_table = bytes(high | (b & 0xF) for b in range(256))
+    high_table = bytes(high | (b >> 4) for b in range(256))
+    out = bytearray(2 * len(data))
+    out[0::2] = data.translate(low_table)
+    out[1::2] = data.translate(high_table)
+    return bytes(out)
+
+
+# Control flag tokens by the 2 bytes they expand to, for the compressor
+def _pattern_tokens(flags: Sequence[int]) -> Dict[bytes, int]:
+    tokens: Dict[bytes, int] = {}
+    for index, flag in enumerate(flags):
+        for n in range(16):
+            tokens.setdefault(PATTERNS[(index << 4) | n], (flag << 4) | n)
+    return tokens
+
+
+# Longest usable back-reference length for each match length
+_COPY_LENGTHS = [0] * (MAX_COPY_LENGTH + 1)
+for _length in range(3, MAX_COPY_LENGTH + 1):
+    _COPY_LENGTHS[_length] = max(n + 3 for n in COPY_NIBBLES if n + 3 <= _length)
+
+
+def px_compress(data: bytes) -> Tuple[bytes, bytes]:
+    """Compress data with the PX algorithm.
+
+    Returns:
+        Tuple[bytes, bytes]: control flags and compressed data
+    """
+    flags = bytes(COMPRESSOR_FLAGS)
+    patterns = _pattern_tokens(COMPRESSOR_FLAGS)
+    chains: Dict[bytes, List[int]] = defaultdict(list)
+    out = bytearray()
+    tokens: List[bytes] = []
+    command = 0
+    n = len(data)
+    pos = 0
+
+    def emit(token: bytes, literal: bool):
+        nonlocal command
+        command = (command << 1) | literal
+        tokens.append(token)
+        if len(tokens) == 8:
+            flush()
+
+    def flush():
+        nonlocal command
+        if tokens:
+            out.append(command << (8 - len(tokens)))
+            for token in tokens:
+                out.extend(token)
+            tokens.clear()
+            command = 0
+
+    while pos < n:
+        # Longest match within the window
+        best_length = best_start = 0
+        key = data[pos : pos + 3]
+        if len(key) == 3:
+            chain = chains[key]
+            limit = min(MAX_COPY_LENGTH, n - pos)
+            for start in reversed(chain):
+                if pos - start > WINDOW_SIZE:
+                    break
+                length = 3
+                while length < limit and data[start + length] == data[pos + length]:
+                    length += 1
+                if length > best_length:
+                    best_length, best_start = length, start
+                    if length == limit:
+                        break
+        pattern = patterns.get(data[pos : pos + 2]) if n - pos >= 2 else None
+        if best_length >= 4 or (best_length == 3 and pattern is None):
+            length = _COPY_LENGTHS[best_length]
+            offset = best_start - pos + WINDOW_SIZE
+            emit(bytes([((length - 3) << 4) | (offset >> 8), offset & 0xFF]), False)
+            step = length
+        elif pattern is not None:
+            emit(bytes([pattern]), False)
+            step = 2
+        else:
+            emit(data[pos : pos + 1], True)
+            step = 1
+        for p in range(pos, min(pos + step, n - 2)):
+            chain = chains[data[p : p + 3]]
+            chain.append(p)
+            if len(chain) > MAX_CHAIN:
+                del chain[0]
+        pos += step
+    flush()
+    return flags, bytes(out)
+
+
+def compress(data: bytes, magic: bytes = b"PKDPX") -> bytes:
+    """Compress data into an AT container.
+
+    Args:
+        data (bytes): data to compress
+        magic (bytes): container format
+
+    Returns:
+        bytes: AT container
+    """
+    fmt = AT_FORMATS[magic]
+    if fmt.length_format is None:
+        payload = data
+        header = b""
+    else:
+        flags, payload = px_compress(data)
+        header = flags + struct.pack(fmt.length_format, len(data))
+    container_length = fmt.header_size + len(payload)
+    if container_length > 0xFFFF:
+        raise ValueError(
+            f"container too large for {magic.decode()}: {container_length}"
+        )
+    return magic + struct.pack("<H", container_length) + header + payload
+
+
+def decompress_entry(data: memoryview) -> Union[bytes, memoryview]:
+    """Decompress a Pack archive entry if it's an AT container."""
+    return decompress(data) if is_at(data) else data
+
+
+def unpack(path: str, output_dir: str, jobs: Optional[int] = None) -> int:
+    """Decompress every entry of a Pack archive in parallel.
+
+    AT entries are decompressed, and other entries are copied as is. Entries
+    are written to the output directory as <index>.bin.
+
+    Returns:
+        int: total number of bytes written
+    """
+    return extract(path, output_dir, transform=decompress_entry, jobs=jobs)
+
+
+def load_containers(paths: List[str]) -> List[bytes]:
+    """Load AT containers from files, and from the entries of Pack archives."""
+    containers = []
+    for path in paths:
+        data = Path(path).read_bytes()
+        if is_at(data):
+            containers.append(data)
+            continue
+        with PackArchive(path) as archive:
+            for entry in archive:
+                if is_at(entry):
+                    containers.append(bytes(entry))
+                entry.release()
+    return containers
+
+
+def benchmark(containers: List[bytes], compression: bool) -> None:
+    total_in = sum(parse_header(c).container_length for c in containers)
+    start = time.perf_counter()
+    outputs = [decompress(c) for c in containers]
+    elapsed = time.perf_counter() - start
+    total_out = sum(map(len, outputs))
+    print(
+        f"decompress: {len(containers)} container(s), {total_in} -> {total_out} bytes"
+        + f" in {elapsed:.3f} s ({total_out / elapsed / 1e6:.2f} MB/s output)"
+    )
+    if compression:
+        start = time.perf_counter()
+        recompressed = [
+            compress(o, parse_header(c).format.magic)
+            for o, c in zip(outputs, containers)
+        ]
+        elapsed = time.perf_counter() - start
+        print(
+            f"compress: {total_out} -> {sum(map(len, recompressed))} bytes"
+            + f" in {elapsed:.3f} s ({total_out / elapsed / 1e6:.2f} MB/s input)"
+        )
+        mismatches = sum(decompress(r) != o for r, o in zip(recompressed, outputs))
+        if mismatches:
+            print(f"{mismatches} container(s) failed to round-trip")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Decompress and compress AT containers (AT4PX, PKDPX, ...)"
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    decompress_parser = subparsers.add_parser(
+        "decompress", help="decompress an AT container"
+    )
+    decompress_parser.add_argument(
+        "--half",
+        type=lambda x: int(x, 0),
+        help="store each nibble in its own byte with this high nibble"
+        + " (like DecompressAtHalf)",
+    )
+    decompress_parser.add_argument("input", help="AT container")
+    decompress_parser.add_argument("output", help="output file")
+
+    compress_parser = subparsers.add_parser(
+        "compress", help="compress a file into an AT container"
+    )
+    compress_parser.add_argument(
+        "-f",
+        "--format",
+        choices=[magic.decode() for magic in AT_FORMATS],
+        default="PKDPX",
+        help="container format",
+    )
+    compress_parser.add_argument("input", help="input file")
+    compress_parser.add_argument("output", help="AT container")
+
+    bench_parser = subparsers.add_parser(
+        "bench", help="measure throughput over AT containers or Pack archives"
+    )
+    bench_parser.add_argument(
+        "--no-compress",
+        action="store_true",
+        help="only measure decompression",
+    )
+    bench_parser.add_argument("file", nargs="+", help="AT containers or Pack archives")
+
+    unpack_parser = subparsers.add_parser(
+        "unpack", help="decompress every entry of a Pack archive in parallel"
+    )
+    add_jobs_argument(unpack_parser)
+    unpack_parser.add_argument(
+        "-o", "--output-dir", required=True, help="output directory"
+    )
+    unpack_parser.add_argument("pack", help="Pack archive")
+    args = parser.parse_args()
+
+    if args.command == "decompress":
+        data = Path(args.input).read_bytes()
+        Path(args.output).write_bytes(decompress(data, args.half))
+    elif args.command == "compress":
+        data = Path(args.input).read_bytes()
+        Path(args.output).write_bytes(compress(data, args.format.encode()))
+    elif args.command == "bench":
+        containers = load_containers(args.file)
+        if not containers:
+            parser.error("no AT containers found")
+        benchmark(containers, not args.no_compress)
+    elif args.command == "unpack":
+        start = time.perf_counter()
+        total = unpack(args.pack, args.output_dir, args.jobs)
+        elapsed = time.perf_counter() - start
+        print(f"Unpacked {total} bytes from {args.pack} in {elapsed:.2f} s")
@@ -0,0 +1,670 @@
+#!/usr/bin/env python3
+
+"""
+`damage_calc.py` is a library and command line utility that reproduces the EoS
+dungeon damage formula on the host, for balance analysis over large sweeps of
+attackers, defenders, moves and levels.
+
+The formula is described in the overlay 29 symbol table (see CalcDamage) and
+in `struct damage_calc_diag`:
+    AT = min(max(offense, 0), 999) + power
+    DEF = defense
+    FLV = round[(offense - defense)/8 + level]
+    base = (153/256)*AT - 0.5*DEF + 50*ClampedLn(10*(FLV + 50)) - 311
+    damage = M * clamp(base [/ (85/64) for non-team members], 1, 999)
+where the constants are the DAMAGE_FORMULA_* values documented in the arm9 and
+overlay 29 symbol tables, and M is the aggregate damage multiplier (type
+matchups, STAB, critical hits, items, abilities, ...). The calculation is done
+in 64-bit fixed point with 16 fraction bits (`struct fx64`), mirroring the
+arm9 fixed-point routines (MultiplyFixedPoint64, DivideFixedPoint64, ...) as
+implemented in `fx64.py`, with 32-bit fixed-point constants and multipliers
+(8 fraction bits) widened as in FixedPoint32To64. The result corresponds to
+`damage_calc_diag::damage_calc`, i.e., the damage before random variation and
+the few stray multipliers applied after it.
+
+Rounding, truncation and clamping at each step follow the documented
+intermediate quantities. ClampedLn looks up NATURAL_LOG_VALUE_TABLE, which is
+read from the RAM dump or arm9 binary when one is given (it's in arm9, so a
+dump taken in any mode works); otherwise `fx64.py` approximates it by rounding
+ln(x) to the table's 12 fraction bits. The results haven't been checked
+against the game, so compare against `damage_calc_diag` values from RAM dumps
+(see `ramdump.py`) when exactness matters.
+
+For sweeps, `DamageBatch` evaluates the formula over structure-of-arrays
+batches. Every term of the base formula that depends on a single input (the AT
+and DEF terms, the FLV quotient and the ClampedLn term) is precomputed into a
+lookup table with the scalar fixed-point routines, so each lane reduces to a
+few table lookups, additions and the final multiply, and since table entries
+are exactly the scalar intermediate values, every lane matches the scalar
+reference path bit for bit (which the `verify` command checks).
+
+Type matchups default to the standard type chart (with Ghost's Normal and
+Fighting immunities applied separately, as in the game), but can be loaded
+from TYPE_MATCHUP_TABLE in a RAM dump taken in dungeon mode.
+
+Example usage:
+
+python3 damage_calc.py calc --offense 120 --defense 90 --level 35 --power 24
+python3 damage_calc.py calc --offense 120 --defense 90 --level 35 --power 24 \\
+    --move-type fire --defender-types grass steel --stab
+python3 damage_calc.py sweep --offense 50:300:10 --defense 50:300:10 \\
+    --level 1:101 --power 4:40:4 -o sweep.csv
+python3 damage_calc.py verify -n 100000
+"""
+
+import argparse
+from array import array
+import csv
+import itertools
+import random
+import sys
+import time
+from typing import Dict, Iterable, List, NamedTuple, Optional, Sequence, Tuple
+
+from fx64 import (
+    FX32_ONE,
+    FX64_ONE,
+    LN_MAX,
+    LN_MIN,
+    add_fx64,
+    batch_fx32_to_fx64,
+    batch_multiply_fx64,
+    clamped_ln,
+    divide_fx64,
+    fx32_const,
+    fx32_to_fx64,
+    fx64_const,
+    fx64_round,
+    int_to_fx64,
+    load_ln_values,
+    multiply_by_fixed_point,
+    multiply_fx64,
+    set_ln_values,
+)
+from ramdump import VERSIONS, RamDump, load_data_symbols, load_layouts
+
+# Damage formula constants, as 32-bit fixed-point numbers (see the arm9 symbol
+# table)
+DAMAGE_FORMULA_FLV_SHIFT = fx32_const(50)
+DAMAGE_FORMULA_CONSTANT_SHIFT = fx32_const(-311)
+DAMAGE_FORMULA_FLV_DEFICIT_DIVISOR = fx32_const(8)
+DAMAGE_FORMULA_NON_TEAM_MEMBER_MODIFIER = fx32_const("85/64")
+DAMAGE_FORMULA_LN_PREFACTOR = fx32_const(50)
+DAMAGE_FORMULA_DEF_PREFACTOR = fx32_const("-0.5")
+DAMAGE_FORMULA_AT_PREFACTOR = fx32_const("153/256")
+DAMAGE_FORMULA_LN_ARG_PREFACTOR = fx32_const(10)
+# As 64-bit fixed-point numbers (see the overlay 29 symbol table)
+DAMAGE_FORMULA_MAX_BASE = fx64_const(999)
+DAMAGE_FORMULA_MIN_BASE = fx64_const(1)
+# The offensive stat is clamped to this range in the AT term
+OFFENSE_CALC_MAX = 999
+
+# Type matchup multipliers, as 32-bit fixed-point numbers (see the overlay 10
+# symbol table). MATCHUP_NOT_VERY_EFFECTIVE_MULTIPLIER is documented as the
+# closest representation of 1/sqrt(2), which is 0xB5.
+MATCHUP_IMMUNE_MULTIPLIER = fx32_const("0.5")
+MATCHUP_NOT_VERY_EFFECTIVE_MULTIPLIER = 0xB5
+MATCHUP_NEUTRAL_MULTIPLIER = fx32_const(1)
+MATCHUP_SUPER_EFFECTIVE_MULTIPLIER = 0x166
+MATCHUP_MULTIPLIERS = [
+    MATCHUP_IMMUNE_MULTIPLIER,
+    MATCHUP_NOT_VERY_EFFECTIVE_MULTIPLIER,
+    MATCHUP_NEUTRAL_MULTIPLIER,
+    MATCHUP_SUPER_EFFECTIVE_MULTIPLIER,
+]
+STAB_MULTIPLIER = fx32_const("1.5")
+
+# enum type_matchup
+MATCHUP_IMMUNE = 0
+MATCHUP_NOT_VERY_EFFECTIVE = 1
+MATCHUP_NEUTRAL = 2
+MATCHUP_SUPER_EFFECTIVE = 3
+
+# enum type_id, not including TYPE_NEUTRAL
+TYPES = [
+    "none",
+    "normal",
+    "fire",
+    "water",
+    "grass",
+    "electric",
+    "ice",
+    "fighting",
+    "poison",
+    "ground",
+    "flying",
+    "psychic",
+    "bug",
+    "rock",
+    "ghost",
+    "dragon",
+    "dark",
+    "steel",
+]
+NUM_TYPES = len(TYPES)
+TYPE_IDS = {name: i for i, name in enumerate(TYPES)}
+
+# Standard type chart: attack type -> (super effective, not very effective,
+# immune) defender types. Normal and Fighting are neutral against Ghost here,
+# like in TYPE_MATCHUP_TABLE; the immunity is applied separately.
+TYPE_CHART: Dict[str, Tuple[str, str, str]] = {
+    "normal": ("", "rock steel", ""),
+    "fire": ("grass ice bug steel", "fire water rock dragon", ""),
+    "water": ("fire ground rock", "water grass dragon", ""),
+    "grass": (
+        "water ground rock",
+        "fire grass poison flying bug dragon steel",
+        "",
+    ),
+    "electric": ("water flying", "electric grass dragon", "ground"),
+    "ice": ("grass ground flying dragon", "fire water ice steel", ""),
+    "fighting": ("normal ice rock dark steel", "poison flying psychic bug", ""),
+    "poison": ("grass", "poison ground rock ghost", "steel"),
+    "ground": ("fire electric poison rock steel", "grass bug", "flying"),
+    "flying": ("grass fighting bug", "electric rock steel", ""),
+    "psychic": ("fighting poison", "psychic steel", "dark"),
+    "bug": ("grass psychic dark", "fire fighting poison flying ghost steel", ""),
+    "rock": ("fire ice flying bug", "fighting ground steel", ""),
+    "ghost": ("psychic ghost", "dark steel", "normal"),
+    "dragon": ("dragon", "steel", ""),
+    "dark": ("psychic ghost", "fighting dark steel", ""),
+    "steel": ("ice rock", "fire water electric steel", ""),
+}
+# Attack types that Ghost types are immune to (see IsTypeIneffectiveAgainstGhost)
+GHOST_IMMUNE_ATTACK_TYPES = ("normal", "fighting")
+
+
+def default_type_matchup_table() -> List[List[int]]:
+    """Build a type matchup table (indexed [attack type][target type])."""
+    table = [[MATCHUP_NEUTRAL] * NUM_TYPES for _ in range(NUM_TYPES)]
+    for attack, (super_effective, not_very_effective, immune) in TYPE_CHART.items():
+        row = table[TYPE_IDS[attack]]
+        for names, matchup in (
+            (super_effective, MATCHUP_SUPER_EFFECTIVE),
+            (not_very_effective, MATCHUP_NOT_VERY_EFFECTIVE),
+            (immune, MATCHUP_IMMUNE),
+        ):
+            for name in names.split():
+                row[TYPE_IDS[name]] = matchup
+    return table
+
+
+DEFAULT_TYPE_MATCHUP_TABLE = default_type_matchup_table()
+
+
+def load_type_matchup_table(dump_path: str, version: str) -> List[List[int]]:
+    """Read TYPE_MATCHUP_TABLE from a RAM dump taken in dungeon mode."""
+    with RamDump(dump_path, load_layouts(version), load_data_symbols(version)) as dump:
+        matchups = dump.symbol("TYPE_MATCHUP_TABLE").matchups
+        return [
+            [matchups[a][t].val for t in range(NUM_TYPES)] for a in range(NUM_TYPES)
+        ]
+
+
+class DamageCalc(NamedTuple):
+    """Intermediate and final quantities, as in struct damage_calc_diag"""
+
+    at: int
+    defense: int
+    flv: int
+    base: int
+    damage: int
+
+
+def type_multiplier(
+    move_type: str,
+    defender_types: Sequence[str],
+    stab: bool = False,
+    table: Optional[List[List[int]]] = None,
+    ghost_immunity: bool = True,
+) -> Tuple[int, List[int]]:
+    """Compute the type-based damage multiplier.
+
+    This covers type matchups against each of the defender's types and STAB,
+    which is the core of CalcTypeBasedDamageEffects; conditional effects from
+    abilities, items, weather, etc. aren't modeled, and can be folded into the
+    extra multiplier passed to calc_damage().
+
+    Args:
+        move_type (str): attack type
+        defender_types (Sequence[str]): defender types (one or two)
+        stab (bool): whether the attacker shares the move type
+        table (Optional[List[List[int]]]): type matchup table (defaults to the
+            standard type chart)
+        ghost_immunity (bool): whether Ghost types are immune to Normal and
+            Fighting moves (false if the defender is exposed, or the attacker
+            has Scrappy or a Scrappy-like item)
+
+    Returns:
+        Tuple[int, List[int]]: multiplier as a 32-bit fixed-point number, and
+            the individual matchups against each defender type
+    """
+    if table is None:
+        table = DEFAULT_TYPE_MATCHUP_TABLE
+    multiplier = FX32_ONE
+    matchups = []
+    for defender_type in defender_types:
+        if (
+            ghost_immunity
+            and defender_type == "ghost"
+            and move_type in GHOST_IMMUNE_ATTACK_TYPES
+        ):
+            matchup = MATCHUP_IMMUNE
+        else:
+            matchup = table[TYPE_IDS[move_type]][TYPE_IDS[defender_type]]
+        matchups.append(matchup)
+        multiplier = multiply_by_fixed_point(multiplier, MATCHUP_MULTIPLIERS[matchup])
+    if stab:
+        multiplier = multiply_by_fixed_point(multiplier, STAB_MULTIPLIER)
+    return multiplier, matchups
+
+
+def flv_quotient(deficit: int) -> int:
+    """The (offense - defense)/8 term of FLV, in 64-bit fixed point"""
+    return divide_fx64(
+        int_to_fx64(deficit), fx32_to_fx64(DAMAGE_FORMULA_FLV_DEFICIT_DIVISOR)
+    )
+
+
+def ln_argument(flv: int) -> int:
+    """The argument to ClampedLn: 10*(FLV + 50)"""
+    return multiply_by_fixed_point(
+        flv * FX32_ONE + DAMAGE_FORMULA_FLV_SHIFT, DAMAGE_FORMULA_LN_ARG_PREFACTOR
+    ) >> 8
+
+
+def at_term(at: int) -> int:
+    return multiply_fx64(
+        int_to_fx64(at), fx32_to_fx64(DAMAGE_FORMULA_AT_PREFACTOR)
+    )
+
+
+def def_term(defense: int) -> int:
+    return multiply_fx64(
+        int_to_fx64(defense), fx32_to_fx64(DAMAGE_FORMULA_DEF_PREFACTOR)
+    )
+
+
+def ln_term(ln_arg: int) -> int:
+    return multiply_fx64(
+        clamped_ln(ln_arg), fx32_to_fx64(DAMAGE_FORMULA_LN_PREFACTOR)
+    )
+
+
+CONSTANT_TERM = fx32_to_fx64(DAMAGE_FORMULA_CONSTANT_SHIFT)
+NON_TEAM_MEMBER_MODIFIER = fx32_to_fx64(DAMAGE_FORMULA_NON_TEAM_MEMBER_MODIFIER)
+
+
+def finish_damage(base: int, team_member: bool, multiplier: int) -> Tuple[int, int]:
+    """Apply the non-team-member modifier, clamping, and the multiplier.
+
+    Returns:
+        Tuple[int, int]: base damage (damage_calc_base) and damage
+    """
+    if not team_member:
+        base = divide_fx64(base, NON_TEAM_MEMBER_MODIFIER)
+    base = min(max(base, DAMAGE_FORMULA_MIN_BASE), DAMAGE_FORMULA_MAX_BASE)
+    return fx64_round(base), fx64_round(multiply_fx64(base, fx32_to_fx64(multiplier)))
+
+
+def calc_damage(
+    offense: int,
+    defense: int,
+    level: int,
+    power: int,
+    multiplier: int = FX32_ONE,
+    team_member: bool = True,
+) -> DamageCalc:
+    """Evaluate the damage formula (the scalar reference path).
+
+    Args:
+        offense (int): modified offensive stat (damage_calc_diag::offense_calc)
+        defense (int): modified defensive stat (damage_calc_diag::defense_calc)
+        level (int): attacker level
+        power (int): modified move power
+        multiplier (int): aggregate damage multiplier, as a 32-bit fixed-point
+            number
+        team_member (bool): whether the attacker is a team member
+
+    Returns:
+        DamageCalc: intermediate and final quantities
+    """
+    at = min(max(offense, 0), OFFENSE_CALC_MAX) + power
+    flv = fx64_round(flv_quotient(offense - defense) + int_to_fx64(level))
+    base = add_fx64(
+        add_fx64(at_term(at), def_term(defense)),
+        add_fx64(ln_term(ln_argument(flv)), CONSTANT_TERM),
+    )
+    damage_base, damage = finish_damage(base, team_member, multiplier)
+    return DamageCalc(at, defense, flv, damage_base, damage)
+
+
+class DamageBatch:
+    """
+    A structure-of-arrays batch of damage calculations.
+
+    Inputs are stored column-wise in typed arrays, and evaluated with lookup
+    tables of the scalar intermediate values.
+    """
+
+    # Lookup table bounds. Inputs outside these bounds are evaluated on the
+    # scalar path.
+    MAX_STAT = 0xFFFF
+    MAX_AT = OFFENSE_CALC_MAX + 0xFFFF
+    # FLV values beyond which the ClampedLn argument is clamped
+    FLV_MIN = LN_MIN // 10 - 50
+    FLV_MAX = LN_MAX // 10 - 50 + 1
+
+    def __init__(self):
+        self.offense = array("l")
+        self.defense = array("l")
+        self.level = array("l")
+        self.power = array("l")
+        # 32-bit fixed-point multipliers
+        self.multiplier = array("i")
+        self.team_member = array("b")
+
+    def __len__(self) -> int:
+        return len(self.offense)
+
+    def append(
+        self,
+        offense: int,
+        defense: int,
+        level: int,
+        power: int,
+        multiplier: int = FX32_ONE,
+        team_member: bool = True,
+    ):
+        self.offense.append(offense)
+        self.defense.append(defense)
+        self.level.append(level)
+        self.power.append(power)
+        self.multiplier.append(multiplier)
+        self.team_member.append(team_member)
+
+    @classmethod
+    def _tables(cls) -> Tuple[List[int], List[int], List[int], List[int]]:
+        tables = getattr(cls, "_cached_tables", None)
+        if tables is None:
+            tables = (
+                [at_term(at) for at in range(cls.MAX_AT + 1)],
+                [def_term(d) for d in range(cls.MAX_STAT + 1)],
+                # Indexed by offense - defense + MAX_STAT
+                [flv_quotient(d) for d in range(-cls.MAX_STAT, cls.MAX_STAT + 1)],
+                # Indexed by FLV - FLV_MIN. The ClampedLn argument saturates
+                # outside of [FLV_MIN, FLV_MAX].
+                [
+                    ln_term(ln_argument(flv))
+                    for flv in range(cls.FLV_MIN, cls.FLV_MAX + 1)
+                ],
+            )
+            cls._cached_tables = tables
+        return tables
+
+    def evaluate(self) -> Tuple[array, array]:
+        """Evaluate every lane of the batch.
+
+        Each step of the formula is applied to whole columns at a time.
+
+        Returns:
+            Tuple[array, array]: base damage and damage for each lane
+        """
+        at_table, def_table, flv_table, ln_table = self._tables()
+        max_stat, max_at = self.MAX_STAT, self.MAX_AT
+        flv_min, flv_max = self.FLV_MIN, self.FLV_MAX
+        offense, defense, level, power = (
+            self.offense,
+            self.defense,
+            self.level,
+            self.power,
+        )
+        # Lanes with inputs outside the lookup tables (or levels outside the
+        # range where IntToFixedPoint64 is a plain shift) take the scalar path
+        in_range = [
+            0 <= o <= max_stat
+            and 0 <= d <= max_stat
+            and 0 <= p <= max_at - o
+            and 0 <= lv <= 0x7FFF
+            for o, d, p, lv in zip(offense, defense, power, level)
+        ]
+        if not all(in_range):
+            offense, defense, power, level = (
+                [x if ok else 0 for x, ok in zip(column, in_range)]
+                for column in (offense, defense, power, level)
+            )
+        flv = [
+            (flv_table[o - d + max_stat] + (lv << 16) + FX64_ONE // 2) >> 16
+            for o, d, lv in zip(offense, defense, level)
+        ]
+        # The terms are small enough that their sum never wraps
+        base = [
+            at_table[(o if o < OFFENSE_CALC_MAX else OFFENSE_CALC_MAX) + p]
+            + def_table[d]
+            + ln_table[
+                (f if f < flv_max else flv_max) - flv_min if f > flv_min else 0
+            ]
+            + CONSTANT_TERM
+            for o, d, p, f in zip(offense, defense, power, flv)
+        ]
+        base = [
+            b if team else divide_fx64(b, NON_TEAM_MEMBER_MODIFIER)
+            for b, team in zip(base, self.team_member)
+        ]
+        base = [
+            DAMAGE_FORMULA_MIN_BASE
+            if b < DAMAGE_FORMULA_MIN_BASE
+            else DAMAGE_FORMULA_MAX_BASE
+            if b > DAMAGE_FORMULA_MAX_BASE
+            else b
+            for b in base
+        ]
+        products = batch_multiply_fx64(base, batch_fx32_to_fx64(self.multiplier))
+        damages = array("l", ((p + FX64_ONE // 2) >> 16 for p in products))
+        bases = array("l", ((b + FX64_ONE // 2) >> 16 for b in base))
+        for i, ok in enumerate(in_range):
+            if not ok:
+                result = calc_damage(
+                    self.offense[i],
+                    self.defense[i],
+                    self.level[i],
+                    self.power[i],
+                    self.multiplier[i],
+                    bool(self.team_member[i]),
+                )
+                bases[i], damages[i] = result.base, result.damage
+        return bases, damages
+
+
+def verify_batch(n: int, seed: int = 0) -> int:
+    """Check that random batch lanes match the scalar path.
+
+    Returns:
+        int: number of mismatching lanes
+    """
+    rng = random.Random(seed)
+    batch = DamageBatch()
+    for _ in range(n):
+        batch.append(
+            rng.randrange(-50, 1500),
+            rng.randrange(0, 1500),
+            rng.randrange(1, 101),
+            rng.randrange(0, 400),
+            rng.randrange(0, 4 * FX32_ONE),
+            rng.random() < 0.5,
+        )
+    bases, damages = batch.evaluate()
+    mismatches = 0
+    for i in range(n):
+        expected = calc_damage(
+            batch.offense[i],
+            batch.defense[i],
+            batch.level[i],
+            batch.power[i],
+            batch.multiplier[i],
+            bool(batch.team_member[i]),
+        )
+        if (bases[i], damages[i]) != (expected.base, expected.damage):
+            mismatches += 1
+    return mismatches
+
+
+def parse_range(spec: str) -> range:
+    """Parse START[:STOP[:STEP]] (STOP exclusive) into a range."""
+    parts = [int(x, 0) for x in spec.split(":")]
+    if len(parts) == 1:
+        return range(parts[0], parts[0] + 1)
+    return range(*parts)
+
+
+def parse_multiplier(spec: str) -> int:
+    """Parse a multiplier given as a decimal number into 32-bit fixed point."""
+    return round(float(spec) * FX32_ONE)
+
+
+def sweep(
+    offenses: Iterable[int],
+    defenses: Iterable[int],
+    levels: Iterable[int],
+    powers: Iterable[int],
+    multiplier: int,
+    team_member: bool,
+) -> Tuple[DamageBatch, array, array]:
+    batch = DamageBatch()
+    for offense, defense, level, power in itertools.product(
+        offenses, defenses, levels, powers
+    ):
+        batch.append(offense, defense, level, power, multiplier, team_member)
+    bases, damages = batch.evaluate()
+    return batch, bases, damages
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Host reimplementation of the dungeon damage formula"
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    def add_type_args(p: argparse.ArgumentParser):
+        p.add_argument("--move-type", choices=TYPES, help="attack type")
+        p.add_argument(
+            "--defender-types", choices=TYPES, nargs="+", help="defender types"
+        )
+        p.add_argument("--stab", action="store_true", help="apply STAB")
+        p.add_argument(
+            "--no-ghost-immunity",
+            action="store_true",
+            help="disable Ghost's Normal/Fighting immunity (e.g., for Scrappy)",
+        )
+        p.add_argument(
+            "-m",
+            "--multiplier",
+            type=parse_multiplier,
+            default=FX32_ONE,
+            help="extra damage multiplier (e.g., 1.5 for a critical hit)",
+        )
+        p.add_argument(
+            "--non-team-member",
+            action="store_true",
+            help="the attacker is not a team member",
+        )
+        p.add_argument(
+            "--dump",
+            help="RAM dump to read NATURAL_LOG_VALUE_TABLE and (in dungeon mode)"
+            + " TYPE_MATCHUP_TABLE from",
+        )
+        p.add_argument(
+            "--arm9", help="arm9 binary to read NATURAL_LOG_VALUE_TABLE from"
+        )
+        p.add_argument(
+            "-v",
+            "--version",
+            choices=VERSIONS,
+            type=str.upper,
+            default="NA",
+            help="EoS version of the RAM dump or arm9 binary",
+        )
+
+    calc_parser = subparsers.add_parser("calc", help="evaluate a single calculation")
+    calc_parser.add_argument("--offense", type=int, required=True)
+    calc_parser.add_argument("--defense", type=int, required=True)
+    calc_parser.add_argument("--level", type=int, required=True)
+    calc_parser.add_argument("--power", type=int, required=True)
+    add_type_args(calc_parser)
+
+    sweep_parser = subparsers.add_parser(
+        "sweep", help="evaluate all combinations of input ranges"
+    )
+    for name in ("offense", "defense", "level", "power"):
+        sweep_parser.add_argument(
+            f"--{name}",
+            type=parse_range,
+            required=True,
+            help="START[:STOP[:STEP]] (STOP exclusive)",
+        )
+    add_type_args(sweep_parser)
+    sweep_parser.add_argument(
+        "-o", "--output", help="CSV output file (defaults to stdout)"
+    )
+
+    verify_parser = subparsers.add_parser(
+        "verify", help="check the batch path against the scalar path"
+    )
+    verify_parser.add_argument(
+        "-n", type=int, default=100000, help="number of random lanes"
+    )
+    verify_parser.add_argument("-s", "--seed", type=int, default=0, help="RNG seed")
+    args = parser.parse_args()
+
+    if args.command == "verify":
+        start = time.perf_counter()
+        mismatches = verify_batch(args.n, args.seed)
+        elapsed = time.perf_counter() - start
+        print(f"{args.n - mismatches}/{args.n} lanes match ({elapsed:.2f} s)")
+        sys.exit(1 if mismatches else 0)
+
+    if args.arm9 is not None:
+        set_ln_values(load_ln_values(args.arm9, args.version, arm9=True))
+    elif args.dump is not None:
+        set_ln_values(load_ln_values(args.dump, args.version))
+    multiplier = args.multiplier
+    if args.move_type is not None:
+        if not args.defender_types:
+            parser.error("--defender-types is required with --move-type")
+        table = (
+            load_type_matchup_table(args.dump, args.version)
+            if args.dump is not None
+            else None
+        )
+        type_mult, matchups = type_multiplier(
+            args.move_type,
+            args.defender_types,
+            args.stab,
+            table,
+            not args.no_ghost_immunity,
+        )
+        multiplier = multiply_by_fixed_point(multiplier, type_mult)
+    team_member = not args.non_team_member
+
+    if args.command == "calc":
+        result = calc_damage(
+            args.offense, args.defense, args.level, args.power, multiplier, team_member
+        )
+        print(f"multiplier: {multiplier / FX32_ONE:.4f} (0x{multiplier:X})")
+        for name, value in result._asdict().items():
+            print(f"{name}: {value}")
+    elif args.command == "sweep":
+        start = time.perf_counter()
+        batch, bases, damages = sweep(
+            args.offense, args.defense, args.level, args.power, multiplier, team_member
+        )
+        elapsed = time.perf_counter() - start
+        out = open(args.output, "w", newline="") if args.output else sys.stdout
+        writer = csv.writer(out)
+        writer.writerow(["offense", "defense", "level", "power", "base", "damage"])
+        writer.writerows(
+            zip(batch.offense, batch.defense, batch.level, batch.power, bases, damages)
+        )
+        if args.output:
+            out.close()
+            print(f"Evaluated {len(batch)} combination(s) in {elapsed:.2f} s")
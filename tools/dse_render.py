@@ -0,0 +1,1419 @@
+#!/usr/bin/env python3
+
+"""
+`dse_render.py` is a library and command line utility for rendering DSE
+(Digital Sound Elements) sequences, SMD files and their SWD sample banks, to
+PCM offline, for listening to them or for regression-testing the whole
+soundtrack.
+
+An SMD file (smdl) is a song chunk followed by one chunk per track, each
+holding a stream of events that the game parses with ParseDseEvent
+(`struct track_data` tracks the current event and the delay before the next
+one). Notes are 0x00-0x7F (the velocity), followed by a byte with the key,
+an octave change and the number of bytes of duration that follow; 0x80-0x8F
+are pauses of predefined lengths; the other events take a fixed number of
+parameter bytes (see EVENT_PARAMETER_SIZES). Only the events that affect the
+rendered sound are interpreted: pauses, loop points and the end of tracks,
+octaves, tempo, programs, track volume, expression, pan, and pitch bends.
+Other events are skipped over.
+
+An SWD file (swdl) holds a wavi chunk of sample descriptions, a prgi chunk of
+programs (`struct wavi_data` describes a loaded wavi chunk), and optionally a
+pcmd chunk of sample data. Song SWDs usually have no pcmd chunk, and play
+samples from the main sample bank (SOUND/BGM/bgm.swd). Each program has
+splits that map ranges of keys and velocities to a sample with its own
+tuning, volume, pan and envelope (`struct sound_envelope_parameters`), and
+LFOs (`struct dse_lfo_settings`). The file formats follow the documentation
+at https://projectpokemon.org/docs/mystery-dungeon-nds/procyon-studios-digital-sound-elements-r12/.
+
+Envelopes (`struct sound_envelope`) go through attack, hold, decay, sustain
+(with an optional fade out) and release. Their durations are indexes into the
+MUSIC_DURATION_LOOKUP_TABLE_1 (scaled by the slide time multiplier) and
+MUSIC_DURATION_LOOKUP_TABLE_2 (without a multiplier) tables of milliseconds.
+These tables can be read from a RAM dump with --tables; otherwise an
+approximation is used. LFOs (`struct dse_lfo`) start after a delay, fade in,
+and modulate the pitch, volume or pan of a voice with one of the waveforms of
+LFO_WAVEFORM_CALLBACKS (assumed to be in the order of the SoundLfoWave*Func
+functions). The scale of their amplitude is a guess.
+
+Rendering is block-based: envelopes, LFOs, pitch and volume are updated once
+per block of samples (--block-size), and each block of each voice is
+resampled, panned and mixed a whole block at a time. Samples are decoded to
+16-bit PCM once, when they're first played. Voices are resampled with
+nearest-neighbour lookups (the NDS sound hardware doesn't interpolate either)
+from a fixed-point position, and mixed with fixed-point gains into integer
+accumulators; the per-sample work is done by map() and array slices, so that
+it runs in C without third-party modules. The output is deterministic, so the
+hashes of rendered songs can be compared from one run to the next, and songs
+are rendered in parallel when rendering a whole directory.
+
+Example usage:
+
+python3 dse_render.py info /path/to/rom/SOUND/BGM/bgm0001.smd
+python3 dse_render.py render /path/to/rom/SOUND/BGM/bgm0001.smd -o bgm0001.wav
+python3 dse_render.py render-all /path/to/rom/SOUND/BGM -o out/ --loops 2
+python3 dse_render.py render-all /path/to/rom/SOUND/BGM --hashes bgm.json
+"""
+
+import argparse
+from array import array
+import enum
+import hashlib
+from itertools import repeat
+import json
+import operator
+import os
+from pathlib import Path
+import random
+import struct
+import sys
+import time
+from typing import Callable, Dict, List, NamedTuple, Optional, Tuple, Union
+import wave
+
+from ramdump import VERSIONS, RamDump, load_data_symbols, load_layouts
+from worker_pool import WorkerPool, add_jobs_argument, worker_state
+
+BANK_FILENAME = "bgm.swd"
+DEFAULT_SAMPLE_RATE = 32768
+DEFAULT_BLOCK_SIZE = 256
+DEFAULT_TEMPO = 120
+DEFAULT_OCTAVE = 4
+DEFAULT_BEND_RANGE = 2
+MAX_VOICES = 16
+MAX_VOLUME = 127
+CENTER_PAN = 64
+# Fractional bits of the position of voices in their samples
+POSITION_BITS = 16
+# Fractional bits of the gains voices are mixed with
+GAIN_BITS = 16
+SAMPLE_FORMAT_PCM8 = 0x000
+SAMPLE_FORMAT_PCM16 = 0x100
+SAMPLE_FORMAT_ADPCM = 0x200
+SAMPLE_FORMAT_PSG = 0x300
+ADPCM_HEADER_SIZE = 4
+ADPCM_MAX_STEP_INDEX = 88
+ADPCM_STEPS = (
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+)  # fmt: skip
+ADPCM_INDEX_CHANGES = (-1, -1, -1, -1, 2, 4, 6, 8)
+# Value of sustain_time that holds the sustain level
+SUSTAIN_FOREVER = 0x7F
+
+SMD_HEADER_SIZE = 0x40
+SONG_CHUNK_SIZE = 0x40
+SWD_HEADER_SIZE = 0x50
+CHUNK_HEADER_SIZE = 0x10
+TRACK_PREAMBLE_SIZE = 4
+SAMPLE_INFO_FORMAT = "<2xHbbBbBb6x2xH1x?6x4xIIII16s"
+SAMPLE_INFO_SIZE = struct.calcsize(SAMPLE_INFO_FORMAT)
+PROGRAM_HEADER_FORMAT = "<HHBB5xB4x"
+PROGRAM_HEADER_SIZE = struct.calcsize(PROGRAM_HEADER_FORMAT)
+LFO_SETTINGS_FORMAT = "<BBBBiHHHH"
+LFO_SETTINGS_SIZE = struct.calcsize(LFO_SETTINGS_FORMAT)
+SPLIT_FORMAT = "<4xbbxxbbxx4x2xHbbbbbb6x16s"
+SPLIT_SIZE = struct.calcsize(SPLIT_FORMAT)
+ENVELOPE_PARAMETERS_FORMAT = "<BBHI8B"
+
+# Lengths of the pause events 0x80-0x8F, in ticks
+PAUSE_LENGTHS = [96, 72, 64, 48, 36, 32, 24, 18, 16, 12, 9, 8, 6, 4, 3, 2]
+# Number of parameter bytes of the events from 0x90 (other events have none)
+EVENT_PARAMETER_SIZES = {
+    0x91: 1,
+    0x92: 1,
+    0x93: 2,
+    0x94: 3,
+    0x95: 1,
+    0x9C: 1,
+    0xA0: 1,
+    0xA1: 1,
+    0xA4: 1,
+    0xA5: 1,
+    0xA8: 2,
+    0xA9: 1,
+    0xAA: 1,
+    0xAB: 1,
+    0xAC: 1,
+    0xAF: 3,
+    0xB1: 1,
+    0xB2: 1,
+    0xB3: 1,
+    0xB4: 2,
+    0xB5: 1,
+    0xB6: 1,
+    0xBC: 1,
+    0xBE: 1,
+    0xBF: 1,
+    0xC0: 1,
+    0xC3: 1,
+    0xD0: 1,
+    0xD1: 1,
+    0xD2: 1,
+    0xD3: 2,
+    0xD4: 3,
+    0xD5: 2,
+    0xD6: 2,
+    0xD7: 2,
+    0xD8: 2,
+    0xDB: 1,
+    0xDC: 5,
+    0xDD: 4,
+    0xDF: 1,
+    0xE0: 1,
+    0xE1: 1,
+    0xE2: 3,
+    0xE3: 1,
+    0xE4: 5,
+    0xE5: 4,
+    0xE7: 1,
+    0xE8: 1,
+    0xE9: 1,
+    0xEA: 3,
+    0xEC: 5,
+    0xED: 4,
+    0xEF: 1,
+    0xF0: 5,
+    0xF1: 4,
+    0xF2: 2,
+    0xF3: 3,
+    0xF6: 1,
+    0xF8: 2,
+}
+EVENT_REPEAT_PAUSE = 0x90
+EVENT_ADD_PAUSE = 0x91
+EVENT_PAUSE_8 = 0x92
+EVENT_PAUSE_16 = 0x93
+EVENT_PAUSE_24 = 0x94
+EVENT_PAUSE_UNTIL_RELEASE = 0x95
+EVENT_END_OF_TRACK = 0x98
+EVENT_LOOP_POINT = 0x99
+EVENT_SET_OCTAVE = 0xA0
+EVENT_ADD_OCTAVE = 0xA1
+EVENT_SET_TEMPO = 0xA4
+EVENT_SET_TEMPO_2 = 0xA5
+EVENT_SET_PROGRAM = 0xAC
+EVENT_SET_PITCH_BEND = 0xD7
+EVENT_SET_BEND_RANGE = 0xDB
+EVENT_SET_VOLUME = 0xE0
+EVENT_ADD_VOLUME = 0xE1
+EVENT_SET_EXPRESSION = 0xE3
+EVENT_SET_PAN = 0xE8
+EVENT_ADD_PAN = 0xE9
+
+
+def approximate_duration_tables() -> Tuple[List[int], List[int]]:
+    """Approximate MUSIC_DURATION_LOOKUP_TABLE_1 and _2, in milliseconds.
+
+    Both grow roughly exponentially, up to about 32 s and 262 s respectively.
+    """
+    table_1 = [max(i, round(0x7FFF ** (i / 127))) for i in range(128)]
+    table_2 = [max(i, round(0x3FFFF ** (i / 127))) for i in range(128)]
+    return table_1, table_2
+
+
+def load_duration_tables(dump_path: str, version: str) -> Tuple[List[int], List[int]]:
+    """Read MUSIC_DURATION_LOOKUP_TABLE_1 and _2 from a RAM dump."""
+    with RamDump(dump_path, load_layouts(version), load_data_symbols(version)) as dump:
+        return (
+            list(dump.symbol("MUSIC_DURATION_LOOKUP_TABLE_1")),
+            list(dump.symbol("MUSIC_DURATION_LOOKUP_TABLE_2")),
+        )
+
+
+class EnvelopeParameters(NamedTuple):
+    """Mirrors struct sound_envelope_parameters."""
+
+    use_envelope: int
+    slide_time_multiplier: int
+    field_0x2: int
+    field_0x4: int
+    attack_begin: int
+    attack_time: int
+    decay_time: int
+    sustain_level: int
+    hold_time: int
+    sustain_time: int
+    release_time: int
+    field_0xe: int
+
+    @staticmethod
+    def unpack(data: bytes) -> "EnvelopeParameters":
+        return EnvelopeParameters(*struct.unpack(ENVELOPE_PARAMETERS_FORMAT, data))
+
+
+class LfoSettings(NamedTuple):
+    """Mirrors struct dse_lfo_settings."""
+
+    field_0x0: int
+    type: int
+    output_type: int
+    lfo_waveform_index: int
+    amplitude: int
+    lfo_phase_change_msec: int
+    msec_until_lfo_started: int
+    lfo_envelope_len_msec: int
+    unused: int
+
+
+class SampleInfo(NamedTuple):
+    """An entry of a wavi chunk."""
+
+    id: int
+    fine_tune: int
+    coarse_tune: int
+    root_key: int
+    transpose: int
+    volume: int
+    pan: int
+    format: int
+    loop: bool
+    rate: int
+    # Offset of the sample data in the pcmd chunk
+    position: int
+    # Loop start and length, in 32-bit words
+    loop_start: int
+    loop_length: int
+    envelope: EnvelopeParameters
+
+
+class Split(NamedTuple):
+    low_key: int
+    high_key: int
+    low_velocity: int
+    high_velocity: int
+    sample_id: int
+    fine_tune: int
+    coarse_tune: int
+    root_key: int
+    transpose: int
+    volume: int
+    pan: int
+    envelope: EnvelopeParameters
+
+
+class Program(NamedTuple):
+    id: int
+    volume: int
+    pan: int
+    lfos: List[LfoSettings]
+    splits: List[Split]
+
+    def find_split(self, key: int, velocity: int) -> Optional[Split]:
+        for split in self.splits:
+            if (
+                split.low_key <= key <= split.high_key
+                and split.low_velocity <= velocity <= split.high_velocity
+            ):
+                return split
+        return None
+
+
+def read_chunks(data: bytes, offset: int) -> Dict[bytes, bytes]:
+    """Read the chunks of a DSE file, by label, starting at an offset."""
+    chunks = {}
+    while offset + CHUNK_HEADER_SIZE <= len(data):
+        label = data[offset : offset + 4]
+        (length,) = struct.unpack_from("<I", data, offset + 0xC)
+        start = offset + CHUNK_HEADER_SIZE
+        chunks[label] = data[start : start + length]
+        if label == b"eod ":
+            break
+        # Chunks are padded to 16 bytes
+        offset = (start + length + 15) & ~15
+    return chunks
+
+
+class Swd:
+    """The samples and programs of an SWD file."""
+
+    def __init__(self, data: bytes):
+        if data[:4] != b"swdl":
+            raise ValueError("not an SWD file")
+        self.name = data[0x20:0x30].split(b"\0")[0].decode("ascii", "replace")
+        nb_sample_slots, nb_program_slots = struct.unpack_from("<HH", data, 0x46)
+        chunks = read_chunks(data, SWD_HEADER_SIZE)
+        self.pcmd: Optional[bytes] = chunks.get(b"pcmd")
+        self.samples: Dict[int, SampleInfo] = {}
+        self.programs: Dict[int, Program] = {}
+
+        wavi = chunks.get(b"wavi", b"")
+        for (offset,) in struct.iter_unpack("<H", wavi[: 2 * nb_sample_slots]):
+            if offset == 0:
+                continue
+            fields = struct.unpack_from(SAMPLE_INFO_FORMAT, wavi, offset)
+            sample = SampleInfo(*fields[:-1], EnvelopeParameters.unpack(fields[-1]))
+            self.samples[sample.id] = sample
+
+        prgi = chunks.get(b"prgi", b"")
+        for (offset,) in struct.iter_unpack("<H", prgi[: 2 * nb_program_slots]):
+            if offset == 0:
+                continue
+            id_, nb_splits, volume, pan, nb_lfos = struct.unpack_from(
+                PROGRAM_HEADER_FORMAT, prgi, offset
+            )
+            offset += PROGRAM_HEADER_SIZE
+            lfos = [
+                LfoSettings(*struct.unpack_from(LFO_SETTINGS_FORMAT, prgi, o))
+                for o in range(offset, offset + nb_lfos * LFO_SETTINGS_SIZE, 16)
+            ]
+            # The LFOs are followed by a 16-byte delimiter
+            offset += nb_lfos * LFO_SETTINGS_SIZE + 16
+            splits = []
+            for o in range(offset, offset + nb_splits * SPLIT_SIZE, SPLIT_SIZE):
+                fields = struct.unpack_from(SPLIT_FORMAT, prgi, o)
+                splits.append(
+                    Split(*fields[:-1], EnvelopeParameters.unpack(fields[-1]))
+                )
+            self.programs[id_] = Program(id_, volume, pan, lfos, splits)
+
+
+class Smd:
+    """The tracks of an SMD file."""
+
+    class Track(NamedTuple):
+        track_id: int
+        channel: int
+        events: bytes
+
+    def __init__(self, data: bytes):
+        if data[:4] != b"smdl":
+            raise ValueError("not an SMD file")
+        self.name = data[0x20:0x30].split(b"\0")[0].decode("ascii", "replace")
+        song = SMD_HEADER_SIZE
+        if data[song : song + 4] != b"song":
+            raise ValueError("missing song chunk")
+        (self.ticks_per_quarter,) = struct.unpack_from("<H", data, song + 0x12)
+        self.tracks: List[Smd.Track] = []
+        offset = song + SONG_CHUNK_SIZE
+        while data[offset : offset + 4] == b"trk ":
+            (length,) = struct.unpack_from("<I", data, offset + 0xC)
+            start = offset + CHUNK_HEADER_SIZE
+            track_id, channel = data[start], data[start + 1]
+            self.tracks.append(
+                Smd.Track(
+                    track_id,
+                    channel,
+                    data[start + TRACK_PREAMBLE_SIZE : start + length],
+                )
+            )
+            # Tracks are padded to 4 bytes
+            offset = (start + length + 3) & ~3
+
+
+LOW_NIBBLES = bytes(b & 0xF for b in range(256))
+HIGH_NIBBLES = bytes(b >> 4 for b in range(256))
+
+
+def _adpcm_table() -> List[Tuple[int, int]]:
+    """(difference, next step index) for each step index and 4-bit delta."""
+    table = []
+    for index, step in enumerate(ADPCM_STEPS):
+        for delta in range(16):
+            difference = step >> 3
+            if delta & 4:
+                difference += step
+            if delta & 2:
+                difference += step >> 1
+            if delta & 1:
+                difference += step >> 2
+            if delta & 8:
+                difference = -difference
+            next_index = index + ADPCM_INDEX_CHANGES[delta & 7]
+            table.append((difference, min(ADPCM_MAX_STEP_INDEX, max(0, next_index))))
+    return table
+
+
+ADPCM_TABLE = _adpcm_table()
+
+
+def decode_adpcm(data: bytes, predictor: int, index: int) -> array:
+    """Decode NDS IMA ADPCM deltas, starting with the low nibble of each byte."""
+    deltas = bytearray(2 * len(data))
+    deltas[0::2] = data.translate(LOW_NIBBLES)
+    deltas[1::2] = data.translate(HIGH_NIBBLES)
+    pcm = array("h", bytes(2 * len(deltas)))
+    table = ADPCM_TABLE
+    index *= 16
+    for i, delta in enumerate(deltas):
+        difference, next_index = table[index + delta]
+        predictor += difference
+        if predictor > 0x7FFF:
+            predictor = 0x7FFF
+        elif predictor < -0x8000:
+            predictor = -0x8000
+        pcm[i] = predictor
+        index = 16 * next_index
+    return pcm
+
+
+class DecodedSample(NamedTuple):
+    """A sample decoded to 16-bit PCM, with its loop start in samples."""
+
+    info: SampleInfo
+    pcm: array
+    loop_start: int
+
+
+def _native_pcm(data: bytes) -> array:
+    """Convert little-endian 16-bit PCM to an array of samples."""
+    pcm = array("h", data)
+    if sys.byteorder == "big":
+        pcm.byteswap()
+    return pcm
+
+
+def decode_sample(info: SampleInfo, pcmd: bytes) -> Optional[DecodedSample]:
+    """Decode a sample of a pcmd chunk to 16-bit PCM.
+
+    Returns None for PSG samples, which aren't stored in the pcmd chunk.
+    """
+    size = 4 * (info.loop_start + info.loop_length)
+    data = pcmd[info.position : info.position + size]
+    loop_start = 4 * info.loop_start
+    if info.format == SAMPLE_FORMAT_PCM8:
+        # Signed 8-bit samples become the high bytes of 16-bit ones
+        pcm16 = bytearray(2 * len(data))
+        pcm16[1::2] = data
+        return DecodedSample(info, _native_pcm(pcm16), loop_start)
+    if info.format == SAMPLE_FORMAT_PCM16:
+        return DecodedSample(info, _native_pcm(data[: len(data) & ~1]), loop_start // 2)
+    if info.format == SAMPLE_FORMAT_ADPCM:
+        # NDS IMA ADPCM: an initial predictor and step index, then 4-bit deltas
+        predictor, index = struct.unpack_from("<hB", data)
+        pcm = decode_adpcm(
+            data[ADPCM_HEADER_SIZE:], predictor, min(index, ADPCM_MAX_STEP_INDEX)
+        )
+        return DecodedSample(info, pcm, max(0, 2 * (loop_start - ADPCM_HEADER_SIZE)))
+    return None
+
+
+class SampleBank:
+    """Samples of a song, decoded lazily and cached."""
+
+    def __init__(self, swd: Swd, bank: Optional[Swd]):
+        self.swd = swd
+        self.bank = bank
+        self.cache: Dict[int, Optional[DecodedSample]] = {}
+
+    def get(self, sample_id: int) -> Optional[DecodedSample]:
+        if sample_id not in self.cache:
+            decoded = None
+            info = self.swd.samples.get(sample_id)
+            pcmd = self.swd.pcmd
+            if pcmd is None and self.bank is not None:
+                pcmd = self.bank.pcmd
+                if info is None:
+                    info = self.bank.samples.get(sample_id)
+            if info is not None and pcmd is not None:
+                decoded = decode_sample(info, pcmd)
+            self.cache[sample_id] = decoded
+        return self.cache[sample_id]
+
+
+class EnvelopeState(enum.IntEnum):
+    STOPPED = 0
+    ATTACK = 1
+    HOLD = 2
+    DECAY = 3
+    SUSTAIN = 4
+    RELEASE = 5
+
+
+NEXT_ENVELOPE_STATE = {
+    EnvelopeState.ATTACK: EnvelopeState.HOLD,
+    EnvelopeState.HOLD: EnvelopeState.DECAY,
+    EnvelopeState.DECAY: EnvelopeState.SUSTAIN,
+    EnvelopeState.SUSTAIN: EnvelopeState.STOPPED,
+    EnvelopeState.RELEASE: EnvelopeState.STOPPED,
+}
+
+
+class Envelope:
+    """Mirrors struct sound_envelope, with times in samples.
+
+    ticks_left is None while the volume holds indefinitely.
+    """
+
+    __slots__ = (
+        "parameters",
+        "durations",
+        "current_volume",
+        "volume_delta",
+        "ticks_left",
+        "state",
+        "target_volume",
+    )
+
+    def __init__(
+        self, parameters: EnvelopeParameters, durations: Callable[[int, int], int]
+    ):
+        self.parameters = parameters
+        self.durations = durations
+        self.volume_delta = 0.0
+        self.ticks_left: Optional[int] = None
+        self.target_volume = MAX_VOLUME
+        if parameters.use_envelope:
+            self.current_volume = float(parameters.attack_begin)
+            self._enter(EnvelopeState.ATTACK)
+        else:
+            self.current_volume = float(MAX_VOLUME)
+            self.state = EnvelopeState.SUSTAIN
+
+    def _enter(self, state: EnvelopeState):
+        p = self.parameters
+        while True:
+            self.state = state
+            if state == EnvelopeState.STOPPED:
+                self.current_volume = 0.0
+                break
+            if state == EnvelopeState.SUSTAIN and p.sustain_time == SUSTAIN_FOREVER:
+                break
+            target, index = {
+                EnvelopeState.ATTACK: (MAX_VOLUME, p.attack_time),
+                EnvelopeState.HOLD: (MAX_VOLUME, p.hold_time),
+                EnvelopeState.DECAY: (p.sustain_level, p.decay_time),
+                EnvelopeState.SUSTAIN: (0, p.sustain_time),
+                EnvelopeState.RELEASE: (0, p.release_time),
+            }[state]
+            length = self.durations(index & 0x7F, p.slide_time_multiplier)
+            self.target_volume = target
+            if length > 0:
+                self.volume_delta = (target - self.current_volume) / length
+                self.ticks_left = length
+                return
+            self.current_volume = float(target)
+            state = NEXT_ENVELOPE_STATE[state]
+        self.volume_delta = 0.0
+        self.ticks_left = None
+
+    def release(self):
+        if self.state != EnvelopeState.STOPPED:
+            self._enter(EnvelopeState.RELEASE)
+
+    def advance(self, n: int) -> float:
+        """Advance by n samples, and return the mean volume over them."""
+        total = 0.0
+        remaining = n
+        while remaining:
+            if self.ticks_left is None:
+                total += self.current_volume * remaining
+                break
+            step = min(remaining, self.ticks_left)
+            total += step * (self.current_volume + self.volume_delta * step / 2)
+            self.current_volume += self.volume_delta * step
+            self.ticks_left -= step
+            remaining -= step
+            if self.ticks_left == 0:
+                self.current_volume = float(self.target_volume)
+                self._enter(NEXT_ENVELOPE_STATE[self.state])
+        return total / n
+
+
+class LfoOutput(enum.IntEnum):
+    NONE = 0
+    PITCH = 1
+    VOLUME = 2
+    PAN = 3
+
+
+def _half_square(phase: float, noise: float) -> float:
+    return 1.0 if phase < 0.5 else 0.0
+
+
+def _full_square(phase: float, noise: float) -> float:
+    return 1.0 if phase < 0.5 else -1.0
+
+
+def _half_triangle(phase: float, noise: float) -> float:
+    return 1.0 - abs(2 * phase - 1)
+
+
+def _full_triangle(phase: float, noise: float) -> float:
+    return 1.0 - abs(4 * phase - 2)
+
+
+def _saw(phase: float, noise: float) -> float:
+    return 2 * phase - 1
+
+
+def _reverse_saw(phase: float, noise: float) -> float:
+    return 1 - 2 * phase
+
+
+def _half_noise(phase: float, noise: float) -> float:
+    return (noise + 1) / 2
+
+
+def _full_noise(phase: float, noise: float) -> float:
+    return noise
+
+
+# Indexed like LFO_WAVEFORM_CALLBACKS; index 0 is SoundLfoWaveInvalidFunc
+LFO_WAVEFORMS: List[Optional[Callable[[float, float], float]]] = [
+    None,
+    _half_square,
+    _full_square,
+    _half_triangle,
+    _full_triangle,
+    _saw,
+    _reverse_saw,
+    _half_noise,
+    _full_noise,
+]
+# Output units per unit of LFO amplitude (guesses): cents of pitch, fractions
+# of full volume and pan steps
+LFO_PITCH_SCALE = 1 / 100
+LFO_VOLUME_SCALE = 1 / MAX_VOLUME
+LFO_PAN_SCALE = 1.0
+
+
+class Lfo:
+    """Mirrors struct dse_lfo, with times in samples."""
+
+    __slots__ = (
+        "output_type",
+        "waveform",
+        "amplitude",
+        "period",
+        "phase",
+        "noise",
+        "random",
+        "ticks_until_lfo_started",
+        "envelope_length",
+        "lfo_envelope_ticks_left",
+        "current_output",
+    )
+
+    def __init__(self, settings: LfoSettings, sample_rate: int, seed: int):
+        self.output_type = settings.output_type
+        waveform_index = settings.lfo_waveform_index
+        self.waveform = (
+            LFO_WAVEFORMS[waveform_index]
+            if waveform_index < len(LFO_WAVEFORMS)
+            else None
+        )
+        self.amplitude = settings.amplitude
+        self.period = max(1, settings.lfo_phase_change_msec * sample_rate // 1000)
+        self.phase = 0.0
+        self.random = random.Random(seed)
+        self.noise = self.random.uniform(-1, 1)
+        self.ticks_until_lfo_started = (
+            settings.msec_until_lfo_started * sample_rate // 1000
+        )
+        self.envelope_length = settings.lfo_envelope_len_msec * sample_rate // 1000
+        self.lfo_envelope_ticks_left = self.envelope_length
+        self.current_output = 0.0
+
+    @property
+    def active(self) -> bool:
+        return (
+            self.waveform is not None
+            and self.amplitude != 0
+            and self.output_type in (LfoOutput.PITCH, LfoOutput.VOLUME, LfoOutput.PAN)
+        )
+
+    def advance(self, n: int) -> float:
+        """Advance by n samples, and return the output at the end."""
+        assert self.waveform is not None
+        if self.ticks_until_lfo_started >= n:
+            self.ticks_until_lfo_started -= n
+            return 0.0
+        n -= self.ticks_until_lfo_started
+        self.ticks_until_lfo_started = 0
+        phase = self.phase + n / self.period
+        if int(2 * phase) != int(2 * self.phase):
+            self.noise = self.random.uniform(-1, 1)
+        self.phase = phase % 1.0
+        level = 1.0
+        if self.lfo_envelope_ticks_left > 0:
+            self.lfo_envelope_ticks_left = max(0, self.lfo_envelope_ticks_left - n)
+            level = 1 - self.lfo_envelope_ticks_left / self.envelope_length
+        self.current_output = (
+            self.waveform(self.phase, self.noise) * self.amplitude * level
+        )
+        return self.current_output
+
+
+class Track:
+    """Mirrors struct track_data, along with the track's channel state."""
+
+    __slots__ = (
+        "events",
+        "active",
+        "play_amount",
+        "event_delay",
+        "track_data_start",
+        "current_event",
+        "loop_point",
+        "octave",
+        "last_duration",
+        "last_pause",
+        "program",
+        "volume",
+        "expression",
+        "pan",
+        "bend",
+        "bend_range",
+        "last_release",
+    )
+
+    def __init__(self, events: bytes):
+        self.events = events
+        self.active = True
+        self.play_amount = 0
+        self.event_delay = 0
+        self.track_data_start = 0
+        self.current_event = 0
+        self.loop_point: Optional[int] = None
+        self.octave = DEFAULT_OCTAVE
+        self.last_duration = 0
+        self.last_pause = 0
+        self.program = 0
+        self.volume = MAX_VOLUME
+        self.expression = MAX_VOLUME
+        self.pan = CENTER_PAN
+        self.bend = 0
+        self.bend_range = DEFAULT_BEND_RANGE
+        # Tick at which the last note played on the track is released
+        self.last_release = 0
+
+
+class Voice:
+    """A note being played, resampled into blocks."""
+
+    __slots__ = (
+        "track",
+        "sample",
+        "position",
+        "finished",
+        "semitones",
+        "rate",
+        "step",
+        "gain",
+        "pan",
+        "release_tick",
+        "envelope",
+        "lfos",
+    )
+
+    def __init__(
+        self,
+        track: Track,
+        sample: DecodedSample,
+        semitones: float,
+        gain: float,
+        pan: int,
+        release_tick: int,
+        envelope: Envelope,
+        lfos: List[Lfo],
+    ):
+        self.track = track
+        self.sample = sample
+        self.position = 0
+        self.finished = False
+        self.semitones = semitones
+        self.rate = sample.info.rate
+        self.step = 0
+        self.gain = gain
+        self.pan = pan
+        self.release_tick = release_tick
+        self.envelope = envelope
+        self.lfos = lfos
+
+    def set_pitch(self, semitones: float, out_rate: int):
+        """Set the number of input samples per output sample, in fixed point."""
+        rate = self.rate * 2 ** (semitones / 12) / out_rate
+        self.step = max(1, round(rate * (1 << POSITION_BITS)))
+
+    def read(self, n: int) -> array:
+        """Resample the next n samples, padding with silence at the end."""
+        pcm = self.sample.pcm
+        end = len(pcm)
+        loop_start = self.sample.loop_start
+        loops = self.sample.info.loop and loop_start < end
+        step = self.step
+        block = array("h")
+        while len(block) < n and not self.finished:
+            index = self.position >> POSITION_BITS
+            if index >= end:
+                if loops:
+                    index = loop_start + (index - loop_start) % (end - loop_start)
+                    fraction = self.position & ((1 << POSITION_BITS) - 1)
+                    self.position = (index << POSITION_BITS) | fraction
+                else:
+                    self.finished = True
+                    break
+            # Output samples until the end of the sample (or the block)
+            count = min(
+                n - len(block), ((end << POSITION_BITS) - self.position - 1) // step + 1
+            )
+            positions = range(self.position, self.position + count * step, step)
+            indexes = map(operator.rshift, positions, repeat(POSITION_BITS))
+            block.extend(map(pcm.__getitem__, indexes))
+            self.position += count * step
+        if len(block) < n:
+            block.frombytes(bytes(2 * (n - len(block))))
+        return block
+
+    @property
+    def done(self) -> bool:
+        return self.envelope.state == EnvelopeState.STOPPED or self.finished
+
+
+def _accumulate(mix: Optional[List[int]], block: array, gain: int) -> List[int]:
+    """Add a block of samples, scaled by a fixed-point gain, to a mix."""
+    scaled = map(operator.mul, block, repeat(gain))
+    if mix is None:
+        return list(scaled)
+    return list(map(operator.add, mix, scaled))
+
+
+def _to_pcm(mix: List[int]) -> array:
+    """Scale a mix back to 16-bit samples, clipping them."""
+    samples = map(operator.rshift, mix, repeat(GAIN_BITS))
+    return array("h", map(min, map(max, samples, repeat(-0x8000)), repeat(0x7FFF)))
+
+
+class Sequencer:
+    """Plays the tracks of an SMD file with the programs of an SWD file."""
+
+    def __init__(
+        self,
+        smd: Smd,
+        swd: Swd,
+        samples: SampleBank,
+        sample_rate: int = DEFAULT_SAMPLE_RATE,
+        block_size: int = DEFAULT_BLOCK_SIZE,
+        loops: int = 1,
+        volume: int = 255,
+        duration_tables: Optional[Tuple[List[int], List[int]]] = None,
+    ):
+        """
+        Args:
+            smd (Smd): song
+            swd (Swd): programs of the song
+            samples (SampleBank): samples of the song
+            sample_rate (int): output sample rate
+            block_size (int): maximum number of samples between updates of the
+                envelopes, LFOs and mixing parameters
+            loops (int): number of times to play the looped part of tracks
+            volume (int): master volume, like audio_command::volume (0-255)
+            duration_tables (Optional[Tuple[List[int], List[int]]]):
+                MUSIC_DURATION_LOOKUP_TABLE_1 and _2
+        """
+        self.smd = smd
+        self.swd = swd
+        self.samples = samples
+        self.sample_rate = sample_rate
+        self.block_size = block_size
+        self.loops = loops
+        self.master_gain = volume / 255
+        self.tables = duration_tables or approximate_duration_tables()
+        self.tracks = [Track(track.events) for track in smd.tracks]
+        self.voices: List[Voice] = []
+        self.tick = 0
+        self.tempo = DEFAULT_TEMPO
+        self.nb_notes = 0
+
+    def durations(self, index: int, multiplier: int) -> int:
+        """Convert an envelope duration index to a number of samples."""
+        table_1, table_2 = self.tables
+        msec = table_1[index] * multiplier if multiplier else table_2[index]
+        return msec * self.sample_rate // 1000
+
+    @property
+    def samples_per_tick(self) -> float:
+        return self.sample_rate * 60 / (self.tempo * self.smd.ticks_per_quarter)
+
+    def note_on(self, track: Track, key: int, velocity: int, duration: int):
+        self.nb_notes += 1
+        track.last_release = self.tick + duration
+        program = self.swd.programs.get(track.program)
+        split = program.find_split(key, velocity) if program is not None else None
+        if program is None or split is None:
+            return
+        sample = self.samples.get(split.sample_id)
+        if sample is None:
+            return
+        envelope = (
+            split.envelope if split.envelope.use_envelope else sample.info.envelope
+        )
+        semitones = (
+            key
+            + split.transpose
+            - split.root_key
+            + split.coarse_tune
+            + split.fine_tune / 100
+        )
+        gain = (
+            velocity * program.volume * split.volume * sample.info.volume
+        ) / MAX_VOLUME**4
+        pan = program.pan + split.pan - CENTER_PAN
+        lfos = [
+            lfo
+            for i, settings in enumerate(program.lfos)
+            if (lfo := Lfo(settings, self.sample_rate, self.nb_notes * 4 + i)).active
+        ]
+        if len(self.voices) >= MAX_VOICES:
+            # Steal a released voice if possible, otherwise the oldest one
+            released = [
+                v for v in self.voices if v.envelope.state == EnvelopeState.RELEASE
+            ]
+            self.voices.remove(released[0] if released else self.voices[0])
+        self.voices.append(
+            Voice(
+                track,
+                sample,
+                semitones,
+                gain,
+                pan,
+                self.tick + duration,
+                Envelope(envelope, self.durations),
+                lfos,
+            )
+        )
+
+    def parse_event(self, track: Track):
+        """Parse and execute the next event of a track, like ParseDseEvent."""
+        events = track.events
+        pos = track.current_event
+        if pos >= len(events):
+            track.active = False
+            return
+        op = events[pos]
+        pos += 1
+        if op < 0x80:
+            # Note: key, octave change and number of bytes of duration
+            note = events[pos]
+            pos += 1
+            track.octave += ((note >> 4) & 3) - 2
+            nb_duration_bytes = note >> 6
+            if nb_duration_bytes:
+                track.last_duration = int.from_bytes(
+                    events[pos : pos + nb_duration_bytes], "big"
+                )
+                pos += nb_duration_bytes
+            track.current_event = pos
+            key = 12 * track.octave + (note & 0xF)
+            self.note_on(track, key, op, track.last_duration)
+            return
+        if op < 0x90:
+            track.last_pause = track.event_delay = PAUSE_LENGTHS[op - 0x80]
+            track.current_event = pos
+            return
+        size = EVENT_PARAMETER_SIZES.get(op, 0)
+        params = events[pos : pos + size]
+        pos += size
+        track.current_event = pos
+        if op == EVENT_REPEAT_PAUSE:
+            track.event_delay = track.last_pause
+        elif op == EVENT_ADD_PAUSE:
+            track.last_pause = track.event_delay = track.last_pause + params[0]
+        elif op in (EVENT_PAUSE_8, EVENT_PAUSE_16, EVENT_PAUSE_24):
+            track.last_pause = track.event_delay = int.from_bytes(params, "little")
+        elif op == EVENT_PAUSE_UNTIL_RELEASE:
+            track.event_delay = max(0, track.last_release - self.tick)
+        elif op == EVENT_END_OF_TRACK:
+            track.play_amount += 1
+            if track.loop_point is not None and track.play_amount < self.loops:
+                track.current_event = track.loop_point
+            else:
+                track.active = False
+        elif op == EVENT_LOOP_POINT:
+            track.loop_point = pos
+        elif op == EVENT_SET_OCTAVE:
+            track.octave = params[0]
+        elif op == EVENT_ADD_OCTAVE:
+            track.octave += struct.unpack("b", params)[0]
+        elif op in (EVENT_SET_TEMPO, EVENT_SET_TEMPO_2):
+            self.tempo = params[0] or DEFAULT_TEMPO
+        elif op == EVENT_SET_PROGRAM:
+            track.program = params[0]
+        elif op == EVENT_SET_PITCH_BEND:
+            (track.bend,) = struct.unpack(">h", params)
+        elif op == EVENT_SET_BEND_RANGE:
+            track.bend_range = params[0]
+        elif op == EVENT_SET_VOLUME:
+            track.volume = params[0] & 0x7F
+        elif op == EVENT_ADD_VOLUME:
+            track.volume = min(
+                MAX_VOLUME, max(0, track.volume + struct.unpack("b", params)[0])
+            )
+        elif op == EVENT_SET_EXPRESSION:
+            track.expression = params[0] & 0x7F
+        elif op == EVENT_SET_PAN:
+            track.pan = params[0] & 0x7F
+        elif op == EVENT_ADD_PAN:
+            track.pan = min(
+                MAX_VOLUME, max(0, track.pan + struct.unpack("b", params)[0])
+            )
+
+    def mix(self, n: int) -> bytes:
+        """Mix the next n samples of all voices, as 16-bit stereo PCM."""
+        left_mix: Optional[List[int]] = None
+        right_mix: Optional[List[int]] = None
+        finished = []
+        for voice in self.voices:
+            level = voice.envelope.advance(n) / MAX_VOLUME
+            track = voice.track
+            semitones = voice.semitones + track.bend * track.bend_range / 8192
+            gain = (
+                voice.gain * level * track.volume * track.expression / MAX_VOLUME**2
+            )
+            pan = voice.pan + track.pan - CENTER_PAN
+            for lfo in voice.lfos:
+                output = lfo.advance(n)
+                if lfo.output_type == LfoOutput.PITCH:
+                    semitones += output * LFO_PITCH_SCALE
+                elif lfo.output_type == LfoOutput.VOLUME:
+                    gain *= max(0.0, 1 + output * LFO_VOLUME_SCALE)
+                else:
+                    pan += round(output * LFO_PAN_SCALE)
+            voice.set_pitch(semitones, self.sample_rate)
+            block = voice.read(n)
+            if voice.done:
+                finished.append(voice)
+            if gain <= 0:
+                continue
+            pan = min(MAX_VOLUME, max(0, pan))
+            gain *= self.master_gain * (1 << GAIN_BITS)
+            left = round(min(1.0, (MAX_VOLUME - pan) / CENTER_PAN) * gain)
+            right = round(min(1.0, pan / CENTER_PAN) * gain)
+            left_mix = _accumulate(left_mix, block, left)
+            right_mix = _accumulate(right_mix, block, right)
+        for voice in finished:
+            self.voices.remove(voice)
+        stereo = array("h", bytes(4 * n))
+        if left_mix is not None:
+            stereo[0::2] = _to_pcm(left_mix)
+        if right_mix is not None:
+            stereo[1::2] = _to_pcm(right_mix)
+        if sys.byteorder == "big":
+            stereo.byteswap()
+        return stereo.tobytes()
+
+    def render_samples(self, n: int, output: List[bytes]):
+        while n > 0:
+            block = min(n, self.block_size)
+            output.append(self.mix(block))
+            n -= block
+
+    def render(self, max_seconds: float = 600, tail_seconds: float = 2) -> bytes:
+        """Render the song to 16-bit stereo PCM.
+
+        Args:
+            max_seconds (float): maximum length of the song, before the tail
+            tail_seconds (float): maximum length of the tail, after the tracks
+                ended and the remaining voices were released
+
+        Returns:
+            bytes: PCM data
+        """
+        output: List[bytes] = []
+        max_samples = int(max_seconds * self.sample_rate)
+        nb_samples = 0
+        fraction = 0.0
+        while nb_samples < max_samples:
+            for track in self.tracks:
+                while track.active and track.event_delay == 0:
+                    self.parse_event(track)
+            for voice in self.voices:
+                if voice.release_tick == self.tick:
+                    voice.envelope.release()
+            active = [track.event_delay for track in self.tracks if track.active]
+            if not active:
+                break
+            pending = [
+                voice.release_tick - self.tick
+                for voice in self.voices
+                if voice.release_tick > self.tick
+            ]
+            step = min(active + pending)
+            fraction += step * self.samples_per_tick
+            n = min(int(fraction), max_samples - nb_samples)
+            fraction -= n
+            self.render_samples(n, output)
+            nb_samples += n
+            self.tick += step
+            for track in self.tracks:
+                if track.active:
+                    track.event_delay -= step
+        for voice in self.voices:
+            voice.envelope.release()
+        tail = int(tail_seconds * self.sample_rate)
+        while self.voices and tail > 0:
+            n = min(tail, self.block_size)
+            output.append(self.mix(n))
+            tail -= n
+        return b"".join(output)
+
+
+def load_song(
+    smd_path: Union[str, os.PathLike],
+    swd_path: Optional[Union[str, os.PathLike]] = None,
+    bank_path: Optional[Union[str, os.PathLike]] = None,
+) -> Tuple[Smd, Swd, SampleBank]:
+    """Load a song, its SWD (by default, next to the SMD with the same name),
+    and the sample bank (by default, bgm.swd in the same directory)."""
+    smd_path = Path(smd_path)
+    swd_path = Path(swd_path) if swd_path else smd_path.with_suffix(".swd")
+    if bank_path is None and (smd_path.parent / BANK_FILENAME).exists():
+        bank_path = smd_path.parent / BANK_FILENAME
+    smd = Smd(smd_path.read_bytes())
+    swd = Swd(swd_path.read_bytes())
+    bank = Swd(Path(bank_path).read_bytes()) if bank_path else None
+    return smd, swd, SampleBank(swd, bank)
+
+
+def write_wav(path: Union[str, os.PathLike], pcm: bytes, sample_rate: int):
+    with wave.open(str(path), "wb") as f:
+        f.setnchannels(2)
+        f.setsampwidth(2)
+        f.setframerate(sample_rate)
+        f.writeframes(pcm)
+
+
+def pcm_hash(pcm: bytes) -> str:
+    return hashlib.blake2b(pcm, digest_size=16).hexdigest()
+
+
+class RenderSettings(NamedTuple):
+    sample_rate: int = DEFAULT_SAMPLE_RATE
+    block_size: int = DEFAULT_BLOCK_SIZE
+    loops: int = 1
+    volume: int = 255
+    max_seconds: float = 600
+    duration_tables: Optional[Tuple[List[int], List[int]]] = None
+
+
+class RenderResult(NamedTuple):
+    name: str
+    seconds: float
+    render_seconds: float
+    hash: str
+
+
+def _setup_renderer(
+    bank_path: Optional[str], settings: RenderSettings
+) -> Tuple[Optional[Swd], RenderSettings]:
+    return Swd(Path(bank_path).read_bytes()) if bank_path else None, settings
+
+
+def _render_task(task: Tuple[str, Optional[str]]) -> RenderResult:
+    smd_path, output_path = task
+    bank, settings = worker_state()
+    start = time.perf_counter()
+    smd = Smd(Path(smd_path).read_bytes())
+    swd = Swd(Path(smd_path).with_suffix(".swd").read_bytes())
+    sequencer = Sequencer(
+        smd,
+        swd,
+        SampleBank(swd, bank),
+        settings.sample_rate,
+        settings.block_size,
+        settings.loops,
+        settings.volume,
+        settings.duration_tables,
+    )
+    pcm = sequencer.render(settings.max_seconds)
+    elapsed = time.perf_counter() - start
+    if output_path is not None:
+        write_wav(output_path, pcm, settings.sample_rate)
+    return RenderResult(
+        Path(smd_path).stem,
+        len(pcm) / 4 / settings.sample_rate,
+        elapsed,
+        pcm_hash(pcm),
+    )
+
+
+def render_all(
+    directory: Union[str, os.PathLike],
+    settings: RenderSettings,
+    output_dir: Optional[Union[str, os.PathLike]] = None,
+    jobs: Optional[int] = None,
+) -> List[RenderResult]:
+    """Render every SMD file of a directory that has a matching SWD file, in
+    parallel, with the directory's bgm.swd as the sample bank."""
+    directory = Path(directory)
+    bank_path = directory / BANK_FILENAME
+    tasks = []
+    for smd_path in sorted(directory.glob("*.smd")):
+        if not smd_path.with_suffix(".swd").exists():
+            continue
+        output_path = (
+            str(Path(output_dir) / f"{smd_path.stem}.wav") if output_dir else None
+        )
+        tasks.append((str(smd_path), output_path))
+    if output_dir:
+        os.makedirs(output_dir, exist_ok=True)
+    with WorkerPool(
+        jobs,
+        _setup_renderer,
+        (str(bank_path) if bank_path.exists() else None, settings),
+    ) as executor:
+        return list(executor.map(_render_task, tasks))
+
+
+def print_info(smd: Smd, swd: Swd):
+    """Print a summary of the tracks of a song, on their first pass."""
+    print(
+        f"{smd.name}: {len(smd.tracks)} tracks,"
+        + f" {smd.ticks_per_quarter} ticks per quarter note"
+    )
+    sequencer = Sequencer(smd, swd, SampleBank(swd, None))
+    for smd_track, track in zip(smd.tracks, sequencer.tracks):
+        programs = set()
+        nb_notes = ticks = 0
+        while track.active and not track.play_amount:
+            if (
+                track.current_event < len(track.events)
+                and track.events[track.current_event] < 0x80
+            ):
+                programs.add(track.program)
+                nb_notes += 1
+            sequencer.parse_event(track)
+            ticks += track.event_delay
+            track.event_delay = 0
+        loop = "looped" if track.loop_point is not None else "not looped"
+        print(
+            f"  track {smd_track.track_id:2} (channel {smd_track.channel:2}):"
+            + f" {nb_notes} notes over {ticks} ticks, {loop},"
+            + f" programs {sorted(programs)}"
+        )
+    print(f"{swd.name}: {len(swd.programs)} programs, {len(swd.samples)} samples")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Render DSE sequences to PCM")
+    parser.add_argument(
+        "--rate", type=int, default=DEFAULT_SAMPLE_RATE, help="output sample rate"
+    )
+    parser.add_argument(
+        "--block-size",
+        type=int,
+        default=DEFAULT_BLOCK_SIZE,
+        help="samples per envelope, LFO and mixing update",
+    )
+    parser.add_argument(
+        "--loops",
+        type=int,
+        default=1,
+        help="number of times to play the looped part of tracks",
+    )
+    parser.add_argument(
+        "--volume", type=int, default=255, help="master volume (0-255)"
+    )
+    parser.add_argument(
+        "--max-seconds",
+        type=float,
+        default=600,
+        help="maximum length of a song, in seconds",
+    )
+    parser.add_argument(
+        "--tables",
+        help="RAM dump to read the envelope duration tables from",
+    )
+    parser.add_argument(
+        "-v",
+        "--version",
+        choices=VERSIONS,
+        default="NA",
+        help="game version of the RAM dump",
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    info_parser = subparsers.add_parser("info", help="summarize a song")
+    info_parser.add_argument("smd", help="SMD file")
+    info_parser.add_argument("--swd", help="SWD file (defaults to the SMD's name)")
+
+    render_parser = subparsers.add_parser("render", help="render a song to a WAV")
+    render_parser.add_argument("smd", help="SMD file")
+    render_parser.add_argument("--swd", help="SWD file (defaults to the SMD's name)")
+    render_parser.add_argument(
+        "--bank", help="sample bank (defaults to bgm.swd next to the SMD)"
+    )
+    render_parser.add_argument("-o", "--output", required=True, help="output WAV")
+
+    all_parser = subparsers.add_parser(
+        "render-all", help="render every song of a directory"
+    )
+    all_parser.add_argument("directory", help="directory of SMD and SWD files")
+    all_parser.add_argument("-o", "--output", help="output directory for WAVs")
+    all_parser.add_argument(
+        "--hashes",
+        help="JSON file of the hash of each song to compare against",
+    )
+    all_parser.add_argument(
+        "--update-hashes",
+        action="store_true",
+        help="write the hashes instead of comparing against them",
+    )
+    add_jobs_argument(all_parser)
+    args = parser.parse_args()
+
+    tables = load_duration_tables(args.tables, args.version) if args.tables else None
+    settings = RenderSettings(
+        args.rate, args.block_size, args.loops, args.volume, args.max_seconds, tables
+    )
+    if args.command == "info":
+        smd, swd, _ = load_song(args.smd, args.swd)
+        print_info(smd, swd)
+    elif args.command == "render":
+        smd, swd, samples = load_song(args.smd, args.swd, args.bank)
+        start = time.perf_counter()
+        pcm = Sequencer(
+            smd,
+            swd,
+            samples,
+            settings.sample_rate,
+            settings.block_size,
+            settings.loops,
+            settings.volume,
+            settings.duration_tables,
+        ).render(settings.max_seconds)
+        elapsed = time.perf_counter() - start
+        write_wav(args.output, pcm, settings.sample_rate)
+        seconds = len(pcm) / 4 / settings.sample_rate
+        print(
+            f"Rendered {seconds:.1f} s in {elapsed:.2f} s"
+            + f" ({seconds / elapsed:.1f}x real time), hash {pcm_hash(pcm)}"
+        )
+    elif args.command == "render-all":
+        start = time.perf_counter()
+        results = render_all(args.directory, settings, args.output, args.jobs)
+        elapsed = time.perf_counter() - start
+        expected: Dict[str, str] = {}
+        if args.hashes and not args.update_hashes and os.path.exists(args.hashes):
+            with open(args.hashes) as f:
+                expected = json.load(f)
+        mismatches = 0
+        for result in results:
+            status = ""
+            if result.name in expected:
+                if expected[result.name] == result.hash:
+                    status = " ok"
+                else:
+                    status = " MISMATCH"
+                    mismatches += 1
+            print(
+                f"{result.name}: {result.seconds:.1f} s in"
+                + f" {result.render_seconds:.2f} s, {result.hash}{status}"
+            )
+        total = sum(result.seconds for result in results)
+        print(
+            f"Rendered {len(results)} songs ({total:.1f} s) in {elapsed:.2f} s"
+            + f" ({total / elapsed:.1f}x real time)"
+        )
+        if args.hashes and args.update_hashes:
+            with open(args.hashes, "w") as f:
+                json.dump({r.name: r.hash for r in results}, f, indent=2)
+        if mismatches:
+            print(f"{mismatches} songs don't match their expected hash")
+            sys.exit(1)
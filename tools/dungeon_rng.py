@@ -0,0 +1,546 @@
+#!/usr/bin/env python3
+
+"""
+`dungeon_rng.py` is a library and command line utility that reimplements the
+EoS dungeon PRNG on the host, for RNG manipulation research.
+
+The dungeon PRNG is described in the overlay 29 symbol tables (see
+DungeonRand16Bit, GenerateDungeonRngSeed, InitDungeonRng and the related
+functions). It consists of a primary LCG and 5 secondary LCGs, all with
+modulus 2^32 and multiplier 1566083941. The primary LCG has increment 1 and
+yields the upper 16 bits of each value, and the secondary LCGs have increment
+2531011 and yield the lower 16 bits. `DungeonPrng` models the global PRNG state
+(`struct prng_state` plus the secondary LCG values) and the functions that
+operate on it, call for call.
+
+For seed searches, `SeedBatch` steps a large batch of independent LCG states
+at once. States are packed into 64-bit lanes of a single big integer, so that
+one multiply-add advances every lane (each 32x32-bit product fits within its
+lane and can't carry into the next one), and masks keep the lanes separate.
+This turns per-seed Python loops into a handful of bulk integer operations
+that run in C. Both `DungeonPrng` and `SeedBatch` support jumping ahead any
+number of steps in O(log n) time, by composing the LCG's affine map with
+itself by repeated squaring.
+
+The `verify` command checks the implementation against a trace of PRNG calls
+recorded from the real game (e.g., with an emulator script that logs the
+arguments and return values of the dungeon PRNG functions). Each trace line is
+one call, with integer arguments followed by the return value (if any):
+    init <seed>
+    preseed <preseed>
+    preseed23 <preseed23>
+    genseed <result>
+    rand16 <result>
+    randint <n> <result>
+    range <x> <y> <result>
+    outcome <percentage> <0|1>
+    rand100 <result>
+    primary
+    secondary <index>
+    unset_secondary
+Blank lines and lines starting with # are ignored.
+
+Example usage:
+
+python3 dungeon_rng.py sequence 0x1234567 -n 10
+python3 dungeon_rng.py sequence 0x1234567 -n 5 --skip 1000000 --randint 100
+python3 dungeon_rng.py search --randint 100 --observe 42 7 93
+python3 dungeon_rng.py search --preseeds --randint 4 --observe 1 3 0 2 2 1
+python3 dungeon_rng.py verify </path/to/trace.txt>
+"""
+
+import argparse
+from array import array
+import functools
+import re
+import sys
+import time
+from typing import Iterator, List, Optional, Tuple
+
+from worker_pool import WorkerPool, add_jobs_argument
+
+MASK32 = 0xFFFFFFFF
+# See DUNGEON_PRNG_LCG_MULTIPLIER and DUNGEON_PRNG_LCG_INCREMENT_SECONDARY
+LCG_MULTIPLIER = 1566083941
+LCG_INCREMENT_PRIMARY = 1
+LCG_INCREMENT_SECONDARY = 2531011
+NUM_SECONDARY_LCGS = 5
+
+
+def lcg_jump(n: int, increment: int) -> Tuple[int, int]:
+    """Compute the affine map that advances a dungeon LCG by n steps.
+
+    Args:
+        n (int): number of steps
+        increment (int): LCG increment
+
+    Returns:
+        Tuple[int, int]: (a, c) such that x_n = (a * x_0 + c) mod 2^32
+    """
+    # Compose x -> m*x + i with itself by repeated squaring
+    a, c = 1, 0
+    m, i = LCG_MULTIPLIER, increment
+    while n:
+        if n & 1:
+            a, c = (a * m) & MASK32, (c * m + i) & MASK32
+        m, i = (m * m) & MASK32, (i * m + i) & MASK32
+        n >>= 1
+    return a, c
+
+
+class DungeonPrng:
+    """
+    Host model of the global dungeon PRNG state and the functions that use it.
+
+    The attributes mirror `struct prng_state` (DUNGEON_PRNG_STATE) and
+    DUNGEON_PRNG_STATE_SECONDARY_VALUES, and the methods mirror the overlay 29
+    functions of the same names.
+    """
+
+    def __init__(self, seed: int = 1, preseed: int = 1):
+        self.preseed = preseed & MASK32
+        self.init(seed)
+
+    def init(self, seed: int):
+        """InitDungeonRng"""
+        seed &= MASK32
+        self.use_secondary = False
+        self.seq_num_primary = 0
+        self.last_value_primary = seed
+        self.idx_secondary = 0
+        self.secondary_values = [seed] * NUM_SECONDARY_LCGS
+
+    def set_preseed(self, preseed: int):
+        """SetDungeonRngPreseed"""
+        self.preseed = preseed & MASK32
+
+    def set_preseed_23bit(self, preseed23: int):
+        """SetDungeonRngPreseed23Bit"""
+        self.preseed = (preseed23 & 0xFFFFFF) | 1
+
+    def generate_seed(self) -> int:
+        """GenerateDungeonRngSeed"""
+        x1 = (LCG_MULTIPLIER * self.preseed + LCG_INCREMENT_PRIMARY) & MASK32
+        x2 = (LCG_MULTIPLIER * x1 + LCG_INCREMENT_PRIMARY) & MASK32
+        self.preseed = x1
+        return (x1 & 0xFF0000) | (x2 >> 16) | 1
+
+    def set_primary(self):
+        """DungeonRngSetPrimary"""
+        self.use_secondary = False
+
+    def set_secondary(self, i: int):
+        """DungeonRngSetSecondary"""
+        self.use_secondary = True
+        self.idx_secondary = i
+
+    def unset_secondary(self):
+        """DungeonRngUnsetSecondary"""
+        self.use_secondary = False
+        self.idx_secondary = 0
+
+    def rand16(self) -> int:
+        """DungeonRand16Bit"""
+        if self.use_secondary:
+            i = self.idx_secondary
+            x = self.secondary_values[i]
+            x = (LCG_MULTIPLIER * x + LCG_INCREMENT_SECONDARY) & MASK32
+            self.secondary_values[i] = x
+            return x & 0xFFFF
+        x = self.last_value_primary
+        x = (LCG_MULTIPLIER * x + LCG_INCREMENT_PRIMARY) & MASK32
+        self.last_value_primary = x
+        self.seq_num_primary = (self.seq_num_primary + 1) & MASK32
+        return x >> 16
+
+    def rand_int(self, n: int) -> int:
+        """DungeonRandInt"""
+        return ((self.rand16() * n) & MASK32) >> 16
+
+    def rand_range(self, x: int, y: int) -> int:
+        """DungeonRandRange"""
+        lo, hi = min(x, y), max(x, y)
+        return lo + self.rand_int((hi - lo) & MASK32)
+
+    def rand_outcome(self, percentage: int) -> bool:
+        """DungeonRandOutcome"""
+        return self.rand_int(100) < percentage
+
+    def rand100(self) -> int:
+        """DungeonRand100"""
+        return self.rand_int(100)
+
+    def skip(self, n: int):
+        """Advance the active LCG by n steps without generating values."""
+        if self.use_secondary:
+            a, c = lcg_jump(n, LCG_INCREMENT_SECONDARY)
+            i = self.idx_secondary
+            self.secondary_values[i] = (a * self.secondary_values[i] + c) & MASK32
+        else:
+            a, c = lcg_jump(n, LCG_INCREMENT_PRIMARY)
+            self.last_value_primary = (a * self.last_value_primary + c) & MASK32
+            self.seq_num_primary = (self.seq_num_primary + n) & MASK32
+
+
+class SeedBatch:
+    """
+    A batch of independent dungeon LCG states, stepped in bulk.
+
+    Each state occupies a 64-bit lane of one big integer. All lane values are
+    kept below 2^32 between operations, so that multiplying by a 32-bit
+    constant never carries from one lane into the next.
+    """
+
+    def __init__(self, packed: int, size: int, increment: int):
+        self.packed = packed
+        self.size = size
+        self.increment = increment
+        # 1 in every lane, for broadcasting constants
+        self.ones = int.from_bytes((b"\x01" + b"\x00" * 7) * size, "little")
+        self.mask32 = self.broadcast(MASK32)
+        self.mask16 = self.broadcast(0xFFFF)
+
+    @staticmethod
+    def from_values(
+        values: List[int], increment: int = LCG_INCREMENT_PRIMARY
+    ) -> "SeedBatch":
+        lanes = array("Q", values)
+        if sys.byteorder != "little":
+            lanes.byteswap()
+        packed = int.from_bytes(lanes.tobytes(), "little")
+        return SeedBatch(packed, len(values), increment)
+
+    @staticmethod
+    def from_range(
+        start: int, size: int, increment: int = LCG_INCREMENT_PRIMARY
+    ) -> "SeedBatch":
+        return SeedBatch.from_values(range(start, start + size), increment)
+
+    def broadcast(self, value: int) -> int:
+        """Replicate a value below 2^64 into every lane."""
+        return value * self.ones
+
+    def values(self) -> List[int]:
+        lanes = array("Q")
+        lanes.frombytes(self.packed.to_bytes(self.size * 8, "little"))
+        if sys.byteorder != "little":
+            lanes.byteswap()
+        return lanes.tolist()
+
+    def lane_values(self, indexes: List[int]) -> List[int]:
+        """Get the values of specific lanes."""
+        lanes = self.packed.to_bytes(self.size * 8, "little")
+        return [int.from_bytes(lanes[8 * i : 8 * i + 8], "little") for i in indexes]
+
+    def skip(self, n: int = 1):
+        """Advance every lane by n steps."""
+        a, c = lcg_jump(n, self.increment)
+        self.packed = (self.packed * a + self.broadcast(c)) & self.mask32
+
+    def rand16(self) -> int:
+        """Advance every lane by one step, and return the packed 16-bit outputs
+        (DungeonRand16Bit) of each lane's LCG."""
+        self.skip(1)
+        if self.increment == LCG_INCREMENT_PRIMARY:
+            return (self.packed >> 16) & self.mask16
+        return self.packed & self.mask16
+
+    def rand_int(self, n: int) -> int:
+        """Like rand16(), but return packed DungeonRandInt(n) outputs."""
+        return (((self.rand16() * n) & self.mask32) >> 16) & self.mask16
+
+    def nonzero(self, packed: int) -> int:
+        """Map each lane (below 2^32) to 1 if it's nonzero, or 0 otherwise."""
+        return ((packed + self.mask32) >> 32) & self.ones
+
+    def lanes_equal(self, packed: int, value: int) -> int:
+        """Map each lane to 0 if it's equal to value, or 1 otherwise."""
+        return self.nonzero(packed ^ self.broadcast(value))
+
+    def zero_lanes(self, flags: int) -> Iterator[int]:
+        """Iterate over the indexes of lanes that are 0 in a packed 0/1 value."""
+        # The low byte of each lane holds its flag
+        flag_bytes = flags.to_bytes(self.size * 8, "little")[::8]
+        i = flag_bytes.find(0)
+        while i >= 0:
+            yield i
+            i = flag_bytes.find(0, i + 1)
+
+
+def seeds_from_preseeds(preseeds: SeedBatch) -> SeedBatch:
+    """Apply GenerateDungeonRngSeed to a batch of preseeds."""
+    preseeds.skip(1)
+    x1 = preseeds.packed
+    preseeds.skip(1)
+    x2 = preseeds.packed
+    seeds = (
+        (x1 & preseeds.broadcast(0xFF0000))
+        | ((x2 >> 16) & preseeds.mask16)
+        | preseeds.ones
+    )
+    return SeedBatch(seeds, preseeds.size, LCG_INCREMENT_PRIMARY)
+
+
+def search_seeds(
+    start: int,
+    stop: int,
+    n: int,
+    observed: List[int],
+    skip: int = 0,
+    secondary: bool = False,
+    preseeds: bool = False,
+    batch_size: int = 1 << 20,
+) -> Iterator[int]:
+    """Search for seeds that produce a sequence of DungeonRandInt(n) outputs.
+
+    Args:
+        start (int): first candidate
+        stop (int): last candidate (exclusive)
+        n (int): DungeonRandInt argument
+        observed (List[int]): consecutive observed outputs
+        skip (int): number of PRNG calls before the first observation
+        secondary (bool): search secondary LCG seeds instead of primary
+        preseeds (bool): candidates are preseeds to GenerateDungeonRngSeed
+            rather than seeds
+        batch_size (int): number of candidates to step at once
+
+    Returns:
+        Iterator[int]: matching candidates
+    """
+    increment = LCG_INCREMENT_SECONDARY if secondary else LCG_INCREMENT_PRIMARY
+    for batch_start in range(start, stop, batch_size):
+        size = min(batch_size, stop - batch_start)
+        if preseeds:
+            lcgs = seeds_from_preseeds(SeedBatch.from_range(batch_start, size))
+            lcgs.increment = increment
+        else:
+            lcgs = SeedBatch.from_range(batch_start, size, increment)
+        if skip:
+            lcgs.skip(skip)
+        # Only about 1/n of the candidates survive the first observation, so
+        # the survivors are checked against the rest of the observations one
+        # at a time rather than stepping the whole batch again
+        first = lcgs.lanes_equal(lcgs.rand_int(n), observed[0])
+        matches = list(lcgs.zero_lanes(first))
+        for i, state in zip(matches, lcgs.lane_values(matches)):
+            prng = DungeonPrng(state)
+            if secondary:
+                prng.set_secondary(0)
+            if all(prng.rand_int(n) == value for value in observed[1:]):
+                yield batch_start + i
+
+
+def _search_chunk(chunk: Tuple[int, int], **kwargs) -> List[int]:
+    return list(search_seeds(chunk[0], chunk[1], **kwargs))
+
+
+def search_seeds_parallel(
+    start: int, stop: int, jobs: Optional[int] = None, **kwargs
+) -> Iterator[int]:
+    """Like search_seeds(), but split the candidates across processes.
+
+    Args:
+        start (int): first candidate
+        stop (int): last candidate (exclusive)
+        jobs (Optional[int]): number of processes (defaults to the CPU count)
+        **kwargs: remaining arguments to search_seeds()
+
+    Returns:
+        Iterator[int]: matching candidates, in order
+    """
+    chunk_size = 16 * kwargs.get("batch_size", 1 << 20)
+    chunks = [(s, min(s + chunk_size, stop)) for s in range(start, stop, chunk_size)]
+    if jobs == 1 or len(chunks) <= 1:
+        yield from search_seeds(start, stop, **kwargs)
+        return
+    with WorkerPool(jobs) as executor:
+        search_chunk = functools.partial(_search_chunk, **kwargs)
+        for matches in executor.map(search_chunk, chunks):
+            yield from matches
+
+
+class TraceMismatch(Exception):
+    pass
+
+
+def verify_trace(lines: Iterator[str]) -> int:
+    """Replay a trace of dungeon PRNG calls and check every return value.
+
+    Args:
+        lines (Iterator[str]): trace lines
+
+    Raises:
+        TraceMismatch: a return value differs from the model
+
+    Returns:
+        int: number of calls checked
+    """
+    prng = DungeonPrng()
+    calls = {
+        "init": (prng.init, 1, False),
+        "preseed": (prng.set_preseed, 1, False),
+        "preseed23": (prng.set_preseed_23bit, 1, False),
+        "genseed": (prng.generate_seed, 0, True),
+        "rand16": (prng.rand16, 0, True),
+        "randint": (prng.rand_int, 1, True),
+        "range": (prng.rand_range, 2, True),
+        "outcome": (prng.rand_outcome, 1, True),
+        "rand100": (prng.rand100, 0, True),
+        "primary": (prng.set_primary, 0, False),
+        "secondary": (prng.set_secondary, 1, False),
+        "unset_secondary": (prng.unset_secondary, 0, False),
+    }
+    checked = 0
+    for lineno, line in enumerate(lines, start=1):
+        tokens = line.split()
+        if not tokens or tokens[0].startswith("#"):
+            continue
+        if tokens[0] not in calls:
+            raise ValueError(f"line {lineno}: unknown call '{tokens[0]}'")
+        func, nargs, returns = calls[tokens[0]]
+        if len(tokens) != 1 + nargs + returns:
+            raise ValueError(f"line {lineno}: wrong number of values for {tokens[0]}")
+        args = [int(t, 0) for t in tokens[1 : 1 + nargs]]
+        result = func(*args)
+        if returns:
+            expected = int(tokens[-1], 0)
+            if int(result) != expected:
+                raise TraceMismatch(
+                    f"line {lineno}: {line.strip()}: expected {expected},"
+                    + f" got {int(result)}"
+                )
+            checked += 1
+    return checked
+
+
+def parse_int_range(s: str) -> Tuple[int, int]:
+    m = re.fullmatch(r"(\w+):(\w+)", s)
+    if not m:
+        raise argparse.ArgumentTypeError(f"invalid range '{s}' (expected START:STOP)")
+    return int(m.group(1), 0), int(m.group(2), 0)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Host reimplementation of the EoS dungeon PRNG"
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    sequence_parser = subparsers.add_parser(
+        "sequence", help="print the sequence of PRNG outputs for a seed"
+    )
+    sequence_parser.add_argument("seed", type=lambda x: int(x, 0), help="LCG seed")
+    sequence_parser.add_argument(
+        "-n", "--count", type=int, default=10, help="number of outputs"
+    )
+    sequence_parser.add_argument(
+        "--skip", type=int, default=0, help="number of outputs to skip first"
+    )
+    sequence_parser.add_argument(
+        "--randint",
+        type=int,
+        help="print DungeonRandInt(N) outputs instead of DungeonRand16Bit outputs",
+        metavar="N",
+    )
+    sequence_parser.add_argument(
+        "--secondary",
+        action="store_true",
+        help="use the secondary LCG rather than the primary LCG",
+    )
+
+    search_parser = subparsers.add_parser(
+        "search", help="search for seeds that produce observed DungeonRandInt outputs"
+    )
+    search_parser.add_argument(
+        "--randint",
+        type=int,
+        required=True,
+        help="DungeonRandInt argument for the observed outputs",
+        metavar="N",
+    )
+    search_parser.add_argument(
+        "--observe",
+        type=lambda x: int(x, 0),
+        nargs="+",
+        required=True,
+        help="consecutive observed outputs",
+    )
+    search_parser.add_argument(
+        "--skip",
+        type=int,
+        default=0,
+        help="number of PRNG calls before the first observation",
+    )
+    search_parser.add_argument(
+        "--range",
+        type=parse_int_range,
+        default=(0, 1 << 32),
+        help="candidate range START:STOP (default: all 32-bit values)",
+    )
+    search_parser.add_argument(
+        "--preseeds",
+        action="store_true",
+        help="search preseeds to GenerateDungeonRngSeed rather than seeds",
+    )
+    search_parser.add_argument(
+        "--secondary",
+        action="store_true",
+        help="search secondary LCG seeds rather than primary LCG seeds",
+    )
+    add_jobs_argument(search_parser)
+    search_parser.add_argument(
+        "--batch-size",
+        type=int,
+        default=1 << 20,
+        help="number of candidates to step at once",
+    )
+
+    verify_parser = subparsers.add_parser(
+        "verify", help="check the implementation against a trace from the game"
+    )
+    verify_parser.add_argument(
+        "trace",
+        type=argparse.FileType("r"),
+        help="trace file (or - for stdin)",
+    )
+    args = parser.parse_args()
+
+    if args.command == "sequence":
+        prng = DungeonPrng(args.seed)
+        if args.secondary:
+            prng.set_secondary(0)
+        prng.skip(args.skip)
+        for _ in range(args.count):
+            if args.randint is None:
+                print(f"0x{prng.rand16():04X}")
+            else:
+                print(prng.rand_int(args.randint))
+    elif args.command == "search":
+        start, stop = args.range
+        began = time.perf_counter()
+        found = 0
+        for candidate in search_seeds_parallel(
+            start,
+            stop,
+            args.jobs,
+            n=args.randint,
+            observed=args.observe,
+            skip=args.skip,
+            secondary=args.secondary,
+            preseeds=args.preseeds,
+            batch_size=args.batch_size,
+        ):
+            print(f"0x{candidate:08X}")
+            found += 1
+        elapsed = time.perf_counter() - began
+        print(
+            f"{found} match(es) among {stop - start} candidate(s) in {elapsed:.1f} s",
+            file=sys.stderr,
+        )
+    elif args.command == "verify":
+        try:
+            checked = verify_trace(args.trace)
+        except TraceMismatch as e:
+            print(f"Mismatch: {e}", file=sys.stderr)
+            sys.exit(1)
+        print(f"All {checked} return value(s) match")
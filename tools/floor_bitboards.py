@@ -0,0 +1,445 @@
+#!/usr/bin/env python3
+
+"""
+`floor_bitboards.py` is a library and command line utility for fast spatial
+queries over dungeon floors, such as reachability, walking distances and line
+of sight.
+
+In the game, a floor is an array of 56x32 `struct tile`s (20 bytes each) in the
+dungeon generation info, and questions like "which tiles can be reached from
+the stairs" walk that array tile by tile. Here, a floor is instead split into
+one bitboard per tile property (terrain type, room membership, stairs, ...).
+Each bitboard is a single 2048-bit integer holding 32 rows of 64 bits, one row
+per y coordinate, where bit x of row y is set if tile (x, y) has the property.
+The 56 columns of a row fit in a single 64-bit word, and the 8 spare bits at
+the end of each row are kept clear, so that shifting a whole bitboard by one
+bit moves every tile one column over, and shifting by 64 bits moves every tile
+one row over, without any tile wrapping into another row. Big integer
+operations run word by word in C, so every query step processes the whole
+floor at once, like a wide SIMD register:
+    - Flood fill grows a frontier by one step in every direction with a few
+      shifts, ANDs and ORs, so reachability takes one iteration per step of
+      walking distance rather than one per tile.
+    - Distance fields are the successive flood fill frontiers, so the tiles at
+      a given walking distance are a single bitboard.
+    - Line of sight is tested by ANDing a precomputed (and cached) bitboard of
+      the line between two tiles with a bitboard of sight-blocking tiles.
+
+Movement follows the usual dungeon rules: monsters can move in 8 directions,
+but can't cut corners diagonally around tiles they can't pass through (unless
+they can pass through walls), and which terrain types they can stand on depends
+on their mobility type (see `enum mobility_type` in the C headers and
+CannotStandOnTile in the overlay 29 symbol table).
+
+Floors can be built from the layout databases collected by
+`floor_layouts.py`, or from text renders of a floor in the same format that
+`floor_layouts.py show` prints.
+
+Example usage:
+
+python3 floor_bitboards.py floors.bin
+python3 floor_bitboards.py floors.bin -i 0 3 7 --mobility hovering
+python3 floor_bitboards.py floors.bin -i 0 --distances
+"""
+
+import argparse
+import functools
+from typing import Dict, Iterator, List, NamedTuple, Optional, Tuple
+
+from floor_layouts import (
+    FLOOR_HEIGHT,
+    FLOOR_WIDTH,
+    ROOM_CHAR,
+    SPAWN_CHAR,
+    STAIRS_CHAR,
+    TERRAIN_CHARS,
+    TILE_ROOM,
+    TILE_STAIRS,
+    TILE_TERRAIN_MASK,
+    FloorDatabase,
+    FloorLayout,
+)
+
+ROW_BITS = 64
+ROW_MASK = (1 << FLOOR_WIDTH) - 1
+# All tiles on the floor, with the spare bits of each row clear
+FULL = sum(ROW_MASK << (y * ROW_BITS) for y in range(FLOOR_HEIGHT))
+# Tiles that can be shifted one column over without leaving their row
+NOT_FIRST_COLUMN = FULL & ~sum(1 << (y * ROW_BITS) for y in range(FLOOR_HEIGHT))
+NOT_LAST_COLUMN = FULL & ~sum(
+    1 << (y * ROW_BITS + FLOOR_WIDTH - 1) for y in range(FLOOR_HEIGHT)
+)
+
+# Terrain types (see `enum terrain_type` in the C headers)
+TERRAIN_WALL = 0
+TERRAIN_NORMAL = 1
+TERRAIN_SECONDARY = 2
+TERRAIN_CHASM = 3
+
+# Terrain types each mobility type can stand on (see `enum mobility_type` in
+# the C headers). Secondary terrain is water or lava depending on the tileset,
+# which the floor layouts don't record, so water and lava mobility are treated
+# alike.
+MOBILITY_TERRAIN = {
+    "normal": (TERRAIN_NORMAL,),
+    "lava": (TERRAIN_NORMAL, TERRAIN_SECONDARY),
+    "water": (TERRAIN_NORMAL, TERRAIN_SECONDARY),
+    "hovering": (TERRAIN_NORMAL, TERRAIN_SECONDARY, TERRAIN_CHASM),
+    "intangible": (TERRAIN_WALL, TERRAIN_NORMAL, TERRAIN_SECONDARY, TERRAIN_CHASM),
+}
+
+# Characters for printing distance grids; longer distances are printed as "+"
+DISTANCE_CHARS = "0123456789abcdefghijklmnopqrstuvwxyz" + "+" * (
+    FLOOR_WIDTH * FLOOR_HEIGHT
+)
+
+# Lookup tables from tile nibbles to ASCII "0"/"1" for each property
+_NIBBLE_VALUES = range(16)
+
+
+def _bit_table(predicate) -> bytes:
+    return bytes(
+        [ord("1") if predicate(n) else ord("0") for n in _NIBBLE_VALUES]
+        + [ord("0")] * (256 - len(_NIBBLE_VALUES))
+    )
+
+
+_TERRAIN_TABLES = [
+    _bit_table(lambda n, t=t: n & TILE_TERRAIN_MASK == t) for t in range(4)
+]
+_ROOM_TABLE = _bit_table(lambda n: n & TILE_ROOM)
+_STAIRS_TABLE = _bit_table(lambda n: n & TILE_STAIRS)
+
+
+def bit(x: int, y: int) -> int:
+    """Bitboard with only tile (x, y) set."""
+    return 1 << (y * ROW_BITS + x)
+
+
+def is_set(board: int, x: int, y: int) -> bool:
+    return (board >> (y * ROW_BITS + x)) & 1 == 1
+
+
+def tiles(board: int) -> Iterator[Tuple[int, int]]:
+    """Iterate over the (x, y) coordinates of the tiles set in a bitboard."""
+    while board:
+        low = board & -board
+        y, x = divmod(low.bit_length() - 1, ROW_BITS)
+        yield x, y
+        board ^= low
+
+
+# Single-step shifts. Shifting east/west masks off the tiles that would cross a
+# row boundary, and shifting north/south drops the tiles that leave the floor.
+def east(board: int) -> int:
+    return (board & NOT_LAST_COLUMN) << 1
+
+
+def west(board: int) -> int:
+    return (board & NOT_FIRST_COLUMN) >> 1
+
+
+def south(board: int) -> int:
+    return (board << ROW_BITS) & FULL
+
+
+def north(board: int) -> int:
+    return board >> ROW_BITS
+
+
+def step(board: int, passable: int, corners: Optional[int] = None) -> int:
+    """Grow a set of tiles by one step of movement in all 8 directions.
+
+    Args:
+        board (int): tiles to step from
+        passable (int): tiles that can be stepped onto
+        corners (Optional[int]): tiles that can be cut around diagonally;
+            diagonal steps are only allowed if both orthogonally adjacent
+            tiles are in this set. Defaults to the passable tiles.
+
+    Returns:
+        int: tiles reachable within one step, including the original tiles
+    """
+    if corners is None:
+        corners = passable
+    e, w = east(board), west(board)
+    n, s = north(board), south(board)
+    # A diagonal step must pass by both orthogonal neighbors
+    ce, cw, cn, cs = e & corners, w & corners, n & corners, s & corners
+    diagonal = (
+        (north(ce) & east(cn))
+        | (south(ce) & east(cs))
+        | (north(cw) & west(cn))
+        | (south(cw) & west(cs))
+    )
+    return board | ((e | w | n | s | diagonal) & passable)
+
+
+def flood_fill(start: int, passable: int, corners: Optional[int] = None) -> int:
+    """Find all tiles reachable from a set of starting tiles.
+
+    Returns:
+        int: reachable tiles, including the starting tiles
+    """
+    reached = start
+    while True:
+        grown = step(reached, passable, corners)
+        if grown == reached:
+            return reached
+        reached = grown
+
+
+def distance_layers(
+    start: int,
+    passable: int,
+    corners: Optional[int] = None,
+    max_distance: Optional[int] = None,
+) -> List[int]:
+    """Compute the walking distance field from a set of starting tiles.
+
+    Returns:
+        List[int]: bitboards of the tiles at each walking distance, starting
+            with distance 0 (the starting tiles themselves)
+    """
+    layers = [start]
+    reached = start
+    while max_distance is None or len(layers) <= max_distance:
+        grown = step(layers[-1], passable, corners) | reached
+        frontier = grown & ~reached
+        if not frontier:
+            break
+        layers.append(frontier)
+        reached = grown
+    return layers
+
+
+def distance_grid(layers: List[int]) -> List[List[Optional[int]]]:
+    """Expand distance layers into a grid of distances, indexed [y][x].
+
+    Unreachable tiles have a distance of None.
+    """
+    grid: List[List[Optional[int]]] = [
+        [None] * FLOOR_WIDTH for _ in range(FLOOR_HEIGHT)
+    ]
+    for distance, layer in enumerate(layers):
+        for x, y in tiles(layer):
+            grid[y][x] = distance
+    return grid
+
+
+@functools.lru_cache(maxsize=65536)
+def line(x0: int, y0: int, x1: int, y1: int) -> int:
+    """Bitboard of the tiles strictly between two tiles on a Bresenham line."""
+    board = 0
+    dx, dy = abs(x1 - x0), -abs(y1 - y0)
+    sx, sy = (1 if x0 < x1 else -1), (1 if y0 < y1 else -1)
+    err = dx + dy
+    x, y = x0, y0
+    while True:
+        e2 = 2 * err
+        if e2 >= dy:
+            err += dy
+            x += sx
+        if e2 <= dx:
+            err += dx
+            y += sy
+        if (x, y) == (x1, y1):
+            return board
+        board |= bit(x, y)
+
+
+def line_of_sight(a: Tuple[int, int], b: Tuple[int, int], blockers: int) -> bool:
+    """Check whether no blocking tiles lie strictly between two tiles."""
+    if a == b:
+        return True
+    return not line(*a, *b) & blockers
+
+
+def visible_tiles(origin: Tuple[int, int], candidates: int, blockers: int) -> int:
+    """Find which of a set of candidate tiles are in line of sight of a tile."""
+    visible = 0
+    for target in tiles(candidates):
+        if line_of_sight(origin, target, blockers):
+            visible |= bit(*target)
+    return visible
+
+
+def _board_from_bits(rows: Iterator[bytes]) -> int:
+    # Each row is a string of ASCII "0"/"1" in column order, so it reads as a
+    # binary number once reversed
+    board = 0
+    for y, row in enumerate(rows):
+        board |= int(row[::-1], 2) << (y * ROW_BITS)
+    return board
+
+
+class FloorBitboards(NamedTuple):
+    """Per-property bitboards of a dungeon floor"""
+
+    # Indexed by terrain type
+    terrain: Tuple[int, int, int, int]
+    room: int
+    stairs: int
+    spawn: Optional[Tuple[int, int]]
+    stairs_pos: Optional[Tuple[int, int]]
+
+    @staticmethod
+    def from_layout(layout: FloorLayout) -> "FloorBitboards":
+        """Build bitboards from a floor layout collected by floor_layouts.py."""
+        rows = [
+            layout.tiles[y * FLOOR_WIDTH : (y + 1) * FLOOR_WIDTH]
+            for y in range(FLOOR_HEIGHT)
+        ]
+
+        def board(table: bytes) -> int:
+            return _board_from_bits(row.translate(table) for row in rows)
+
+        def position(pos: Tuple[int, int]) -> Optional[Tuple[int, int]]:
+            x, y = pos
+            return pos if 0 <= x < FLOOR_WIDTH and 0 <= y < FLOOR_HEIGHT else None
+
+        return FloorBitboards(
+            tuple(board(table) for table in _TERRAIN_TABLES),
+            board(_ROOM_TABLE),
+            board(_STAIRS_TABLE),
+            position(layout.spawn),
+            position(layout.stairs),
+        )
+
+    @staticmethod
+    def from_text(rows: List[str]) -> "FloorBitboards":
+        """Build bitboards from a text render of a floor.
+
+        The text uses the same characters as `floor_layouts.py show`. Rows
+        and columns missing from the text are filled with walls.
+        """
+        terrain = [0, 0, 0, 0]
+        room = stairs = 0
+        spawn = stairs_pos = None
+        chars = {c: t for t, c in TERRAIN_CHARS.items()}
+        for y in range(FLOOR_HEIGHT):
+            row = rows[y] if y < len(rows) else ""
+            for x in range(FLOOR_WIDTH):
+                c = row[x] if x < len(row) else TERRAIN_CHARS[TERRAIN_WALL]
+                b = bit(x, y)
+                if c in (ROOM_CHAR, STAIRS_CHAR, SPAWN_CHAR):
+                    terrain[TERRAIN_NORMAL] |= b
+                    if c == ROOM_CHAR:
+                        room |= b
+                    elif c == STAIRS_CHAR:
+                        stairs |= b
+                        stairs_pos = (x, y)
+                    else:
+                        spawn = (x, y)
+                elif c in chars:
+                    terrain[chars[c]] |= b
+                else:
+                    raise ValueError(f"unknown tile character '{c}' at ({x}, {y})")
+        return FloorBitboards(tuple(terrain), room, stairs, spawn, stairs_pos)
+
+    def passable(self, mobility: str = "normal") -> int:
+        """Tiles that a monster with the given mobility can stand on."""
+        board = 0
+        for t in MOBILITY_TERRAIN[mobility]:
+            board |= self.terrain[t]
+        return board
+
+    def corners(self, mobility: str = "normal") -> int:
+        """Tiles that a monster with the given mobility can cut corners around.
+
+        Only walls block diagonal movement, and not for monsters that can
+        pass through them.
+        """
+        if mobility == "intangible":
+            return FULL
+        return FULL & ~self.terrain[TERRAIN_WALL]
+
+    def reachable(self, start: Tuple[int, int], mobility: str = "normal") -> int:
+        """Tiles that can be reached on foot from a tile."""
+        return flood_fill(bit(*start), self.passable(mobility), self.corners(mobility))
+
+    def distances(
+        self,
+        start: Tuple[int, int],
+        mobility: str = "normal",
+        max_distance: Optional[int] = None,
+    ) -> List[int]:
+        """Walking distance layers from a tile (see distance_layers())."""
+        return distance_layers(
+            bit(*start), self.passable(mobility), self.corners(mobility), max_distance
+        )
+
+    def sight_blockers(self) -> int:
+        """Tiles that block line of sight (walls)."""
+        return self.terrain[TERRAIN_WALL]
+
+
+def floor_report(floor: FloorBitboards, mobility: str) -> Dict[str, Optional[int]]:
+    passable = floor.passable(mobility)
+    report: Dict[str, Optional[int]] = {
+        "passable": passable.bit_count(),
+        "reachable_from_stairs": None,
+        "unreachable": None,
+        "max_distance": None,
+        "spawn_to_stairs": None,
+    }
+    if floor.stairs_pos is not None:
+        layers = floor.distances(floor.stairs_pos, mobility)
+        reached = 0
+        for layer in layers:
+            reached |= layer
+        report["reachable_from_stairs"] = reached.bit_count()
+        report["unreachable"] = (passable & ~reached).bit_count()
+        report["max_distance"] = len(layers) - 1
+        if floor.spawn is not None:
+            spawn = bit(*floor.spawn)
+            report["spawn_to_stairs"] = next(
+                (d for d, layer in enumerate(layers) if layer & spawn), None
+            )
+    return report
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Reachability and distance queries over dungeon floors"
+    )
+    parser.add_argument(
+        "database", help="floor layout database collected by floor_layouts.py"
+    )
+    parser.add_argument(
+        "-i",
+        "--index",
+        type=int,
+        nargs="+",
+        help="record indexes to query (defaults to all records)",
+    )
+    parser.add_argument(
+        "-m",
+        "--mobility",
+        choices=list(MOBILITY_TERRAIN),
+        default="normal",
+        help="mobility type of the walking monster",
+    )
+    parser.add_argument(
+        "--distances",
+        action="store_true",
+        help="print the walking distance from the stairs to each tile",
+    )
+    args = parser.parse_args()
+
+    db = FloorDatabase(args.database)
+    indexes = args.index if args.index is not None else range(len(db))
+    for i in indexes:
+        floor = FloorBitboards.from_layout(db[i])
+        report = floor_report(floor, args.mobility)
+        print(
+            f"#{i}: "
+            + ", ".join(
+                f"{key.replace('_', ' ')} {'n/a' if value is None else value}"
+                for key, value in report.items()
+            )
+        )
+        if args.distances and floor.stairs_pos is not None:
+            grid = distance_grid(floor.distances(floor.stairs_pos, args.mobility))
+            for row in grid:
+                print("".join(" " if d is None else DISTANCE_CHARS[d] for d in row))
@@ -0,0 +1,1894 @@
+#!/usr/bin/env python3
+
+"""
+`floor_layouts.py` is a library and command line utility for generating
+dungeon floor layouts on the host from the floor properties and the dungeon
+PRNG state, over many seeds in parallel, into a compact bit-packed database,
+and for querying the generated layouts (e.g., for seed hunting and
+dungeon-balance analysis).
+
+The generator mirrors the layout stage of GenerateFloor in overlay 29: the
+grid-based layouts (GenerateStandardFloor for the large, medium and small
+layouts, and GenerateOuterRingFloor), the one-room Monster House fallback,
+and FinalizeJunctions, drawing from the dungeon PRNG (see `dungeon_rng.py`)
+in the same order as the game. Each step is a method named after the overlay
+29 function it models. The other layouts, full-floor fixed rooms, and the
+spawn stage that follows layout generation (stairs, items, traps, monsters
+and secondary terrain formations) aren't modeled. Layouts are retried when
+they end up without rooms, but the game also regenerates the floor when the
+spawn stage fails, which this tool can't predict.
+
+Each layout record holds the dungeon and floor, the floor layout type from the
+floor properties, the dungeon PRNG state the floor was generated from, the
+stairs and team spawn positions (-1 when unknown), and the full 56x32 tile
+grid. Each tile is packed into a 4-bit nibble:
+    - bits 0-1: terrain type (wall, normal, secondary, chasm)
+    - bit 2: whether the tile is part of a room
+    - bit 3: whether the tile has stairs
+so a whole floor takes 896 bytes. Records are fixed-size, so a database can be
+memory-mapped and indexed directly. The primary LCG state is recorded both as
+is and as the seed passed to InitDungeonRng during dungeon initialization,
+which is recovered by rewinding the primary LCG by seq_num_primary steps, so a
+record links a seed and a number of PRNG draws into the dungeon to the layout
+they produce.
+
+Seeds are generated in small chunks on a process pool. Chunks are queued and
+idle workers pick up the next pending chunk as soon as they finish, so all
+cores stay busy even though floors take different amounts of time to
+generate.
+
+The generator is checked against the game with pairs of main RAM dumps of a
+floor: one taken when GenerateFloor first calls ResetFloor (e.g., at an
+emulator breakpoint), for the floor properties and the PRNG state, and one
+taken once the floor is generated. The `check` command generates each floor
+and compares it against the tiles of the second dump (see `ramdump.py`), and
+the `extract` command collects the layouts the game generated into a database
+instead. Secondary terrain outside of rooms is ignored by the check, since it
+comes from the secondary terrain formations of the spawn stage.
+
+Example usage:
+
+python3 floor_layouts.py generate -o floors.bin --properties-dump pre1.bin \
+    --seeds 0:100000 --draws 1500
+python3 floor_layouts.py generate -o floors.bin --seeds 0x1000:0x2000 \
+    --properties 00060000000F000A0A050000020500000003000A000000000000000000000000
+python3 floor_layouts.py check pre1.bin post1.bin pre2.bin post2.bin
+python3 floor_layouts.py extract -o floors.bin pre1.bin post1.bin pre2.bin post2.bin
+python3 floor_layouts.py show floors.bin 0
+python3 floor_layouts.py stats floors.bin
+python3 floor_layouts.py find floors.bin --min-rooms 6 --max-stairs-distance 10
+python3 floor_layouts.py find floors.bin --seed 0x1234567
+"""
+
+import argparse
+from concurrent.futures import FIRST_COMPLETED, as_completed, wait
+import mmap
+from pathlib import Path
+import struct
+import sys
+from typing import (
+    Callable,
+    Dict,
+    Iterator,
+    List,
+    NamedTuple,
+    Optional,
+    Set,
+    Tuple,
+)
+
+from dungeon_rng import (
+    LCG_INCREMENT_PRIMARY,
+    MASK32,
+    DungeonPrng,
+    lcg_jump,
+    parse_int_range,
+)
+from ramdump import (
+    LAYOUTS_DIR,
+    VERSIONS,
+    LayoutDatabase,
+    RamDump,
+    load_data_symbols,
+    load_layouts,
+)
+from worker_pool import WorkerPool, add_jobs_argument, worker_state
+
+FLOOR_WIDTH = 56
+FLOOR_HEIGHT = 32
+NUM_TILES = FLOOR_WIDTH * FLOOR_HEIGHT
+
+MAGIC = b"PMDFLOOR"
+FORMAT_VERSION = 2
+# magic, format version, record size, record count
+HEADER_FORMAT = struct.Struct("<8sHHI")
+# source index, dungeon id, floor, layout, room count, PRNG seed,
+# PRNG last_value_primary, PRNG seq_num_primary, PRNG preseed, stairs x/y,
+# team spawn x/y
+RECORD_HEADER_FORMAT = struct.Struct("<IBBBBIIIIbbbb")
+RECORD_SIZE = RECORD_HEADER_FORMAT.size + NUM_TILES // 2
+
+# Tile nibble bits
+TILE_TERRAIN_MASK = 0x3
+TILE_ROOM = 0x4
+TILE_STAIRS = 0x8
+# Value of tile::room for tiles that aren't in a room, and for hallway anchors
+# during generation
+NO_ROOM = 0xFF
+ANCHOR_ROOM = 0xFE
+NO_POSITION = (-1, -1)
+
+TERRAIN_CHARS = {0: "#", 1: ".", 2: "~", 3: " "}
+ROOM_CHAR = ","
+STAIRS_CHAR = ">"
+SPAWN_CHAR = "@"
+
+# enum terrain_type
+TERRAIN_WALL = 0
+TERRAIN_NORMAL = 1
+TERRAIN_SECONDARY = 2
+
+# Tile flags tracked by the generator, from tile::terrain_flags
+FLAG_IMPASSABLE = 0x1
+FLAG_IN_KECLEON_SHOP = 0x2
+FLAG_IN_MONSTER_HOUSE = 0x4
+FLAG_JUNCTION = 0x8
+
+# enum floor_layout
+LAYOUT_LARGE = 0
+LAYOUT_SMALL = 1
+LAYOUT_ONE_ROOM_MONSTER_HOUSE = 2
+LAYOUT_OUTER_RING = 3
+LAYOUT_LARGE_0x8 = 8
+LAYOUT_MEDIUM = 11
+
+# enum floor_size
+FLOOR_SIZE_LARGE = 0
+FLOOR_SIZE_SMALL = 1
+FLOOR_SIZE_MEDIUM = 2
+
+# floor_properties::room_flags bits
+ROOM_FLAG_SECONDARY_STRUCTURES = 0x1
+ROOM_FLAG_IMPERFECTIONS = 0x4
+
+# See GenerateFloor
+MAX_LAYOUT_ATTEMPTS = 10
+# See IsNotFullFloorFixedRoom
+FIRST_NON_FULL_FIXED_ROOM = 0xA5
+# Bounds on AssignRooms
+MAX_GRID_CELLS = 256
+MAX_ROOMS = 36
+# Grid cell boundaries of GenerateOuterRingFloor
+OUTER_RING_GRID_X = [0, 6, 17, 28, 39, 50, 56]
+OUTER_RING_GRID_Y = [0, 7, 16, 25, 32]
+
+# Grid directions, counterclockwise, so that d ^ 2 is the opposite of d
+RIGHT, UP, LEFT, DOWN = range(4)
+DIRECTIONS = ((1, 0), (0, -1), (-1, 0), (0, 1))
+# Order of the is_connected_to_* flags in struct dungeon_grid_cell
+CONNECTION_ORDER = (UP, DOWN, LEFT, RIGHT)
+
+# layout, room_density, floor_connectivity, kecleon_shop_spawn_chance,
+# monster_house_spawn_chance, maze_room_chance, allow_dead_ends,
+# max_secondary_structures, room_flags, floor_number, fixed_room_id,
+# extra_hallways
+FLOOR_PROPERTIES_FORMAT = struct.Struct("<Bb3xBxBBBxBBB3xBBB12x")
+# Seed chunks per task, and tasks queued at once
+SEEDS_PER_TASK = 64
+MAX_PENDING_TASKS = 256
+
+
+class FloorLayout(NamedTuple):
+    source: int
+    dungeon: int
+    floor: int
+    layout: int
+    rooms: int
+    # Primary LCG state before generation, and the seed it was initialized with
+    prng_seed: int
+    prng_last_value: int
+    prng_seq_num: int
+    prng_preseed: int
+    stairs: Tuple[int, int]
+    spawn: Tuple[int, int]
+    # Tile nibbles in row-major order
+    tiles: bytes
+
+    def pack(self) -> bytes:
+        packed = bytes(
+            self.tiles[i] | (self.tiles[i + 1] << 4) for i in range(0, NUM_TILES, 2)
+        )
+        return (
+            RECORD_HEADER_FORMAT.pack(
+                self.source,
+                self.dungeon,
+                self.floor,
+                self.layout,
+                self.rooms,
+                self.prng_seed,
+                self.prng_last_value,
+                self.prng_seq_num,
+                self.prng_preseed,
+                *self.stairs,
+                *self.spawn,
+            )
+            + packed
+        )
+
+    @staticmethod
+    def unpack(record: bytes) -> "FloorLayout":
+        (
+            source,
+            dungeon,
+            floor,
+            layout,
+            rooms,
+            prng_seed,
+            prng_last_value,
+            prng_seq_num,
+            prng_preseed,
+            stairs_x,
+            stairs_y,
+            spawn_x,
+            spawn_y,
+        ) = RECORD_HEADER_FORMAT.unpack_from(record)
+        tiles = bytearray(NUM_TILES)
+        packed = record[RECORD_HEADER_FORMAT.size : RECORD_SIZE]
+        tiles[0::2] = bytes(b & 0xF for b in packed)
+        tiles[1::2] = bytes(b >> 4 for b in packed)
+        return FloorLayout(
+            source,
+            dungeon,
+            floor,
+            layout,
+            rooms,
+            prng_seed,
+            prng_last_value,
+            prng_seq_num,
+            prng_preseed,
+            (stairs_x, stairs_y),
+            (spawn_x, spawn_y),
+            bytes(tiles),
+        )
+
+    def render(self) -> List[str]:
+        rows = []
+        for y in range(FLOOR_HEIGHT):
+            row = []
+            for x in range(FLOOR_WIDTH):
+                tile = self.tiles[y * FLOOR_WIDTH + x]
+                if (x, y) == self.spawn:
+                    row.append(SPAWN_CHAR)
+                elif tile & TILE_STAIRS:
+                    row.append(STAIRS_CHAR)
+                elif tile & TILE_ROOM and tile & TILE_TERRAIN_MASK == 1:
+                    row.append(ROOM_CHAR)
+                else:
+                    row.append(TERRAIN_CHARS[tile & TILE_TERRAIN_MASK])
+            rows.append("".join(row))
+        return rows
+
+
+class FloorProperties(NamedTuple):
+    """The fields of `struct floor_properties` that the layout generator uses."""
+
+    layout: int
+    room_density: int
+    floor_connectivity: int
+    kecleon_shop_spawn_chance: int
+    monster_house_spawn_chance: int
+    maze_room_chance: int
+    allow_dead_ends: bool
+    max_secondary_structures: int
+    room_flags: int
+    floor_number: int
+    fixed_room_id: int
+    extra_hallways: int
+
+    @staticmethod
+    def unpack(raw: bytes) -> "FloorProperties":
+        """Unpack the 32 bytes of a struct floor_properties."""
+        (
+            layout,
+            room_density,
+            floor_connectivity,
+            kecleon_shop_spawn_chance,
+            monster_house_spawn_chance,
+            maze_room_chance,
+            allow_dead_ends,
+            max_secondary_structures,
+            room_flags,
+            floor_number,
+            fixed_room_id,
+            extra_hallways,
+        ) = FLOOR_PROPERTIES_FORMAT.unpack(raw)
+        return FloorProperties(
+            layout,
+            room_density,
+            floor_connectivity,
+            kecleon_shop_spawn_chance,
+            monster_house_spawn_chance,
+            maze_room_chance,
+            bool(allow_dead_ends),
+            max_secondary_structures,
+            room_flags,
+            floor_number,
+            fixed_room_id,
+            extra_hallways,
+        )
+
+
+class GridCell:
+    """Host model of `struct dungeon_grid_cell`.
+
+    The four is_connected_to_* and should_connect_to_* flags are kept in lists
+    indexed by direction (see DIRECTIONS).
+    """
+
+    __slots__ = (
+        "start_x",
+        "start_y",
+        "end_x",
+        "end_y",
+        "is_invalid",
+        "has_secondary_structure",
+        "is_room",
+        "is_connected",
+        "is_kecleon_shop",
+        "is_monster_house",
+        "is_maze_room",
+        "was_merged_into_other_room",
+        "is_merged_room",
+        "is_connected_to",
+        "should_connect_to",
+        "flag_imperfect",
+        "flag_secondary_structure",
+    )
+
+    def __init__(self, is_invalid: bool):
+        self.start_x = self.start_y = self.end_x = self.end_y = 0
+        self.is_invalid = is_invalid
+        self.has_secondary_structure = False
+        self.is_room = True
+        self.is_connected = False
+        self.is_kecleon_shop = False
+        self.is_monster_house = False
+        self.is_maze_room = False
+        self.was_merged_into_other_room = False
+        self.is_merged_room = False
+        self.is_connected_to = [False] * 4
+        self.should_connect_to = [False] * 4
+        self.flag_imperfect = False
+        self.flag_secondary_structure = False
+
+    def is_plain_room(self) -> bool:
+        """Whether this is a valid, connected room with no special features."""
+        return (
+            self.is_room
+            and self.is_connected
+            and not self.is_invalid
+            and not self.was_merged_into_other_room
+            and not self.is_merged_room
+            and not self.is_kecleon_shop
+            and not self.is_monster_house
+            and not self.is_maze_room
+            and not self.has_secondary_structure
+        )
+
+
+Grid = List[List[GridCell]]
+
+
+class FloorGenerator:
+    """
+    Host model of the floor layout generator in overlay 29.
+
+    The tile grid is kept as flat row-major arrays of terrain types, room
+    indexes and tile flags. The methods mirror the overlay 29 functions of the
+    same names, and draw from the dungeon PRNG in the same order.
+    """
+
+    def __init__(self, prng: DungeonPrng, properties: FloorProperties):
+        self.prng = prng
+        self.properties = properties
+        self.terrain = bytearray(NUM_TILES)
+        self.room = bytearray(NUM_TILES)
+        self.flags = bytearray(NUM_TILES)
+        self.reset_floor()
+
+    def reset_floor(self):
+        """ResetFloor, for the tiles and the floor generation status"""
+        props = self.properties
+        self.floor_size = FLOOR_SIZE_LARGE
+        self.n_rooms = props.room_density
+        self.kecleon_shop_spawn_chance = props.kecleon_shop_spawn_chance
+        self.monster_house_spawn_chance = props.monster_house_spawn_chance
+        self.secondary_structures_budget = (
+            props.max_secondary_structures
+            if props.room_flags & ROOM_FLAG_SECONDARY_STRUCTURES
+            else 0
+        )
+        self.has_monster_house = False
+        self.has_kecleon_shop = False
+        self.has_maze = False
+        self.terrain[:] = bytes(NUM_TILES)
+        self.room[:] = bytes([NO_ROOM]) * NUM_TILES
+        self.flags[:] = bytes(NUM_TILES)
+        for x in range(FLOOR_WIDTH):
+            self.flags[x] = self.flags[NUM_TILES - FLOOR_WIDTH + x] = FLAG_IMPASSABLE
+        for y in range(FLOOR_HEIGHT):
+            self.flags[y * FLOOR_WIDTH] = FLAG_IMPASSABLE
+            self.flags[y * FLOOR_WIDTH + FLOOR_WIDTH - 1] = FLAG_IMPASSABLE
+
+    def generate_floor(self):
+        """The layout stage of GenerateFloor
+
+        A layout is retried if it ends up without any rooms (e.g., when every
+        grid cell had to be removed for being unreachable), and the one-room
+        Monster House is generated after MAX_LAYOUT_ATTEMPTS failed attempts.
+
+        Raises:
+            ValueError: if the floor layout isn't supported
+        """
+        props = self.properties
+        if props.fixed_room_id and props.fixed_room_id < FIRST_NON_FULL_FIXED_ROOM:
+            raise ValueError(f"fixed room {props.fixed_room_id} isn't supported")
+        for _ in range(MAX_LAYOUT_ATTEMPTS):
+            self.reset_floor()
+            self.generate_layout()
+            if any(room < ANCHOR_ROOM for room in self.room):
+                break
+        else:
+            self.reset_floor()
+            self.generate_one_room_monster_house_floor()
+        self.finalize_junctions()
+        self.ensure_impassable_tiles_are_walls()
+
+    def generate_layout(self):
+        """Generate one layout attempt, dispatching on the floor layout."""
+        props = self.properties
+        if props.layout == LAYOUT_SMALL:
+            self.floor_size = FLOOR_SIZE_SMALL
+            self.generate_standard_floor(4, self.prng.rand_int(2) + 2)
+        elif props.layout == LAYOUT_MEDIUM:
+            self.floor_size = FLOOR_SIZE_MEDIUM
+            self.generate_standard_floor(4, self.prng.rand_int(2) + 2)
+        elif props.layout == LAYOUT_ONE_ROOM_MONSTER_HOUSE:
+            self.generate_one_room_monster_house_floor()
+        elif props.layout == LAYOUT_OUTER_RING:
+            self.generate_outer_ring_floor()
+        elif props.layout in (LAYOUT_LARGE, LAYOUT_LARGE_0x8):
+            for _ in range(32):
+                grid_size_x = self.prng.rand_range(2, 9)
+                grid_size_y = self.prng.rand_range(2, 9)
+                if grid_size_x <= 6 and grid_size_y <= 4:
+                    break
+            else:
+                grid_size_x, grid_size_y = 4, 4
+            if FLOOR_WIDTH // grid_size_x < 8:
+                grid_size_x = 1
+            if FLOOR_HEIGHT // grid_size_y < 8:
+                grid_size_y = 1
+            self.generate_standard_floor(grid_size_x, grid_size_y)
+        else:
+            raise ValueError(f"floor layout {props.layout} isn't supported")
+
+    def generate_standard_floor(self, grid_size_x: int, grid_size_y: int):
+        """GenerateStandardFloor"""
+        list_x, list_y = get_grid_positions(grid_size_x, grid_size_y)
+        grid = self.init_dungeon_grid(grid_size_x, grid_size_y)
+        self.assign_rooms(grid, grid_size_x, grid_size_y, self.n_rooms)
+        self.create_rooms_and_anchors(
+            grid, grid_size_x, grid_size_y, list_x, list_y, self.properties.room_flags
+        )
+        cursor_x = self.prng.rand_int(grid_size_x)
+        cursor_y = self.prng.rand_int(grid_size_y)
+        self.assign_grid_cell_connections(
+            grid, grid_size_x, grid_size_y, cursor_x, cursor_y
+        )
+        self.create_grid_cell_connections(
+            grid, grid_size_x, grid_size_y, list_x, list_y, False
+        )
+        self.ensure_connected_grid(grid, grid_size_x, grid_size_y, list_x, list_y)
+        self.generate_special_features(grid, grid_size_x, grid_size_y)
+
+    def generate_outer_ring_floor(self):
+        """GenerateOuterRingFloor"""
+        grid_size_x, grid_size_y = 6, 4
+        list_x, list_y = OUTER_RING_GRID_X, OUTER_RING_GRID_Y
+        grid = self.init_dungeon_grid(grid_size_x, grid_size_y)
+        for x in range(grid_size_x):
+            for y in range(grid_size_y):
+                grid[x][y].is_room = 0 < x < grid_size_x - 1 and 0 < y < grid_size_y - 1
+        self.create_rooms_and_anchors(
+            grid, grid_size_x, grid_size_y, list_x, list_y, self.properties.room_flags
+        )
+        # The outer ring of hallways
+        for x in range(grid_size_x - 1):
+            connect_cells(grid, x, 0, RIGHT)
+            connect_cells(grid, x, grid_size_y - 1, RIGHT)
+        for y in range(grid_size_y - 1):
+            connect_cells(grid, 0, y, DOWN)
+            connect_cells(grid, grid_size_x - 1, y, DOWN)
+        # Each room is connected to the part of the ring it borders
+        for x in range(1, grid_size_x - 1):
+            connect_cells(grid, x, 1, UP)
+            connect_cells(grid, x, grid_size_y - 2, DOWN)
+        for y in range(1, grid_size_y - 1):
+            connect_cells(grid, 1, y, LEFT)
+            connect_cells(grid, grid_size_x - 2, y, RIGHT)
+        self.create_grid_cell_connections(
+            grid, grid_size_x, grid_size_y, list_x, list_y, True
+        )
+        self.ensure_connected_grid(grid, grid_size_x, grid_size_y, list_x, list_y)
+        self.generate_special_features(grid, grid_size_x, grid_size_y)
+
+    def generate_one_room_monster_house_floor(self):
+        """GenerateOneRoomMonsterHouseFloor"""
+        cell = GridCell(False)
+        cell.start_x, cell.start_y = 2, 2
+        cell.end_x, cell.end_y = FLOOR_WIDTH - 2, FLOOR_HEIGHT - 2
+        self.fill_room(cell, 0)
+        self.set_room_flag(cell, FLAG_IN_MONSTER_HOUSE)
+        self.has_monster_house = True
+
+    def generate_special_features(self, grid: Grid, grid_size_x: int, grid_size_y: int):
+        """The special features shared by the grid-based layouts."""
+        self.generate_maze_room(
+            grid, grid_size_x, grid_size_y, self.properties.maze_room_chance
+        )
+        self.generate_kecleon_shop(
+            grid, grid_size_x, grid_size_y, self.kecleon_shop_spawn_chance
+        )
+        self.generate_monster_house(
+            grid, grid_size_x, grid_size_y, self.monster_house_spawn_chance
+        )
+        self.generate_extra_hallways(
+            grid, grid_size_x, grid_size_y, self.properties.extra_hallways
+        )
+        self.generate_room_imperfections(grid, grid_size_x, grid_size_y)
+        self.generate_secondary_structures(grid, grid_size_x, grid_size_y)
+
+    def init_dungeon_grid(self, grid_size_x: int, grid_size_y: int) -> Grid:
+        """InitDungeonGrid
+
+        Columns beyond the configured floor size are invalidated.
+        """
+        grid = []
+        for x in range(grid_size_x):
+            if self.floor_size == FLOOR_SIZE_SMALL:
+                is_invalid = x >= grid_size_x // 2
+            elif self.floor_size == FLOOR_SIZE_MEDIUM:
+                is_invalid = x >= grid_size_x * 3 // 4
+            else:
+                is_invalid = False
+            grid.append([GridCell(is_invalid) for _ in range(grid_size_y)])
+        return grid
+
+    def assign_rooms(self, grid: Grid, grid_size_x: int, grid_size_y: int, n: int):
+        """AssignRooms"""
+        n_rooms = -n if n < 0 else n + self.prng.rand_int(3)
+        n_cells = grid_size_x * grid_size_y
+        room_bits = [i < n_rooms for i in range(MAX_GRID_CELLS)]
+        for _ in range(64):
+            a = self.prng.rand_int(n_cells)
+            b = self.prng.rand_int(n_cells)
+            room_bits[a], room_bits[b] = room_bits[b], room_bits[a]
+        count = 0
+        i = 0
+        for x in range(grid_size_x):
+            for y in range(grid_size_y):
+                cell = grid[x][y]
+                if not cell.is_invalid:
+                    cell.is_room = room_bits[i] and count < MAX_ROOMS
+                    count += cell.is_room
+                i += 1
+        # Every floor gets at least 2 rooms
+        for _ in range(200):
+            if count >= 2:
+                break
+            for x in range(grid_size_x):
+                for y in range(grid_size_y):
+                    cell = grid[x][y]
+                    if count < 2 and not cell.is_invalid and not cell.is_room:
+                        if self.prng.rand_int(100) < 60:
+                            cell.is_room = True
+                            count += 1
+
+    def create_rooms_and_anchors(
+        self,
+        grid: Grid,
+        grid_size_x: int,
+        grid_size_y: int,
+        list_x: List[int],
+        list_y: List[int],
+        room_flags: int,
+    ):
+        """CreateRoomsAndAnchors"""
+        room_index = 0
+        for y in range(grid_size_y):
+            range_y = list_y[y + 1] - list_y[y] - 4
+            for x in range(grid_size_x):
+                range_x = list_x[x + 1] - list_x[x] - 4
+                cell = grid[x][y]
+                if cell.is_invalid:
+                    continue
+                if not cell.is_room:
+                    # A hallway anchor, with a 2-tile margin from the cell border
+                    cell.start_x = self.prng.rand_range(
+                        list_x[x] + 2, list_x[x + 1] - 2
+                    )
+                    cell.start_y = self.prng.rand_range(
+                        list_y[y] + 2, list_y[y + 1] - 2
+                    )
+                    cell.end_x, cell.end_y = cell.start_x + 1, cell.start_y + 1
+                    i = cell.start_y * FLOOR_WIDTH + cell.start_x
+                    self.terrain[i] = TERRAIN_NORMAL
+                    self.room[i] = ANCHOR_ROOM
+                    continue
+                size_x = self.prng.rand_range(5, range_x)
+                size_y = self.prng.rand_range(4, range_y)
+                # Prefer odd dimensions, which maze rooms need
+                if size_x | 1 < range_x:
+                    size_x |= 1
+                if size_y | 1 < range_y:
+                    size_y |= 1
+                # Limit the aspect ratio to 3:2
+                if size_x > size_y * 3 // 2:
+                    size_x = size_y * 3 // 2
+                if size_y > size_x * 3 // 2:
+                    size_y = size_x * 3 // 2
+                cell.start_x = self.prng.rand_int(range_x - size_x) + list_x[x] + 2
+                cell.end_x = cell.start_x + size_x
+                cell.start_y = self.prng.rand_int(range_y - size_y) + list_y[y] + 2
+                cell.end_y = cell.start_y + size_y
+                self.fill_room(cell, room_index)
+                cell.flag_imperfect = bool(room_flags & ROOM_FLAG_IMPERFECTIONS)
+                cell.flag_secondary_structure = True
+                room_index += 1
+
+    def assign_grid_cell_connections(
+        self,
+        grid: Grid,
+        grid_size_x: int,
+        grid_size_y: int,
+        cursor_x: int,
+        cursor_y: int,
+    ):
+        """AssignGridCellConnections"""
+        direction = self.prng.rand_int(4)
+        for _ in range(self.properties.floor_connectivity):
+            # Keep going the same way half of the time
+            if self.prng.rand_int(8) < 4:
+                direction = self.prng.rand_int(4)
+            # Turn counterclockwise away from the grid boundary. Invalid cells
+            # aren't avoided, their connections are dropped later.
+            for _ in range(4):
+                dx, dy = DIRECTIONS[direction]
+                x, y = cursor_x + dx, cursor_y + dy
+                if 0 <= x < grid_size_x and 0 <= y < grid_size_y:
+                    break
+                direction = (direction + 1) & 3
+            else:
+                return
+            connect_cells(grid, cursor_x, cursor_y, direction)
+            cursor_x, cursor_y = x, y
+
+        if self.properties.allow_dead_ends:
+            return
+        # Connect dead-end hallway anchors to another neighbor. The game checks
+        # the validity of the anchor's cell instead of the neighbor's here, so
+        # a dead end can be connected to an invalid cell.
+        found = True
+        while found:
+            found = False
+            for y in range(grid_size_y):
+                for x in range(grid_size_x):
+                    cell = grid[x][y]
+                    if cell.is_invalid or cell.is_room:
+                        continue
+                    if sum(cell.is_connected_to) != 1:
+                        continue
+                    direction = self.prng.rand_int(4)
+                    for _ in range(4):
+                        dx, dy = DIRECTIONS[direction]
+                        if (
+                            0 <= x + dx < grid_size_x
+                            and 0 <= y + dy < grid_size_y
+                            and not cell.is_connected_to[direction]
+                        ):
+                            connect_cells(grid, x, y, direction)
+                            found = True
+                            break
+                        direction = (direction + 1) & 3
+
+    def create_grid_cell_connections(
+        self,
+        grid: Grid,
+        grid_size_x: int,
+        grid_size_y: int,
+        list_x: List[int],
+        list_y: List[int],
+        disable_room_merging: bool,
+    ):
+        """CreateGridCellConnections"""
+        for column in grid:
+            for cell in column:
+                cell.should_connect_to = list(cell.is_connected_to)
+        for x in range(grid_size_x):
+            for y in range(grid_size_y):
+                cell = grid[x][y]
+                if cell.is_invalid:
+                    continue
+                for direction in CONNECTION_ORDER:
+                    if not cell.should_connect_to[direction]:
+                        continue
+                    dx, dy = DIRECTIONS[direction]
+                    other = grid[x + dx][y + dy]
+                    cell.should_connect_to[direction] = False
+                    other.should_connect_to[direction ^ 2] = False
+                    if other.is_invalid:
+                        continue
+                    cell.is_connected = other.is_connected = True
+                    if (
+                        not disable_room_merging
+                        and cell.is_room
+                        and other.is_room
+                        and not (cell.is_merged_room or cell.was_merged_into_other_room)
+                        and not (
+                            other.is_merged_room or other.was_merged_into_other_room
+                        )
+                    ):
+                        # One roll for each room
+                        roll_a = self.prng.rand_int(100)
+                        roll_b = self.prng.rand_int(100)
+                        if roll_a < 5 or roll_b < 5:
+                            self.merge_rooms(cell, other)
+                            continue
+                    self.connect_cells_with_hallway(
+                        grid, x, y, direction, list_x, list_y
+                    )
+
+    def connect_cells_with_hallway(
+        self,
+        grid: Grid,
+        x: int,
+        y: int,
+        direction: int,
+        list_x: List[int],
+        list_y: List[int],
+    ):
+        """Create a hallway from a grid cell to its neighbor in a direction."""
+        dx, dy = DIRECTIONS[direction]
+        x0, y0 = self.cell_edge_point(grid[x][y], direction)
+        x1, y1 = self.cell_edge_point(grid[x + dx][y + dy], direction ^ 2)
+        # Kink on the boundary between the two cells
+        x_mid = list_x[x + 1] if direction == RIGHT else list_x[x]
+        y_mid = list_y[y + 1] if direction == DOWN else list_y[y]
+        self.create_hallway(x0, y0, x1, y1, direction in (UP, DOWN), x_mid, y_mid)
+
+    def cell_edge_point(self, cell: GridCell, direction: int) -> Tuple[int, int]:
+        """The endpoint of a hallway leaving a grid cell in a direction.
+
+        This is the anchor of a hallway anchor cell, or a random point just
+        outside the edge of a room that faces the direction.
+        """
+        if not cell.is_room:
+            return cell.start_x, cell.start_y
+        if direction == UP:
+            return self.prng.rand_range(cell.start_x, cell.end_x), cell.start_y - 1
+        if direction == DOWN:
+            return self.prng.rand_range(cell.start_x, cell.end_x), cell.end_y
+        if direction == LEFT:
+            return cell.start_x - 1, self.prng.rand_range(cell.start_y, cell.end_y)
+        return cell.end_x, self.prng.rand_range(cell.start_y, cell.end_y)
+
+    def create_hallway(
+        self,
+        x0: int,
+        y0: int,
+        x1: int,
+        y1: int,
+        vertical: bool,
+        x_mid: int,
+        y_mid: int,
+    ):
+        """CreateHallway"""
+        if vertical:
+            legs = ((x0, y_mid), (x1, y_mid), (x1, y1))
+        else:
+            legs = ((x_mid, y0), (x_mid, y1), (x1, y1))
+        x, y = x0, y0
+        first = True
+        for target_x, target_y in legs:
+            while (x, y) != (target_x, target_y):
+                i = y * FLOOR_WIDTH + x
+                # Stop at existing open terrain, such as another hallway
+                if not first and self.terrain[i] != TERRAIN_WALL:
+                    return
+                self.terrain[i] = TERRAIN_NORMAL
+                first = False
+                x += (target_x > x) - (target_x < x)
+                y += (target_y > y) - (target_y < y)
+        self.terrain[y * FLOOR_WIDTH + x] = TERRAIN_NORMAL
+
+    def merge_rooms(self, cell: GridCell, other: GridCell):
+        """Merge a room into a neighboring room, as one bounding rectangle."""
+        room_index = self.room[cell.start_y * FLOOR_WIDTH + cell.start_x]
+        cell.start_x = min(cell.start_x, other.start_x)
+        cell.start_y = min(cell.start_y, other.start_y)
+        cell.end_x = max(cell.end_x, other.end_x)
+        cell.end_y = max(cell.end_y, other.end_y)
+        self.fill_room(cell, room_index)
+        cell.is_merged_room = True
+        other.was_merged_into_other_room = True
+
+    def ensure_connected_grid(
+        self,
+        grid: Grid,
+        grid_size_x: int,
+        grid_size_y: int,
+        list_x: List[int],
+        list_y: List[int],
+    ):
+        """EnsureConnectedGrid"""
+        reachable = reachable_cells(grid, grid_size_x, grid_size_y)
+        changed = True
+        while changed:
+            changed = False
+            for x in range(grid_size_x):
+                for y in range(grid_size_y):
+                    if grid[x][y].is_invalid or (x, y) in reachable:
+                        continue
+                    for direction in CONNECTION_ORDER:
+                        dx, dy = DIRECTIONS[direction]
+                        if (x + dx, y + dy) not in reachable:
+                            continue
+                        connect_cells(grid, x, y, direction)
+                        grid[x][y].is_connected = True
+                        grid[x + dx][y + dy].is_connected = True
+                        self.connect_cells_with_hallway(
+                            grid, x, y, direction, list_x, list_y
+                        )
+                        reachable = reachable_cells(grid, grid_size_x, grid_size_y)
+                        changed = True
+                        break
+        # Remove the cells that couldn't be connected
+        for x in range(grid_size_x):
+            for y in range(grid_size_y):
+                cell = grid[x][y]
+                if cell.is_invalid or (x, y) in reachable:
+                    continue
+                for ty in range(cell.start_y, cell.end_y):
+                    for tx in range(cell.start_x, cell.end_x):
+                        i = ty * FLOOR_WIDTH + tx
+                        self.terrain[i] = TERRAIN_WALL
+                        self.room[i] = NO_ROOM
+                cell.is_invalid = True
+
+    def generate_maze_room(
+        self, grid: Grid, grid_size_x: int, grid_size_y: int, chance: int
+    ):
+        """GenerateMazeRoom"""
+        if self.prng.rand_int(100) >= chance:
+            return
+        cell = self.pick_room(
+            grid,
+            grid_size_x,
+            grid_size_y,
+            lambda c: (c.end_x - c.start_x) & 1 and (c.end_y - c.start_y) & 1,
+        )
+        if cell is not None:
+            self.generate_maze(cell, False)
+            cell.is_maze_room = True
+            self.has_maze = True
+
+    def generate_maze(self, cell: GridCell, use_secondary_terrain: bool):
+        """GenerateMaze"""
+        room_index = self.room[cell.start_y * FLOOR_WIDTH + cell.start_x]
+        bounds = (cell.start_x, cell.start_y, cell.end_x, cell.end_y)
+        starts = []
+        # Every other tile around the border of the room, where there isn't a
+        # hallway coming in
+        for x in range(cell.start_x + 1, cell.end_x - 1, 2):
+            starts += [(x, cell.start_y - 1), (x, cell.end_y)]
+        for y in range(cell.start_y + 1, cell.end_y - 1, 2):
+            starts += [(cell.start_x - 1, y), (cell.end_x, y)]
+        for x, y in starts:
+            if self.terrain[y * FLOOR_WIDTH + x] == TERRAIN_WALL:
+                self.generate_maze_line(
+                    x, y, *bounds, use_secondary_terrain, room_index
+                )
+        # Then every other interior tile that's still open
+        for y in range(cell.start_y + 1, cell.end_y - 1, 2):
+            for x in range(cell.start_x + 1, cell.end_x - 1, 2):
+                if self.terrain[y * FLOOR_WIDTH + x] == TERRAIN_NORMAL:
+                    self.set_terrain_obstacle_checked(
+                        x, y, use_secondary_terrain, room_index
+                    )
+                    self.generate_maze_line(
+                        x, y, *bounds, use_secondary_terrain, room_index
+                    )
+
+    def generate_maze_line(
+        self,
+        x0: int,
+        y0: int,
+        x_min: int,
+        y_min: int,
+        x_max: int,
+        y_max: int,
+        use_secondary_terrain: bool,
+        room_index: int,
+    ):
+        """GenerateMazeLine"""
+        while True:
+            direction = self.prng.rand_int(4)
+            for _ in range(4):
+                dx, dy = DIRECTIONS[direction]
+                x, y = x0 + 2 * dx, y0 + 2 * dy
+                if (
+                    x_min <= x < x_max
+                    and y_min <= y < y_max
+                    and self.terrain[y * FLOOR_WIDTH + x] == TERRAIN_NORMAL
+                ):
+                    break
+                direction = (direction + 1) & 3
+            else:
+                return
+            self.set_terrain_obstacle_checked(
+                x0 + dx, y0 + dy, use_secondary_terrain, room_index
+            )
+            self.set_terrain_obstacle_checked(x, y, use_secondary_terrain, room_index)
+            x0, y0 = x, y
+
+    def set_terrain_obstacle_checked(
+        self, x: int, y: int, use_secondary_terrain: bool, room_index: int
+    ):
+        """SetTerrainObstacleChecked"""
+        i = y * FLOOR_WIDTH + x
+        if use_secondary_terrain and self.room[i] == room_index:
+            self.terrain[i] = TERRAIN_SECONDARY
+        else:
+            self.terrain[i] = TERRAIN_WALL
+
+    def generate_kecleon_shop(
+        self, grid: Grid, grid_size_x: int, grid_size_y: int, chance: int
+    ):
+        """GenerateKecleonShop"""
+        if self.prng.rand_int(100) >= chance:
+            return
+        cell = self.pick_room(
+            grid,
+            grid_size_x,
+            grid_size_y,
+            lambda c: c.end_x - c.start_x >= 5 and c.end_y - c.start_y >= 4,
+        )
+        if cell is None:
+            return
+        cell.is_kecleon_shop = True
+        self.has_kecleon_shop = True
+        for y in range(cell.start_y + 1, cell.end_y - 1):
+            for x in range(cell.start_x + 1, cell.end_x - 1):
+                self.flags[y * FLOOR_WIDTH + x] |= FLAG_IN_KECLEON_SHOP
+
+    def generate_monster_house(
+        self, grid: Grid, grid_size_x: int, grid_size_y: int, chance: int
+    ):
+        """GenerateMonsterHouse
+
+        This assumes the floor can support a Monster House (no outlaw missions
+        or special floor types).
+        """
+        if self.prng.rand_int(100) >= chance:
+            return
+        cell = self.pick_room(grid, grid_size_x, grid_size_y, lambda c: True)
+        if cell is None:
+            return
+        cell.is_monster_house = True
+        self.has_monster_house = True
+        self.set_room_flag(cell, FLAG_IN_MONSTER_HOUSE)
+
+    def pick_room(
+        self,
+        grid: Grid,
+        grid_size_x: int,
+        grid_size_y: int,
+        accept: Callable[[GridCell], bool],
+    ) -> Optional[GridCell]:
+        """Pick a random room with no special features that passes a check."""
+        candidates = [
+            grid[x][y]
+            for x in range(grid_size_x)
+            for y in range(grid_size_y)
+            if grid[x][y].is_plain_room() and accept(grid[x][y])
+        ]
+        if not candidates:
+            return None
+        return candidates[self.prng.rand_int(len(candidates))]
+
+    def generate_extra_hallways(
+        self, grid: Grid, grid_size_x: int, grid_size_y: int, n: int
+    ):
+        """GenerateExtraHallways"""
+        for _ in range(n):
+            cell = grid[self.prng.rand_int(grid_size_x)][
+                self.prng.rand_int(grid_size_y)
+            ]
+            if not cell.is_room or not cell.is_connected or cell.is_invalid:
+                continue
+            if cell.is_maze_room or cell.was_merged_into_other_room:
+                continue
+            x = self.prng.rand_range(cell.start_x, cell.end_x)
+            y = self.prng.rand_range(cell.start_y, cell.end_y)
+            room_index = self.room[y * FLOOR_WIDTH + x]
+            direction = self.prng.rand_int(4)
+            dx, dy = DIRECTIONS[direction]
+            # Leave the room
+            while self.room[y * FLOOR_WIDTH + x] == room_index:
+                x, y = x + dx, y + dy
+            steps_to_turn = self.prng.rand_range(3, 6)
+            # Stay clear of the impassable border and the inner boundary rows
+            while 2 <= x < FLOOR_WIDTH - 2 and 2 <= y < FLOOR_HEIGHT - 2:
+                i = y * FLOOR_WIDTH + x
+                if self.terrain[i] != TERRAIN_WALL or self.flags[i] & FLAG_IMPASSABLE:
+                    break
+                if self.forms_open_square(x, y):
+                    break
+                self.terrain[i] = TERRAIN_NORMAL
+                steps_to_turn -= 1
+                if not steps_to_turn:
+                    steps_to_turn = self.prng.rand_range(3, 6)
+                    direction = (direction + (1 if self.prng.rand_int(2) else 3)) & 3
+                    dx, dy = DIRECTIONS[direction]
+                x, y = x + dx, y + dy
+
+    def forms_open_square(self, x: int, y: int) -> bool:
+        """Whether opening a tile would complete a 2x2 square of open tiles."""
+        for sx in (-1, 1):
+            for sy in (-1, 1):
+                if all(
+                    self.terrain[ty * FLOOR_WIDTH + tx] == TERRAIN_NORMAL
+                    for tx, ty in ((x + sx, y), (x, y + sy), (x + sx, y + sy))
+                ):
+                    return True
+        return False
+
+    def generate_room_imperfections(
+        self, grid: Grid, grid_size_x: int, grid_size_y: int
+    ):
+        """GenerateRoomImperfections"""
+        for x in range(grid_size_x):
+            for y in range(grid_size_y):
+                cell = grid[x][y]
+                if not cell.flag_imperfect or not cell.is_plain_room():
+                    continue
+                if self.prng.rand_int(100) >= 40:
+                    continue
+                iterations = min(cell.end_x - cell.start_x, cell.end_y - cell.start_y)
+                corners = (
+                    (cell.start_x, cell.start_y, 1, 1),
+                    (cell.end_x - 1, cell.start_y, -1, 1),
+                    (cell.start_x, cell.end_y - 1, 1, -1),
+                    (cell.end_x - 1, cell.end_y - 1, -1, -1),
+                )
+                # Grow the walls inwards from each corner, along the edges
+                for tx, ty, dx, dy in corners:
+                    for _ in range(iterations // 2):
+                        if self.can_grow_wall(tx, ty):
+                            self.terrain[ty * FLOOR_WIDTH + tx] = TERRAIN_WALL
+                        if self.prng.rand_int(2):
+                            tx += dx
+                        else:
+                            ty += dy
+
+    def can_grow_wall(self, x: int, y: int) -> bool:
+        """Whether a room tile borders at least 2 walls and no hallway."""
+        i = y * FLOOR_WIDTH + x
+        if self.terrain[i] != TERRAIN_NORMAL or self.room[i] == NO_ROOM:
+            return False
+        walls = 0
+        for dx, dy in DIRECTIONS:
+            j = i + dy * FLOOR_WIDTH + dx
+            if self.terrain[j] == TERRAIN_WALL:
+                walls += 1
+            elif self.room[j] == NO_ROOM:
+                return False
+        return walls >= 2
+
+    def generate_secondary_structures(
+        self, grid: Grid, grid_size_x: int, grid_size_y: int
+    ):
+        """GenerateSecondaryStructures"""
+        for x in range(grid_size_x):
+            for y in range(grid_size_y):
+                cell = grid[x][y]
+                if self.secondary_structures_budget <= 0:
+                    return
+                if not cell.flag_secondary_structure or not cell.is_plain_room():
+                    continue
+                if self.generate_secondary_structure(cell, self.prng.rand_int(6)):
+                    cell.has_secondary_structure = True
+                    self.secondary_structures_budget -= 1
+
+    def generate_secondary_structure(self, cell: GridCell, kind: int) -> bool:
+        """Generate a secondary structure of a kind from the dice roll.
+
+        Returns:
+            bool: whether the room supports the structure
+        """
+        width = cell.end_x - cell.start_x
+        height = cell.end_y - cell.start_y
+        mid_x = (cell.start_x + cell.end_x) // 2
+        mid_y = (cell.start_y + cell.end_y) // 2
+        room_index = self.room[cell.start_y * FLOOR_WIDTH + cell.start_x]
+
+        def fill(x0: int, y0: int, x1: int, y1: int):
+            for ty in range(y0, y1):
+                for tx in range(x0, x1):
+                    self.set_terrain_obstacle_checked(tx, ty, True, room_index)
+
+        if kind == 1:
+            if width & 1 and height & 1:
+                # Maze, with secondary terrain for the walls
+                self.generate_maze(cell, True)
+                cell.is_maze_room = True
+                self.has_maze = True
+            elif width >= 5 and height >= 5:
+                # Plus sign
+                fill(mid_x - 1, mid_y, mid_x + 2, mid_y + 1)
+                fill(mid_x, mid_y - 1, mid_x + 1, mid_y + 2)
+            else:
+                fill(mid_x, mid_y, mid_x + 1, mid_y + 1)
+        elif kind == 2:
+            # Checkerboard
+            if not (width & 1 and height & 1):
+                return False
+            for ty in range(cell.start_y + 1, cell.end_y - 1):
+                for tx in range(cell.start_x + 1, cell.end_x - 1):
+                    if (tx - cell.start_x + ty - cell.start_y) & 1 == 0:
+                        fill(tx, ty, tx + 1, ty + 1)
+        elif kind == 3:
+            # Central pool
+            if width < 5 or height < 5:
+                return False
+            fill(cell.start_x + 2, cell.start_y + 2, cell.end_x - 2, cell.end_y - 2)
+        elif kind == 4:
+            # Central island surrounded by a moat
+            if width < 7 or height < 7:
+                return False
+            fill(cell.start_x + 2, cell.start_y + 2, cell.end_x - 2, cell.end_y - 2)
+            for ty in range(cell.start_y + 3, cell.end_y - 3):
+                for tx in range(cell.start_x + 3, cell.end_x - 3):
+                    self.terrain[ty * FLOOR_WIDTH + tx] = TERRAIN_NORMAL
+        elif kind == 5:
+            # Divider
+            if self.prng.rand_int(2):
+                fill(cell.start_x, mid_y, cell.end_x, mid_y + 1)
+            else:
+                fill(mid_x, cell.start_y, mid_x + 1, cell.end_y)
+        else:
+            return False
+        return True
+
+    def finalize_junctions(self):
+        """FinalizeJunctions
+
+        Like the game, this turns hallway anchors into hallway tiles within the
+        same scan, so whether an anchor becomes a junction depends on where its
+        hallways come from.
+        """
+        for y in range(1, FLOOR_HEIGHT - 1):
+            for x in range(1, FLOOR_WIDTH - 1):
+                i = y * FLOOR_WIDTH + x
+                if self.room[i] == ANCHOR_ROOM:
+                    self.room[i] = NO_ROOM
+                if self.room[i] != NO_ROOM or self.terrain[i] != TERRAIN_NORMAL:
+                    continue
+                for dx, dy in DIRECTIONS:
+                    j = i + dy * FLOOR_WIDTH + dx
+                    if self.room[j] != NO_ROOM:
+                        self.terrain[j] = TERRAIN_NORMAL
+                        self.flags[j] |= FLAG_JUNCTION
+
+    def ensure_impassable_tiles_are_walls(self):
+        """EnsureImpassableTilesAreWalls"""
+        for i, flags in enumerate(self.flags):
+            if flags & FLAG_IMPASSABLE:
+                self.terrain[i] = TERRAIN_WALL
+
+    def fill_room(self, cell: GridCell, room_index: int):
+        for y in range(cell.start_y, cell.end_y):
+            start = y * FLOOR_WIDTH + cell.start_x
+            end = start + cell.end_x - cell.start_x
+            self.terrain[start:end] = bytes([TERRAIN_NORMAL]) * (end - start)
+            self.room[start:end] = bytes([room_index]) * (end - start)
+
+    def set_room_flag(self, cell: GridCell, flag: int):
+        for y in range(cell.start_y, cell.end_y):
+            for x in range(cell.start_x, cell.end_x):
+                self.flags[y * FLOOR_WIDTH + x] |= flag
+
+    def tiles(self) -> Tuple[bytes, int]:
+        """Pack the tiles into nibbles.
+
+        Returns:
+            Tuple[bytes, int]: tile nibbles in row-major order, and the number
+                of distinct rooms
+        """
+        tiles = bytearray(self.terrain)
+        rooms = set()
+        for i, room in enumerate(self.room):
+            if room < ANCHOR_ROOM:
+                tiles[i] |= TILE_ROOM
+                rooms.add(room)
+        return bytes(tiles), len(rooms)
+
+
+def get_grid_positions(
+    grid_size_x: int, grid_size_y: int
+) -> Tuple[List[int], List[int]]:
+    """GetGridPositions
+
+    Returns:
+        Tuple[List[int], List[int]]: the starting x coordinate of each grid
+            column and y coordinate of each grid row, each followed by the end
+            of the last one
+    """
+    return (
+        [i * (FLOOR_WIDTH // grid_size_x) for i in range(grid_size_x + 1)],
+        [i * (FLOOR_HEIGHT // grid_size_y) for i in range(grid_size_y + 1)],
+    )
+
+
+def connect_cells(grid: Grid, x: int, y: int, direction: int):
+    """Flag a grid cell and its neighbor in a direction as connected."""
+    dx, dy = DIRECTIONS[direction]
+    grid[x][y].is_connected_to[direction] = True
+    grid[x + dx][y + dy].is_connected_to[direction ^ 2] = True
+
+
+def reachable_cells(
+    grid: Grid, grid_size_x: int, grid_size_y: int
+) -> Set[Tuple[int, int]]:
+    """The valid grid cells reachable from the first connected valid cell."""
+    valid = [
+        (x, y)
+        for x in range(grid_size_x)
+        for y in range(grid_size_y)
+        if not grid[x][y].is_invalid
+    ]
+    starts = [(x, y) for x, y in valid if grid[x][y].is_connected] or valid[:1]
+    reachable = set(starts[:1])
+    stack = list(reachable)
+    while stack:
+        x, y = stack.pop()
+        for direction, (dx, dy) in enumerate(DIRECTIONS):
+            if not grid[x][y].is_connected_to[direction]:
+                continue
+            neighbor = (x + dx, y + dy)
+            if neighbor in reachable or grid[x + dx][y + dy].is_invalid:
+                continue
+            reachable.add(neighbor)
+            stack.append(neighbor)
+    return reachable
+
+
+def generate_layout(
+    prng: DungeonPrng, properties: FloorProperties, dungeon: int = 0, source: int = 0
+) -> FloorLayout:
+    """Generate a floor layout on the host.
+
+    Args:
+        prng (DungeonPrng): dungeon PRNG, in the state it's in when
+            GenerateFloor first calls ResetFloor
+        properties (FloorProperties): floor properties
+        dungeon (int): dungeon ID to record
+        source (int): index to identify the record
+
+    Returns:
+        FloorLayout: floor layout, without stairs or team spawn positions
+    """
+    last_value, seq_num = prng.last_value_primary, prng.seq_num_primary
+    generator = FloorGenerator(prng, properties)
+    generator.generate_floor()
+    tiles, rooms = generator.tiles()
+    return FloorLayout(
+        source,
+        dungeon,
+        properties.floor_number,
+        properties.layout,
+        rooms,
+        dungeon_seed(last_value, seq_num),
+        last_value,
+        seq_num,
+        prng.preseed,
+        NO_POSITION,
+        NO_POSITION,
+        tiles,
+    )
+
+
+def dungeon_seed(last_value: int, seq_num: int) -> int:
+    """Recover the seed of the primary LCG by rewinding it to sequence number 0.
+
+    The primary LCG has a full period of 2^32, so stepping back n steps is
+    the same as stepping ahead 2^32 - n steps.
+    """
+    a, c = lcg_jump(-seq_num & MASK32, LCG_INCREMENT_PRIMARY)
+    return (a * last_value + c) & MASK32
+
+
+class GeneratorConfig(NamedTuple):
+    """What the generation workers share for a run."""
+
+    properties: FloorProperties
+    # Number of primary PRNG draws into the dungeon before generation
+    draws: int
+    dungeon: int
+    first_seed: int
+
+
+def _setup_generator(config: GeneratorConfig) -> GeneratorConfig:
+    return config
+
+
+def generate_seed_range(start: int, stop: int) -> List[FloorLayout]:
+    """Generate the floor layouts of a range of seeds.
+
+    This must be called in a worker process of generate_layouts().
+    """
+    config: GeneratorConfig = worker_state()
+    layouts = []
+    for seed in range(start, stop):
+        prng = DungeonPrng(seed)
+        prng.skip(config.draws)
+        layouts.append(
+            generate_layout(
+                prng, config.properties, config.dungeon, seed - config.first_seed
+            )
+        )
+    return layouts
+
+
+def generate_layouts(
+    start: int,
+    stop: int,
+    properties: FloorProperties,
+    draws: int = 0,
+    dungeon: int = 0,
+    jobs: Optional[int] = None,
+) -> Iterator[FloorLayout]:
+    """Generate the floor layouts of a range of seeds in parallel.
+
+    Args:
+        start (int): first seed passed to InitDungeonRng
+        stop (int): last seed (exclusive)
+        properties (FloorProperties): floor properties
+        draws (int): number of primary PRNG draws into the dungeon before
+            GenerateFloor first calls ResetFloor
+        dungeon (int): dungeon ID to record
+        jobs (Optional[int]): number of worker processes (defaults to the CPU
+            count)
+
+    Returns:
+        Iterator[FloorLayout]: floor layouts, in completion order, with the
+            offset of their seed from the first seed as the source index
+    """
+    config = GeneratorConfig(properties, draws, dungeon, start)
+    chunks = (
+        (s, min(s + SEEDS_PER_TASK, stop)) for s in range(start, stop, SEEDS_PER_TASK)
+    )
+    with WorkerPool(jobs, _setup_generator, (config,)) as executor:
+        # Keep a bounded queue of chunks, so that huge seed ranges don't
+        # queue up all of their tasks at once
+        pending = set()
+        for chunk in chunks:
+            pending.add(executor.submit(generate_seed_range, *chunk))
+            if len(pending) >= MAX_PENDING_TASKS:
+                done, pending = wait(pending, return_when=FIRST_COMPLETED)
+                for future in done:
+                    yield from future.result()
+        for future in as_completed(pending):
+            yield from future.result()
+
+
+class TileDecoder:
+    """Decodes the tile grid in a dungeon struct into packed tile nibbles"""
+
+    def __init__(self, layouts: LayoutDatabase):
+        dungeon = layouts.field_map(layouts.lookup("struct dungeon"))
+        gen_info = layouts.field_map(dungeon["gen_info"].type)
+        tile_fields = layouts.field_map(layouts.lookup("struct tile"))
+        self.tiles_offset = dungeon["gen_info"].offset + gen_info["tiles"].offset
+        self.tile_size = layouts.types[layouts.lookup("struct tile")].size
+        terrain = tile_fields["terrain_type"]
+        stairs = tile_fields["f_stairs"]
+        # The terrain type and stairs flag share the leading terrain flags
+        # bitfield, so one little-endian read per tile gets both
+        assert terrain.offset == 0 and stairs.offset + (stairs.bit_offset >> 3) < 2
+        self.terrain_shift = terrain.bit_offset
+        self.terrain_mask = (1 << terrain.bit_size) - 1
+        self.stairs_bit = 1 << (8 * stairs.offset + stairs.bit_offset)
+        # Read the flags and the room index from each tile
+        room_offset = tile_fields["room"].offset
+        self.tile_format = struct.Struct(
+            f"<H{room_offset - 2}xB{self.tile_size - room_offset - 1}x"
+        )
+
+    def decode(self, dungeon: memoryview) -> Tuple[bytes, int]:
+        """Decode the tiles of a dungeon struct.
+
+        Returns:
+            Tuple[bytes, int]: tile nibbles in row-major order, and the number
+                of distinct rooms
+        """
+        start = self.tiles_offset
+        raw = dungeon[start : start + self.tile_size * NUM_TILES]
+        tiles = bytearray(NUM_TILES)
+        rooms = set()
+        # The tile array is declared as tiles[32][56], so it's row-major with
+        # FLOOR_WIDTH tiles per row, in the same order as the nibbles
+        for i, (flags, room) in enumerate(self.tile_format.iter_unpack(raw)):
+            tile = (flags >> self.terrain_shift) & self.terrain_mask
+            if room != NO_ROOM:
+                tile |= TILE_ROOM
+                rooms.add(room)
+            if flags & self.stairs_bit:
+                tile |= TILE_STAIRS
+            tiles[i] = tile
+        return bytes(tiles), len(rooms)
+
+
+class ExtractorState(NamedTuple):
+    """What the extraction workers load once."""
+
+    layouts: LayoutDatabase
+    symbols: Dict[str, int]
+    decoder: TileDecoder
+
+
+def _setup_extractor(version: str, layouts_dir: Path) -> ExtractorState:
+    layouts = load_layouts(version, layouts_dir)
+    return ExtractorState(layouts, load_data_symbols(version), TileDecoder(layouts))
+
+
+def extract_layout(source: int, before_path: str, after_path: str) -> FloorLayout:
+    """Extract a floor layout and the PRNG state it was generated from.
+
+    This must be called in a worker process of extract_layouts().
+
+    Args:
+        source (int): index of the dump pair, to identify the record
+        before_path (str): path to a RAM dump taken when GenerateFloor first
+            calls ResetFloor
+        after_path (str): path to a RAM dump of the same floor, taken once it's
+            generated
+
+    Returns:
+        FloorLayout: floor layout
+    """
+    state: ExtractorState = worker_state()
+    with RamDump(before_path, state.layouts, state.symbols) as dump:
+        dungeon_id = dump.symbol("DUNGEON_PTR").deref().id.val
+        prng = dump.symbol("DUNGEON_PRNG_STATE")
+        last_value, seq_num = prng.last_value_primary, prng.seq_num_primary
+        preseed = prng.preseed
+    with RamDump(after_path, state.layouts, state.symbols) as dump:
+        dungeon = dump.symbol("DUNGEON_PTR").deref()
+        if dungeon.id.val != dungeon_id:
+            raise ValueError(
+                f"{before_path} and {after_path} are from different dungeons"
+            )
+        gen_info = dungeon.gen_info
+        raw = dungeon.raw()
+        tiles, rooms = state.decoder.decode(raw)
+        raw.release()
+        return FloorLayout(
+            source,
+            dungeon_id,
+            dungeon.floor,
+            dungeon.floor_properties.layout.val,
+            rooms,
+            dungeon_seed(last_value, seq_num),
+            last_value,
+            seq_num,
+            preseed,
+            (gen_info.stairs_pos.x, gen_info.stairs_pos.y),
+            (gen_info.team_spawn_pos.x, gen_info.team_spawn_pos.y),
+            tiles,
+        )
+
+
+def prng_from_dump(dump: RamDump) -> DungeonPrng:
+    """Load the dungeon PRNG state from a RAM dump."""
+    state = dump.symbol("DUNGEON_PRNG_STATE")
+    prng = DungeonPrng(preseed=state.preseed)
+    prng.use_secondary = bool(state.use_secondary)
+    prng.seq_num_primary = state.seq_num_primary
+    prng.last_value_primary = state.last_value_primary
+    prng.idx_secondary = state.idx_secondary
+    prng.secondary_values = list(dump.symbol("DUNGEON_PRNG_STATE_SECONDARY_VALUES"))
+    return prng
+
+
+def layout_tiles(layout: FloorLayout) -> bytes:
+    """The tiles of a layout that the layout stage of GenerateFloor decides.
+
+    Stairs are dropped, and secondary terrain outside of rooms (from the
+    secondary terrain formations of the spawn stage) is turned back into walls.
+    """
+    return bytes(
+        TERRAIN_WALL
+        if t & (TILE_ROOM | TILE_TERRAIN_MASK) == TERRAIN_SECONDARY
+        else t & (TILE_ROOM | TILE_TERRAIN_MASK)
+        for t in layout.tiles
+    )
+
+
+def check_layout(
+    source: int, before_path: str, after_path: str
+) -> Tuple[FloorLayout, List[Tuple[int, int]]]:
+    """Generate a floor on the host and compare it against the game.
+
+    This must be called in a worker process of check_layouts().
+
+    Args:
+        source (int): index of the dump pair, to identify the record
+        before_path (str): path to a RAM dump taken when GenerateFloor first
+            calls ResetFloor
+        after_path (str): path to a RAM dump of the same floor, taken once it's
+            generated
+
+    Returns:
+        Tuple[FloorLayout, List[Tuple[int, int]]]: generated floor layout, and
+            the positions of the tiles that differ from the game's
+    """
+    state: ExtractorState = worker_state()
+    with RamDump(before_path, state.layouts, state.symbols) as dump:
+        dungeon = dump.symbol("DUNGEON_PTR").deref()
+        raw = dungeon.floor_properties.raw()
+        properties = FloorProperties.unpack(raw)
+        raw.release()
+        generated = generate_layout(
+            prng_from_dump(dump), properties, dungeon.id.val, source
+        )
+    expected = layout_tiles(extract_layout(source, before_path, after_path))
+    actual = layout_tiles(generated)
+    return generated, [
+        (i % FLOOR_WIDTH, i // FLOOR_WIDTH)
+        for i in range(NUM_TILES)
+        if actual[i] != expected[i]
+    ]
+
+
+def check_layouts(
+    pairs: List[Tuple[str, str]],
+    version: str,
+    layouts_dir: Path = LAYOUTS_DIR,
+    jobs: Optional[int] = None,
+) -> Iterator[Tuple[FloorLayout, List[Tuple[int, int]]]]:
+    """Check the generator against pairs of RAM dumps in parallel.
+
+    Args:
+        pairs (List[Tuple[str, str]]): paths to the RAM dumps taken before
+            and after the generation of each floor
+        version (str): game version
+        layouts_dir (Path): directory containing the layout databases
+        jobs (Optional[int]): number of worker processes (defaults to the CPU
+            count)
+
+    Returns:
+        Iterator[Tuple[FloorLayout, List[Tuple[int, int]]]]: results of
+            check_layout(), in completion order
+    """
+    with WorkerPool(jobs, _setup_extractor, (version, layouts_dir)) as executor:
+        futures = [
+            executor.submit(check_layout, i, before, after)
+            for i, (before, after) in enumerate(pairs)
+        ]
+        for future in as_completed(futures):
+            yield future.result()
+
+
+def extract_layouts(
+    pairs: List[Tuple[str, str]],
+    version: str,
+    layouts_dir: Path = LAYOUTS_DIR,
+    jobs: Optional[int] = None,
+) -> Iterator[FloorLayout]:
+    """Extract floor layouts from pairs of RAM dumps in parallel.
+
+    Args:
+        pairs (List[Tuple[str, str]]): paths to the RAM dumps taken before
+            and after the generation of each floor
+        version (str): game version
+        layouts_dir (Path): directory containing the layout databases
+        jobs (Optional[int]): number of worker processes (defaults to the CPU
+            count)
+
+    Returns:
+        Iterator[FloorLayout]: floor layouts, in completion order
+    """
+    with WorkerPool(jobs, _setup_extractor, (version, layouts_dir)) as executor:
+        futures = [
+            executor.submit(extract_layout, i, before, after)
+            for i, (before, after) in enumerate(pairs)
+        ]
+        for future in as_completed(futures):
+            yield future.result()
+
+
+def write_database(path: str, layouts: List[FloorLayout]):
+    with open(path, "wb") as f:
+        f.write(HEADER_FORMAT.pack(MAGIC, FORMAT_VERSION, RECORD_SIZE, len(layouts)))
+        for layout in layouts:
+            f.write(layout.pack())
+
+
+class FloorDatabase:
+    """A memory-mapped floor layout database"""
+
+    def __init__(self, path: str):
+        with open(path, "rb") as f:
+            self.data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, format_version, record_size, self.count = HEADER_FORMAT.unpack_from(
+            self.data
+        )
+        if magic != MAGIC or format_version != FORMAT_VERSION:
+            raise ValueError("not a floor layout database, or unsupported version")
+        if record_size != RECORD_SIZE:
+            raise ValueError(f"unexpected record size {record_size}")
+
+    def __len__(self) -> int:
+        return self.count
+
+    def __getitem__(self, i: int) -> FloorLayout:
+        if not 0 <= i < self.count:
+            raise IndexError(f"record {i} out of range")
+        start = HEADER_FORMAT.size + i * RECORD_SIZE
+        return FloorLayout.unpack(self.data[start : start + RECORD_SIZE])
+
+    def __iter__(self) -> Iterator[FloorLayout]:
+        for i in range(self.count):
+            yield self[i]
+
+
+def stairs_distance(layout: FloorLayout) -> Optional[int]:
+    """Chebyshev distance between the team spawn and the stairs, if known."""
+    if NO_POSITION in (layout.stairs, layout.spawn):
+        return None
+    return max(
+        abs(layout.stairs[0] - layout.spawn[0]), abs(layout.stairs[1] - layout.spawn[1])
+    )
+
+
+def print_summary(i: int, layout: FloorLayout):
+    print(
+        f"#{i} (source {layout.source}): dungeon {layout.dungeon}"
+        + f" floor {layout.floor}, layout {layout.layout}, {layout.rooms} room(s),"
+        + f" stairs {layout.stairs}, spawn {layout.spawn},"
+        + f" seed 0x{layout.prng_seed:08X} + {layout.prng_seq_num} draws"
+        + f" (PRNG 0x{layout.prng_last_value:08X},"
+        + f" preseed 0x{layout.prng_preseed:08X})"
+    )
+
+
+def add_dump_arguments(parser: argparse.ArgumentParser):
+    parser.add_argument(
+        "-v",
+        "--version",
+        choices=VERSIONS,
+        type=str.upper,
+        default="NA",
+        help="EoS version",
+    )
+    parser.add_argument(
+        "--layouts-dir",
+        type=Path,
+        default=LAYOUTS_DIR,
+        help="directory containing the layout databases generated by"
+        + " `make layouts` in the headers directory",
+    )
+    add_jobs_argument(parser)
+
+
+def dump_pairs(
+    parser: argparse.ArgumentParser, dumps: List[str]
+) -> List[Tuple[str, str]]:
+    if len(dumps) % 2:
+        parser.error("dumps must come in before/after pairs")
+    return list(zip(dumps[0::2], dumps[1::2]))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Generate, collect and query dungeon floor layouts"
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    dump_help = (
+        "pairs of RAM dumps of a floor, taken when GenerateFloor first calls"
+        + " ResetFloor and once the floor is generated"
+    )
+
+    generate_parser = subparsers.add_parser(
+        "generate", help="generate the floor layouts of many seeds into a database"
+    )
+    properties_group = generate_parser.add_mutually_exclusive_group(required=True)
+    properties_group.add_argument(
+        "--properties",
+        type=bytes.fromhex,
+        help="the 32 bytes of a struct floor_properties, in hex",
+    )
+    properties_group.add_argument(
+        "--properties-dump",
+        help="RAM dump to read the floor properties of the current floor from",
+    )
+    add_dump_arguments(generate_parser)
+    generate_parser.add_argument(
+        "--seeds",
+        type=parse_int_range,
+        required=True,
+        help="range START:STOP of seeds passed to InitDungeonRng",
+    )
+    generate_parser.add_argument(
+        "--draws",
+        type=int,
+        default=0,
+        help="number of primary PRNG draws into the dungeon before generation",
+    )
+    generate_parser.add_argument(
+        "--dungeon", type=int, default=0, help="dungeon ID to record"
+    )
+    generate_parser.add_argument(
+        "-o", "--output", required=True, help="output database file"
+    )
+
+    check_parser = subparsers.add_parser(
+        "check", help="check the generator against floors generated by the game"
+    )
+    add_dump_arguments(check_parser)
+    check_parser.add_argument(
+        "--show", action="store_true", help="render mismatching floors"
+    )
+    check_parser.add_argument("dump", nargs="+", help=dump_help)
+
+    extract_parser = subparsers.add_parser(
+        "extract", help="extract floor layouts from RAM dumps into a database"
+    )
+    add_dump_arguments(extract_parser)
+    extract_parser.add_argument(
+        "-o", "--output", required=True, help="output database file"
+    )
+    extract_parser.add_argument("dump", nargs="+", help=dump_help)
+
+    show_parser = subparsers.add_parser("show", help="render floor layouts")
+    show_parser.add_argument("database", help="floor layout database")
+    show_parser.add_argument("index", type=int, nargs="+", help="record index")
+
+    stats_parser = subparsers.add_parser(
+        "stats", help="print aggregate statistics by layout type"
+    )
+    stats_parser.add_argument("database", help="floor layout database")
+
+    find_parser = subparsers.add_parser("find", help="find floors matching criteria")
+    find_parser.add_argument("database", help="floor layout database")
+    find_parser.add_argument("--layout", type=int, help="floor layout type")
+    find_parser.add_argument(
+        "--seed",
+        type=lambda s: int(s, 0),
+        help="seed the dungeon PRNG was initialized with",
+    )
+    find_parser.add_argument(
+        "--draws",
+        type=int,
+        help="number of primary PRNG draws into the dungeon before generation",
+    )
+    find_parser.add_argument("--min-rooms", type=int, help="minimum room count")
+    find_parser.add_argument("--max-rooms", type=int, help="maximum room count")
+    find_parser.add_argument(
+        "--max-stairs-distance",
+        type=int,
+        help="maximum distance between the team spawn and the stairs",
+    )
+    args = parser.parse_args()
+
+    if args.command == "generate":
+        if args.properties is not None:
+            if len(args.properties) != FLOOR_PROPERTIES_FORMAT.size:
+                parser.error(
+                    f"floor properties must be {FLOOR_PROPERTIES_FORMAT.size} bytes"
+                )
+            properties = FloorProperties.unpack(args.properties)
+        else:
+            with RamDump(
+                args.properties_dump,
+                load_layouts(args.version, args.layouts_dir),
+                load_data_symbols(args.version),
+            ) as dump:
+                raw = dump.symbol("DUNGEON_PTR").deref().floor_properties.raw()
+                properties = FloorProperties.unpack(raw)
+                raw.release()
+        start, stop = args.seeds
+        try:
+            generated = sorted(
+                generate_layouts(
+                    start, stop, properties, args.draws, args.dungeon, args.jobs
+                ),
+                key=lambda layout: layout.source,
+            )
+        except ValueError as e:
+            print(f"Error: {e}", file=sys.stderr)
+            sys.exit(1)
+        write_database(args.output, generated)
+        print(f"Generated {len(generated)} floor layout(s) to {args.output}")
+    elif args.command == "check":
+        pairs = dump_pairs(parser, args.dump)
+        mismatches = 0
+        for layout, diffs in sorted(
+            check_layouts(pairs, args.version, args.layouts_dir, args.jobs),
+            key=lambda result: result[0].source,
+        ):
+            before, after = pairs[layout.source]
+            if not diffs:
+                print(f"{before} -> {after}: OK")
+                continue
+            mismatches += 1
+            print(
+                f"{before} -> {after}: {len(diffs)} tile(s) differ,"
+                + f" first at {diffs[0]}"
+            )
+            if args.show:
+                print("\n".join(layout.render()))
+        print(f"{len(pairs) - mismatches} of {len(pairs)} floor(s) match")
+        if mismatches:
+            sys.exit(1)
+    elif args.command == "extract":
+        pairs = dump_pairs(parser, args.dump)
+        collected = sorted(
+            extract_layouts(pairs, args.version, args.layouts_dir, args.jobs),
+            key=lambda layout: layout.source,
+        )
+        write_database(args.output, collected)
+        print(f"Extracted {len(collected)} floor layout(s) to {args.output}")
+    elif args.command == "show":
+        db = FloorDatabase(args.database)
+        for i in args.index:
+            print_summary(i, db[i])
+            print("\n".join(db[i].render()))
+    elif args.command == "stats":
+        db = FloorDatabase(args.database)
+        by_layout: Dict[int, List[FloorLayout]] = {}
+        for layout in db:
+            by_layout.setdefault(layout.layout, []).append(layout)
+        for layout_type, floors in sorted(by_layout.items()):
+            n = len(floors)
+            open_tiles = sum(
+                sum(1 for t in f.tiles if t & TILE_TERRAIN_MASK == 1) for f in floors
+            )
+            line = (
+                f"layout {layout_type}: {n} floor(s),"
+                + f" {sum(f.rooms for f in floors) / n:.2f} rooms,"
+                + f" {open_tiles / n / NUM_TILES:.1%} open tiles"
+            )
+            distances = [d for d in map(stairs_distance, floors) if d is not None]
+            if distances:
+                line += f", stairs distance {sum(distances) / len(distances):.1f}"
+            print(line)
+    elif args.command == "find":
+        db = FloorDatabase(args.database)
+        for i, layout in enumerate(db):
+            distance = stairs_distance(layout)
+            if (
+                (args.layout is None or layout.layout == args.layout)
+                and (args.seed is None or layout.prng_seed == args.seed)
+                and (args.draws is None or layout.prng_seq_num == args.draws)
+                and (args.min_rooms is None or layout.rooms >= args.min_rooms)
+                and (args.max_rooms is None or layout.rooms <= args.max_rooms)
+                and (
+                    args.max_stairs_distance is None
+                    or (distance is not None and distance <= args.max_stairs_distance)
+                )
+            ):
+                print_summary(i, layout)
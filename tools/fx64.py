@@ -0,0 +1,645 @@
+#!/usr/bin/env python3
+
+"""
+`fx64.py` is a library that implements the arm9 fixed-point math routines on
+the host, as a shared foundation for simulators of game mechanics (see
+`damage_calc.py`). It also has a command line self-check.
+
+The routines are documented in the arm9 symbol table (MultiplyFixedPoint64,
+DivideFixedPoint64, AddFixedPoint64, MultiplyByFixedPoint, ...). There are two
+fixed-point formats:
+    - 64-bit fixed point (`struct fx64`), with 16 fraction bits. Values are
+      represented here as Python ints holding the raw signed 64-bit value
+      (or the raw unsigned 64-bit value, for the unsigned routines).
+    - 32-bit fixed point, with 8 fraction bits, represented as Python ints
+      holding the raw signed (or unsigned) 32-bit value.
+Every routine wraps its result to the width of the game's output, like the
+game does. Signed multiplication and division work on magnitudes and restore
+the sign afterwards (so they truncate toward zero), and division by zero
+returns the maximum positive value, as documented. IntToFixedPoint64
+reproduces the documented bug in its sign extension: the sign is taken from
+bit 15 of the input, but extended into all 32 upper bits. ClampedLn looks its
+argument up in NATURAL_LOG_VALUE_TABLE, which can be read from a RAM dump or
+the arm9 binary with load_ln_values() and installed with set_ln_values().
+Until then, the table is approximated by rounding ln(x) to the same 12
+fraction bits.
+
+There are three ways to use the routines:
+    - Scalar functions, named after the game's routines (multiply_fx64 for
+      MultiplyFixedPoint64 and so on).
+    - Batch functions (batch_*), which apply a routine lane by lane to
+      structure-of-arrays columns and return typed arrays. The loop over the
+      lanes is a single comprehension with the routine inlined, which avoids
+      per-lane function calls.
+    - Constant construction: fx64_const() and fx32_const() convert exact
+      decimal or rational values (e.g., "1.4" or "85/64") into the nearest
+      fixed-point value, for defining constants at import time.
+
+The `check` command differentially tests the scalar functions against an
+independent model that works on pairs of 32-bit words, like the ARM code
+(`struct fx64` upper and lower words, 32x32-bit partial products and
+shift-subtract division), and the batch functions against the scalar ones.
+The inputs are the full cross product of a set of edge-case values (zero,
++/-1, the fraction boundaries, powers of two and the extremes of each width),
+followed by random values with random magnitudes.
+
+Example usage:
+
+python3 fx64.py check
+python3 fx64.py check -n 1000000 --seed 42
+"""
+
+import argparse
+from array import array
+from fractions import Fraction
+import itertools
+import math
+import random
+import struct
+import sys
+from typing import Callable, Iterable, List, Sequence, Tuple, Union
+
+from ramdump import RamDump, load_data_symbols, load_layouts
+
+FRACTION_BITS = 16
+FX64_ONE = 1 << FRACTION_BITS
+FX32_FRACTION_BITS = 8
+FX32_ONE = 1 << FX32_FRACTION_BITS
+
+MASK32 = (1 << 32) - 1
+MASK64 = (1 << 64) - 1
+INT32_MIN = -(1 << 31)
+INT64_MIN = -(1 << 63)
+INT64_MAX = (1 << 63) - 1
+# Returned by the division routines when dividing by zero
+FX64_MAX = INT64_MAX
+
+# ClampedLn domain
+LN_MIN = 1
+LN_MAX = 2047
+# NATURAL_LOG_VALUE_TABLE, an int16_t[2048] in arm9 with 12 fraction bits
+LN_VALUE_FRACTION_BITS = 12
+LN_VALUE_TABLE_FORMAT = struct.Struct(f"<{LN_MAX + 1}h")
+# Load address of the arm9 binary
+ARM9_ADDRESS = 0x2000000
+
+
+def wrap32(x: int) -> int:
+    """Wrap an integer to a signed 32-bit value."""
+    return ((x - INT32_MIN) & MASK32) + INT32_MIN
+
+
+def wrap64(x: int) -> int:
+    """Wrap an integer to a signed 64-bit value."""
+    return ((x - INT64_MIN) & MASK64) + INT64_MIN
+
+
+def to_words(x: int) -> Tuple[int, int]:
+    """Split a raw 64-bit value into `struct fx64` (upper, lower) words."""
+    x &= MASK64
+    return wrap32(x >> 32), x & MASK32
+
+
+def from_words(upper: int, lower: int) -> int:
+    """Join `struct fx64` (upper, lower) words into a signed 64-bit value."""
+    return wrap64(((upper & MASK32) << 32) | (lower & MASK32))
+
+
+def fx64_const(value: Union[int, float, str, Fraction]) -> int:
+    """Convert a number into the nearest 64-bit fixed-point value.
+
+    Strings are parsed exactly, as decimals ("1.4") or fractions ("85/64").
+    """
+    return wrap64(round(Fraction(value) * FX64_ONE))
+
+
+def fx32_const(value: Union[int, float, str, Fraction]) -> int:
+    """Convert a number into the nearest 32-bit fixed-point value.
+
+    Strings are parsed exactly, as decimals ("1.4") or fractions ("85/64").
+    """
+    return wrap32(round(Fraction(value) * FX32_ONE))
+
+
+def fx64_to_float(x: int) -> float:
+    return x / FX64_ONE
+
+
+def fx64_round(x: int) -> int:
+    """Round a 64-bit fixed-point number to the nearest integer (halves up).
+
+    This is a host convenience, not one of the game's routines.
+    """
+    return (x + FX64_ONE // 2) >> FRACTION_BITS
+
+
+# Scalar routines
+def multiply_by_fixed_point(x: int, multiplier: int) -> int:
+    """MultiplyByFixedPoint: signed int times signed 32-bit fixed point"""
+    return wrap32((x * multiplier) >> FX32_FRACTION_BITS)
+
+
+def umultiply_by_fixed_point(x: int, multiplier: int) -> int:
+    """UMultiplyByFixedPoint: unsigned int times unsigned 32-bit fixed point"""
+    return (((x & MASK32) * (multiplier & MASK32)) >> FX32_FRACTION_BITS) & MASK32
+
+
+def round_up_div_256(x: int) -> int:
+    """RoundUpDiv256"""
+    return -(-x // 256)
+
+
+def int_to_fx64(x: int) -> int:
+    """IntToFixedPoint64, including its sign extension bug"""
+    return wrap64(((x << FRACTION_BITS) & MASK32) - ((x & 0x8000) << 17))
+
+
+def fx64_to_int(x: int) -> int:
+    """FixedPoint64ToInt"""
+    return wrap32(x >> FRACTION_BITS)
+
+
+def fx32_to_fx64(x: int) -> int:
+    """FixedPoint32To64"""
+    return wrap32(x) << (FRACTION_BITS - FX32_FRACTION_BITS)
+
+
+def negate_fx64(x: int) -> int:
+    """NegateFixedPoint64"""
+    return wrap64(-x)
+
+
+def fx64_is_zero(x: int) -> bool:
+    """FixedPoint64IsZero"""
+    return x == 0
+
+
+def fx64_is_negative(x: int) -> bool:
+    """FixedPoint64IsNegative"""
+    return x < 0
+
+
+def fx64_cmp_lt(x: int, y: int) -> bool:
+    """FixedPoint64CmpLt"""
+    return x < y
+
+
+def ufx64_cmp_lt(x: int, y: int) -> bool:
+    """UFixedPoint64CmpLt"""
+    return (x & MASK64) < (y & MASK64)
+
+
+def add_fx64(x: int, y: int) -> int:
+    """AddFixedPoint64"""
+    return wrap64(x + y)
+
+
+def umultiply_fx64(x: int, y: int) -> int:
+    """UMultiplyFixedPoint64"""
+    return (((x & MASK64) * (y & MASK64)) >> FRACTION_BITS) & MASK64
+
+
+def multiply_fx64(x: int, y: int) -> int:
+    """MultiplyFixedPoint64"""
+    product = (abs(x) * abs(y)) >> FRACTION_BITS
+    return wrap64(-product if (x < 0) != (y < 0) else product)
+
+
+def udivide_fx64(x: int, y: int) -> int:
+    """UDivideFixedPoint64"""
+    y &= MASK64
+    if y == 0:
+        return FX64_MAX
+    return (((x & MASK64) << FRACTION_BITS) // y) & MASK64
+
+
+def divide_fx64(x: int, y: int) -> int:
+    """DivideFixedPoint64"""
+    if y == 0:
+        return FX64_MAX
+    quotient = (abs(x) << FRACTION_BITS) // abs(y)
+    return wrap64(-quotient if (x < 0) != (y < 0) else quotient)
+
+
+def default_ln_values() -> List[int]:
+    """Tabulate ln(x) like NATURAL_LOG_VALUE_TABLE, by rounding to 12 fraction bits.
+
+    This stands in for the game's table when it isn't available.
+    """
+    return [0] + [
+        round(math.log(x) * (1 << LN_VALUE_FRACTION_BITS))
+        for x in range(LN_MIN, LN_MAX + 1)
+    ]
+
+
+def load_ln_values(path: str, version: str, arm9: bool = False) -> List[int]:
+    """Read NATURAL_LOG_VALUE_TABLE from a RAM dump or an arm9 binary.
+
+    Args:
+        path (str): path to the RAM dump, or to the (decompressed) arm9 binary
+        version (str): game version
+        arm9 (bool): whether the path is an arm9 binary rather than a RAM dump
+
+    Returns:
+        List[int]: table entries, with 12 fraction bits
+    """
+    symbols = load_data_symbols(version)
+    if not arm9:
+        with RamDump(path, load_layouts(version), symbols) as dump:
+            return list(dump.symbol("NATURAL_LOG_VALUE_TABLE"))
+    if "NATURAL_LOG_VALUE_TABLE" not in symbols:
+        raise KeyError(f"no address for NATURAL_LOG_VALUE_TABLE in {version}")
+    with open(path, "rb") as f:
+        f.seek(symbols["NATURAL_LOG_VALUE_TABLE"] - ARM9_ADDRESS)
+        data = f.read(LN_VALUE_TABLE_FORMAT.size)
+    if len(data) < LN_VALUE_TABLE_FORMAT.size:
+        raise ValueError(f"{path} is too short to hold NATURAL_LOG_VALUE_TABLE")
+    return list(LN_VALUE_TABLE_FORMAT.unpack(data))
+
+
+# ClampedLn, indexed by its (clamped) argument. ClampedLn widens entries of
+# NATURAL_LOG_VALUE_TABLE to 16 fraction bits.
+LN_TABLE: List[int] = []
+
+
+def set_ln_values(values: Sequence[int]):
+    """Set the NATURAL_LOG_VALUE_TABLE entries used by ClampedLn.
+
+    This must be called before any precomputation that uses ClampedLn (e.g., the
+    lookup tables of damage_calc.DamageBatch).
+    """
+    if len(values) != LN_MAX + 1:
+        raise ValueError(f"expected {LN_MAX + 1} ln values, got {len(values)}")
+    LN_TABLE[:] = [v << (FRACTION_BITS - LN_VALUE_FRACTION_BITS) for v in values]
+
+
+set_ln_values(default_ln_values())
+
+
+def clamped_ln(x: int) -> int:
+    """ClampedLn"""
+    return LN_TABLE[min(max(x, LN_MIN), LN_MAX)]
+
+
+# Batch routines. Each takes columns of inputs and returns a typed array, with
+# the scalar routine inlined into the loop over the lanes.
+def batch_add_fx64(xs: Sequence[int], ys: Sequence[int]) -> array:
+    return array(
+        "q", (((x + y - INT64_MIN) & MASK64) + INT64_MIN for x, y in zip(xs, ys))
+    )
+
+
+def batch_negate_fx64(xs: Sequence[int]) -> array:
+    return array("q", (((INT64_MIN - x) & MASK64) + INT64_MIN for x in xs))
+
+
+def batch_multiply_fx64(xs: Sequence[int], ys: Sequence[int]) -> array:
+    return array(
+        "q",
+        (
+            (
+                (
+                    (
+                        -((-x * y) >> FRACTION_BITS)
+                        if x < 0 <= y
+                        else -((x * -y) >> FRACTION_BITS)
+                        if y < 0 <= x
+                        else (x * y) >> FRACTION_BITS
+                    )
+                    - INT64_MIN
+                )
+                & MASK64
+            )
+            + INT64_MIN
+            for x, y in zip(xs, ys)
+        ),
+    )
+
+
+def batch_divide_fx64(xs: Sequence[int], ys: Sequence[int]) -> array:
+    return array(
+        "q",
+        (
+            (
+                (
+                    (
+                        -((-x << FRACTION_BITS) // y)
+                        if x < 0 < y
+                        else -((x << FRACTION_BITS) // -y)
+                        if y < 0 <= x
+                        else (-x << FRACTION_BITS) // -y
+                        if x < 0
+                        else (x << FRACTION_BITS) // y
+                    )
+                    - INT64_MIN
+                )
+                & MASK64
+            )
+            + INT64_MIN
+            if y
+            else FX64_MAX
+            for x, y in zip(xs, ys)
+        ),
+    )
+
+
+def batch_multiply_by_fixed_point(
+    xs: Sequence[int], multipliers: Sequence[int]
+) -> array:
+    return array(
+        "i",
+        (
+            ((((x * m) >> FX32_FRACTION_BITS) - INT32_MIN) & MASK32) + INT32_MIN
+            for x, m in zip(xs, multipliers)
+        ),
+    )
+
+
+def batch_int_to_fx64(xs: Sequence[int]) -> array:
+    return array(
+        "q", (((x << FRACTION_BITS) & MASK32) - ((x & 0x8000) << 17) for x in xs)
+    )
+
+
+def batch_fx32_to_fx64(xs: Sequence[int]) -> array:
+    return array(
+        "q",
+        (
+            (((x - INT32_MIN) & MASK32) + INT32_MIN)
+            << (FRACTION_BITS - FX32_FRACTION_BITS)
+            for x in xs
+        ),
+    )
+
+
+def batch_fx64_to_int(xs: Sequence[int]) -> array:
+    return array(
+        "i",
+        ((((x >> FRACTION_BITS) - INT32_MIN) & MASK32) + INT32_MIN for x in xs),
+    )
+
+
+def batch_clamped_ln(xs: Sequence[int]) -> array:
+    table = LN_TABLE
+    return array(
+        "q",
+        (
+            table[LN_MIN if x < LN_MIN else LN_MAX if x > LN_MAX else x]
+            for x in xs
+        ),
+    )
+
+
+class WordModel:
+    """
+    An independent model of the 64-bit fixed-point routines on pairs of
+    32-bit words, for differential testing.
+
+    Values are (upper, lower) tuples of unsigned 32-bit words, like the
+    registers the ARM code works with.
+    """
+
+    @staticmethod
+    def add(x: Tuple[int, int], y: Tuple[int, int]) -> Tuple[int, int]:
+        lower = x[1] + y[1]
+        upper = x[0] + y[0] + (lower >> 32)
+        return upper & MASK32, lower & MASK32
+
+    @classmethod
+    def negate(cls, x: Tuple[int, int]) -> Tuple[int, int]:
+        return cls.add((x[0] ^ MASK32, x[1] ^ MASK32), (0, 1))
+
+    @staticmethod
+    def is_negative(x: Tuple[int, int]) -> bool:
+        return bool(x[0] >> 31)
+
+    @classmethod
+    def magnitude(cls, x: Tuple[int, int]) -> Tuple[int, int]:
+        return cls.negate(x) if cls.is_negative(x) else x
+
+    @staticmethod
+    def umultiply(x: Tuple[int, int], y: Tuple[int, int]) -> Tuple[int, int]:
+        # 128-bit product from 32x32-bit partial products, in 4 words
+        words = [0, 0, 0, 0]
+        for i, a in enumerate((x[1], x[0])):
+            carry = 0
+            for j, b in enumerate((y[1], y[0])):
+                t = words[i + j] + a * b + carry
+                words[i + j] = t & MASK32
+                carry = t >> 32
+            k = i + 2
+            while carry:
+                t = words[k] + carry
+                words[k] = t & MASK32
+                carry = t >> 32
+                k += 1
+        # Bits 16..79 of the product
+        lower = ((words[0] >> 16) | (words[1] << 16)) & MASK32
+        upper = ((words[1] >> 16) | (words[2] << 16)) & MASK32
+        return upper, lower
+
+    @classmethod
+    def multiply(cls, x: Tuple[int, int], y: Tuple[int, int]) -> Tuple[int, int]:
+        product = cls.umultiply(cls.magnitude(x), cls.magnitude(y))
+        if cls.is_negative(x) != cls.is_negative(y):
+            product = cls.negate(product)
+        return product
+
+    @staticmethod
+    def udivide(x: Tuple[int, int], y: Tuple[int, int]) -> Tuple[int, int]:
+        if y == (0, 0):
+            return MASK32 >> 1, MASK32
+        # Restoring shift-subtract division of the 80-bit dividend (x << 16),
+        # one bit at a time, with a 3-word remainder
+        dividend = [
+            (x[1] << 16) & MASK32,
+            ((x[0] << 16) | (x[1] >> 16)) & MASK32,
+            x[0] >> 16,
+        ]
+        divisor = y[0] << 32 | y[1]
+        remainder = 0
+        quotient = [0, 0, 0]
+        for bit in range(95, -1, -1):
+            word, shift = divmod(bit, 32)
+            remainder = (remainder << 1) | ((dividend[word] >> shift) & 1)
+            if remainder >= divisor:
+                remainder -= divisor
+                quotient[word] |= 1 << shift
+        return quotient[1], quotient[0]
+
+    @classmethod
+    def divide(cls, x: Tuple[int, int], y: Tuple[int, int]) -> Tuple[int, int]:
+        if y == (0, 0):
+            return MASK32 >> 1, MASK32
+        quotient = cls.udivide(cls.magnitude(x), cls.magnitude(y))
+        if cls.is_negative(x) != cls.is_negative(y):
+            quotient = cls.negate(quotient)
+        return quotient
+
+    @staticmethod
+    def int_to_fx64(x: int) -> Tuple[int, int]:
+        x &= MASK32
+        return (MASK32 if x & 0x8000 else 0), (x << 16) & MASK32
+
+    @staticmethod
+    def to_int(x: Tuple[int, int]) -> int:
+        return ((x[0] << 16) | (x[1] >> 16)) & MASK32
+
+
+def edge_values() -> List[int]:
+    """Edge-case raw 64-bit values for exhaustive checks."""
+    values = {0, 1, -1, FX64_ONE, -FX64_ONE, FX64_ONE - 1, INT64_MAX, INT64_MIN}
+    for shift in (15, 16, 31, 32, 47, 48, 62):
+        for delta in (-1, 0, 1):
+            values.add((1 << shift) + delta)
+            values.add(-(1 << shift) + delta)
+    return sorted(wrap64(v) for v in values)
+
+
+def random_values(rng: random.Random, n: int, bits: int = 64) -> List[int]:
+    """Random raw signed values with uniformly random magnitudes (in bits)."""
+    values = []
+    for _ in range(n):
+        magnitude = rng.getrandbits(rng.randint(0, bits - 1))
+        values.append(-magnitude if rng.random() < 0.5 else magnitude)
+    return values
+
+
+Check = Tuple[str, Callable[[int, int], int], Callable[[int, int], int]]
+
+
+def _word_binary(op, signed: bool = True) -> Callable[[int, int], int]:
+    def unsigned_words(x: int) -> Tuple[int, int]:
+        upper, lower = to_words(x)
+        return upper & MASK32, lower
+
+    def model(x: int, y: int) -> int:
+        upper, lower = op(unsigned_words(x), unsigned_words(y))
+        result = (upper << 32) | lower
+        return wrap64(result) if signed else result
+
+    return model
+
+
+BINARY_CHECKS: List[Check] = [
+    ("AddFixedPoint64", add_fx64, _word_binary(WordModel.add)),
+    ("MultiplyFixedPoint64", multiply_fx64, _word_binary(WordModel.multiply)),
+    ("DivideFixedPoint64", divide_fx64, _word_binary(WordModel.divide)),
+    (
+        "UMultiplyFixedPoint64",
+        umultiply_fx64,
+        _word_binary(WordModel.umultiply, signed=False),
+    ),
+    (
+        "UDivideFixedPoint64",
+        udivide_fx64,
+        _word_binary(WordModel.udivide, signed=False),
+    ),
+]
+
+BATCH_CHECKS = [
+    ("add", batch_add_fx64, add_fx64),
+    ("multiply", batch_multiply_fx64, multiply_fx64),
+    ("divide", batch_divide_fx64, divide_fx64),
+]
+
+
+def check(n: int, seed: int) -> int:
+    """Run the differential checks.
+
+    Args:
+        n (int): number of random inputs per check
+        seed (int): random seed
+
+    Returns:
+        int: number of failures
+    """
+    rng = random.Random(seed)
+    edges = edge_values()
+    failures = 0
+
+    def report(name: str, inputs: Tuple[int, ...], got: int, expected: int):
+        nonlocal failures
+        failures += 1
+        if failures <= 20:
+            args = ", ".join(f"0x{x & MASK64:016X}" for x in inputs)
+            print(
+                f"  {name}({args}): got 0x{got & MASK64:X},"
+                + f" expected 0x{expected & MASK64:X}"
+            )
+
+    for name, scalar, model in BINARY_CHECKS:
+        pairs: Iterable[Tuple[int, int]] = itertools.chain(
+            itertools.product(edges, repeat=2),
+            zip(random_values(rng, n), random_values(rng, n)),
+        )
+        count = 0
+        for x, y in pairs:
+            count += 1
+            got, expected = scalar(x, y), model(x, y)
+            if got != expected:
+                report(name, (x, y), got, expected)
+        print(f"{name}: {count} input(s) checked against the word model")
+
+    ints = list(range(-0x10000, 0x10000)) + random_values(rng, n, 32)
+    for name, scalar, model in (
+        (
+            "IntToFixedPoint64",
+            int_to_fx64,
+            lambda x: from_words(*WordModel.int_to_fx64(x)),
+        ),
+        (
+            "FixedPoint64ToInt",
+            lambda x: fx64_to_int(int_to_fx64(x)),
+            lambda x: wrap32(WordModel.to_int(WordModel.int_to_fx64(x))),
+        ),
+        (
+            "NegateFixedPoint64",
+            lambda x: negate_fx64(int_to_fx64(x)),
+            lambda x: from_words(*WordModel.negate(WordModel.int_to_fx64(x))),
+        ),
+    ):
+        for x in ints:
+            got, expected = scalar(x), model(x)
+            if got != expected:
+                report(name, (x,), got, expected)
+        print(f"{name}: {len(ints)} input(s) checked against the word model")
+
+    xs = edges * len(edges) + random_values(rng, n)
+    ys = [y for y in edges for _ in edges] + random_values(rng, n)
+    for name, batch, scalar in BATCH_CHECKS:
+        for x, y, got in zip(xs, ys, batch(xs, ys)):
+            expected = scalar(x, y)
+            if got != expected:
+                report(f"batch_{name}", (x, y), got, expected)
+        print(f"batch_{name}: {len(xs)} lane(s) checked against the scalar path")
+    xs32 = random_values(rng, n, 32)
+    ms32 = random_values(rng, n, 32)
+    for x, m, got in zip(xs32, ms32, batch_multiply_by_fixed_point(xs32, ms32)):
+        expected = multiply_by_fixed_point(x, m)
+        if got != expected:
+            report("batch_multiply_by_fixed_point", (x, m), got, expected)
+    print(
+        f"batch_multiply_by_fixed_point: {n} lane(s) checked against the scalar path"
+    )
+    return failures
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Host implementation of the arm9 fixed-point routines"
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+    check_parser = subparsers.add_parser(
+        "check", help="differentially test the implementation"
+    )
+    check_parser.add_argument(
+        "-n", type=int, default=100000, help="number of random inputs per check"
+    )
+    check_parser.add_argument("-s", "--seed", type=int, default=0, help="RNG seed")
+    args = parser.parse_args()
+
+    if args.command == "check":
+        failures = check(args.n, args.seed)
+        print("All checks passed" if not failures else f"{failures} failure(s)")
+        sys.exit(1 if failures else 0)
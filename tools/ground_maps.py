@@ -0,0 +1,619 @@
+#!/usr/bin/env python3
+
+"""
+`ground_maps.py` is a library and command line utility for rendering the
+ground mode backgrounds listed in MAP_BG/bg_list.dat (see `struct
+bg_list_entry` in the C headers) to PNGs, at every step of their tile and
+palette animations.
+
+Each entry of bg_list.dat is 11 names of 8 characters, null-padded, of files in
+MAP_BG (lowercased, with the file type as the extension): a BPL palette, a BPC
+tile set, a BMA map, and up to 8 BPA animated tile sets. LoadBackgroundAttributes
+reads an entry into a bg_list_entry. The file formats follow SkyTemple's
+documentation:
+    - BPL: the number of palettes and whether they're animated, then 15 colors
+      per palette (4 bytes each, RGB and an unused byte; color 0 of each
+      palette is transparent and not stored). Animated files then have a
+      duration and frame count per palette, followed by the frames of the
+      palette animation, 16 colors each.
+    - BPC: one or two layers of 4bpp 8x8 tiles and of chunks (tiling_width x
+      tiling_height tilemap entries, 3x3 in practice). Tile 0 and chunk 0 are
+      empty and not stored. Tiles past the end of a layer's tile set are taken
+      from its 4 BPA slots, in order.
+    - BPA: a set of tiles with several frames, each with a duration.
+    - BMA: the size of the map in chunks, and one or two layers of chunk
+      indexes.
+The tile and tilemap data of BPC files and the layers of BMA files are
+compressed; see bpc_image_decompress(), bpc_tilemap_decompress() and
+nrl_decompress(). Tilemap entries are like DS background tilemap entries (tile
+number, flips and palette). Layer 0 is drawn on top of layer 1.
+
+Decoded tile sets, chunks and animated tiles are cached by file name (and by
+chunk tiling, for tile sets), so maps that share files only decode them once
+(per process), and chunks are rendered once per animation frame of the BPAs
+they use. Layers are rendered and
+composed in palette index space with whole-row transparent blits (see
+`rgba.py`), and converted to RGBA with the palette of each animation step.
+Backgrounds are rendered in parallel, one per task, with the tasks ordered by
+tile set so that maps sharing one tend to be rendered by the same worker.
+
+Example usage:
+
+python3 ground_maps.py list /path/to/rom
+python3 ground_maps.py render /path/to/rom -o out/
+python3 ground_maps.py render /path/to/rom -b 0 -b 12 --max-steps 8 -o out/
+"""
+
+import argparse
+import math
+import os
+from pathlib import Path
+import struct
+import time
+from typing import Dict, List, NamedTuple, Optional, Sequence, Tuple, Union
+
+from rgba import (
+    BANK_TABLES,
+    Color,
+    blit,
+    channel_tables,
+    expand_4bpp,
+    flip,
+    to_rgba,
+    write_png,
+)
+from worker_pool import WorkerPool, add_jobs_argument, worker_state
+
+BG_LIST_PATH = "MAP_BG/bg_list.dat"
+NAME_LENGTH = 8
+NB_BPAS = 8
+BPAS_PER_LAYER = 4
+TILE_SIZE = 8
+TILE_BYTES = TILE_SIZE * TILE_SIZE // 2
+PALETTE_SIZE = 16
+NB_PALETTES = 16
+COLOR_SIZE = 4
+BPC_LAYER_SPEC_FORMAT = "<H4HH"
+BPC_LAYER_SPEC_SIZE = struct.calcsize(BPC_LAYER_SPEC_FORMAT)
+BMA_HEADER_FORMAT = "<6BHHH"
+BMA_HEADER_SIZE = struct.calcsize(BMA_HEADER_FORMAT)
+TRANSPARENT: Color = (0, 0, 0, 0)
+
+
+class BgListEntry(NamedTuple):
+    """Mirrors struct bg_list_entry, with empty names as None."""
+
+    bpl: Optional[str]
+    bpc: Optional[str]
+    bma: Optional[str]
+    bpas: Tuple[Optional[str], ...]
+
+
+def read_bg_list(data: bytes) -> List[BgListEntry]:
+    entry_size = (3 + NB_BPAS) * NAME_LENGTH
+    entries = []
+    for offset in range(0, len(data) - entry_size + 1, entry_size):
+        names = [
+            data[o : o + NAME_LENGTH].split(b"\0")[0].decode("ascii") or None
+            for o in range(offset, offset + entry_size, NAME_LENGTH)
+        ]
+        entries.append(BgListEntry(names[0], names[1], names[2], tuple(names[3:])))
+    return entries
+
+
+def nrl_decompress(
+    data: bytes, offset: int, size: int, unit: int = 1
+) -> Tuple[bytes, int]:
+    """Decompress NRL data (runs of zeros, runs of a value and literals).
+
+    Each command byte is followed by its operands:
+        - 0x00-0x7F: cmd + 1 zero units
+        - 0x80-0xBF: one unit, repeated cmd - 0x7F times
+        - 0xC0-0xFF: cmd - 0xBF literal units
+
+    Returns:
+        Tuple[bytes, int]: size bytes of decompressed data, and the offset of
+            the end of the compressed data
+    """
+    out = bytearray()
+    while len(out) < size:
+        cmd = data[offset]
+        offset += 1
+        if cmd < 0x80:
+            out += bytes(unit * (cmd + 1))
+        elif cmd < 0xC0:
+            out += data[offset : offset + unit] * (cmd - 0x7F)
+            offset += unit
+        else:
+            n = unit * (cmd - 0xBF)
+            out += data[offset : offset + n]
+            offset += n
+    return bytes(out[:size]), offset
+
+
+def bpc_image_decompress(data: bytes, offset: int, size: int) -> Tuple[bytes, int]:
+    """Decompress BPC tile data.
+
+    The decompressor keeps the last 3 distinct pattern bytes. Each command
+    byte is followed by its operands:
+        - 0x00-0x7D: cmd + 1 literal bytes (0x7E and 0x7F: the count - 1 is
+          in the next byte, or the next big-endian 16-bit value)
+        - 0x80-0xBF: a new pattern byte, written cmd - 0x7F times
+        - 0xC0-0xDF: the last pattern byte, written cmd - 0xBF times
+        - 0xE0-0xFF: the second to last pattern byte (which becomes the last),
+          written cmd - 0xDF times
+
+    Returns:
+        Tuple[bytes, int]: size bytes of decompressed data, and the offset of
+            the end of the compressed data
+    """
+    out = bytearray()
+    patterns = [0, 0, 0]
+    while len(out) < size:
+        cmd = data[offset]
+        offset += 1
+        if cmd < 0x80:
+            if cmd == 0x7E:
+                count = data[offset]
+                offset += 1
+            elif cmd == 0x7F:
+                count = (data[offset] << 8) | data[offset + 1]
+                offset += 2
+            else:
+                count = cmd
+            out += data[offset : offset + count + 1]
+            offset += count + 1
+            continue
+        if cmd < 0xC0:
+            patterns = [data[offset]] + patterns[:2]
+            offset += 1
+            count = cmd - 0x7F
+        elif cmd < 0xE0:
+            count = cmd - 0xBF
+        else:
+            patterns[0], patterns[1] = patterns[1], patterns[0]
+            count = cmd - 0xDF
+        out += bytes([patterns[0]]) * count
+    return bytes(out[:size]), offset
+
+
+def bpc_tilemap_decompress(
+    data: bytes, offset: int, count: int
+) -> Tuple[List[int], int]:
+    """Decompress BPC chunk tilemap entries.
+
+    The low bytes of all the entries are stored first, then the high bytes,
+    each NRL-compressed (see nrl_decompress()).
+
+    Returns:
+        Tuple[List[int], int]: count tilemap entries, and the offset of the end
+            of the compressed data
+    """
+    low, offset = nrl_decompress(data, offset, count)
+    high, offset = nrl_decompress(data, offset, count)
+    return [lo | (hi << 8) for lo, hi in zip(low, high)], offset
+
+
+class Bpl:
+    """A BPL palette file."""
+
+    def __init__(self, data: bytes):
+        nb_palettes, animated = struct.unpack_from("<HH", data)
+        offset = 4
+        self.palettes: List[List[Color]] = []
+        for _ in range(nb_palettes):
+            self.palettes.append([TRANSPARENT] + self._colors(data, offset, 15))
+            offset += 15 * COLOR_SIZE
+        # (duration of each frame, number of frames) of each palette
+        self.animation_specs: List[Tuple[int, int]] = []
+        self.animation_frames: List[List[Color]] = []
+        if animated:
+            self.animation_specs = list(
+                struct.iter_unpack("<HH", data[offset : offset + 4 * nb_palettes])
+            )
+            offset += 4 * nb_palettes
+            frame_size = PALETTE_SIZE * COLOR_SIZE
+            while offset + frame_size <= len(data):
+                colors = self._colors(data, offset, PALETTE_SIZE)
+                self.animation_frames.append([TRANSPARENT] + colors[1:])
+                offset += frame_size
+
+    @staticmethod
+    def _colors(data: bytes, offset: int, count: int) -> List[Color]:
+        return [
+            (r, g, b, 0xFF)
+            for r, g, b, _ in struct.iter_unpack(
+                "<4B", data[offset : offset + COLOR_SIZE * count]
+            )
+        ]
+
+    def periods(self) -> List[int]:
+        return [
+            duration * frames
+            for duration, frames in self.animation_specs
+            if duration and frames and self.animation_frames
+        ]
+
+    def colors(self, tick: int) -> List[Color]:
+        """Get all colors (16 palettes of 16) at a given animation tick."""
+        colors: List[Color] = []
+        for i in range(NB_PALETTES):
+            palette = self.palettes[i] if i < len(self.palettes) else []
+            if i < len(self.animation_specs) and self.animation_frames:
+                duration, frames = self.animation_specs[i]
+                if duration and frames:
+                    frame = (tick // duration) % frames
+                    palette = self.animation_frames[frame % len(self.animation_frames)]
+            colors += (palette + [TRANSPARENT] * PALETTE_SIZE)[:PALETTE_SIZE]
+        return colors
+
+
+def expand_tiles(data: bytes) -> List[bytes]:
+    """Expand 4bpp tiles into one byte per pixel."""
+    pixels = bytes(expand_4bpp(data))
+    size = TILE_SIZE * TILE_SIZE
+    return [pixels[i : i + size] for i in range(0, len(pixels), size)]
+
+
+class Bpa:
+    """A BPA animated tile set."""
+
+    def __init__(self, data: bytes):
+        self.nb_tiles, nb_frames = struct.unpack_from("<HH", data)
+        self.durations = [
+            duration
+            for duration, _ in struct.iter_unpack("<HH", data[4 : 4 + 4 * nb_frames])
+        ]
+        tiles = expand_tiles(data[4 + 4 * nb_frames :])
+        self.frames = [
+            tiles[i * self.nb_tiles : (i + 1) * self.nb_tiles] for i in range(nb_frames)
+        ]
+
+    @property
+    def period(self) -> int:
+        return sum(self.durations)
+
+    def frame(self, tick: int) -> int:
+        """Get the frame shown at a given animation tick."""
+        if len(self.frames) <= 1 or not self.period:
+            return 0
+        tick %= self.period
+        for frame, duration in enumerate(self.durations):
+            if tick < duration:
+                return frame
+            tick -= duration
+        return 0
+
+
+class BpcLayer(NamedTuple):
+    # Tile pixels, one byte per pixel (tile 0 is empty)
+    tiles: List[bytes]
+    # Number of tiles of each BPA slot
+    bpa_tiles: Tuple[int, ...]
+    # Tilemap entries of each chunk (chunk 0 is empty)
+    chunks: List[List[int]]
+
+
+class Bpc:
+    """A BPC tile set."""
+
+    def __init__(self, data: bytes, tiling_width: int = 3, tiling_height: int = 3):
+        pointers = struct.unpack_from("<HH", data)
+        chunk_size = tiling_width * tiling_height
+        self.layers: List[BpcLayer] = []
+        for i, pointer in enumerate(pointers):
+            if not pointer:
+                continue
+            nb_tiles, *bpa_tiles, nb_chunks = struct.unpack_from(
+                BPC_LAYER_SPEC_FORMAT, data, 4 + i * BPC_LAYER_SPEC_SIZE
+            )
+            tile_data, end = bpc_image_decompress(
+                data, pointer, max(nb_tiles - 1, 0) * TILE_BYTES
+            )
+            entries, _ = bpc_tilemap_decompress(
+                data, end, max(nb_chunks - 1, 0) * chunk_size
+            )
+            self.layers.append(
+                BpcLayer(
+                    [bytes(TILE_SIZE * TILE_SIZE)] + expand_tiles(tile_data),
+                    tuple(bpa_tiles),
+                    [[0] * chunk_size]
+                    + [
+                        entries[c : c + chunk_size]
+                        for c in range(0, len(entries), chunk_size)
+                    ],
+                )
+            )
+
+
+class Bma:
+    """A BMA map."""
+
+    def __init__(self, data: bytes):
+        (
+            self.width_camera,
+            self.height_camera,
+            self.tiling_width,
+            self.tiling_height,
+            self.width,
+            self.height,
+            nb_layers,
+            _,
+            _,
+        ) = struct.unpack_from(BMA_HEADER_FORMAT, data)
+        offset = BMA_HEADER_SIZE
+        self.layers: List[List[int]] = []
+        for _ in range(min(nb_layers, 2)):
+            layer, offset = nrl_decompress(
+                data, offset, 2 * self.width * self.height, 2
+            )
+            cells = list(struct.unpack(f"<{self.width * self.height}H", layer))
+            # Each row is stored XORed with the previous one
+            for i in range(self.width, len(cells)):
+                cells[i] ^= cells[i - self.width]
+            self.layers.append(cells)
+
+    @property
+    def pixel_size(self) -> Tuple[int, int]:
+        return (
+            self.width * self.tiling_width * TILE_SIZE,
+            self.height * self.tiling_height * TILE_SIZE,
+        )
+
+
+class Background:
+    """A background from bg_list.dat, with its files loaded."""
+
+    def __init__(self, loader: "FileLoader", entry: BgListEntry):
+        if entry.bpl is None or entry.bpc is None or entry.bma is None:
+            raise ValueError(f"incomplete background entry {entry}")
+        self.loader = loader
+        self.entry = entry
+        self.bpl: Bpl = loader.load(entry.bpl, "bpl", Bpl)
+        self.bma: Bma = loader.load(entry.bma, "bma", Bma)
+        self.tiling = (self.bma.tiling_width, self.bma.tiling_height)
+        # BPC chunks are decoded with the tiling of the BMA, so the same BPC
+        # can decode differently for different maps
+        self.bpc: Bpc = loader.load(
+            entry.bpc, "bpc", lambda data: Bpc(data, *self.tiling), self.tiling
+        )
+        self.bpas: List[Optional[Bpa]] = [
+            None if name is None else loader.load(name, "bpa", Bpa)
+            for name in entry.bpas
+        ]
+
+    def animation_ticks(self, max_steps: int) -> List[int]:
+        """Get the ticks at which the animated tiles or palettes change, over
+        one period of all the animations (at most max_steps of them)."""
+        periods = [b.period for b in self.bpas if b is not None and b.period]
+        periods += self.bpl.periods()
+        if not periods:
+            return [0]
+        period = 1
+        for p in periods:
+            period = period * p // math.gcd(period, p)
+        changes = {0}
+        for bpa in self.bpas:
+            if bpa is not None and bpa.period and len(bpa.frames) > 1:
+                tick = 0
+                while tick < period and len(changes) <= max_steps:
+                    for duration in bpa.durations:
+                        tick += duration
+                        changes.add(tick)
+        for duration, frames in self.bpl.animation_specs:
+            if duration and frames:
+                changes.update(range(0, min(period, duration * max_steps), duration))
+        return sorted(t for t in changes if t < period)[:max_steps]
+
+    def _tile(self, layer: int, tile: int, bpa_frames: Tuple[int, ...]) -> bytes:
+        tiles = self.bpc.layers[layer].tiles
+        if tile < len(tiles):
+            return tiles[tile]
+        tile -= len(tiles)
+        for slot, count in enumerate(self.bpc.layers[layer].bpa_tiles):
+            bpa = self.bpas[layer * BPAS_PER_LAYER + slot]
+            if tile < count:
+                if bpa is None or not bpa.frames:
+                    break
+                frame = bpa.frames[bpa_frames[slot]]
+                return frame[tile] if tile < len(frame) else frame[-1]
+            tile -= count
+        return tiles[0]
+
+    def chunk(self, layer: int, chunk: int, bpa_frames: Tuple[int, ...]) -> bytes:
+        """Render a chunk into palette indexes, cached per BPA frame."""
+        bpc_layer = self.bpc.layers[layer]
+        chunks = bpc_layer.chunks
+        entries = chunks[chunk] if chunk < len(chunks) else chunks[0]
+        # Chunks that don't use animated tiles are the same for every frame
+        if all((e & 0x3FF) < len(bpc_layer.tiles) for e in entries):
+            bpa_frames = ()
+        # Backgrounds can share a BPC but not its BPAs, which animated chunks
+        # depend on
+        key = (
+            (self.entry.bpc or "").lower(),
+            self.tiling,
+            self.entry.bpas if bpa_frames else (),
+            layer,
+            chunk,
+            bpa_frames,
+        )
+        cached = self.loader.chunks.get(key)
+        if cached is not None:
+            return cached
+        tw, th = self.bma.tiling_width, self.bma.tiling_height
+        width = tw * TILE_SIZE
+        pixels = bytearray(width * th * TILE_SIZE)
+        for i, entry in enumerate(entries):
+            tile = self._tile(layer, entry & 0x3FF, bpa_frames)
+            h_flip, v_flip = bool(entry & 0x400), bool(entry & 0x800)
+            tile = bytes(flip(tile, TILE_SIZE, TILE_SIZE, h_flip, v_flip)).translate(
+                BANK_TABLES[entry >> 12]
+            )
+            ty, tx = divmod(i, tw)
+            for row in range(TILE_SIZE):
+                d = (ty * TILE_SIZE + row) * width + tx * TILE_SIZE
+                s = row * TILE_SIZE
+                pixels[d : d + TILE_SIZE] = tile[s : s + TILE_SIZE]
+        self.loader.chunks[key] = bytes(pixels)
+        return self.loader.chunks[key]
+
+    def render_layer(self, layer: int, tick: int) -> bytearray:
+        """Render a layer into palette indexes."""
+        bpas = self.bpas[layer * BPAS_PER_LAYER : (layer + 1) * BPAS_PER_LAYER]
+        bpa_frames = tuple(0 if b is None else b.frame(tick) for b in bpas)
+        width, height = self.bma.pixel_size
+        chunk_width = self.bma.tiling_width * TILE_SIZE
+        chunk_height = self.bma.tiling_height * TILE_SIZE
+        pixels = bytearray(width * height)
+        for i, chunk in enumerate(self.bma.layers[layer]):
+            if not chunk:
+                continue
+            image = self.chunk(layer, chunk, bpa_frames)
+            cy, cx = divmod(i, self.bma.width)
+            for row in range(chunk_height):
+                d = (cy * chunk_height + row) * width + cx * chunk_width
+                s = row * chunk_width
+                pixels[d : d + chunk_width] = image[s : s + chunk_width]
+        return pixels
+
+    def render(self, tick: int = 0) -> bytearray:
+        """Render the background at a given animation tick to RGBA."""
+        width, _ = self.bma.pixel_size
+        layers = min(len(self.bma.layers), len(self.bpc.layers))
+        canvas = self.render_layer(layers - 1, tick)
+        for layer in reversed(range(layers - 1)):
+            blit(canvas, width, self.render_layer(layer, tick), width, 0, 0)
+        return to_rgba(canvas, channel_tables(self.bpl.colors(tick)))
+
+
+class FileLoader:
+    """Loads files from MAP_BG and caches them decoded, by name."""
+
+    def __init__(self, rom_dir: Union[str, os.PathLike]):
+        self.map_bg = Path(rom_dir) / "MAP_BG"
+        self.files: Dict[Tuple[str, str, Tuple], object] = {}
+        # (BPC name, tiling, BPA names, layer, chunk, BPA frames) -> pixels
+        self.chunks: Dict[tuple, bytes] = {}
+
+    def load(self, name: str, extension: str, decode, variant: Tuple = ()):
+        """Load a file, decoding it if it isn't cached yet.
+
+        Args:
+            name (str): file name, without the extension
+            extension (str): file extension
+            decode: function that decodes the file contents
+            variant (Tuple): parameters of the decoding, which are cached
+                separately
+        """
+        key = (name.lower(), extension, variant)
+        if key not in self.files:
+            path = self.map_bg / f"{key[0]}.{extension}"
+            self.files[key] = decode(path.read_bytes())
+        return self.files[key]
+
+
+def read_rom_bg_list(rom_dir: Union[str, os.PathLike]) -> List[BgListEntry]:
+    return read_bg_list((Path(rom_dir) / BG_LIST_PATH).read_bytes())
+
+
+def _render_task(task: Tuple[int, BgListEntry, str, int]) -> int:
+    bg_id, entry, output_dir, max_steps = task
+    background = Background(worker_state(), entry)
+    width, height = background.bma.pixel_size
+    ticks = background.animation_ticks(max_steps)
+    for step, tick in enumerate(ticks):
+        write_png(
+            os.path.join(output_dir, f"{bg_id:03}_{entry.bma}_{step:03}.png"),
+            width,
+            height,
+            background.render(tick),
+        )
+    return len(ticks)
+
+
+def render_all(
+    rom_dir: Union[str, os.PathLike],
+    output_dir: Union[str, os.PathLike],
+    bg_ids: Optional[Sequence[int]] = None,
+    max_steps: int = 1,
+    jobs: Optional[int] = None,
+) -> int:
+    """Render backgrounds in parallel.
+
+    Each animation step of each background is written to
+    <output_dir>/<bg id>_<BMA name>_<step>.png.
+
+    Args:
+        rom_dir (Union[str, os.PathLike]): extracted ROM filesystem
+        output_dir (Union[str, os.PathLike]): output directory
+        bg_ids (Optional[Sequence[int]]): backgrounds to render (defaults to
+            all of them)
+        max_steps (int): maximum number of animation steps to render for each
+            background
+        jobs (Optional[int]): number of worker processes (defaults to the CPU
+            count)
+
+    Returns:
+        int: number of images written
+    """
+    os.makedirs(output_dir, exist_ok=True)
+    entries = read_rom_bg_list(rom_dir)
+    if bg_ids is None:
+        bg_ids = range(len(entries))
+    tasks = [
+        (bg_id, entries[bg_id], str(output_dir), max_steps)
+        for bg_id in bg_ids
+        if None not in (entries[bg_id].bpl, entries[bg_id].bpc, entries[bg_id].bma)
+    ]
+    # Keep backgrounds that share a tile set together
+    tasks.sort(key=lambda task: (task[1].bpc, task[0]))
+    # Each worker has its own file cache
+    with WorkerPool(jobs, FileLoader, (str(rom_dir),)) as executor:
+        return sum(executor.map(_render_task, tasks, chunksize=8))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Render ground mode backgrounds from MAP_BG"
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    list_parser = subparsers.add_parser("list", help="list the entries of bg_list.dat")
+    list_parser.add_argument("rom_dir", help="extracted ROM filesystem")
+
+    render_parser = subparsers.add_parser("render", help="render backgrounds to PNGs")
+    render_parser.add_argument(
+        "-b",
+        "--bg",
+        type=int,
+        action="append",
+        help="background ID to render (can be repeated; defaults to all)",
+    )
+    render_parser.add_argument(
+        "--max-steps",
+        type=int,
+        default=1,
+        help="maximum number of animation steps to render per background",
+    )
+    add_jobs_argument(render_parser)
+    render_parser.add_argument(
+        "-o", "--output-dir", required=True, help="output directory"
+    )
+    render_parser.add_argument("rom_dir", help="extracted ROM filesystem")
+    args = parser.parse_args()
+
+    if args.command == "list":
+        for bg_id, entry in enumerate(read_rom_bg_list(args.rom_dir)):
+            bpas = ", ".join(name for name in entry.bpas if name is not None)
+            print(
+                f"{bg_id:3}: BPL {entry.bpl}, BPC {entry.bpc}, BMA {entry.bma}"
+                + (f", BPA {bpas}" if bpas else "")
+            )
+    elif args.command == "render":
+        start = time.perf_counter()
+        count = render_all(
+            args.rom_dir, args.output_dir, args.bg, args.max_steps, args.jobs
+        )
+        elapsed = time.perf_counter() - start
+        print(f"Rendered {count} images in {elapsed:.2f} s")
@@ -0,0 +1,553 @@
+#!/usr/bin/env python3
+
+"""
+`heap_analyzer.py` is a library and command line utility for analyzing the
+state of the game's heap in RAM dumps, or in a stream of RAM dumps taken over
+time, to chase down out-of-memory crashes.
+
+The heap is made of memory arenas (`struct mem_arena`), each with an array of
+blocks (`struct mem_block`). MEMORY_ALLOCATION_TABLE (`struct
+mem_alloc_table`) holds the default arena (DEFAULT_MEMORY_ARENA, with
+DEFAULT_MEMORY_ARENA_BLOCKS) and pointers to the other global arenas. The
+ground mode arenas (GROUND_MEMORY_ARENA_1 and _2) and the sound arena
+(SOUND_MEMORY_ARENA, which is passed to MemLocateSet directly) are also looked
+up by symbol, and blocks that hold an arena (f_arena) are checked for
+subarenas created in them with CreateMemArena. Arenas are reported in a tree,
+with:
+    - used: the used bytes of the arena's blocks
+    - free: the available bytes of the blocks that aren't reserved
+      (f_in_use), which are the ones that FindAvailableMemBlock can split
+    - largest: the largest of those, which bounds the largest allocation that
+      can succeed
+    - frag: the fragmentation of the free space, 1 - largest / free
+    - blocks: the number of blocks used out of the arena's maximum (running
+      out of block slots also makes allocations fail)
+Over a stream of dumps, the high-water marks of each arena are reported too:
+the peak usage, the smallest largest free block and the peak block count,
+along with the dump where each happened.
+
+The mem_block structs don't record who allocated them, so allocation sites
+come from an optional trace of allocator calls, with one call per line:
+    alloc <size> <flags> <pointer> [<return address>]
+    free <pointer> [<return address>]
+    arena <parent arena> <size> <max blocks> <flags> <arena> [<return address>]
+    create <pointer> <size> <max blocks> [<return address>]
+for calls to MemAlloc, MemFree, MemArenaAlloc and CreateMemArena (on memory
+that wasn't allocated with MemAlloc) respectively, with the arguments and
+results of each call, in decimal or with a 0x prefix (a debugger or emulator
+script that logs the calls on entry and exit can produce this). The site of
+each live allocation is the return address of the last call that returned its
+pointer, symbolized with the function symbols of the symbol tables. Since
+overlays share addresses, a return address can match functions in several
+overlays, in which case all of them are listed. The same trace format can be
+replayed by `mem_alloc_sim.py`.
+
+Dumps are analyzed in parallel. The mem_arena structs are read through the
+struct layout database generated from the C headers (see `make layouts` in
+the headers directory), and block arrays are decoded in bulk.
+
+Example usage:
+
+python3 heap_analyzer.py dump.bin
+python3 heap_analyzer.py -v EU --blocks dump.bin
+python3 heap_analyzer.py dumps/*.bin --trace allocs.txt --sites 10
+"""
+
+import argparse
+import bisect
+from collections import defaultdict
+import os
+import struct
+from typing import Dict, Iterator, List, NamedTuple, Optional, Sequence, Tuple, Union
+
+import yaml
+
+from ramdump import (
+    SYMBOLS_DIR,
+    VERSIONS,
+    YAML_LOADER,
+    LayoutDatabase,
+    RamDump,
+    load_data_symbols,
+    load_layouts,
+)
+from worker_pool import WorkerPool, add_jobs_argument, worker_state
+
+# Mirrors struct mem_block
+MEM_BLOCK_STRUCT = struct.Struct("<6I")
+# Bits of the flags of struct mem_block (see enum memory_alloc_flag)
+MEM_IN_USE = 1 << 0
+MEM_OBJECT = 1 << 1
+MEM_ARENA = 1 << 2
+MEM_SUBARENA = 1 << 3
+# Global arenas that aren't necessarily in MEMORY_ALLOCATION_TABLE
+ARENA_SYMBOLS = [
+    "DEFAULT_MEMORY_ARENA",
+    "GROUND_MEMORY_ARENA_1",
+    "GROUND_MEMORY_ARENA_2",
+    "SOUND_MEMORY_ARENA",
+]
+ARENA_POINTER_SYMBOLS = [
+    "GROUND_MEMORY_ARENA_1_PTR",
+    "GROUND_MEMORY_ARENA_2_PTR",
+    "SOUND_MEMORY_ARENA_PTR",
+]
+
+
+def format_flags(flags: int) -> str:
+    names = [
+        name
+        for bit, name in [
+            (MEM_IN_USE, "in_use"),
+            (MEM_OBJECT, "object"),
+            (MEM_ARENA, "arena"),
+            (MEM_SUBARENA, "subarena"),
+        ]
+        if flags & bit
+    ]
+    return "|".join(names) or "free"
+
+
+class Block(NamedTuple):
+    """Mirrors struct mem_block, with the bitfields as whole words."""
+
+    content_flags: int
+    alloc_flags: int
+    user_flags: int
+    data: int
+    available: int
+    used: int
+
+    @property
+    def in_use(self) -> bool:
+        return bool(self.content_flags & MEM_IN_USE)
+
+    @property
+    def end(self) -> int:
+        return self.data + self.used + self.available
+
+
+class ArenaStats(NamedTuple):
+    name: str
+    address: int
+    parent: int
+    depth: int
+    length: int
+    used: int
+    free: int
+    largest_free: int
+    n_blocks: int
+    max_blocks: int
+
+    @property
+    def fragmentation(self) -> float:
+        return 1 - self.largest_free / self.free if self.free else 0.0
+
+
+class Arena(NamedTuple):
+    """Mirrors struct mem_arena, with its blocks."""
+
+    name: str
+    address: int
+    content_flags: int
+    parent: int
+    data: int
+    length: int
+    max_blocks: int
+    blocks: List[Block]
+
+    def stats(self, depth: int = 0) -> ArenaStats:
+        free = [b.available for b in self.blocks if not b.in_use]
+        return ArenaStats(
+            self.name,
+            self.address,
+            self.parent,
+            depth,
+            self.length,
+            sum(b.used for b in self.blocks),
+            sum(free),
+            max(free, default=0),
+            len(self.blocks),
+            self.max_blocks,
+        )
+
+
+def read_arena(dump: RamDump, address: int, name: str) -> Optional[Arena]:
+    """Read an arena and its blocks, or return None if it doesn't look valid."""
+    try:
+        view = dump.view(address, "struct mem_arena")
+        blocks_ptr = view.blocks.target()
+        data_ptr = view.data.target()
+        parent_ptr = view.parent.target()
+        n_blocks, max_blocks = view.n_blocks, view.max_blocks
+        if blocks_ptr is None or data_ptr is None or not 0 < n_blocks <= max_blocks:
+            return None
+        size = n_blocks * MEM_BLOCK_STRUCT.size
+        offset = dump.offset(blocks_ptr.address, size)
+    except ValueError:
+        return None
+    blocks = [
+        Block(*fields)
+        for fields in MEM_BLOCK_STRUCT.iter_unpack(dump.buffer[offset : offset + size])
+    ]
+    return Arena(
+        name,
+        address,
+        view.content_flags,
+        parent_ptr.address if parent_ptr is not None else 0,
+        data_ptr.address,
+        view["len"],
+        max_blocks,
+        blocks,
+    )
+
+
+def read_arenas(dump: RamDump) -> List[Tuple[Arena, int]]:
+    """Find all arenas and subarenas in a RAM dump.
+
+    Returns:
+        List[Tuple[Arena, int]]: arenas and their nesting depth, with each
+            arena followed by its subarenas
+    """
+    names: Dict[int, str] = {}
+    for name in ARENA_SYMBOLS:
+        if name in dump.symbols:
+            names[dump.symbols[name]] = name
+    candidates: List[int] = []
+    table = dump.symbol("MEMORY_ALLOCATION_TABLE")
+    candidates.append(table.default_arena.address)
+    for pointer in table.arenas:
+        target = pointer.target()
+        if target is not None:
+            candidates.append(target.address)
+    candidates += [dump.symbols[name] for name in ARENA_SYMBOLS if name in dump.symbols]
+    for name in ARENA_POINTER_SYMBOLS:
+        if name in dump.symbols:
+            try:
+                target = dump.symbol(name).target()
+            except ValueError:
+                continue
+            if target is not None:
+                names.setdefault(target.address, name.removesuffix("_PTR"))
+                candidates.append(target.address)
+
+    arenas: Dict[int, Arena] = {}
+    while candidates:
+        address = candidates.pop(0)
+        if address in arenas:
+            continue
+        arena = read_arena(dump, address, names.get(address, f"arena@0x{address:X}"))
+        if arena is None:
+            continue
+        arenas[address] = arena
+        # Subarenas are created at the start of blocks holding an arena
+        for block in arena.blocks:
+            if block.content_flags & MEM_ARENA and block.data not in arenas:
+                sub = read_arena(dump, block.data, f"arena@0x{block.data:X}")
+                if sub is not None and block.data <= sub.data < block.end:
+                    candidates.append(block.data)
+
+    # Order arenas depth-first, with subarenas after their parent, which is
+    # either the parent field or the arena containing the subarena's block
+    def container(arena: Arena) -> int:
+        if arena.parent in arenas:
+            return arena.parent
+        for other in arenas.values():
+            if other is not arena and other.data <= arena.address < (
+                other.data + other.length
+            ):
+                return other.address
+        return 0
+
+    children: Dict[int, List[Arena]] = defaultdict(list)
+    for arena in arenas.values():
+        children[container(arena)].append(arena)
+    ordered: List[Tuple[Arena, int]] = []
+
+    def visit(parent: int, depth: int):
+        for arena in children.get(parent, []):
+            ordered.append((arena, depth))
+            visit(arena.address, depth + 1)
+
+    visit(0, 0)
+    return ordered
+
+
+class TraceOp(NamedTuple):
+    """A call to the allocator in a trace: MemAlloc, MemFree, MemArenaAlloc or
+    CreateMemArena."""
+
+    kind: str
+    size: int
+    flags: int
+    # Returned pointer (or arena) for allocations, freed pointer for frees
+    pointer: int
+    caller: int
+    # Parent arena and maximum number of blocks, for MemArenaAlloc
+    parent: int = 0
+    max_blocks: int = 0
+
+
+def parse_trace_line(line: str) -> Optional[TraceOp]:
+    fields = line.split("#", 1)[0].split()
+    if not fields:
+        return None
+    kind, args = fields[0], [int(x, 0) for x in fields[1:]]
+    try:
+        if kind == "alloc":
+            size, flags, pointer, *caller = args
+            return TraceOp(kind, size, flags, pointer, caller[0] if caller else 0)
+        if kind == "free":
+            pointer, *caller = args
+            return TraceOp(kind, 0, 0, pointer, caller[0] if caller else 0)
+        if kind == "arena":
+            parent, size, max_blocks, flags, pointer, *caller = args
+            return TraceOp(
+                kind,
+                size,
+                flags,
+                pointer,
+                caller[0] if caller else 0,
+                parent,
+                max_blocks,
+            )
+        if kind == "create":
+            pointer, size, max_blocks, *caller = args
+            return TraceOp(
+                kind, size, 0, pointer, caller[0] if caller else 0, 0, max_blocks
+            )
+    except ValueError:
+        pass
+    raise ValueError(f"invalid trace line: {line.strip()}")
+
+
+def read_trace(path: Union[str, os.PathLike]) -> Iterator[TraceOp]:
+    """Read a trace of allocator calls (see the module description)."""
+    with open(path) as f:
+        for line in f:
+            op = parse_trace_line(line)
+            if op is not None:
+                yield op
+
+
+def live_allocation_sites(trace: Iterator[TraceOp]) -> Dict[int, int]:
+    """Find the return address of the call that allocated each live pointer."""
+    sites: Dict[int, int] = {}
+    for op in trace:
+        if op.kind == "free":
+            sites.pop(op.pointer, None)
+        elif op.kind != "create":
+            sites[op.pointer] = op.caller
+    return sites
+
+
+class SymbolIndex:
+    """Function symbols of all binaries, for symbolizing code addresses."""
+
+    def __init__(self, version: str):
+        # Per binary: name, start and end of the binary, function starts,
+        # and function (start, end, name)
+        self.binaries: List[Tuple[str, int, int, List[int], List[tuple]]] = []
+        for path in sorted(SYMBOLS_DIR.rglob("*.yml")):
+            with open(path, "r") as f:
+                contents = yaml.load(f, Loader=YAML_LOADER)
+            if not isinstance(contents, dict):
+                continue
+            for binary, block in contents.items():
+                start = block.get("address", {}).get(version)
+                length = block.get("length", {}).get(version)
+                if start is None or length is None:
+                    continue
+                functions = []
+                for symbol in block.get("functions", []):
+                    addresses = symbol.get("address", {}).get(version)
+                    lengths = (symbol.get("length") or {}).get(version)
+                    if addresses is None:
+                        continue
+                    if not isinstance(addresses, list):
+                        addresses = [addresses]
+                    for address in addresses:
+                        functions.append((address, lengths, symbol["name"]))
+                functions.sort()
+                entries = []
+                for i, (address, size, name) in enumerate(functions):
+                    if size is None:
+                        size = (
+                            functions[i + 1][0]
+                            if i + 1 < len(functions)
+                            else start + length
+                        ) - address
+                    entries.append((address, address + size, name))
+                self.binaries.append(
+                    (binary, start, start + length, [e[0] for e in entries], entries)
+                )
+
+    def lookup(self, address: int) -> List[str]:
+        """Find the functions containing an address, as name+offset [binary]."""
+        matches = []
+        for binary, start, end, starts, entries in self.binaries:
+            if not start <= address < end:
+                continue
+            i = bisect.bisect_right(starts, address) - 1
+            if i >= 0 and address < entries[i][1]:
+                name, offset = entries[i][2], address - entries[i][0]
+                matches.append(f"{name}+0x{offset:X} [{binary}]")
+        return matches
+
+    def symbolize_return(self, return_address: int) -> str:
+        """Symbolize the call site of a return address."""
+        if not return_address:
+            return "?"
+        # Clear the Thumb bit, and look up the call instruction rather than
+        # the next one
+        matches = self.lookup((return_address & ~1) - 2)
+        return " / ".join(matches) if matches else f"0x{return_address:X}"
+
+
+class DumpReport(NamedTuple):
+    path: str
+    stats: List[ArenaStats]
+    # Per arena address, the live blocks as (block, site)
+    blocks: Dict[int, List[Tuple[Block, int]]]
+
+
+class AnalyzerState(NamedTuple):
+    """What the analysis workers load once."""
+
+    layouts: LayoutDatabase
+    symbols: Dict[str, int]
+    sites: Dict[int, int]
+
+
+def _setup_analyzer(version: str, sites: Dict[int, int]) -> AnalyzerState:
+    return AnalyzerState(load_layouts(version), load_data_symbols(version), sites)
+
+
+def _analyze_task(path: str) -> DumpReport:
+    state: AnalyzerState = worker_state()
+    with RamDump(path, state.layouts, state.symbols) as dump:
+        arenas = read_arenas(dump)
+    return DumpReport(
+        path,
+        [arena.stats(depth) for arena, depth in arenas],
+        {
+            arena.address: [
+                (block, state.sites.get(block.data, 0)) for block in arena.blocks
+            ]
+            for arena, _ in arenas
+        },
+    )
+
+
+def analyze_dumps(
+    paths: Sequence[str],
+    version: str,
+    sites: Optional[Dict[int, int]] = None,
+    jobs: Optional[int] = None,
+) -> List[DumpReport]:
+    """Analyze the heap of RAM dumps in parallel, in order."""
+    with WorkerPool(jobs, _setup_analyzer, (version, sites or {})) as executor:
+        return list(executor.map(_analyze_task, paths))
+
+
+def print_report(
+    report: DumpReport,
+    symbols: Optional[SymbolIndex] = None,
+    show_blocks: bool = False,
+    top_sites: int = 0,
+):
+    print(report.path)
+    print(
+        f"  {'arena':32} {'size':>9} {'used':>9} {'free':>9}"
+        + f" {'largest':>9} {'frag':>6} {'blocks':>9}"
+    )
+    for stats in report.stats:
+        name = "  " * stats.depth + stats.name
+        print(
+            f"  {name:32} {stats.length:9} {stats.used:9} {stats.free:9}"
+            + f" {stats.largest_free:9} {stats.fragmentation:6.1%}"
+            + f" {stats.n_blocks:4}/{stats.max_blocks:<4}"
+        )
+        blocks = report.blocks[stats.address]
+        if show_blocks:
+            for block, site in blocks:
+                line = (
+                    f"      0x{block.data:08X} used {block.used:8}"
+                    + f" free {block.available:8} {format_flags(block.content_flags)}"
+                )
+                if site and symbols is not None:
+                    line += f" <- {symbols.symbolize_return(site)}"
+                print(line)
+        if top_sites and symbols is not None:
+            by_site: Dict[int, List[int]] = defaultdict(lambda: [0, 0])
+            for block, site in blocks:
+                if block.in_use and site:
+                    by_site[site][0] += block.used
+                    by_site[site][1] += 1
+            for site, (used, count) in sorted(
+                by_site.items(), key=lambda item: -item[1][0]
+            )[:top_sites]:
+                print(
+                    f"      {used:9} bytes in {count:3} blocks"
+                    + f" <- {symbols.symbolize_return(site)}"
+                )
+
+
+def print_high_water_marks(reports: Sequence[DumpReport]):
+    """Print the peak usage, smallest largest free block and peak block count
+    of each arena over a stream of dumps."""
+    marks: Dict[str, Dict[str, Tuple[int, str]]] = {}
+    for report in reports:
+        for stats in report.stats:
+            mark = marks.setdefault(
+                stats.name,
+                {
+                    "used": (stats.used, report.path),
+                    "largest": (stats.largest_free, report.path),
+                    "blocks": (stats.n_blocks, report.path),
+                },
+            )
+            if stats.used > mark["used"][0]:
+                mark["used"] = (stats.used, report.path)
+            if stats.largest_free < mark["largest"][0]:
+                mark["largest"] = (stats.largest_free, report.path)
+            if stats.n_blocks > mark["blocks"][0]:
+                mark["blocks"] = (stats.n_blocks, report.path)
+    print(f"High-water marks over {len(reports)} dumps:")
+    for name, mark in marks.items():
+        print(f"  {name}")
+        print(f"    peak used:        {mark['used'][0]:9} ({mark['used'][1]})")
+        print(f"    smallest largest: {mark['largest'][0]:9} ({mark['largest'][1]})")
+        print(f"    peak blocks:      {mark['blocks'][0]:9} ({mark['blocks'][1]})")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Analyze the heap arenas in RAM dumps"
+    )
+    parser.add_argument(
+        "-v", "--version", choices=VERSIONS, default="NA", help="game version"
+    )
+    parser.add_argument(
+        "--trace", help="trace of allocator calls, for allocation sites"
+    )
+    parser.add_argument(
+        "--blocks", action="store_true", help="list the blocks of each arena"
+    )
+    parser.add_argument(
+        "--sites",
+        type=int,
+        default=0,
+        help="number of top allocation sites to list per arena (needs --trace)",
+    )
+    add_jobs_argument(parser)
+    parser.add_argument("dumps", nargs="+", help="RAM dumps, in order")
+    args = parser.parse_args()
+
+    sites = live_allocation_sites(read_trace(args.trace)) if args.trace else {}
+    symbols = SymbolIndex(args.version) if args.trace else None
+    reports = analyze_dumps(args.dumps, args.version, sites, args.jobs)
+    for report in reports:
+        print_report(report, symbols, args.blocks, args.sites)
+    if len(reports) > 1:
+        print_high_water_marks(reports)
@@ -0,0 +1,359 @@
+#!/usr/bin/env python3
+
+"""
+`kaomado.py` is a library and command line utility for extracting the
+portraits in FONT/kaomado.kao (KAOMADO_FILEPATH), the file that LoadPortrait
+reads into a `struct kaomado_buffer` for a `struct portrait_params`.
+
+The file starts with a table of contents with one entry per monster ID (entry
+0 is unused), each with 40 signed 32-bit offsets: one per portrait_emotion,
+each followed by its flipped variant (so the portrait for emotion e is in slot
+2e, and its flipped variant in slot 2e + 1). Slots without a portrait have an
+offset of 0 or less. The table ends where the first portrait starts. Each
+portrait is a 16-color palette (`struct rgb`, 3 bytes per color) followed by
+an AT4PX container (see `at_compression.py`) holding the 40x40 image as 4bpp
+8x8 tiles, in rows of 5 tiles. See
+https://projectpokemon.org/home/docs/mystery-dungeon-nds/kaomadokao-file-format-r54/
+for more details.
+
+Like LoadPortrait, looking up a portrait can prefer its flipped variant
+(try_flip) and fall back to PORTRAIT_NORMAL (allow_default).
+
+The table of contents is read once, in one call, into a flat table of offsets
+indexed by monster and emotion slot. The file is memory-mapped, and portraits
+are only decompressed when they're requested, into a decode buffer that's
+reused from one portrait to the next. Batch exports split the monsters
+between worker processes, each of which maps the file once.
+
+Example usage:
+
+python3 kaomado.py info /path/to/rom/FONT/kaomado.kao
+python3 kaomado.py export /path/to/rom/FONT/kaomado.kao 25 -e 0 -e 1 -o out/
+python3 kaomado.py export-all /path/to/rom/FONT/kaomado.kao -o out/
+python3 kaomado.py layouts -v NA dump.bin
+"""
+
+import argparse
+from array import array
+import enum
+import mmap
+import os
+import struct
+import time
+from typing import List, NamedTuple, Optional, Sequence, Tuple, Union
+
+from at_compression import decompress
+from ramdump import VERSIONS, RamDump, load_data_symbols, load_layouts
+from rgba import HIGH_NIBBLE, LOW_NIBBLE, Color, channel_tables, to_rgba, write_png
+from worker_pool import WorkerPool, add_jobs_argument, worker_state
+
+KAOMADO_FILEPATH = "FONT/kaomado.kao"
+SLOTS_PER_MONSTER = 40
+PALETTE_SIZE = 16
+PALETTE_BYTES = 3 * PALETTE_SIZE
+PORTRAIT_SIZE = 40
+TILE_SIZE = 8
+TILES_PER_ROW = PORTRAIT_SIZE // TILE_SIZE
+
+
+class PortraitEmotion(enum.IntEnum):
+    """Mirrors enum portrait_emotion."""
+
+    NORMAL = 0
+    HAPPY = 1
+    PAIN = 2
+    ANGRY = 3
+    WORRIED = 4
+    SAD = 5
+    CRYING = 6
+    SHOUTING = 7
+    TEARY_EYED = 8
+    DETERMINED = 9
+    JOYOUS = 10
+    INSPIRED = 11
+    SURPRISED = 12
+    DIZZY = 13
+    SPECIAL0 = 14
+    SPECIAL1 = 15
+    SIGH = 16
+    STUNNED = 17
+    SPECIAL2 = 18
+    SPECIAL3 = 19
+
+
+class PortraitRef(NamedTuple):
+    """A portrait found by Kaomado.find()."""
+
+    monster_id: int
+    emotion: int
+    flipped: bool
+    offset: int
+
+
+class Portrait(NamedTuple):
+    palette: List[Color]
+    # One palette index per pixel, in rows
+    indexes: bytes
+
+
+class Kaomado:
+    """A memory-mapped kaomado.kao file, with its table of contents indexed."""
+
+    def __init__(self, path: Union[str, os.PathLike]):
+        with open(path, "rb") as f:
+            self.memory = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self.buffer = memoryview(self.memory)
+        entry_size = 4 * SLOTS_PER_MONSTER
+        # The first portrait starts right after the table of contents; entry 0
+        # is unused, so look for the first offset after it
+        end = len(self.memory)
+        offset = entry_size
+        while offset < end:
+            slots = struct.unpack_from(f"<{SLOTS_PER_MONSTER}i", self.buffer, offset)
+            first = min((s for s in slots if s > 0), default=None)
+            if first is not None:
+                end = first
+                break
+            offset += entry_size
+        self.nb_monsters = end // entry_size
+        self.offsets = array("i")
+        self.offsets.frombytes(self.buffer[: self.nb_monsters * entry_size])
+        # Reused for every decoded portrait
+        self._pixels = bytearray(PORTRAIT_SIZE * PORTRAIT_SIZE)
+
+    def close(self):
+        self.buffer.release()
+        self.memory.close()
+
+    def __enter__(self) -> "Kaomado":
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def offset(self, monster_id: int, emotion: int, flipped: bool = False) -> int:
+        """Get the offset of a portrait, or 0 if there's none."""
+        if not 0 <= monster_id < self.nb_monsters or not 0 <= emotion < 20:
+            return 0
+        offset = self.offsets[monster_id * SLOTS_PER_MONSTER + 2 * emotion + flipped]
+        return max(offset, 0)
+
+    def find(
+        self,
+        monster_id: int,
+        emotion: int,
+        try_flip: bool = False,
+        allow_default: bool = False,
+    ) -> Optional[PortraitRef]:
+        """Look up a portrait like LoadPortrait, or return None if it's missing."""
+        emotions = [emotion]
+        if allow_default and emotion != PortraitEmotion.NORMAL:
+            emotions.append(int(PortraitEmotion.NORMAL))
+        for e in emotions:
+            for flipped in (True, False) if try_flip else (False,):
+                offset = self.offset(monster_id, e, flipped)
+                if offset:
+                    return PortraitRef(monster_id, e, flipped, offset)
+        return None
+
+    def portraits(self) -> List[PortraitRef]:
+        """List every portrait in the file."""
+        return [
+            PortraitRef(
+                slot // SLOTS_PER_MONSTER,
+                (slot % SLOTS_PER_MONSTER) // 2,
+                bool(slot & 1),
+                offset,
+            )
+            for slot, offset in enumerate(self.offsets)
+            if offset > 0
+        ]
+
+    def decode(self, offset: int) -> Portrait:
+        """Decode the portrait at an offset.
+
+        The returned indexes are only valid until the next call.
+        """
+        palette = [
+            (r, g, b, 0xFF)
+            for r, g, b in struct.iter_unpack(
+                "<3B", self.buffer[offset : offset + PALETTE_BYTES]
+            )
+        ]
+        (length,) = struct.unpack_from("<H", self.buffer, offset + PALETTE_BYTES + 5)
+        start = offset + PALETTE_BYTES
+        tiles = decompress(bytes(self.buffer[start : start + length]))
+        pixels = self._pixels
+        # Expand the 4bpp tiles straight into rows of the reusable buffer
+        low = tiles.translate(LOW_NIBBLE)
+        high = tiles.translate(HIGH_NIBBLE)
+        half_row = TILE_SIZE // 2
+        for tile in range(min(len(tiles) // (TILE_SIZE * half_row), TILES_PER_ROW**2)):
+            ty, tx = divmod(tile, TILES_PER_ROW)
+            for row in range(TILE_SIZE):
+                s = (tile * TILE_SIZE + row) * half_row
+                d = (ty * TILE_SIZE + row) * PORTRAIT_SIZE + tx * TILE_SIZE
+                pixels[d : d + TILE_SIZE : 2] = low[s : s + half_row]
+                pixels[d + 1 : d + TILE_SIZE : 2] = high[s : s + half_row]
+        return Portrait(palette, pixels)
+
+
+def portrait_rgba(portrait: Portrait, transparent_0: bool = False) -> bytearray:
+    """Convert a decoded portrait to RGBA."""
+    tables = channel_tables(portrait.palette)
+    if not transparent_0 and portrait.palette:
+        color_0 = portrait.palette[0]
+        tables = [bytes([color_0[c]]) + table[1:] for c, table in enumerate(tables)]
+    return to_rgba(portrait.indexes, tables)
+
+
+def portrait_name(ref: PortraitRef) -> str:
+    name = PortraitEmotion(ref.emotion).name.lower()
+    suffix = "_flip" if ref.flipped else ""
+    return f"{ref.monster_id:04}_{ref.emotion:02}_{name}{suffix}"
+
+
+def export(
+    kaomado: Kaomado,
+    refs: Sequence[PortraitRef],
+    output_dir: Union[str, os.PathLike],
+    transparent_0: bool = False,
+) -> int:
+    """Write portraits to <output_dir>/<monster>_<emotion>_<name>[_flip].png."""
+    for ref in refs:
+        rgba = portrait_rgba(kaomado.decode(ref.offset), transparent_0)
+        path = os.path.join(output_dir, portrait_name(ref) + ".png")
+        write_png(path, PORTRAIT_SIZE, PORTRAIT_SIZE, rgba)
+    return len(refs)
+
+
+def _export_task(task: Tuple[List[PortraitRef], str, bool]) -> int:
+    return export(worker_state(), *task)
+
+
+def export_all(
+    path: Union[str, os.PathLike],
+    output_dir: Union[str, os.PathLike],
+    transparent_0: bool = False,
+    jobs: Optional[int] = None,
+) -> int:
+    """Export every portrait in parallel, split by monster.
+
+    Returns:
+        int: number of portraits written
+    """
+    os.makedirs(output_dir, exist_ok=True)
+    with Kaomado(path) as kaomado:
+        refs = kaomado.portraits()
+    by_monster: List[List[PortraitRef]] = []
+    for ref in refs:
+        if not by_monster or by_monster[-1][0].monster_id != ref.monster_id:
+            by_monster.append([])
+        by_monster[-1].append(ref)
+    tasks = [(group, str(output_dir), transparent_0) for group in by_monster]
+    with WorkerPool(jobs, Kaomado, (str(path),)) as executor:
+        return sum(executor.map(_export_task, tasks, chunksize=16))
+
+
+def print_layouts(dump_path: str, version: str):
+    """Print PORTRAIT_LAYOUTS from a RAM dump."""
+    with RamDump(dump_path, load_layouts(version), load_data_symbols(version)) as dump:
+        for i, layout in enumerate(dump.symbol("PORTRAIT_LAYOUTS")):
+            print(
+                f"{i:2}: offset ({layout.offset_x}, {layout.offset_y}),"
+                + f" try_flip {bool(layout.try_flip)}"
+            )
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Extract portraits from kaomado.kao")
+    parser.add_argument(
+        "--transparent-color-0",
+        action="store_true",
+        help="make color 0 of the palettes transparent",
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    info_parser = subparsers.add_parser("info", help="summarize a kaomado.kao file")
+    info_parser.add_argument("file", help="kaomado.kao")
+
+    export_parser = subparsers.add_parser(
+        "export", help="export the portraits of a monster"
+    )
+    export_parser.add_argument(
+        "-e",
+        "--emotion",
+        type=int,
+        action="append",
+        help="emotion to export (can be repeated; defaults to all)",
+    )
+    export_parser.add_argument(
+        "--try-flip", action="store_true", help="prefer flipped portraits"
+    )
+    export_parser.add_argument(
+        "--allow-default",
+        action="store_true",
+        help="fall back to PORTRAIT_NORMAL for missing emotions",
+    )
+    export_parser.add_argument(
+        "-o", "--output-dir", required=True, help="output directory"
+    )
+    export_parser.add_argument("file", help="kaomado.kao")
+    export_parser.add_argument("monster_id", type=int, help="monster ID")
+
+    export_all_parser = subparsers.add_parser(
+        "export-all", help="export every portrait in parallel"
+    )
+    add_jobs_argument(export_all_parser)
+    export_all_parser.add_argument(
+        "-o", "--output-dir", required=True, help="output directory"
+    )
+    export_all_parser.add_argument("file", help="kaomado.kao")
+
+    layouts_parser = subparsers.add_parser(
+        "layouts", help="print PORTRAIT_LAYOUTS from a RAM dump"
+    )
+    layouts_parser.add_argument(
+        "-v",
+        "--version",
+        choices=VERSIONS,
+        default="NA",
+        help="game version of the RAM dump",
+    )
+    layouts_parser.add_argument("dump", help="RAM dump")
+    args = parser.parse_args()
+
+    if args.command == "info":
+        with Kaomado(args.file) as kaomado:
+            refs = kaomado.portraits()
+            monsters = {ref.monster_id for ref in refs}
+            flipped = sum(ref.flipped for ref in refs)
+            print(f"table of contents: {kaomado.nb_monsters} entries")
+            print(f"portraits: {len(refs)} ({flipped} flipped)")
+            print(f"monsters with portraits: {len(monsters)}")
+    elif args.command == "export":
+        os.makedirs(args.output_dir, exist_ok=True)
+        emotions = args.emotion
+        if emotions is None:
+            emotions = [int(e) for e in PortraitEmotion]
+        with Kaomado(args.file) as kaomado:
+            found = []
+            for emotion in emotions:
+                ref = kaomado.find(
+                    args.monster_id, emotion, args.try_flip, args.allow_default
+                )
+                if ref is None:
+                    print(f"No portrait for emotion {emotion}")
+                elif ref not in found:
+                    found.append(ref)
+            count = export(kaomado, found, args.output_dir, args.transparent_color_0)
+        print(f"Exported {count} portraits")
+    elif args.command == "export-all":
+        start = time.perf_counter()
+        count = export_all(
+            args.file, args.output_dir, args.transparent_color_0, args.jobs
+        )
+        elapsed = time.perf_counter() - start
+        print(f"Exported {count} portraits in {elapsed:.2f} s")
+    elif args.command == "layouts":
+        print_layouts(args.dump, args.version)
@@ -0,0 +1,829 @@
+#!/usr/bin/env python3
+
+"""
+`mem_alloc_sim.py` is a library and command line utility that simulates the
+game's memory allocator on the host, to replay traces of allocator calls
+against alternative arena layouts and measure their fragmentation and peak
+usage offline, before touching the ROM.
+
+The simulator follows the allocator as documented in the symbol tables and in
+`struct mem_arena`/`struct mem_block`:
+    - InitMemArena: an arena starts with a single vacant block spanning its
+      whole data region.
+    - CreateMemArena: the arena struct and its block array are placed at the
+      start of the given region, and the arena's data takes up the rest.
+    - MemAlloc (MemLocateSet): the length is rounded up to a multiple of 4,
+      and the internal alloc flags are the user flags shifted right by 8.
+      FindAvailableMemBlock searches the blocks that aren't reserved
+      (f_in_use) in reverse order, picking the one with the least available
+      space that still suffices for objects (best fit, the highest index
+      winning ties), or the first one found for arenas. SplitMemBlock then
+      splits a new block of the requested size off the end of the available
+      space of that block, and inserts it right after it. MemLocateSet hangs
+      the game on failure (no block is large enough, or the arena's block
+      array is full), which the simulator records as a failed allocation
+      instead.
+    - MemAllocFlagsToBlockType: the content flags are the alloc flags'
+      f_in_use, f_object and f_arena bits, and subarena allocations set
+      f_arena and clear f_in_use.
+    - MemArenaAlloc: a subarena allocation of the whole length in the parent
+      arena, followed by CreateMemArena in the new block.
+    - MemFree (MemLocateUnset): the block holding the pointer is emptied (its
+      used space becomes available), merged with the next block if that one is
+      vacant, and merged into the previous block if that one isn't reserved.
+Some details aren't pinned down by the documentation, and are modeled in the
+simplest way consistent with it: an allocation that exactly fits a vacant
+block reuses it instead of splitting off an empty block, and blocks with no
+content flags are considered vacant. Allocations without any content flags
+are recorded as objects, so that they can be told apart from vacant blocks.
+The `verify` command checks these assumptions: it replays a trace from the
+start of the game and compares the resulting blocks with those of a RAM dump
+taken at the end of the trace, block for block.
+
+Traces have the format read by `heap_analyzer.py` (`alloc`, `free`, `arena`
+and `create` lines, for MemAlloc, MemFree, MemArenaAlloc and CreateMemArena).
+The game chooses the arena of an allocation through the arena getters set by
+SetMemAllocatorParams, which aren't visible in a trace, so each allocation is
+replayed in the innermost arena whose traced data region contains the pointer
+it returned in the trace (falling back to the default arena, for failed or
+out-of-range allocations). Frees follow the pointers the simulator returned
+for the traced ones. When replaying with the game's own layout, the pointers
+the simulator returns should match the traced ones, and the number of
+mismatches (divergences) is reported.
+
+A layout is a JSON file that overrides the placement, length and block count
+of arenas, by name: DEFAULT_MEMORY_ARENA, or the symbol name or `arena@0x...`
+address of an arena created in the trace. For example:
+    {
+        "DEFAULT_MEMORY_ARENA": {"length": 2097152, "max_blocks": 384},
+        "GROUND_MEMORY_ARENA_2": {"length": 786432, "max_blocks": 64}
+    }
+The keys of each arena are `address` (the arena struct), `data`, `length` and
+`max_blocks`, all optional. Several layouts can be replayed in parallel on the
+same trace, and the baseline game layout is always replayed first.
+
+The default arena starts out empty unless the replay starts from a RAM dump
+(--initial), in which case all the arenas found in the dump by
+`heap_analyzer.py` are loaded first, for traces recorded from the time of the
+dump on. Layout overrides don't apply to the arenas loaded from the dump.
+
+Example usage:
+
+python3 mem_alloc_sim.py replay allocs.txt
+python3 mem_alloc_sim.py replay allocs.txt --layout a.json --layout b.json
+python3 mem_alloc_sim.py -v EU replay allocs.txt --initial dump.bin
+python3 mem_alloc_sim.py verify allocs.txt dump.bin
+python3 mem_alloc_sim.py bench --ops 1000000
+"""
+
+import argparse
+import json
+import random
+import sys
+import time
+from typing import Any, Dict, List, NamedTuple, Optional, Sequence, Tuple
+
+from heap_analyzer import (
+    ARENA_SYMBOLS,
+    MEM_ARENA,
+    MEM_IN_USE,
+    MEM_OBJECT,
+    MEM_SUBARENA,
+    Arena,
+    ArenaStats,
+    Block,
+    TraceOp,
+    format_flags,
+    read_arenas,
+    read_trace,
+)
+from ramdump import VERSIONS, RamDump, load_data_symbols, load_layouts
+from worker_pool import WorkerPool, add_jobs_argument
+
+# Size of struct mem_arena and struct mem_block
+MEM_ARENA_SIZE = 28
+MEM_BLOCK_SIZE = 24
+# The default arena is set up by InitMemAllocTable, with DEFAULT_MEMORY_ARENA_SIZE
+# bytes of data and 256 blocks (the size of DEFAULT_MEMORY_ARENA_BLOCKS). Its data
+# follows the block array.
+DEFAULT_ARENA_NAME = "DEFAULT_MEMORY_ARENA"
+DEFAULT_ARENA_LENGTH = 1991680
+DEFAULT_ARENA_MAX_BLOCKS = 256
+# Bits of the alloc flags that carry over to the content flags
+CONTENT_FLAGS_MASK = MEM_IN_USE | MEM_OBJECT | MEM_ARENA
+
+
+def alloc_flags_to_block_type(alloc_flags: int) -> int:
+    """Mirrors MemAllocFlagsToBlockType."""
+    content = alloc_flags & CONTENT_FLAGS_MASK
+    if alloc_flags & MEM_SUBARENA:
+        content = (content | MEM_ARENA) & ~MEM_IN_USE
+    return content or MEM_OBJECT
+
+
+class SimBlock:
+    """A mutable struct mem_block."""
+
+    __slots__ = (
+        "content_flags",
+        "alloc_flags",
+        "user_flags",
+        "data",
+        "available",
+        "used",
+    )
+
+    def __init__(
+        self,
+        content_flags: int,
+        alloc_flags: int,
+        user_flags: int,
+        data: int,
+        available: int,
+        used: int,
+    ):
+        self.content_flags = content_flags
+        self.alloc_flags = alloc_flags
+        self.user_flags = user_flags
+        self.data = data
+        self.available = available
+        self.used = used
+
+    def freeze(self) -> Block:
+        return Block(
+            self.content_flags,
+            self.alloc_flags,
+            self.user_flags,
+            self.data,
+            self.available,
+            self.used,
+        )
+
+
+class SimArena:
+    """A simulated struct mem_arena, with running statistics.
+
+    Attributes:
+        depth (int): nesting depth of the arena, for reports
+        trace_data (int): start of the arena's data region in the trace, for
+            routing traced allocations to the arena
+        trace_end (int): end of the arena's data region in the trace
+    """
+
+    def __init__(
+        self,
+        name: str,
+        address: int,
+        parent: int,
+        data: int,
+        length: int,
+        max_blocks: int,
+        blocks: Optional[List[SimBlock]] = None,
+        depth: int = 0,
+    ):
+        self.name = name
+        self.address = address
+        self.parent = parent
+        self.depth = depth
+        self.data = data
+        self.length = length
+        self.max_blocks = max_blocks
+        self.blocks = blocks or [SimBlock(0, 0, 0, data, length, 0)]
+        # Allocated blocks by data pointer, for MemFree
+        self.allocated = {b.data: b for b in self.blocks if b.content_flags}
+        self.trace_data = data
+        self.trace_end = data + length
+        self.used = sum(b.used for b in self.blocks)
+        self.peak_used = self.used
+        self.peak_used_op = -1
+        self.peak_blocks = len(self.blocks)
+        self.min_largest_free = self.largest_free()
+        self.allocs = 0
+        self.failures = 0
+
+    def largest_free(self) -> int:
+        return max(
+            (b.available for b in self.blocks if not b.content_flags & MEM_IN_USE),
+            default=0,
+        )
+
+    def alloc(self, size: int, alloc_flags: int, user_flags: int, op: int) -> int:
+        """Allocate a block, like MemLocateSet.
+
+        Args:
+            size (int): length in bytes
+            alloc_flags (int): internal alloc flags
+            user_flags (int): flags passed by the caller
+            op (int): index of the call in the trace, for the statistics
+
+        Returns:
+            int: pointer to the allocated block, or 0 on failure
+        """
+        size = (size + 3) & ~3
+        blocks = self.blocks
+        first_fit = alloc_flags & (MEM_ARENA | MEM_SUBARENA)
+        found = None
+        best = 0
+        largest = 0
+        # FindAvailableMemBlock, also measuring the largest free block on the way
+        for b in reversed(blocks):
+            if b.content_flags & MEM_IN_USE:
+                continue
+            available = b.available
+            if available > largest:
+                largest = available
+            if available >= size and (
+                found is None or (not first_fit and available < best)
+            ):
+                found = b
+                best = available
+        self.allocs += 1
+        if largest < self.min_largest_free:
+            self.min_largest_free = largest
+        if found is None:
+            self.failures += 1
+            return 0
+
+        # SplitMemBlock
+        b = found
+        content_flags = alloc_flags_to_block_type(alloc_flags)
+        if not b.content_flags and not b.used and b.available == size:
+            block = b
+            block.content_flags = content_flags
+            block.alloc_flags = alloc_flags
+            block.user_flags = user_flags
+            block.available = 0
+            block.used = size
+        else:
+            if len(blocks) >= self.max_blocks:
+                self.failures += 1
+                return 0
+            b.available -= size
+            block = SimBlock(
+                content_flags,
+                alloc_flags,
+                user_flags,
+                b.data + b.used + b.available,
+                0,
+                size,
+            )
+            blocks.insert(blocks.index(b) + 1, block)
+            if len(blocks) > self.peak_blocks:
+                self.peak_blocks = len(blocks)
+        self.allocated[block.data] = block
+        self.used += size
+        if self.used > self.peak_used:
+            self.peak_used = self.used
+            self.peak_used_op = op
+        return block.data
+
+    def free(self, pointer: int) -> bool:
+        """Free a block, like MemLocateUnset.
+
+        Returns:
+            bool: whether the pointer was allocated in this arena
+        """
+        block = self.allocated.pop(pointer, None)
+        if block is None:
+            return False
+        blocks = self.blocks
+        i = blocks.index(block)
+        self.used -= block.used
+        block.content_flags = block.alloc_flags = block.user_flags = 0
+        block.available += block.used
+        block.used = 0
+        if i + 1 < len(blocks):
+            following = blocks[i + 1]
+            if not following.content_flags and not following.used:
+                block.available += following.available
+                del blocks[i + 1]
+        if i > 0 and not blocks[i - 1].content_flags & MEM_IN_USE:
+            blocks[i - 1].available += block.available
+            del blocks[i]
+        return True
+
+    def freeze(self) -> Arena:
+        return Arena(
+            self.name,
+            self.address,
+            MEM_OBJECT,
+            self.parent,
+            self.data,
+            self.length,
+            self.max_blocks,
+            [b.freeze() for b in self.blocks],
+        )
+
+
+class ArenaLayout(NamedTuple):
+    """Placement and size of an arena."""
+
+    address: int
+    data: int
+    length: int
+    max_blocks: int
+
+    def override(self, overrides: Dict[str, int]) -> "ArenaLayout":
+        return self._replace(
+            **{k: v for k, v in overrides.items() if k in self._fields}
+        )
+
+
+def create_mem_arena(
+    name: str, parent: int, region: int, length: int, max_blocks: int, depth: int = 0
+) -> SimArena:
+    """Mirrors CreateMemArena: the arena struct and block array take up the start
+    of the region."""
+    data = region + MEM_ARENA_SIZE + max_blocks * MEM_BLOCK_SIZE
+    return SimArena(
+        name,
+        region,
+        parent,
+        data,
+        max(length - (data - region), 0),
+        max_blocks,
+        depth=depth,
+    )
+
+
+def default_arena_layout(version: str) -> ArenaLayout:
+    """The layout of the default arena set up by InitMemAllocTable."""
+    symbols = load_data_symbols(version)
+    if "DEFAULT_MEMORY_ARENA_BLOCKS" not in symbols:
+        raise ValueError(
+            f"the default arena isn't known for {version}; specify its address"
+            + " and data in a layout"
+        )
+    address = symbols.get("DEFAULT_MEMORY_ARENA", 0)
+    blocks = symbols["DEFAULT_MEMORY_ARENA_BLOCKS"]
+    data = symbols.get(
+        "DEFAULT_MEMORY_ARENA_MEMORY",
+        blocks + DEFAULT_ARENA_MAX_BLOCKS * MEM_BLOCK_SIZE,
+    )
+    return ArenaLayout(address, data, DEFAULT_ARENA_LENGTH, DEFAULT_ARENA_MAX_BLOCKS)
+
+
+class ArenaReport(NamedTuple):
+    """Final state and high-water marks of an arena after a replay."""
+
+    stats: ArenaStats
+    peak_used: int
+    # Index of the call in the trace that reached the peak usage
+    peak_used_op: int
+    peak_blocks: int
+    # The smallest largest free block seen by an allocation
+    min_largest_free: int
+    allocs: int
+    failures: int
+
+
+class ReplayReport(NamedTuple):
+    layout: str
+    ops: int
+    seconds: float
+    arenas: List[ArenaReport]
+    divergences: int
+    # Index of the first call whose pointer diverged from the trace, or -1
+    first_divergence: int
+    # Failed allocations as (trace index, arena name, size)
+    failures: List[Tuple[int, str, int]]
+
+
+class Allocator:
+    """The simulated heap: the default arena and all arenas created in it, or
+    elsewhere with CreateMemArena."""
+
+    def __init__(
+        self,
+        default: ArenaLayout,
+        layout: Optional[Dict[str, Dict[str, int]]] = None,
+        arena_names: Optional[Dict[int, str]] = None,
+    ):
+        """
+        Args:
+            default (ArenaLayout): layout of the default arena in the game
+            layout (Optional[Dict[str, Dict[str, int]]]): layout overrides by
+                arena name
+            arena_names (Optional[Dict[int, str]]): names of known arenas, by
+                address in the game
+        """
+        self.layout = layout or {}
+        self.arena_names = arena_names or {}
+        sim = default.override(self.layout.get(DEFAULT_ARENA_NAME, {}))
+        self.default = SimArena(
+            DEFAULT_ARENA_NAME, sim.address, 0, sim.data, sim.length, sim.max_blocks
+        )
+        self.default.trace_data = default.data
+        self.default.trace_end = default.data + default.length
+        # Live arenas, in creation order (the default arena first)
+        self.arenas: List[SimArena] = [self.default]
+        # Traced pointers and arena addresses, mapped to simulated ones
+        self.pointers: Dict[int, Tuple[SimArena, int]] = {}
+        self.traced_arenas: Dict[int, SimArena] = {default.address: self.default}
+        self.ops = 0
+        self.divergences = 0
+        self.first_divergence = -1
+        self.failures: List[Tuple[int, str, int]] = []
+
+    def load_arenas(self, arenas: Sequence[Tuple[Arena, int]]):
+        """Load the state of arenas read from a RAM dump, which must have been
+        taken with the game's own layout."""
+        for arena, depth in arenas:
+            sim = SimArena(
+                arena.name,
+                arena.address,
+                arena.parent,
+                arena.data,
+                arena.length,
+                arena.max_blocks,
+                [SimBlock(*block) for block in arena.blocks],
+                depth,
+            )
+            if self.traced_arenas.get(arena.address) is self.default:
+                self.arenas.remove(self.default)
+                self.default = sim
+            self.arenas.append(sim)
+            self.traced_arenas[arena.address] = sim
+            for pointer in sim.allocated:
+                self.pointers[pointer] = (sim, pointer)
+
+    def route(self, pointer: int) -> SimArena:
+        """Find the innermost arena whose traced data region holds a pointer."""
+        found = self.default
+        for arena in self.arenas:
+            if arena.trace_data <= pointer < arena.trace_end and (
+                arena.trace_end - arena.trace_data
+                <= found.trace_end - found.trace_data
+            ):
+                found = arena
+        return found
+
+    def record(self, op: TraceOp, arena: SimArena, pointer: int, size: int):
+        if pointer != op.pointer:
+            self.divergences += 1
+            if self.first_divergence < 0:
+                self.first_divergence = self.ops
+        if pointer:
+            self.pointers[op.pointer] = (arena, pointer)
+        else:
+            self.failures.append((self.ops, arena.name, size))
+
+    def arena_overrides(self, op: TraceOp) -> Tuple[str, Dict[str, int]]:
+        name = self.arena_names.get(op.pointer, f"arena@0x{op.pointer:X}")
+        return name, self.layout.get(name, {})
+
+    def new_arena(
+        self,
+        op: TraceOp,
+        parent: Optional[SimArena],
+        region: int,
+        length: int,
+        max_blocks: int,
+    ) -> SimArena:
+        """Create an arena in a region, and register it under its traced
+        address."""
+        name, _ = self.arena_overrides(op)
+        arena = create_mem_arena(
+            name,
+            parent.address if parent is not None else 0,
+            region,
+            length,
+            max_blocks,
+            parent.depth + 1 if parent is not None else 0,
+        )
+        traced = create_mem_arena(name, 0, op.pointer, op.size, op.max_blocks)
+        arena.trace_data, arena.trace_end = traced.data, traced.data + traced.length
+        # Keep the arenas in tree order, with subarenas after their parent
+        position = len(self.arenas)
+        if parent is not None:
+            position = self.arenas.index(parent) + 1
+            while (
+                position < len(self.arenas)
+                and self.arenas[position].depth > parent.depth
+            ):
+                position += 1
+        self.arenas.insert(position, arena)
+        self.traced_arenas[op.pointer] = arena
+        return arena
+
+    def apply(self, op: TraceOp):
+        """Replay a call from a trace."""
+        kind = op.kind
+        if kind == "alloc":
+            arena = self.route(op.pointer)
+            flags = op.flags
+            self.record(
+                op,
+                arena,
+                arena.alloc(op.size, (flags >> 8) & 0xF, flags, self.ops),
+                op.size,
+            )
+        elif kind == "free":
+            arena, pointer = self.pointers.pop(op.pointer, (None, op.pointer))
+            if arena is None:
+                arena = self.route(pointer)
+            if arena.free(pointer):
+                # Freeing a subarena's block frees the subarena with it
+                for traced, sub in list(self.traced_arenas.items()):
+                    if sub.address == pointer and sub is not arena:
+                        self.arenas.remove(sub)
+                        del self.traced_arenas[traced]
+        elif kind == "arena":
+            parent = (
+                self.traced_arenas.get(op.parent)
+                if op.parent
+                else self.route(op.pointer)
+            ) or self.default
+            # Allocated arenas can only be resized
+            _, overrides = self.arena_overrides(op)
+            length = overrides.get("length", op.size)
+            max_blocks = overrides.get("max_blocks", op.max_blocks)
+            flags = op.flags | (MEM_SUBARENA << 8)
+            pointer = parent.alloc(length, (flags >> 8) & 0xF, flags, self.ops)
+            self.record(op, parent, pointer, length)
+            if pointer:
+                self.new_arena(op, parent, pointer, length, max_blocks)
+        elif kind == "create":
+            _, overrides = self.arena_overrides(op)
+            sim = ArenaLayout(op.pointer, 0, op.size, op.max_blocks).override(overrides)
+            self.new_arena(op, None, sim.address, sim.length, sim.max_blocks)
+        self.ops += 1
+
+    def report(self, layout: str, seconds: float) -> ReplayReport:
+        arenas = []
+        for arena in self.arenas:
+            arenas.append(
+                ArenaReport(
+                    arena.freeze().stats(arena.depth),
+                    arena.peak_used,
+                    arena.peak_used_op,
+                    arena.peak_blocks,
+                    arena.min_largest_free,
+                    arena.allocs,
+                    arena.failures,
+                )
+            )
+        return ReplayReport(
+            layout,
+            self.ops,
+            seconds,
+            arenas,
+            self.divergences,
+            self.first_divergence,
+            self.failures,
+        )
+
+
+def arena_names(version: str) -> Dict[int, str]:
+    symbols = load_data_symbols(version)
+    return {symbols[name]: name for name in ARENA_SYMBOLS if name in symbols}
+
+
+def load_layout(path: Optional[str]) -> Dict[str, Dict[str, int]]:
+    if path is None:
+        return {}
+    with open(path, "r") as f:
+        layout: Dict[str, Any] = json.load(f)
+    for name, overrides in layout.items():
+        for key, value in overrides.items():
+            if key not in ArenaLayout._fields or not isinstance(value, int):
+                raise ValueError(f"{path}: invalid layout entry {name}.{key}")
+    return layout
+
+
+def initial_arenas(dump_path: str, version: str) -> List[Tuple[Arena, int]]:
+    with RamDump(
+        dump_path, load_layouts(version), load_data_symbols(version)
+    ) as dump:
+        return read_arenas(dump)
+
+
+def replay(
+    trace_path: str,
+    version: str,
+    layout_path: Optional[str] = None,
+    initial: Optional[str] = None,
+) -> Tuple[ReplayReport, Allocator]:
+    """Replay a trace against a layout.
+
+    Args:
+        trace_path (str): trace of allocator calls
+        version (str): game version
+        layout_path (Optional[str]): layout overrides, or None for the game's
+            own layout
+        initial (Optional[str]): RAM dump to start from, or None to start
+            with an empty default arena
+
+    Returns:
+        Tuple[ReplayReport, Allocator]: the report and the final state
+    """
+    allocator = Allocator(
+        default_arena_layout(version), load_layout(layout_path), arena_names(version)
+    )
+    if initial is not None:
+        allocator.load_arenas(initial_arenas(initial, version))
+    trace = list(read_trace(trace_path))
+    start = time.perf_counter()
+    apply = allocator.apply
+    for op in trace:
+        apply(op)
+    seconds = time.perf_counter() - start
+    return allocator.report(layout_path or "game layout", seconds), allocator
+
+
+def _replay_task(args: Tuple[str, str, Optional[str], Optional[str]]) -> ReplayReport:
+    return replay(*args)[0]
+
+
+def replay_layouts(
+    trace_path: str,
+    version: str,
+    layout_paths: Sequence[Optional[str]],
+    initial: Optional[str] = None,
+    jobs: Optional[int] = None,
+) -> List[ReplayReport]:
+    """Replay a trace against several layouts in parallel, in order."""
+    with WorkerPool(jobs) as executor:
+        return list(
+            executor.map(
+                _replay_task,
+                [(trace_path, version, path, initial) for path in layout_paths],
+            )
+        )
+
+
+def print_replay_report(report: ReplayReport):
+    rate = report.ops / report.seconds if report.seconds else 0
+    print(f"{report.layout}: {report.ops} calls in {report.seconds:.3f}s", end="")
+    print(f" ({rate:,.0f} calls/s)")
+    print(
+        f"  {'arena':32} {'size':>9} {'used':>9} {'peak':>9} {'free':>9}"
+        + f" {'largest':>9} {'min lrg':>9} {'frag':>6} {'blocks':>9} {'peak':>4}"
+        + f" {'fails':>5}"
+    )
+    for arena in report.arenas:
+        stats = arena.stats
+        name = "  " * stats.depth + stats.name
+        print(
+            f"  {name:32} {stats.length:9} {stats.used:9} {arena.peak_used:9}"
+            + f" {stats.free:9} {stats.largest_free:9} {arena.min_largest_free:9}"
+            + f" {stats.fragmentation:6.1%} {stats.n_blocks:4}/{stats.max_blocks:<4}"
+            + f" {arena.peak_blocks:4} {arena.failures:5}"
+        )
+    if report.divergences:
+        print(
+            f"  {report.divergences} pointers diverged from the trace"
+            + f" (first at call {report.first_divergence})"
+        )
+    for index, name, size in report.failures[:10]:
+        print(f"  call {index}: allocation of {size} bytes failed in {name}")
+    if len(report.failures) > 10:
+        print(f"  ... and {len(report.failures) - 10} more failed allocations")
+
+
+def verify(allocator: Allocator, arenas: Sequence[Tuple[Arena, int]]) -> bool:
+    """Compare the simulated arenas with the arenas of a RAM dump.
+
+    Returns:
+        bool: whether all arenas match
+    """
+    simulated = {arena.address: arena for arena in allocator.arenas}
+    ok = True
+    for arena, _ in arenas:
+        sim = simulated.pop(arena.address, None)
+        if sim is None:
+            print(f"{arena.name}: not created in the trace")
+            ok = False
+            continue
+        blocks = [b.freeze() for b in sim.blocks]
+        mismatch = next(
+            (
+                i
+                for i, (expected, actual) in enumerate(zip(arena.blocks, blocks))
+                if expected != actual
+            ),
+            min(len(arena.blocks), len(blocks)),
+        )
+        if mismatch == len(arena.blocks) == len(blocks):
+            print(f"{arena.name}: {len(blocks)} blocks match")
+            continue
+        ok = False
+        print(f"{arena.name}: mismatch at block {mismatch}")
+        for label, source in [("dump", arena.blocks), ("sim", blocks)]:
+            if mismatch < len(source):
+                block = source[mismatch]
+                print(
+                    f"  {label:4} 0x{block.data:08X} used {block.used:8}"
+                    + f" free {block.available:8} {format_flags(block.content_flags)}"
+                    + f" (alloc 0x{block.alloc_flags:X}, user 0x{block.user_flags:X})"
+                )
+            else:
+                print(f"  {label:4} (only {len(source)} blocks)")
+    for sim in simulated.values():
+        print(f"{sim.name}: not found in the dump")
+        ok = False
+    return ok
+
+
+def bench(ops: int, seed: int = 0) -> ReplayReport:
+    """Replay a random workload of object allocations and frees in an arena with
+    the default arena's size."""
+    rng = random.Random(seed)
+    address = 0x2000000
+    allocator = Allocator(
+        ArenaLayout(address, address, DEFAULT_ARENA_LENGTH, DEFAULT_ARENA_MAX_BLOCKS)
+    )
+    live: List[int] = []
+    trace = []
+    for _ in range(ops):
+        if live and (len(live) >= 200 or rng.random() < 0.5):
+            i = rng.randrange(len(live))
+            live[i], live[-1] = live[-1], live[i]
+            trace.append(TraceOp("free", 0, 0, live.pop(), 0))
+        else:
+            size = int(2 ** rng.uniform(4, 14))
+            flags = rng.choice([MEM_OBJECT, MEM_IN_USE | MEM_OBJECT]) << 8
+            # The pointer is unknown until replayed; any value in the arena
+            # routes the allocation there
+            trace.append(TraceOp("alloc", size, flags, address, 0))
+            live.append(len(trace))
+    # Frees refer to the allocation they release by trace index, resolved to
+    # the simulated pointer during the replay
+    pointers: Dict[int, int] = {}
+    start = time.perf_counter()
+    arena = allocator.default
+    for index, op in enumerate(trace, 1):
+        if op.kind == "alloc":
+            pointers[index] = arena.alloc(op.size, op.flags >> 8, op.flags, index)
+        else:
+            arena.free(pointers.pop(op.pointer))
+        allocator.ops += 1
+    seconds = time.perf_counter() - start
+    return allocator.report(f"random workload (seed {seed})", seconds)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Simulate the memory allocator and replay allocator traces"
+    )
+    parser.add_argument(
+        "-v", "--version", choices=VERSIONS, default="NA", help="game version"
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    replay_parser = subparsers.add_parser(
+        "replay", help="replay a trace against layouts"
+    )
+    replay_parser.add_argument("trace", help="trace of allocator calls")
+    replay_parser.add_argument(
+        "--layout",
+        action="append",
+        default=[],
+        help="JSON layout to replay against, in addition to the game layout"
+        + " (can be repeated)",
+    )
+    replay_parser.add_argument(
+        "--initial", help="RAM dump holding the heap at the start of the trace"
+    )
+    add_jobs_argument(replay_parser)
+
+    verify_parser = subparsers.add_parser(
+        "verify", help="compare a replayed trace with a RAM dump"
+    )
+    verify_parser.add_argument("trace", help="trace of allocator calls")
+    verify_parser.add_argument("dump", help="RAM dump taken at the end of the trace")
+    verify_parser.add_argument(
+        "--initial", help="RAM dump holding the heap at the start of the trace"
+    )
+
+    bench_parser = subparsers.add_parser(
+        "bench", help="measure the replay speed on a random workload"
+    )
+    bench_parser.add_argument(
+        "--ops", type=int, default=1000000, help="number of calls"
+    )
+    bench_parser.add_argument("--seed", type=int, default=0, help="random seed")
+
+    args = parser.parse_args()
+
+    if args.command == "replay":
+        layouts: List[Optional[str]] = [None, *args.layout]
+        if len(layouts) > 1:
+            reports = replay_layouts(
+                args.trace, args.version, layouts, args.initial, args.jobs
+            )
+        else:
+            reports = [replay(args.trace, args.version, None, args.initial)[0]]
+        for report in reports:
+            print_replay_report(report)
+    elif args.command == "verify":
+        report, allocator = replay(args.trace, args.version, None, args.initial)
+        if report.divergences:
+            print(
+                f"{report.divergences} pointers diverged from the trace"
+                + f" (first at call {report.first_divergence})"
+            )
+        if not verify(allocator, initial_arenas(args.dump, args.version)):
+            sys.exit(1)
+    elif args.command == "bench":
+        print_replay_report(bench(args.ops, args.seed))
@@ -14,15 +14,32 @@ conversions will be listed. If no binary files are provided and only absolute
 offsets are given, all possible binary files will be considered. If any of the
 input offsets are relative, an explicit list of binary files must be provided.
 
+Many overlays share load addresses, so absolute addresses within overlays are
+often ambiguous. An overlay context (the set of overlays that are loaded at the
+same time) can be given to resolve this. When an overlay context is given, only
+the overlays in the context are considered, along with all the non-overlay
+binaries.
+
+For converting large numbers of offsets at once (e.g., whole trace dumps), the
+tool also has a bulk mode, which reads whitespace-separated offsets from a file
+or from stdin and prints one conversion per line. Bulk conversions are done
+with a sorted interval table for the selected binaries, so the cost per offset
+is a binary search regardless of how many binaries are being considered.
+
 Example usage:
 python3 offsets.py 0x2010000 0x22DC260
 python3 offsets.py -b arm9 -b overlay29 0x2010000 0x22DC260
 python3 offsets.py -v EU -b overlay29 0x22DCBA0
 python3 offsets.py -b arm9 0x100 0x200 0x2010000
+python3 offsets.py -c overlay10 -c overlay29 0x22DC260
+python3 offsets.py -c overlay10 -c overlay29 --bulk </path/to/trace.txt>
 """
 
 import argparse
-from typing import List, Optional, Union
+import bisect
+import itertools
+import sys
+from typing import Dict, Iterable, List, Optional, Tuple, Union
 
 
 class Binary:
@@ -58,6 +75,12 @@ class Binary:
             return absolute - self.address + self.file_offset
         raise ValueError(f"absolute offset {hex(absolute)} is out of binary range")
 
+    def overlaps(self, other: "Binary") -> bool:
+        return (
+            self.address < other.address + other.length
+            and other.address < self.address + self.length
+        )
+
 
 BINARIES = {
     "NA": {
@@ -198,6 +221,90 @@ BINARY_NAMES = sorted(
 )
 
 
+def select_binaries(
+    version: str,
+    bin_names: Optional[List[str]] = None,
+    context: Optional[List[str]] = None,
+) -> Dict[str, Binary]:
+    """Select the binaries to consider for offset conversion.
+
+    Args:
+        version (str): game version
+        bin_names (Optional[List[str]]): list of binary file names to consider,
+            or None for all binaries
+        context (Optional[List[str]]): list of overlays that are loaded at the
+            same time, or None to consider all overlays
+
+    Raises:
+        ValueError: overlay context contains overlapping overlays
+
+    Returns:
+        Dict[str, Binary]: selected binaries, keyed by name
+    """
+    local_bin_map = BINARIES[version]
+    if context is not None:
+        for a, b in itertools.combinations(context, 2):
+            if local_bin_map[a].overlaps(local_bin_map[b]):
+                raise ValueError(
+                    f"overlays {a} and {b} overlap and cannot be loaded at the same time"
+                )
+    return {
+        bname: b
+        for bname, b in local_bin_map.items()
+        if (bin_names is None or bname in set(bin_names))
+        and (context is None or not bname.startswith("overlay") or bname in context)
+    }
+
+
+class IntervalTable:
+    """
+    Sorted table of intervals for classifying large numbers of offsets.
+
+    The input intervals (which may overlap) are split at every interval
+    endpoint into disjoint segments. Each segment stores the list of labeled
+    conversion deltas for the intervals covering it, so classifying an offset
+    takes a single binary search.
+    """
+
+    def __init__(self, intervals: List[Tuple[int, int, str, int]]):
+        """
+        Args:
+            intervals (List[Tuple[int, int, str, int]]): list of (start, end,
+                label, delta) tuples, where [start, end) is the interval and
+                delta is the amount to add to an offset within the interval
+                to convert it
+        """
+        # Segment k covers [bounds[k], bounds[k + 1]), and the last segment is
+        # unbounded. Offsets are nonnegative, so starting at 0 guarantees that
+        # every offset falls in some segment.
+        self.bounds: List[int] = sorted(
+            {0} | {i[0] for i in intervals} | {i[1] for i in intervals}
+        )
+        self.segments: List[List[Tuple[str, int]]] = [[] for _ in self.bounds]
+        for start, end, label, delta in intervals:
+            for k in range(
+                bisect.bisect_left(self.bounds, start),
+                bisect.bisect_left(self.bounds, end),
+            ):
+                self.segments[k].append((label, delta))
+
+    def classify(self, offsets: Iterable[int]) -> List[List[Tuple[str, int]]]:
+        """Find the intervals containing each of the given offsets.
+
+        Args:
+            offsets (Iterable[int]): nonnegative offsets to classify
+
+        Returns:
+            List[List[Tuple[str, int]]]: list of (label, delta) pairs for each
+                offset, where the converted offset is offset + delta
+        """
+        segments = self.segments
+        return [
+            segments[k - 1]
+            for k in map(bisect.bisect_right, itertools.repeat(self.bounds), offsets)
+        ]
+
+
 class OffsetMapping:
     """A mapping from some relative/absolute offset to a list of complementary offsets"""
 
@@ -231,7 +338,10 @@ class OffsetMapping:
 
 
 def convert_offsets(
-    version: str, bin_names: Optional[List[str]], offsets: List[int]
+    version: str,
+    bin_names: Optional[List[str]],
+    offsets: List[int],
+    context: Optional[List[str]] = None,
 ) -> List[OffsetMapping]:
     """Convert a list of offsets from absolute to relative or vice versa.
 
@@ -239,6 +349,8 @@ def convert_offsets(
         version (str): game version
         bin_names (Optional[List[str]]): list of binary file names to consider
         offsets (List[int]): list of offsets to convert
+        context (Optional[List[str]]): list of overlays that are loaded at the
+            same time, or None to consider all overlays
 
     Raises:
         ValueError: invalid offsets
@@ -255,11 +367,7 @@ def convert_offsets(
     max_bin_len = max([b.length for b in local_bin_map.values()])
     assert min_bin_addr > max_bin_len
 
-    selected_binaries = {
-        bname: b
-        for bname, b in local_bin_map.items()
-        if bin_names is None or bname in set(bin_names)
-    }
+    selected_binaries = select_binaries(version, bin_names, context)
 
     offset_mappings: List[OffsetMapping] = []
     for offset in offsets:
@@ -296,6 +404,87 @@ def convert_offsets(
     return offset_mappings
 
 
+def convert_offsets_bulk(
+    version: str,
+    bin_names: Optional[List[str]],
+    offsets: List[int],
+    context: Optional[List[str]] = None,
+) -> List[str]:
+    """Convert a large list of offsets from absolute to relative or vice versa.
+
+    This gives the same conversions as convert_offsets(), but classifies all
+    the offsets at once with an interval table, and formats the conversions
+    directly rather than building OffsetMapping objects. Each line is formatted
+    like str(OffsetMapping), e.g. "0x2010000 (absolute): 0x10000 (arm9)".
+
+    Args:
+        version (str): game version
+        bin_names (Optional[List[str]]): list of binary file names to consider
+        offsets (List[int]): list of offsets to convert
+        context (Optional[List[str]]): list of overlays that are loaded at the
+            same time, or None to consider all overlays
+
+    Raises:
+        ValueError: invalid offsets
+
+    Returns:
+        List[str]: formatted conversion for each input offset
+    """
+
+    local_bin_map = BINARIES[version]
+    min_bin_addr = min([b.address for b in local_bin_map.values()])
+    max_bin_len = max([b.length for b in local_bin_map.values()])
+    assert min_bin_addr > max_bin_len
+
+    if offsets:
+        lowest = min(offsets)
+        if lowest < 0:
+            raise ValueError(f"negative offset -0x{abs(lowest):X} is invalid")
+        if lowest < max_bin_len and bin_names is None:
+            raise ValueError(
+                f"no binary specified, cannot interpret relative offset 0x{lowest:X}"
+            )
+
+    selected_binaries = select_binaries(version, bin_names, context)
+
+    # Relative and absolute offsets are disjoint ranges, so a single table can
+    # hold both. Relative intervals are clipped to the range of offsets that
+    # are interpreted as relative.
+    intervals: List[Tuple[int, int, str, int]] = []
+    for bname, b in selected_binaries.items():
+        intervals.append(
+            (
+                b.file_offset,
+                min(b.file_offset + b.length, max_bin_len),
+                bname,
+                b.address - b.file_offset,
+            )
+        )
+        intervals.append(
+            (b.address, b.address + b.length, bname, b.file_offset - b.address)
+        )
+    table = IntervalTable(intervals)
+    labeled = len(selected_binaries) != 1
+
+    lines: List[str] = []
+    for offset, mapped in zip(offsets, table.classify(offsets)):
+        if offset < max_bin_len:
+            head = f"0x{offset:X} (relative): "
+        elif offset >= min_bin_addr:
+            head = f"0x{offset:X} (absolute): "
+        else:
+            head = f"0x{offset:X}: "
+        if not mapped:
+            lines.append(head + "???")
+        elif labeled:
+            lines.append(
+                head + ", ".join(f"0x{offset + d:X} ({bname})" for bname, d in mapped)
+            )
+        else:
+            lines.append(head + ", ".join(f"0x{offset + d:X}" for _, d in mapped))
+    return lines
+
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(
         description="Convert between absolute and relative offsets in the EoS binaries"
@@ -315,6 +504,22 @@ if __name__ == "__main__":
         action="append",
         help="EoS binary",
     )
+    parser.add_argument(
+        "-c",
+        "--context",
+        choices=[b for b in BINARY_NAMES if b.startswith("overlay")],
+        action="append",
+        help="overlay in the overlay context (other overlays will be ignored)",
+    )
+    parser.add_argument(
+        "--bulk",
+        nargs="?",
+        type=argparse.FileType("r"),
+        const=sys.stdin,
+        metavar="FILE",
+        help="convert whitespace-separated offsets read from a file (or stdin if"
+        + " no file is given), printing one conversion per line",
+    )
     parser.add_argument(
         "offset",
         nargs="*",
@@ -323,7 +528,15 @@ if __name__ == "__main__":
     )
     args = parser.parse_args()
 
-    offset_mappings = convert_offsets(args.version, args.binary, args.offset)
+    if args.bulk is not None:
+        offsets = args.offset + [int(tok, 0) for tok in args.bulk.read().split()]
+        lines = convert_offsets_bulk(args.version, args.binary, offsets, args.context)
+        sys.stdout.write("".join(line + "\n" for line in lines))
+        sys.exit(0)
+
+    offset_mappings = convert_offsets(
+        args.version, args.binary, args.offset, args.context
+    )
 
     print(f"Version: {args.version}")
     if args.binary:
@@ -331,6 +544,8 @@ if __name__ == "__main__":
             f"Binary(s): "
             + ", ".join([f"{b} ({BINARIES[args.version][b]})" for b in args.binary])
         )
+    if args.context:
+        print(f"Overlay context: {', '.join(args.context)}")
 
     if offset_mappings:
         print()
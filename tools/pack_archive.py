@@ -0,0 +1,484 @@
+#!/usr/bin/env python3
+
+"""
+`pack_archive.py` is a library and command line utility for reading and
+writing the .bin Pack archives that EoS opens with OpenPackFile (see
+`struct pack_file_opened` in the C headers).
+
+A Pack archive starts with a zero word and the number of entries, followed by
+the table of contents (`struct pack_file_table_of_content`: the offset and
+length of each entry, relative to the start of the archive). The table is
+terminated by a null entry, and entries are padded to an alignment boundary.
+
+An archive is memory-mapped rather than read, and entries are exposed as
+zero-copy memoryview slices of the mapping, so extracting a single entry only
+touches the pages it spans. Entries can be extracted or transformed in
+parallel: each worker process maps the archive itself, so entry data never
+needs to be pickled, only the results. Archives are rebuilt with streaming
+writes: the table of contents is reserved up-front and filled in at the end,
+and each entry is written straight from its source (a slice of another
+mapping, or a file copied in chunks), with no in-memory copy of the archive.
+By default, rebuilt archives keep the alignment and padding of the archive
+they are based on.
+
+As a library:
+
+    with PackArchive.open_rom(rom_dir, PackFileId.MONSTER) as pack:
+        wan = pack[42]  # memoryview into the mapping
+        ...
+
+Example usage:
+
+python3 pack_archive.py list /path/to/rom/MONSTER/monster.bin
+python3 pack_archive.py extract /path/to/rom/MONSTER/monster.bin -o monster/
+python3 pack_archive.py extract -i 1 -i 5 /path/to/rom/DUNGEON/dungeon.bin -o dungeon/
+python3 pack_archive.py rebuild /path/to/rom/MONSTER/monster.bin -o monster.bin \
+    -r 42=new_sprite.bin
+"""
+
+import argparse
+import enum
+import mmap
+import os
+from pathlib import Path
+import shutil
+import struct
+import tempfile
+import time
+from typing import (
+    Any,
+    BinaryIO,
+    Callable,
+    Dict,
+    Iterable,
+    Iterator,
+    List,
+    Optional,
+    Tuple,
+    Union,
+)
+
+from worker_pool import WorkerPool, add_jobs_argument, worker_state
+
+HEADER_FORMAT = "<II"
+TOC_ENTRY_FORMAT = "<II"
+TOC_ENTRY_SIZE = struct.calcsize(TOC_ENTRY_FORMAT)
+# Offset of the table of contents
+TOC_OFFSET = struct.calcsize(HEADER_FORMAT)
+DEFAULT_ALIGNMENT = 16
+DEFAULT_PADDING = 0xFF
+# Largest alignment detected from the offsets of an existing archive
+MAX_ALIGNMENT = 0x200
+COPY_BUFFER_SIZE = 1 << 20
+
+
+class PackFileId(enum.IntEnum):
+    """Mirrors enum pack_file_id."""
+
+    MONSTER = 0
+    M_ATTACK = 1
+    M_GROUND = 2
+    EFFECT = 3
+    DUNGEON = 4
+    M_LEVEL = 5
+
+
+# ROM filesystem paths of the Pack archives, by ID (see PACK_FILE_PATHS_TABLE)
+PACK_FILE_PATHS: Dict[PackFileId, str] = {
+    PackFileId.MONSTER: "MONSTER/monster.bin",
+    PackFileId.M_ATTACK: "MONSTER/m_attack.bin",
+    PackFileId.M_GROUND: "MONSTER/m_ground.bin",
+    PackFileId.EFFECT: "EFFECT/effect.bin",
+    PackFileId.DUNGEON: "DUNGEON/dungeon.bin",
+    PackFileId.M_LEVEL: "BALANCE/m_level.bin",
+}
+
+
+class PackArchive:
+    """
+    A memory-mapped Pack archive.
+
+    Entries are memoryview slices of the mapping, and must be released (or go
+    out of scope) before the archive is closed.
+    """
+
+    def __init__(self, path: Union[str, os.PathLike]):
+        self.path = Path(path)
+        with open(path, "rb") as f:
+            self.memory = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self.buffer = memoryview(self.memory)
+        _, count = struct.unpack_from(HEADER_FORMAT, self.buffer)
+        toc_end = TOC_OFFSET + count * TOC_ENTRY_SIZE
+        if toc_end > len(self.buffer):
+            raise ValueError(f"{path}: table of contents is truncated")
+        self.toc: List[Tuple[int, int]] = list(
+            struct.iter_unpack(TOC_ENTRY_FORMAT, self.buffer[TOC_OFFSET:toc_end])
+        )
+        for i, (offset, length) in enumerate(self.toc):
+            if offset + length > len(self.buffer):
+                raise ValueError(f"{path}: entry {i} is out of bounds")
+
+    @classmethod
+    def open_rom(
+        cls, rom_dir: Union[str, os.PathLike], pack_id: PackFileId
+    ) -> "PackArchive":
+        """Open a Pack archive in an extracted ROM filesystem by its ID."""
+        return cls(Path(rom_dir) / PACK_FILE_PATHS[pack_id])
+
+    def close(self):
+        self.buffer.release()
+        self.memory.close()
+
+    def __enter__(self) -> "PackArchive":
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __len__(self) -> int:
+        return len(self.toc)
+
+    def __getitem__(self, index: int) -> memoryview:
+        """Get an entry (like LoadFileInPack), without copying it."""
+        offset, length = self.toc[index]
+        return self.buffer[offset : offset + length]
+
+    def __iter__(self) -> Iterator[memoryview]:
+        for i in range(len(self)):
+            yield self[i]
+
+    def length(self, index: int) -> int:
+        """Get the length of an entry (like GetFileLengthInPack)."""
+        return self.toc[index][1]
+
+    def alignment(self) -> int:
+        """Detect the alignment of the entries from their offsets."""
+        alignment = MAX_ALIGNMENT
+        for offset, length in self.toc:
+            if length:
+                while offset % alignment:
+                    alignment //= 2
+        return alignment
+
+    def padding(self) -> int:
+        """Detect the padding byte from the gaps between entries."""
+        end = TOC_OFFSET + (len(self.toc) + 1) * TOC_ENTRY_SIZE
+        for offset, length in sorted(self.toc):
+            if offset > end:
+                return self.buffer[end]
+            end = max(end, offset + length)
+        return DEFAULT_PADDING
+
+
+class PackWriter:
+    """
+    Writes a Pack archive one entry at a time.
+
+    The number of entries must be known up-front, so that space for the table
+    of contents can be reserved; the table is filled in when the writer is
+    closed. The archive is written to a temporary file in the same directory,
+    which only replaces the output file once the writer is closed, so the
+    output can be one of the files being read (e.g., when rebuilding an
+    archive in place), and a failed write leaves the output untouched.
+    """
+
+    def __init__(
+        self,
+        path: Union[str, os.PathLike],
+        count: int,
+        alignment: int = DEFAULT_ALIGNMENT,
+        padding: int = DEFAULT_PADDING,
+    ):
+        self.path = path
+        self.file: BinaryIO = tempfile.NamedTemporaryFile(
+            dir=os.path.dirname(os.path.abspath(path)),
+            prefix=f".{os.path.basename(path)}.",
+            delete=False,
+        )
+        self.count = count
+        self.alignment = alignment
+        self.padding = padding
+        self.toc: List[Tuple[int, int]] = []
+        # The header, the table of contents and its null terminator
+        self.position = TOC_OFFSET + (count + 1) * TOC_ENTRY_SIZE
+        self.file.write(bytes(self.position))
+        self._align()
+
+    def _align(self):
+        gap = -self.position % self.alignment
+        self.file.write(bytes([self.padding]) * gap)
+        self.position += gap
+
+    def _begin(self) -> int:
+        if len(self.toc) >= self.count:
+            raise ValueError(f"more than {self.count} entries written")
+        return self.position
+
+    def _end(self, offset: int):
+        self.toc.append((offset, self.position - offset))
+        self._align()
+
+    def write(self, data: Union[bytes, memoryview]):
+        """Write the next entry from a buffer."""
+        offset = self._begin()
+        self.position += self.file.write(data)
+        self._end(offset)
+
+    def write_file(self, source: BinaryIO):
+        """Write the next entry from a file, copying it in chunks."""
+        offset = self._begin()
+        shutil.copyfileobj(source, self.file, COPY_BUFFER_SIZE)
+        self.position = self.file.tell()
+        self._end(offset)
+
+    def close(self):
+        if len(self.toc) != self.count:
+            self.discard()
+            raise ValueError(f"wrote {len(self.toc)} entries, expected {self.count}")
+        self.file.seek(0)
+        self.file.write(struct.pack(HEADER_FORMAT, 0, self.count))
+        for entry in self.toc:
+            self.file.write(struct.pack(TOC_ENTRY_FORMAT, *entry))
+        self.file.close()
+        # Temporary files are private, so give the archive the permissions of
+        # the file it replaces, or those of a newly created file
+        try:
+            mode = os.stat(self.path).st_mode & 0o777
+        except FileNotFoundError:
+            umask = os.umask(0)
+            os.umask(umask)
+            mode = 0o666 & ~umask
+        os.chmod(self.file.name, mode)
+        os.replace(self.file.name, self.path)
+
+    def discard(self):
+        """Abandon the archive, leaving the output file untouched."""
+        self.file.close()
+        os.unlink(self.file.name)
+
+    def __enter__(self) -> "PackWriter":
+        return self
+
+    def __exit__(self, exc_type, *exc):
+        if exc_type is None:
+            self.close()
+        else:
+            self.discard()
+
+
+# Entry transform: (entry index, entry data) -> result
+Transform = Callable[[int, memoryview], Any]
+
+
+def _setup_transform(path: Path, transform: Transform) -> Tuple[PackArchive, Transform]:
+    return PackArchive(path), transform
+
+
+def _run_transform(index: int) -> Any:
+    archive, transform = worker_state()
+    entry = archive[index]
+    try:
+        return transform(index, entry)
+    finally:
+        entry.release()
+
+
+def map_entries(
+    path: Union[str, os.PathLike],
+    transform: Transform,
+    indexes: Optional[Iterable[int]] = None,
+    jobs: Optional[int] = None,
+) -> Iterator[Any]:
+    """Apply a transform to the entries of a Pack archive in parallel.
+
+    Args:
+        path (Union[str, os.PathLike]): Pack archive
+        transform (Transform): picklable function called with the index and
+            data of each entry in a worker process
+        indexes (Optional[Iterable[int]]): entries to transform (defaults to
+            all of them)
+        jobs (Optional[int]): number of worker processes (defaults to the CPU
+            count)
+
+    Returns:
+        Iterator[Any]: the results, in the order of the indexes
+    """
+    if indexes is None:
+        with PackArchive(path) as archive:
+            indexes = range(len(archive))
+    with WorkerPool(jobs, _setup_transform, (Path(path), transform)) as executor:
+        yield from executor.map(_run_transform, indexes, chunksize=16)
+
+
+class EntryWriter:
+    """Transform that writes each entry to <output_dir>/<index>.bin.
+
+    An optional transform is applied to the entry data first.
+    """
+
+    def __init__(
+        self,
+        output_dir: Union[str, os.PathLike],
+        transform: Optional[Callable[[memoryview], Union[bytes, memoryview]]] = None,
+    ):
+        self.output_dir = Path(output_dir)
+        self.transform = transform
+
+    def __call__(self, index: int, data: memoryview) -> int:
+        out = self.transform(data) if self.transform is not None else data
+        (self.output_dir / f"{index:04}.bin").write_bytes(out)
+        return len(out)
+
+
+def extract(
+    path: Union[str, os.PathLike],
+    output_dir: Union[str, os.PathLike],
+    indexes: Optional[Iterable[int]] = None,
+    transform: Optional[Callable[[memoryview], Union[bytes, memoryview]]] = None,
+    jobs: Optional[int] = None,
+) -> int:
+    """Extract the entries of a Pack archive to <output_dir>/<index>.bin.
+
+    Args:
+        path (Union[str, os.PathLike]): Pack archive
+        output_dir (Union[str, os.PathLike]): output directory
+        indexes (Optional[Iterable[int]]): entries to extract (defaults to all
+            of them)
+        transform (Optional[Callable]): picklable function applied to the data
+            of each entry before it's written
+        jobs (Optional[int]): number of worker processes (defaults to the CPU
+            count)
+
+    Returns:
+        int: total number of bytes written
+    """
+    os.makedirs(output_dir, exist_ok=True)
+    return sum(map_entries(path, EntryWriter(output_dir, transform), indexes, jobs))
+
+
+def rebuild(
+    source: Union[str, os.PathLike],
+    output: Union[str, os.PathLike],
+    replacements: Dict[int, Union[str, os.PathLike]],
+    alignment: Optional[int] = None,
+    padding: Optional[int] = None,
+):
+    """Rebuild a Pack archive, replacing some of its entries with files.
+
+    Args:
+        source (Union[str, os.PathLike]): Pack archive to base the new one on
+        output (Union[str, os.PathLike]): new Pack archive
+        replacements (Dict[int, Union[str, os.PathLike]]): files to replace
+            entries with, by index. An index one past the last entry appends
+            a new entry.
+        alignment (Optional[int]): entry alignment (defaults to the alignment
+            of the source archive)
+        padding (Optional[int]): padding byte (defaults to the padding byte of
+            the source archive)
+    """
+    with PackArchive(source) as archive:
+        count = max(len(archive), max(replacements, default=-1) + 1)
+        missing = set(range(len(archive), count)) - set(replacements)
+        if missing:
+            raise ValueError(f"no replacement for new entries {sorted(missing)}")
+        if alignment is None:
+            alignment = archive.alignment()
+        if padding is None:
+            padding = archive.padding()
+    # The source is unmapped before the writer replaces the output, which may
+    # be the source itself
+    with PackWriter(output, count, alignment, padding) as writer:
+        with PackArchive(source) as archive:
+            for i in range(count):
+                if i in replacements:
+                    with open(replacements[i], "rb") as f:
+                        writer.write_file(f)
+                else:
+                    entry = archive[i]
+                    writer.write(entry)
+                    entry.release()
+
+
+def parse_replacement(arg: str) -> Tuple[int, Path]:
+    index, _, path = arg.partition("=")
+    if not path:
+        raise argparse.ArgumentTypeError(f"expected INDEX=FILE, got '{arg}'")
+    return int(index, 0), Path(path)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Read and write Pack archives")
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    list_parser = subparsers.add_parser(
+        "list", help="list the entries of a Pack archive"
+    )
+    list_parser.add_argument("pack", help="Pack archive")
+
+    extract_parser = subparsers.add_parser(
+        "extract", help="extract entries of a Pack archive in parallel"
+    )
+    extract_parser.add_argument(
+        "-i",
+        "--index",
+        type=lambda x: int(x, 0),
+        action="append",
+        help="entry to extract (can be repeated; defaults to all entries)",
+    )
+    add_jobs_argument(extract_parser)
+    extract_parser.add_argument(
+        "-o", "--output-dir", required=True, help="output directory"
+    )
+    extract_parser.add_argument("pack", help="Pack archive")
+
+    rebuild_parser = subparsers.add_parser(
+        "rebuild", help="rebuild a Pack archive with replaced entries"
+    )
+    rebuild_parser.add_argument(
+        "-r",
+        "--replace",
+        type=parse_replacement,
+        action="append",
+        default=[],
+        metavar="INDEX=FILE",
+        help="replace an entry with a file (can be repeated)",
+    )
+    rebuild_parser.add_argument(
+        "-a",
+        "--alignment",
+        type=lambda x: int(x, 0),
+        help="entry alignment (defaults to that of the source archive)",
+    )
+    rebuild_parser.add_argument(
+        "-p",
+        "--padding",
+        type=lambda x: int(x, 0),
+        help="padding byte (defaults to that of the source archive)",
+    )
+    rebuild_parser.add_argument(
+        "-o", "--output", required=True, help="output Pack archive"
+    )
+    rebuild_parser.add_argument("pack", help="Pack archive to base the new one on")
+    args = parser.parse_args()
+
+    if args.command == "list":
+        with PackArchive(args.pack) as archive:
+            print(
+                f"{len(archive)} entries, alignment {archive.alignment()},"
+                + f" padding 0x{archive.padding():02X}"
+            )
+            for i, (offset, length) in enumerate(archive.toc):
+                entry = archive[i]
+                magic = bytes(entry[:5])
+                entry.release()
+                name = magic.decode() if magic.isalnum() else ""
+                print(f"{i:4}: offset 0x{offset:08X}, length 0x{length:06X} {name}")
+    elif args.command == "extract":
+        start = time.perf_counter()
+        total = extract(args.pack, args.output_dir, args.index, jobs=args.jobs)
+        elapsed = time.perf_counter() - start
+        print(f"Extracted {total} bytes from {args.pack} in {elapsed:.2f} s")
+    elif args.command == "rebuild":
+        rebuild(
+            args.pack, args.output, dict(args.replace), args.alignment, args.padding
+        )
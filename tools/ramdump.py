@@ -0,0 +1,352 @@
+#!/usr/bin/env python3
+
+"""
+`ramdump.py` is a library and command line utility for decoding main RAM dumps
+of EoS using the types in the pmdsky-debug C headers.
+
+A dump is memory-mapped rather than read, and values are decoded lazily
+straight out of the mapping. Views into a dump are typed by the struct layout
+database generated from the C headers (see `make layouts` in the headers
+directory), and global data symbols are resolved to addresses with the symbol
+tables. Pointers within a dump hold 32-bit game addresses, which are translated
+to offsets within the mapping when dereferenced. This makes it cheap to decode
+a handful of fields from many large dumps: nothing is copied or decoded
+up-front, and the layout database and symbol tables are loaded only once per
+game version.
+
+As a library:
+
+    symbols = load_data_symbols("NA")
+    layouts = load_layouts("NA")
+    with RamDump("dump.bin", layouts, symbols) as dump:
+        dungeon = dump.symbol("DUNGEON_PTR").deref()
+        # Enums stored as 8-bit integers are wrapped in a struct with a val field
+        print(dungeon.floor, dungeon.floor_properties.layout.val)
+        for item in dump.symbol("BAG_ITEMS"):
+            ...
+
+From the command line, expressions are a global data symbol name followed by
+any number of field accesses (`.field`), array subscripts (`[n]`), and pointer
+dereferences (`->field`, or `*` as a suffix).
+
+Example usage:
+
+python3 ramdump.py </path/to/dump.bin> 'DUNGEON_PTR->floor_properties'
+python3 ramdump.py -v EU </path/to/dump.bin> 'BAG_ITEMS[0]' BAG_ITEMS[1].id
+"""
+
+import argparse
+import mmap
+import os
+from pathlib import Path
+import re
+import struct
+import sys
+from typing import Dict, Iterator, List, Optional, Union
+import yaml
+
+ROOT_DIR = Path(__file__).resolve().parent.parent
+SYMBOLS_DIR = ROOT_DIR / "symbols"
+LAYOUTS_DIR = ROOT_DIR / "headers" / "build"
+
+sys.path.insert(0, str(ROOT_DIR / "headers"))
+from struct_layouts import Kind, LayoutDatabase, NONE  # noqa: E402
+
+# Use the LibYAML-based loader if it's available, since it's much faster
+YAML_LOADER = getattr(yaml, "CSafeLoader", yaml.SafeLoader)
+# Load address of main RAM, which is where dumps start
+RAM_ADDRESS = 0x2000000
+VERSIONS = ["NA", "EU", "JP"]
+
+# struct formats for integer scalars, keyed by (size, signed)
+SCALAR_FORMATS: Dict[tuple, struct.Struct] = {
+    (size, signed): struct.Struct("<" + (code.lower() if signed else code))
+    for size, code in [(1, "B"), (2, "H"), (4, "I"), (8, "Q")]
+    for signed in [False, True]
+}
+
+
+def load_data_symbols(version: str) -> Dict[str, int]:
+    """Load the addresses of all data symbols in the symbol tables.
+
+    Args:
+        version (str): game version
+
+    Returns:
+        Dict[str, int]: address of each data symbol (the first address, for
+            symbols with multiple addresses)
+    """
+    addresses: Dict[str, int] = {}
+    for path in sorted(SYMBOLS_DIR.rglob("*.yml")):
+        with open(path, "r") as f:
+            contents = yaml.load(f, Loader=YAML_LOADER)
+        if not isinstance(contents, dict):
+            continue
+        for block in contents.values():
+            for symbol in block.get("data", []):
+                address = symbol.get("address", {}).get(version)
+                if isinstance(address, list):
+                    address = address[0] if address else None
+                if address is not None:
+                    addresses.setdefault(symbol["name"], address)
+    return addresses
+
+
+def load_layouts(version: str, layouts_dir: Path = LAYOUTS_DIR) -> LayoutDatabase:
+    """Load the struct layout database for a game version.
+
+    Args:
+        version (str): game version
+        layouts_dir (Path): directory containing the generated databases
+
+    Returns:
+        LayoutDatabase: layout database
+    """
+    return LayoutDatabase.load(str(layouts_dir / f"layouts_{version.lower()}.bin"))
+
+
+class View:
+    """
+    A typed view of a value within a RAM dump.
+
+    Fields of struct/union views can be accessed as attributes (or with
+    string subscripts, for fields whose names clash with View attributes like
+    `type` or `size`), and elements of array views with integer subscripts.
+    Accessing a scalar member decodes it; accessing an aggregate member
+    returns another view.
+    """
+
+    __slots__ = ("dump", "address", "type")
+
+    def __init__(self, dump: "RamDump", address: int, type_: int):
+        self.dump = dump
+        self.address = address
+        self.type = dump.layouts.resolve(type_)
+
+    @property
+    def kind(self) -> int:
+        if self.type == NONE:
+            return Kind.VOID
+        return self.dump.layouts.types[self.type].kind
+
+    @property
+    def size(self) -> int:
+        return 0 if self.type == NONE else self.dump.layouts.types[self.type].size
+
+    def raw(self) -> memoryview:
+        """Get the underlying bytes of the value, without copying."""
+        offset = self.dump.offset(self.address, self.size)
+        return self.dump.buffer[offset : offset + self.size]
+
+    def value(self) -> Union[int, "View"]:
+        """Decode the value if it's an integer or enum.
+
+        Views of other types (aggregates and pointers) are returned as is.
+        """
+        t = self.dump.layouts.types[self.type] if self.type != NONE else None
+        if t is None or t.kind not in (Kind.BASE, Kind.ENUM):
+            return self
+        return SCALAR_FORMATS[(t.size, t.signed)].unpack_from(
+            self.dump.memory, self.dump.offset(self.address, t.size)
+        )[0]
+
+    def target(self) -> Optional["View"]:
+        """Get a view of the target of a pointer view, or None if it's null."""
+        t = self.dump.layouts.types[self.type] if self.type != NONE else None
+        if t is None or t.kind != Kind.POINTER:
+            raise TypeError(f"{self.type_name()} is not a pointer")
+        (address,) = SCALAR_FORMATS[(4, False)].unpack_from(
+            self.dump.memory, self.dump.offset(self.address, 4)
+        )
+        return View(self.dump, address, t.ref) if address else None
+
+    def deref(self) -> "View":
+        """Dereference a pointer view."""
+        target = self.target()
+        if target is None:
+            raise ValueError(f"null pointer dereference at 0x{self.address:X}")
+        return target
+
+    def field(self, name: str) -> Union[int, "View"]:
+        field = self.dump.layouts.field_map(self.type).get(name)
+        if field is None:
+            raise AttributeError(f"{self.type_name()} has no field '{name}'")
+        if field.bit_size:
+            nbytes = (field.bit_offset + field.bit_size + 7) // 8
+            offset = self.dump.offset(self.address + field.offset, nbytes)
+            raw = int.from_bytes(self.dump.buffer[offset : offset + nbytes], "little")
+            value = (raw >> field.bit_offset) & ((1 << field.bit_size) - 1)
+            t = self.dump.layouts.types[self.dump.layouts.resolve(field.type)]
+            if t.signed and value >> (field.bit_size - 1):
+                value -= 1 << field.bit_size
+            return value
+        return View(self.dump, self.address + field.offset, field.type).value()
+
+    def element(self, index: int) -> Union[int, "View"]:
+        t = self.dump.layouts.types[self.type] if self.type != NONE else None
+        if t is None or t.kind != Kind.ARRAY:
+            raise TypeError(f"{self.type_name()} is not an array")
+        # Unsized arrays can be indexed freely, like in C
+        if index < 0 or (t.count and index >= t.count):
+            raise IndexError(f"index {index} out of range for {self.type_name()}")
+        element_size = self.dump.layouts.types[self.dump.layouts.resolve(t.ref)].size
+        return View(self.dump, self.address + index * element_size, t.ref).value()
+
+    def __getattr__(self, name: str) -> Union[int, "View"]:
+        if name.startswith("__"):
+            raise AttributeError(name)
+        return self.field(name)
+
+    def __getitem__(self, key: Union[int, str]) -> Union[int, "View"]:
+        if isinstance(key, str):
+            return self.field(key)
+        return self.element(key)
+
+    def __len__(self) -> int:
+        if self.kind != Kind.ARRAY:
+            raise TypeError(f"{self.type_name()} is not an array")
+        return self.dump.layouts.types[self.type].count
+
+    def __iter__(self) -> Iterator[Union[int, "View"]]:
+        for i in range(len(self)):
+            yield self.element(i)
+
+    def type_name(self) -> str:
+        return self.dump.layouts.type_name(self.type)
+
+    def __repr__(self) -> str:
+        return f"<{self.type_name()} at 0x{self.address:X}>"
+
+
+class RamDump:
+    """A memory-mapped main RAM dump"""
+
+    def __init__(
+        self,
+        path: Union[str, os.PathLike],
+        layouts: LayoutDatabase,
+        symbols: Dict[str, int],
+        base_address: int = RAM_ADDRESS,
+    ):
+        """
+        Args:
+            path (Union[str, os.PathLike]): path to the RAM dump
+            layouts (LayoutDatabase): layout database for the dump's version
+            symbols (Dict[str, int]): data symbol addresses for the dump's
+                version, from load_data_symbols()
+            base_address (int): address of the start of the dump
+        """
+        self.layouts = layouts
+        self.symbols = symbols
+        self.base_address = base_address
+        with open(path, "rb") as f:
+            self.memory = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self.buffer = memoryview(self.memory)
+
+    def close(self):
+        self.buffer.release()
+        self.memory.close()
+
+    def __enter__(self) -> "RamDump":
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def offset(self, address: int, size: int = 0) -> int:
+        """Translate a 32-bit game address into an offset within the dump."""
+        offset = address - self.base_address
+        if offset < 0 or offset + size > len(self.memory):
+            raise ValueError(f"address 0x{address:X} is outside the dump")
+        return offset
+
+    def view(self, address: int, type_name: str) -> View:
+        """Create a view of a value with a given type at a given address."""
+        return View(self, address, self.layouts.lookup(type_name))
+
+    def symbol(self, name: str) -> View:
+        """Create a view of a global data symbol."""
+        if name not in self.symbols:
+            raise KeyError(f"no address for data symbol '{name}'")
+        if name not in self.layouts.globals:
+            raise KeyError(f"no type for data symbol '{name}' in the C headers")
+        return View(self, self.symbols[name], self.layouts.globals[name])
+
+
+EXPRESSION_TOKEN_REGEX = re.compile(r"\s*(?:(->|\.)\s*(\w+)|\[\s*(\w+)\s*\]|(\*))")
+
+
+def evaluate(dump: RamDump, expression: str) -> Union[int, View]:
+    """Evaluate a symbol expression like `DUNGEON_PTR->floor_properties`."""
+    m = re.match(r"\s*(\w+)", expression)
+    if not m:
+        raise ValueError(f"invalid expression '{expression}'")
+    value: Union[int, View] = dump.symbol(m.group(1)).value()
+    pos = m.end()
+    while pos < len(expression.rstrip()):
+        m = EXPRESSION_TOKEN_REGEX.match(expression, pos)
+        if not m or not isinstance(value, View):
+            raise ValueError(f"invalid expression '{expression}' at offset {pos}")
+        op, name, index, star = m.groups()
+        if op == "->" or star:
+            value = value.deref()
+        if name is not None:
+            value = value.field(name)
+        elif index is not None:
+            value = value.element(int(index, 0))
+        pos = m.end()
+    return value
+
+
+def format_value(value: Union[int, View]) -> List[str]:
+    """Format a decoded value, expanding aggregates one level deep."""
+    if isinstance(value, int):
+        return [f"{value}" if value < 0 else f"0x{value:X}"]
+    if value.kind == Kind.POINTER:
+        target = value.target()
+        target_str = f"0x{target.address:X}" if target is not None else "NULL"
+        return [f"{value!r} -> {target_str}"]
+    lines = [repr(value)]
+    if value.kind in (Kind.STRUCT, Kind.UNION):
+        members = [
+            (f".{name}", value.field(name))
+            for name in value.dump.layouts.field_map(value.type)
+        ]
+    elif value.kind == Kind.ARRAY:
+        members = [(f"[{i}]", element) for i, element in enumerate(value)]
+    else:
+        members = []
+    for label, member in members:
+        lines.append(f"  {label} = {format_value(member)[0]}")
+    return lines
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Decode values from an EoS main RAM dump"
+    )
+    parser.add_argument(
+        "-v",
+        "--version",
+        choices=VERSIONS,
+        type=str.upper,
+        default="NA",
+        help="EoS version",
+    )
+    parser.add_argument(
+        "--layouts-dir",
+        type=Path,
+        default=LAYOUTS_DIR,
+        help="directory containing the layout databases generated by"
+        + " `make layouts` in the headers directory",
+    )
+    parser.add_argument("dump", help="main RAM dump file")
+    parser.add_argument("expression", nargs="+", help="symbol expression to decode")
+    args = parser.parse_args()
+
+    layouts = load_layouts(args.version, args.layouts_dir)
+    symbols = load_data_symbols(args.version)
+    with RamDump(args.dump, layouts, symbols) as dump:
+        for expression in args.expression:
+            lines = format_value(evaluate(dump, expression))
+            print(f"{expression}: " + "\n".join(lines))
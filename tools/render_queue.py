@@ -0,0 +1,706 @@
+#!/usr/bin/env python3
+
+"""
+`render_queue.py` is a library and command line utility for rendering the
+queue of 3D elements that EoS builds up in RENDER_3D each frame (see `union
+render_3d_element` in the C headers) without an emulator, for headless UI
+regression tests.
+
+The queue is read from a RAM dump (RENDER_3D.render_queue, with
+RENDER_3D.current_index elements), or from a raw dump of the queue itself (52
+bytes per element). Like Render3dProcessQueue, elements are drawn in order of
+their z_index (z = -(z_index + 1), so higher indexes are drawn first), and
+each element type is converted to a polygon like the corresponding function in
+RENDER_3D_FUNCTIONS:
+    - RENDER_RECTANGLE and RENDER_TEXTURE: a rectangle with its top-left
+      corner at -negative_corner_pos, scaled, rotated clockwise and translated,
+      all in fixed-point arithmetic with 6 fraction bits (sines and cosines
+      have 12 fraction bits). Texture rectangles are texture_size texels in
+      size, with 1 texel per 1/64 unit before scaling.
+    - RENDER_QUADRILATERAL and RENDER_TILING: the given vertices, in triangle
+      strip order (v0 v1 / v2 v3). Tilings repeat the texture according to
+      the texture parameters.
+Vertex colors are interpolated across the polygon when the element is
+multicolored, textures are modulated by the vertex color and color 0 of
+paletted textures is transparent (as set by Render3dSetTextureParams), and
+polygons are blended with an alpha of 0-31 (0 is not drawn). The
+transformed coordinates are mapped to screen pixels by dividing them by
+--units-per-pixel (64 by default, i.e., 1.0 per pixel).
+
+Textures are read from a dump of texture VRAM (512 KiB, with the palette index
+data of 4x4-compressed textures in slot 1) and a dump of texture palette VRAM,
+and decoded with `wte_textures.py`. If they aren't given, textured elements
+are drawn with their vertex colors only.
+
+The rasterizer splits the screen into bands of rows and rasterizes each band
+in a separate process (or, when rendering several queues, each queue in a
+separate process). Polygons are split into two triangles and filled a span at
+a time: untextured opaque spans of a single color are filled with one slice
+assignment, and other spans compute each color channel for the whole span at
+once before blending. The per-pixel arithmetic (interpolation, texel lookups,
+modulation and blending) is done by map() over whole spans and slice
+assignments of bytes objects, so that it runs in C.
+
+Example usage:
+
+python3 render_queue.py list dump.bin
+python3 render_queue.py render dump.bin -o out/ --texture-vram tex.bin \
+    --palette-vram pal.bin
+python3 render_queue.py render --raw queue1.bin queue2.bin -o out/
+python3 render_queue.py bench dump.bin -n 100
+"""
+
+import argparse
+from concurrent.futures import ProcessPoolExecutor
+import enum
+from itertools import repeat
+import math
+import operator
+import os
+from pathlib import Path
+import struct
+import time
+from typing import (
+    Dict,
+    Iterable,
+    Iterator,
+    List,
+    NamedTuple,
+    Optional,
+    Sequence,
+    Tuple,
+    Union,
+)
+
+from ramdump import VERSIONS, RamDump, load_data_symbols, load_layouts
+from rgba import rgb555, write_png
+from worker_pool import WorkerPool, add_jobs_argument
+from wte_textures import TexelDecoder, TextureFormat
+
+ELEMENT_SIZE = 52
+HEADER_FORMAT = "<HH"
+RECTANGLE_FORMAT = "<4xhhhhhh4xHHH4HBB?x"
+QUADRILATERAL_FORMAT = "<4x8h6x4HxB?x"
+TILING_FORMAT = "<4xiihhhhH8h4H2xBB?x"
+TEXTURE_FORMAT = "<4xiihhhhHhhhhHHHHBB"
+SCREEN_WIDTH = 256
+SCREEN_HEIGHT = 192
+BAND_HEIGHT = 48
+FRACTION_BITS = 6
+TRIG_FRACTION_BITS = 12
+MAX_ALPHA = 31
+# Layout of texture VRAM: 4 slots, with the palette index data of compressed
+# textures in slot 0 and 2 stored in slot 1
+TEXTURE_SLOT_SIZE = 0x20000
+
+
+class RenderType(enum.IntEnum):
+    """Mirrors enum render_type."""
+
+    RECTANGLE = 0
+    QUADRILATERAL = 1
+    TILING = 2
+    TEXTURE = 3
+
+
+class TextureParams(NamedTuple):
+    """Mirrors struct render_3d_texture_params."""
+
+    width: int
+    height: int
+    format: TextureFormat
+    repeat_s: bool
+    repeat_t: bool
+
+    @classmethod
+    def unpack(cls, raw: int) -> "TextureParams":
+        return cls(
+            8 << (raw & 7),
+            8 << ((raw >> 3) & 7),
+            TextureFormat((raw >> 8) & 7),
+            bool(raw & 0x800),
+            bool(raw & 0x1000),
+        )
+
+
+class Element(NamedTuple):
+    """A render_3d_element, with the fields of all types flattened."""
+
+    type: RenderType
+    z_index: int
+    # Vertices (quadrilateral, tiling) or rectangle corners (rectangle,
+    # texture), as (x, y) pairs in fixed-point
+    points: Tuple[Tuple[int, int], ...]
+    colors: Tuple[int, ...]
+    alpha: int
+    multicolored: bool
+    translation: Tuple[int, int] = (0, 0)
+    scale: Tuple[int, int] = (1 << FRACTION_BITS, 1 << FRACTION_BITS)
+    rotation: int = 0
+    texture_vram_offset: int = 0
+    palette_base_addr: int = 0
+    texture_top_left: Tuple[int, int] = (0, 0)
+    texture_size: Tuple[int, int] = (0, 0)
+    texture_params: Optional[TextureParams] = None
+
+
+def _corners(
+    corner: Tuple[int, int], size: Tuple[int, int]
+) -> Tuple[Tuple[int, int], ...]:
+    """Rectangle corners, in triangle strip order."""
+    (x, y), (w, h) = corner, size
+    return ((x, y), (x + w, y), (x, y + h), (x + w, y + h))
+
+
+def parse_element(data: Union[bytes, memoryview], offset: int = 0) -> Element:
+    """Decode a render_3d_element."""
+    type_and_flags, z_index = struct.unpack_from(HEADER_FORMAT, data, offset)
+    render_type = RenderType(type_and_flags & 7)
+    if render_type == RenderType.RECTANGLE:
+        (tx, ty, w, h, nx, ny, sx, sy, rotation, *rest) = struct.unpack_from(
+            RECTANGLE_FORMAT, data, offset
+        )
+        colors, (_, alpha, multicolored) = tuple(rest[:4]), rest[4:]
+        return Element(
+            render_type,
+            z_index,
+            _corners((-nx, -ny), (w, h)),
+            colors,
+            alpha,
+            multicolored,
+            translation=(tx, ty),
+            scale=(sx, sy),
+            rotation=rotation,
+        )
+    if render_type == RenderType.QUADRILATERAL:
+        values = struct.unpack_from(QUADRILATERAL_FORMAT, data, offset)
+        points = tuple(zip(values[0:8:2], values[1:8:2]))
+        return Element(
+            render_type, z_index, points, values[8:12], values[12], values[13]
+        )
+    if render_type == RenderType.TILING:
+        (vram, palette, tlx, tly, tw, th, params, *rest) = struct.unpack_from(
+            TILING_FORMAT, data, offset
+        )
+        points = tuple(zip(rest[0:8:2], rest[1:8:2]))
+        return Element(
+            render_type,
+            z_index,
+            points,
+            tuple(rest[8:12]),
+            rest[13],
+            rest[14],
+            texture_vram_offset=vram,
+            palette_base_addr=palette,
+            texture_top_left=(tlx, tly),
+            texture_size=(tw, th),
+            texture_params=TextureParams.unpack(params),
+        )
+    (
+        vram,
+        palette,
+        tlx,
+        tly,
+        tw,
+        th,
+        params,
+        tx,
+        ty,
+        nx,
+        ny,
+        sx,
+        sy,
+        color,
+        rotation,
+        _,
+        alpha,
+    ) = struct.unpack_from(TEXTURE_FORMAT, data, offset)
+    return Element(
+        render_type,
+        z_index,
+        _corners((-nx, -ny), (tw, th)),
+        (color,) * 4,
+        alpha,
+        False,
+        translation=(tx, ty),
+        scale=(sx, sy),
+        rotation=rotation,
+        texture_vram_offset=vram,
+        palette_base_addr=palette,
+        texture_top_left=(tlx, tly),
+        texture_size=(tw, th),
+        texture_params=TextureParams.unpack(params),
+    )
+
+
+def parse_queue(data: Union[bytes, memoryview]) -> List[Element]:
+    return [parse_element(data, i) for i in range(0, len(data), ELEMENT_SIZE)]
+
+
+def load_queue(dump_path: str, version: str) -> bytes:
+    """Read the render queue of RENDER_3D from a RAM dump."""
+    with RamDump(dump_path, load_layouts(version), load_data_symbols(version)) as dump:
+        render_3d = dump.symbol("RENDER_3D")
+        count = max(render_3d.current_index, 0)
+        queue = render_3d.render_queue.target()
+        if queue is None or not count:
+            return b""
+        start = dump.offset(queue.address, count * ELEMENT_SIZE)
+        return bytes(dump.buffer[start : start + count * ELEMENT_SIZE])
+
+
+def transform(element: Element) -> List[Tuple[int, int]]:
+    """Scale, rotate and translate the corners of a rectangle or texture."""
+    if element.type in (RenderType.QUADRILATERAL, RenderType.TILING):
+        return list(element.points)
+    angle = element.rotation * 2 * math.pi / 0x10000
+    one = 1 << TRIG_FRACTION_BITS
+    sin = round(math.sin(angle) * one)
+    cos = round(math.cos(angle) * one)
+    sx, sy = element.scale
+    tx, ty = element.translation
+    points = []
+    for x, y in element.points:
+        x = (x * sx) >> FRACTION_BITS
+        y = (y * sy) >> FRACTION_BITS
+        rx = (x * cos - y * sin) >> TRIG_FRACTION_BITS
+        ry = (x * sin + y * cos) >> TRIG_FRACTION_BITS
+        points.append((rx + (tx << FRACTION_BITS), ry + (ty << FRACTION_BITS)))
+    return points
+
+
+class Texture(NamedTuple):
+    width: int
+    height: int
+    repeat_s: bool
+    repeat_t: bool
+    # RGBA channels, one byte per texel each
+    channels: Tuple[bytes, bytes, bytes, bytes]
+
+
+class Vram(NamedTuple):
+    """Texture and texture palette VRAM."""
+
+    texture: bytes
+    palette: bytes
+
+    def load_texture(
+        self, vram_offset: int, palette_addr: int, params: TextureParams
+    ) -> Texture:
+        colors = [
+            rgb555(c)
+            for (c,) in struct.iter_unpack(
+                "<H", self.palette[palette_addr : palette_addr + 512]
+            )
+        ]
+        index_offset = None
+        if params.format == TextureFormat.COMPRESSED:
+            slot, offset = divmod(vram_offset, TEXTURE_SLOT_SIZE)
+            index_offset = TEXTURE_SLOT_SIZE + (slot // 2) * 0x10000 + offset // 2
+        rgba = TexelDecoder(
+            self.texture,
+            vram_offset,
+            params.width,
+            params.height,
+            params.format,
+            colors,
+            True,
+            index_offset,
+        ).to_rgba()
+        return Texture(
+            params.width,
+            params.height,
+            params.repeat_s,
+            params.repeat_t,
+            (rgba[0::4], rgba[1::4], rgba[2::4], rgba[3::4]),
+        )
+
+
+class Vertex(NamedTuple):
+    x: float
+    y: float
+    r: int
+    g: int
+    b: int
+    s: float
+    t: float
+
+
+class Polygon(NamedTuple):
+    z_index: int
+    # In triangle strip order
+    vertices: Tuple[Vertex, Vertex, Vertex, Vertex]
+    alpha: int
+    shaded: bool
+    texture: Optional[Texture]
+
+
+def to_polygon(
+    element: Element,
+    vram: Optional[Vram],
+    units_per_pixel: float,
+    texture_cache: Dict[Tuple[int, int, TextureParams], Texture],
+) -> Polygon:
+    """Convert an element to a polygon in screen coordinates."""
+    colors = element.colors if element.multicolored else (element.colors[0],) * 4
+    tlx, tly = element.texture_top_left
+    tw, th = element.texture_size
+    texcoords = ((tlx, tly), (tlx + tw, tly), (tlx, tly + th), (tlx + tw, tly + th))
+    vertices = tuple(
+        Vertex(x / units_per_pixel, y / units_per_pixel, *rgb555(c)[:3], s, t)
+        for (x, y), c, (s, t) in zip(transform(element), colors, texcoords)
+    )
+    texture = None
+    if vram is not None and element.texture_params is not None:
+        key = (
+            element.texture_vram_offset,
+            element.palette_base_addr,
+            element.texture_params,
+        )
+        texture = texture_cache.get(key)
+        if texture is None:
+            texture = vram.load_texture(*key)
+            texture_cache[key] = texture
+    return Polygon(
+        element.z_index,
+        vertices,  # type: ignore
+        element.alpha,
+        element.multicolored and len(set(colors)) > 1,
+        texture,
+    )
+
+
+def prepare(
+    elements: Sequence[Element],
+    vram: Optional[Vram] = None,
+    units_per_pixel: float = 1 << FRACTION_BITS,
+) -> List[Polygon]:
+    """Convert elements to polygons, in drawing order."""
+    cache: Dict[Tuple[int, int, TextureParams], Texture] = {}
+    polygons = [
+        to_polygon(e, vram, units_per_pixel, cache)
+        for e in elements
+        if e.alpha > 0
+    ]
+    # Stable, so elements with the same z_index are drawn in queue order
+    polygons.sort(key=lambda p: -p.z_index)
+    return polygons
+
+
+def _plane(
+    a: Vertex, b: Vertex, c: Vertex, values: Tuple[float, float, float]
+) -> Tuple[float, float, float]:
+    """Coefficients (dx, dy, c) of an attribute interpolated across a triangle."""
+    det = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y)
+    va, vb, vc = values
+    dx = ((vb - va) * (c.y - a.y) - (vc - va) * (b.y - a.y)) / det
+    dy = ((vc - va) * (b.x - a.x) - (vb - va) * (c.x - a.x)) / det
+    return dx, dy, va - dx * a.x - dy * a.y
+
+
+def _ramp(start: float, step: float, n: int) -> Iterator[int]:
+    """floor(start + step * k) for k in range(n)."""
+    if step == 0:
+        return repeat(math.floor(start), n)
+    offsets = map(operator.mul, range(n), repeat(step))
+    return map(math.floor, map(operator.add, offsets, repeat(start)))
+
+
+def _clamp(values: Iterable[int], low: int, high: int) -> Iterator[int]:
+    return map(min, map(max, values, repeat(low)), repeat(high))
+
+
+def _channel(start: float, step: float, n: int) -> bytes:
+    """A color channel interpolated across a span, clamped to 0-255."""
+    if step == 0:
+        return bytes([min(255, max(0, math.floor(start)))]) * n
+    values = _ramp(start, step, n)
+    # Ramps are monotonic, so they only need clamping if either end is out of range
+    ends = math.floor(start), math.floor(start + step * (n - 1))
+    if min(ends) < 0 or max(ends) > 255:
+        values = _clamp(values, 0, 255)
+    return bytes(values)
+
+
+def _blend(dst: bytearray, start: int, n: int, rgb: List[bytes], alpha: bytes):
+    """Blend per-channel colors with per-pixel alphas (0-255) into a span."""
+    opaque = alpha.count(255) == n
+    for channel in range(3):
+        span = slice(3 * start + channel, 3 * (start + n), 3)
+        if opaque:
+            dst[span] = rgb[channel]
+            continue
+        current = dst[span]
+        # (s * a + d * (255 - a)) // 255, with one multiplication
+        weighted = map(operator.mul, map(operator.sub, rgb[channel], current), alpha)
+        blended = map(operator.floordiv, weighted, repeat(255))
+        dst[span] = bytes(map(operator.add, current, blended))
+
+
+def _fill_triangle(
+    fb: bytearray,
+    width: int,
+    y0: int,
+    y1: int,
+    polygon: Polygon,
+    tri: Tuple[Vertex, Vertex, Vertex],
+):
+    a, b, c = tri
+    if (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y) == 0:
+        return
+    top = max(y0, math.ceil(min(a.y, b.y, c.y) - 0.5))
+    bottom = min(y1, math.ceil(max(a.y, b.y, c.y) - 0.5))
+    edges = ((a, b), (b, c), (c, a))
+    texture = polygon.texture
+    flat = not polygon.shaded and texture is None
+    opaque = polygon.alpha >= MAX_ALPHA
+    poly_alpha = polygon.alpha * 255 // MAX_ALPHA
+    planes = None
+    if not flat:
+        planes = [
+            _plane(a, b, c, (a.r, b.r, c.r)),
+            _plane(a, b, c, (a.g, b.g, c.g)),
+            _plane(a, b, c, (a.b, b.b, c.b)),
+            _plane(a, b, c, (a.s, b.s, c.s)),
+            _plane(a, b, c, (a.t, b.t, c.t)),
+        ]
+    color = bytes([a.r, a.g, a.b])
+    for y in range(top, bottom):
+        yc = y + 0.5
+        xs = []
+        for p, q in edges:
+            if p.y != q.y and min(p.y, q.y) <= yc < max(p.y, q.y):
+                xs.append(p.x + (yc - p.y) * (q.x - p.x) / (q.y - p.y))
+        if len(xs) < 2:
+            continue
+        start = max(0, math.ceil(min(xs) - 0.5))
+        end = min(width, math.ceil(max(xs) - 0.5))
+        n = end - start
+        if n <= 0:
+            continue
+        row = (y - y0) * width
+        if flat and opaque:
+            fb[3 * (row + start) : 3 * (row + end)] = color * n
+            continue
+        alpha = bytes([poly_alpha]) * n
+        if flat:
+            rgb = [bytes(color[i : i + 1]) * n for i in range(3)]
+        else:
+            assert planes is not None
+            xc = start + 0.5
+            rgb = [_channel(dx * xc + dy * yc + c0, dx, n) for dx, dy, c0 in planes[:3]]
+            if texture is not None:
+                sdx, sdy, sc = planes[3]
+                tdx, tdy, tc = planes[4]
+                w, h = texture.width, texture.height
+                ss = _ramp(sdx * xc + sdy * yc + sc, sdx, n)
+                ts = _ramp(tdx * xc + tdy * yc + tc, tdx, n)
+                # Texture sizes are powers of 2
+                if texture.repeat_s:
+                    ss = map(operator.and_, ss, repeat(w - 1))
+                else:
+                    ss = _clamp(ss, 0, w - 1)
+                if texture.repeat_t:
+                    ts = map(operator.and_, ts, repeat(h - 1))
+                else:
+                    ts = _clamp(ts, 0, h - 1)
+                index = list(map(operator.add, map(operator.mul, ts, repeat(w)), ss))
+                white = b"\xff" * n
+                for i in range(3):
+                    texels = bytes(map(texture.channels[i].__getitem__, index))
+                    if rgb[i] != white:
+                        modulated = map(operator.mul, texels, rgb[i])
+                        texels = bytes(map(operator.floordiv, modulated, repeat(255)))
+                    rgb[i] = texels
+                alpha = bytes(map(texture.channels[3].__getitem__, index))
+                if poly_alpha < 255:
+                    weighted = map(operator.mul, alpha, repeat(poly_alpha))
+                    alpha = bytes(map(operator.floordiv, weighted, repeat(255)))
+        _blend(fb, row + start, n, rgb, alpha)
+
+
+def rasterize_band(
+    polygons: Sequence[Polygon], width: int, y0: int, y1: int, clear: bytes
+) -> bytearray:
+    """Rasterize the rows y0 to y1 of the screen, as RGB."""
+    fb = bytearray(clear * (width * (y1 - y0)))
+    for polygon in polygons:
+        v0, v1, v2, v3 = polygon.vertices
+        if max(v.y for v in polygon.vertices) < y0 or min(
+            v.y for v in polygon.vertices
+        ) >= y1:
+            continue
+        _fill_triangle(fb, width, y0, y1, polygon, (v0, v1, v2))
+        _fill_triangle(fb, width, y0, y1, polygon, (v1, v3, v2))
+    return fb
+
+
+def _rasterize_band_task(args) -> bytearray:
+    return rasterize_band(*args)
+
+
+def to_rgba(rgb: bytes) -> bytearray:
+    out = bytearray(b"\xff" * (len(rgb) // 3 * 4))
+    for channel in range(3):
+        out[channel::4] = rgb[channel::3]
+    return out
+
+
+def render(
+    polygons: Sequence[Polygon],
+    width: int = SCREEN_WIDTH,
+    height: int = SCREEN_HEIGHT,
+    clear: bytes = bytes(3),
+    executor: Optional[ProcessPoolExecutor] = None,
+) -> bytearray:
+    """Render polygons to an RGBA image, optionally one band per process."""
+    bands = [
+        (polygons, width, y, min(y + BAND_HEIGHT, height), clear)
+        for y in range(0, height, BAND_HEIGHT)
+    ]
+    if executor is None:
+        rgb = b"".join(rasterize_band(*band) for band in bands)
+    else:
+        rgb = b"".join(executor.map(_rasterize_band_task, bands))
+    return to_rgba(rgb)
+
+
+class RenderOptions(NamedTuple):
+    raw: bool
+    version: str
+    vram: Optional[Vram]
+    units_per_pixel: float
+    clear: bytes
+
+
+def load_elements(path: str, options: RenderOptions) -> List[Element]:
+    data = Path(path).read_bytes() if options.raw else load_queue(path, options.version)
+    return parse_queue(data)
+
+
+def render_file(
+    path: str,
+    output: str,
+    options: RenderOptions,
+    executor: Optional[ProcessPoolExecutor] = None,
+) -> str:
+    polygons = prepare(
+        load_elements(path, options), options.vram, options.units_per_pixel
+    )
+    rgba = render(polygons, clear=options.clear, executor=executor)
+    write_png(output, SCREEN_WIDTH, SCREEN_HEIGHT, rgba)
+    return output
+
+
+def _render_file_task(args) -> str:
+    return render_file(*args)
+
+
+def render_files(
+    paths: Sequence[str],
+    output_dir: str,
+    options: RenderOptions,
+    jobs: Optional[int] = None,
+) -> List[str]:
+    """Render queues to <output_dir>/<name>.png in parallel.
+
+    A single queue is split into bands that are rendered in parallel; several
+    queues are rendered in parallel, one per process.
+    """
+    os.makedirs(output_dir, exist_ok=True)
+    outputs = [os.path.join(output_dir, f"{Path(p).stem}.png") for p in paths]
+    with WorkerPool(jobs) as executor:
+        if len(paths) == 1:
+            return [render_file(paths[0], outputs[0], options, executor)]
+        return list(
+            executor.map(
+                _render_file_task, [(p, o, options) for p, o in zip(paths, outputs)]
+            )
+        )
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Render the RENDER_3D queue without an emulator"
+    )
+    parser.add_argument(
+        "-v",
+        "--version",
+        choices=VERSIONS,
+        default="NA",
+        help="game version of the RAM dumps",
+    )
+    parser.add_argument(
+        "--raw",
+        action="store_true",
+        help="inputs are raw dumps of the render queue instead of RAM dumps",
+    )
+    parser.add_argument("--texture-vram", help="dump of texture VRAM")
+    parser.add_argument("--palette-vram", help="dump of texture palette VRAM")
+    parser.add_argument(
+        "--units-per-pixel",
+        type=float,
+        default=1 << FRACTION_BITS,
+        help="fixed-point units per screen pixel",
+    )
+    parser.add_argument(
+        "--clear",
+        type=lambda x: bytes.fromhex(x),
+        default=bytes(3),
+        help="clear color, as RRGGBB",
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    list_parser = subparsers.add_parser("list", help="list the queued elements")
+    list_parser.add_argument("input", help="RAM dump or raw render queue")
+
+    render_parser = subparsers.add_parser("render", help="render queues to PNGs")
+    add_jobs_argument(render_parser)
+    render_parser.add_argument(
+        "-o", "--output-dir", required=True, help="output directory"
+    )
+    render_parser.add_argument(
+        "input", nargs="+", help="RAM dumps or raw render queues"
+    )
+
+    bench_parser = subparsers.add_parser(
+        "bench", help="measure rendering throughput for a queue"
+    )
+    add_jobs_argument(bench_parser)
+    bench_parser.add_argument(
+        "-n", "--frames", type=int, default=60, help="number of frames to render"
+    )
+    bench_parser.add_argument("input", help="RAM dump or raw render queue")
+    args = parser.parse_args()
+
+    vram = None
+    if args.texture_vram or args.palette_vram:
+        if not (args.texture_vram and args.palette_vram):
+            parser.error("--texture-vram and --palette-vram must be given together")
+        vram = Vram(
+            Path(args.texture_vram).read_bytes(), Path(args.palette_vram).read_bytes()
+        )
+    options = RenderOptions(
+        args.raw, args.version, vram, args.units_per_pixel, args.clear
+    )
+
+    if args.command == "list":
+        for i, element in enumerate(load_elements(args.input, options)):
+            print(f"{i:3}: {element}")
+    elif args.command == "render":
+        start = time.perf_counter()
+        render_files(args.input, args.output_dir, options, args.jobs)
+        elapsed = time.perf_counter() - start
+        print(f"Rendered {len(args.input)} queues in {elapsed:.2f} s")
+    elif args.command == "bench":
+        elements = load_elements(args.input, options)
+        with WorkerPool(args.jobs) as executor:
+            start = time.perf_counter()
+            for _ in range(args.frames):
+                polygons = prepare(elements, vram, args.units_per_pixel)
+                render(polygons, clear=args.clear, executor=executor)
+            elapsed = time.perf_counter() - start
+        print(
+            f"{len(elements)} elements: {args.frames} frames in {elapsed:.3f} s"
+            + f" ({args.frames / elapsed:.1f} frames/s)"
+        )
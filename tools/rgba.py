@@ -0,0 +1,213 @@
+#!/usr/bin/env python3
+
+"""
+`rgba.py` is a library of helpers for converting EoS graphics to RGBA images on
+the host, shared by the sprite and texture tools.
+
+Images are processed a whole buffer at a time rather than a pixel at a time:
+palette lookups are done with `bytes.translate()` (one 256-entry table per
+output channel), packed pixels are expanded with translation tables and
+strided slice assignment, and transparent blits merge rows with bitwise
+operations on big integers, so that the per-pixel work happens in native
+code. Paletted images are kept as one byte per pixel (a palette index, with
+0 as transparent) until the final conversion to RGBA.
+
+Example usage:
+
+python3 rgba.py image.png 64 32 < pixels.rgba
+"""
+
+import argparse
+import struct
+import sys
+from typing import List, Sequence, Tuple, Union
+import zlib
+
+Buffer = Union[bytes, bytearray, memoryview]
+Color = Tuple[int, int, int, int]
+
+# Nibble expansion tables for 4bpp data (the low nibble is the first pixel)
+LOW_NIBBLE = bytes(b & 0xF for b in range(256))
+HIGH_NIBBLE = bytes(b >> 4 for b in range(256))
+# Maps 0 to 0x00 and everything else to 0xFF
+OPAQUE_MASK = bytes([0]) + bytes([0xFF]) * 255
+# Maps 4bpp indexes into a palette bank (one table per bank), keeping 0
+# transparent
+BANK_TABLES = [
+    bytes(0 if i == 0 else (bank * 16 + i) & 0xFF for i in range(256))
+    for bank in range(16)
+]
+
+
+def expand_4bpp(data: Buffer) -> bytearray:
+    """Expand 4bpp pixels into one byte per pixel."""
+    data = bytes(data)
+    out = bytearray(2 * len(data))
+    out[0::2] = data.translate(LOW_NIBBLE)
+    out[1::2] = data.translate(HIGH_NIBBLE)
+    return out
+
+
+def untile(
+    data: Buffer, width: int, height: int, tile_width: int = 8, tile_height: int = 8
+) -> bytearray:
+    """Reorder one-byte-per-pixel data from tiles into rows.
+
+    Tiles are stored in row-major order, and so are the pixels in each tile.
+    Missing data is treated as transparent.
+    """
+    out = bytearray(width * height)
+    tiles_per_row = width // tile_width
+    tile_size = tile_width * tile_height
+    count = min(len(data) // tile_size, tiles_per_row * (height // tile_height))
+    for tile in range(count):
+        ty, tx = divmod(tile, tiles_per_row)
+        src = tile * tile_size
+        dst = ty * tile_height * width + tx * tile_width
+        for _ in range(tile_height):
+            out[dst : dst + tile_width] = data[src : src + tile_width]
+            src += tile_width
+            dst += width
+    return out
+
+
+def flip(data: Buffer, width: int, height: int, h_flip: bool, v_flip: bool) -> Buffer:
+    """Flip one-byte-per-pixel data horizontally and/or vertically."""
+    if not h_flip and not v_flip:
+        return data
+    rows = [data[y * width : (y + 1) * width] for y in range(height)]
+    if h_flip:
+        rows = [row[::-1] for row in rows]
+    if v_flip:
+        rows.reverse()
+    return b"".join(rows)
+
+
+def blit(
+    dst: bytearray,
+    dst_width: int,
+    src: Buffer,
+    src_width: int,
+    x: int,
+    y: int,
+):
+    """Draw one-byte-per-pixel data onto another, treating 0 as transparent.
+
+    The source is clipped to the bounds of the destination.
+    """
+    src_height = len(src) // src_width
+    dst_height = len(dst) // dst_width
+    x0 = max(x, 0)
+    x1 = min(x + src_width, dst_width)
+    if x0 >= x1:
+        return
+    for row in range(max(0, -y), min(src_height, dst_height - y)):
+        start = row * src_width + x0 - x
+        line = bytes(src[start : start + x1 - x0])
+        mask = line.translate(OPAQUE_MASK)
+        d = (y + row) * dst_width
+        if mask.count(0) == 0:
+            dst[d + x0 : d + x1] = line
+        elif mask.count(0xFF) != 0:
+            m = int.from_bytes(mask, "little")
+            merged = (int.from_bytes(dst[d + x0 : d + x1], "little") & ~m) | (
+                int.from_bytes(line, "little") & m
+            )
+            dst[d + x0 : d + x1] = merged.to_bytes(x1 - x0, "little")
+
+
+def channel_tables(colors: Sequence[Color]) -> List[bytes]:
+    """Build palette lookup tables for each RGBA channel.
+
+    Index 0 is transparent, and indexes outside the palette are black.
+    """
+    tables = [bytearray(256) for _ in range(4)]
+    for index, color in enumerate(colors[:256]):
+        if index == 0:
+            continue
+        for channel in range(4):
+            tables[channel][index] = color[channel]
+    return [bytes(table) for table in tables]
+
+
+def to_rgba(indexes: Buffer, tables: Sequence[bytes]) -> bytearray:
+    """Convert one-byte-per-pixel palette indexes to RGBA."""
+    data = bytes(indexes)
+    out = bytearray(4 * len(data))
+    for channel in range(4):
+        out[channel::4] = data.translate(tables[channel])
+    return out
+
+
+def rgb555(color: int, alpha: int = 0xFF) -> Color:
+    """Convert a 15-bit DS color to RGBA."""
+    r = color & 0x1F
+    g = (color >> 5) & 0x1F
+    b = (color >> 10) & 0x1F
+    return ((r << 3) | (r >> 2), (g << 3) | (g >> 2), (b << 3) | (b >> 2), alpha)
+
+
+def shelf_pack(
+    sizes: Sequence[Tuple[int, int]], max_width: int = 512
+) -> Tuple[List[Tuple[int, int]], int, int]:
+    """Pack rectangles into rows of an atlas, tallest first.
+
+    Returns:
+        Tuple[List[Tuple[int, int]], int, int]: position of each rectangle,
+            and the width and height of the atlas
+    """
+    width = max([max_width] + [w for w, _ in sizes])
+    positions = [(0, 0)] * len(sizes)
+    x = y = shelf_height = used_width = 0
+    for i in sorted(range(len(sizes)), key=lambda i: -sizes[i][1]):
+        w, h = sizes[i]
+        if x + w > width:
+            x = 0
+            y += shelf_height
+            shelf_height = 0
+        positions[i] = (x, y)
+        x += w
+        used_width = max(used_width, x)
+        shelf_height = max(shelf_height, h)
+    return positions, max(used_width, 1), max(y + shelf_height, 1)
+
+
+def png_bytes(width: int, height: int, rgba: Buffer) -> bytes:
+    """Encode RGBA data as a PNG image."""
+
+    def chunk(kind: bytes, body: bytes) -> bytes:
+        return (
+            struct.pack(">I", len(body))
+            + kind
+            + body
+            + struct.pack(">I", zlib.crc32(kind + body))
+        )
+
+    stride = 4 * width
+    raw = b"".join(
+        b"\x00" + bytes(rgba[y * stride : (y + 1) * stride]) for y in range(height)
+    )
+    return (
+        b"\x89PNG\r\n\x1a\n"
+        + chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, 8, 6, 0, 0, 0))
+        + chunk(b"IDAT", zlib.compress(raw, 6))
+        + chunk(b"IEND", b"")
+    )
+
+
+def write_png(path: str, width: int, height: int, rgba: Buffer):
+    with open(path, "wb") as f:
+        f.write(png_bytes(width, height, rgba))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Convert raw RGBA data to a PNG")
+    parser.add_argument("output", help="output PNG")
+    parser.add_argument("width", type=int, help="image width")
+    parser.add_argument("height", type=int, help="image height")
+    args = parser.parse_args()
+
+    data = sys.stdin.buffer.read()
+    if len(data) != 4 * args.width * args.height:
+        parser.error(f"expected {4 * args.width * args.height} bytes, got {len(data)}")
+    write_png(args.output, args.width, args.height, data)
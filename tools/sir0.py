@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+
+"""
+`sir0.py` is a library and command line utility for reading SIR0 containers,
+the wrapper that EoS uses for files with internal pointers (such as WAN
+sprites and WTE textures), which are translated into memory addresses by
+ConvertPointersSir0 when the file is loaded.
+
+A SIR0 file starts with the magic "SIR0", the offset of the content header,
+the offset of the pointer offset list, and a zero word. Pointers within the
+file are offsets relative to the start of the file. The pointer offset list
+encodes the location of every pointer in the file (including the two in the
+SIR0 header) as a sequence of deltas between consecutive locations; each delta
+is a big-endian variable-length integer with 7 bits per byte and the high bit
+set on every byte but the last. The list is terminated by a zero delta.
+
+Since the pointer offset list records exactly which words are pointers, it
+can be used to find the length of pointer tables whose length isn't stored
+anywhere else (see Sir0.pointer_table()).
+
+Example usage:
+
+python3 sir0.py sprite.wan
+"""
+
+import argparse
+from pathlib import Path
+import struct
+from typing import List, Set, Union
+
+MAGIC = b"SIR0"
+# Magic of a file whose pointers have been translated (by ConvertPointersSir0)
+MAGIC_OPENED = b"SirO"
+HEADER_FORMAT = "<4sIII"
+
+
+class Sir0:
+    """A SIR0 container, read in place from a buffer."""
+
+    def __init__(self, data: Union[bytes, memoryview]):
+        magic, self.content, pointer_list, _ = struct.unpack_from(HEADER_FORMAT, data)
+        if magic != MAGIC:
+            raise ValueError(f"not a SIR0 file: magic {magic!r}")
+        self.data = data
+        self.pointer_list = pointer_list
+        self.pointers: List[int] = decode_pointer_list(data, pointer_list)
+        self.pointer_set: Set[int] = set(self.pointers)
+
+    def pointer(self, offset: int) -> int:
+        """Read the pointer at a given offset."""
+        return struct.unpack_from("<I", self.data, offset)[0]
+
+    def pointer_table(self, offset: int) -> List[int]:
+        """Read a table of consecutive pointers starting at a given offset.
+
+        The table ends at the first word that isn't in the pointer offset list.
+        """
+        table = []
+        while offset in self.pointer_set:
+            table.append(self.pointer(offset))
+            offset += 4
+        return table
+
+
+def decode_pointer_list(data: Union[bytes, memoryview], offset: int) -> List[int]:
+    """Decode a SIR0 pointer offset list into the offsets of all pointers."""
+    pointers = []
+    location = 0
+    value = 0
+    while True:
+        byte = data[offset]
+        offset += 1
+        value = (value << 7) | (byte & 0x7F)
+        if byte & 0x80:
+            continue
+        if value == 0:
+            return pointers
+        location += value
+        pointers.append(location)
+        value = 0
+
+
+def encode_pointer_list(pointers: List[int]) -> bytes:
+    """Encode the offsets of all pointers into a SIR0 pointer offset list."""
+    out = bytearray()
+    location = 0
+    for pointer in sorted(pointers):
+        delta = pointer - location
+        location = pointer
+        groups = [delta & 0x7F]
+        delta >>= 7
+        while delta:
+            groups.append(0x80 | (delta & 0x7F))
+            delta >>= 7
+        out += bytes(reversed(groups))
+    out.append(0)
+    return bytes(out)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Inspect a SIR0 file")
+    parser.add_argument("file", help="SIR0 file")
+    args = parser.parse_args()
+
+    sir0 = Sir0(Path(args.file).read_bytes())
+    print(f"content header: 0x{sir0.content:X}")
+    print(f"pointer offset list: 0x{sir0.pointer_list:X}")
+    print(f"{len(sir0.pointers)} pointers:")
+    for offset in sir0.pointers:
+        print(f"  0x{offset:06X} -> 0x{sir0.pointer(offset):06X}")
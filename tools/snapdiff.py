@@ -0,0 +1,335 @@
+#!/usr/bin/env python3
+
+"""
+`snapdiff.py` is a library and command line utility for finding which fields
+of a struct change between successive snapshots, such as consecutive RAM dumps
+taken before and after some game action.
+
+A struct type is first flattened into its leaf fields (scalars, bitfields,
+unions, and individual array elements, with C-style paths like
+`entity_table.header.active_monster_ptrs[2]`) using the struct layout database
+generated from the C headers (see `make layouts` in the headers directory).
+Each pair of snapshots is then compared hierarchically, like a wide SIMD
+compare: 2 KiB blocks are compared with memcmp, then 256-byte lines within the
+blocks that differ, and only the lines that differ are XORed to find the exact
+runs of changed bytes. Since game actions typically touch a small fraction of
+a struct, the cost per pair is dominated by a single memcmp-speed pass over
+the snapshots. Only the changed byte runs are mapped back to leaf fields, with
+a binary search over the sorted field offsets, and bitfields are checked
+bit-for-bit so that only the bitfields that actually changed are reported.
+
+Snapshots can be taken from main RAM dumps (with a `ramdump.py` expression or
+an address to locate the struct), or from files containing just the raw
+struct.
+
+Example usage:
+
+python3 snapdiff.py -e 'DUNGEON_PTR*' dump1.bin dump2.bin dump3.bin
+python3 snapdiff.py -v EU -t 'struct entity' -a 0x21BA4E0 dump1.bin dump2.bin
+python3 snapdiff.py -t 'struct monster' --raw monster1.bin monster2.bin
+"""
+
+import argparse
+import bisect
+import itertools
+from pathlib import Path
+import re
+from typing import Iterator, List, NamedTuple, Optional, Tuple, Union
+
+from ramdump import (
+    LAYOUTS_DIR,
+    VERSIONS,
+    Kind,
+    LayoutDatabase,
+    RamDump,
+    View,
+    evaluate,
+    load_data_symbols,
+    load_layouts,
+)
+
+Buffer = Union[bytes, bytearray, memoryview]
+
+# Snapshots are compared in blocks, and then in lines within changed blocks
+BLOCK_SIZE = 2048
+LINE_SIZE = 256
+# Runs of changed bytes in the XOR of two snapshot lines
+CHANGED_RUN_REGEX = re.compile(rb"[^\x00]+")
+
+
+class Leaf(NamedTuple):
+    """A leaf field within a flattened struct"""
+
+    path: str
+    offset: int
+    size: int
+    # For bitfields, the bit position within the little-endian value at offset
+    bit_offset: int
+    bit_size: int
+    # Whether the leaf is an integer, enum or pointer that can be decoded
+    scalar: bool
+    signed: bool
+
+    def decode(self, snapshot: Buffer) -> Union[int, str]:
+        raw = snapshot[self.offset : self.offset + self.size]
+        if self.bit_size:
+            value = int.from_bytes(raw, "little") >> self.bit_offset
+            value &= (1 << self.bit_size) - 1
+            if self.signed and value >> (self.bit_size - 1):
+                value -= 1 << self.bit_size
+            return value
+        if self.scalar:
+            return int.from_bytes(raw, "little", signed=self.signed)
+        return bytes(raw).hex(" ")
+
+
+class FieldChange(NamedTuple):
+    leaf: Leaf
+    old: Union[int, str]
+    new: Union[int, str]
+
+    def __str__(self) -> str:
+        def fmt(value: Union[int, str]) -> str:
+            if isinstance(value, int) and value >= 0:
+                return f"0x{value:X}"
+            return str(value)
+
+        return (
+            f"{self.leaf.path} (+0x{self.leaf.offset:X}):"
+            + f" {fmt(self.old)} -> {fmt(self.new)}"
+        )
+
+
+class FlatLayout:
+    """A struct type flattened into a sorted list of leaf fields"""
+
+    def __init__(self, layouts: LayoutDatabase, type_name: str):
+        self.layouts = layouts
+        self.type_name = type_name
+        index = layouts.lookup(type_name)
+        self.size = layouts.types[layouts.resolve(index)].size
+        self.leaves: List[Leaf] = sorted(
+            self._flatten(index, 0, ""),
+            key=lambda leaf: (leaf.offset, leaf.bit_offset),
+        )
+        # Running maximum of the leaf end offsets. Leaves only overlap when
+        # bitfields share bytes, but this keeps the array sorted regardless.
+        self.max_ends = list(
+            itertools.accumulate(
+                (leaf.offset + leaf.size for leaf in self.leaves), max
+            )
+        )
+
+    def _flatten(self, type_: int, offset: int, path: str) -> Iterator[Leaf]:
+        layouts = self.layouts
+        index = layouts.resolve(type_)
+        t = layouts.types[index]
+        if t.kind == Kind.STRUCT:
+            for f in layouts.members(index):
+                if f.bit_size:
+                    nbytes = (f.bit_offset + f.bit_size + 7) // 8
+                    signed = layouts.types[layouts.resolve(f.type)].signed
+                    yield Leaf(
+                        self._join(path, f.name),
+                        offset + f.offset,
+                        nbytes,
+                        f.bit_offset,
+                        f.bit_size,
+                        True,
+                        signed,
+                    )
+                elif f.name is None and layouts.types[
+                    layouts.resolve(f.type)
+                ].kind == Kind.UNION:
+                    # Anonymous unions are named after their members
+                    names = "|".join(layouts.field_map(f.type))
+                    yield from self._flatten(
+                        f.type, offset + f.offset, self._join(path, names)
+                    )
+                else:
+                    yield from self._flatten(
+                        f.type, offset + f.offset, self._join(path, f.name)
+                    )
+        elif t.kind == Kind.ARRAY:
+            element_size = layouts.types[layouts.resolve(t.ref)].size
+            for i in range(t.count):
+                yield from self._flatten(
+                    t.ref, offset + i * element_size, f"{path}[{i}]"
+                )
+        else:
+            # Unions are reported as a whole, since their members overlap
+            scalar = t.kind in (Kind.BASE, Kind.ENUM, Kind.POINTER) and t.size <= 8
+            yield Leaf(path, offset, t.size, 0, 0, scalar, t.signed)
+
+    @staticmethod
+    def _join(path: str, name: Optional[str]) -> str:
+        if name is None:
+            return path
+        return f"{path}.{name}" if path else name
+
+    def changed_runs(
+        self, old: bytes, new: bytes
+    ) -> Iterator[Tuple[int, int, bytes]]:
+        """Find the runs of bytes that differ between two snapshots.
+
+        The snapshots are compared block by block, then line by line within
+        blocks that differ, with plain bytes comparisons (memcmp). Only lines
+        that differ are XORed to find the exact changed bytes.
+
+        Returns:
+            Iterator[Tuple[int, int, bytes]]: start offset, end offset, and the
+                XOR of the snapshots within the run, for each run
+        """
+        if old == new:
+            return
+        # Slices past the end of the snapshots are clamped, so only the line
+        # loop needs an explicit bound
+        for block in range(0, self.size, BLOCK_SIZE):
+            if old[block : block + BLOCK_SIZE] == new[block : block + BLOCK_SIZE]:
+                continue
+            for line in range(block, min(block + BLOCK_SIZE, self.size), LINE_SIZE):
+                a, b = old[line : line + LINE_SIZE], new[line : line + LINE_SIZE]
+                if a == b:
+                    continue
+                xor = (
+                    int.from_bytes(a, "little") ^ int.from_bytes(b, "little")
+                ).to_bytes(len(a), "little")
+                for m in CHANGED_RUN_REGEX.finditer(xor):
+                    yield line + m.start(), line + m.end(), m.group()
+
+    def diff(self, old: Buffer, new: Buffer) -> List[FieldChange]:
+        """Find the leaf fields that differ between two snapshots of the struct."""
+        if len(old) < self.size or len(new) < self.size:
+            raise ValueError(f"snapshots must be at least {self.size} bytes")
+        # Slicing bytes is much faster than slicing other buffers
+        old, new = bytes(old[: self.size]), bytes(new[: self.size])
+        changes: List[FieldChange] = []
+        last_reported = -1
+        for start, end, xor in self.changed_runs(old, new):
+            i = max(bisect.bisect_right(self.max_ends, start), last_reported + 1)
+            while i < len(self.leaves) and self.leaves[i].offset < end:
+                leaf = self.leaves[i]
+                i += 1
+                if leaf.offset + leaf.size <= start:
+                    continue
+                if leaf.bit_size:
+                    # Bitfields can share changed bytes with other bitfields,
+                    # so check the exact bits
+                    lo = max(leaf.offset, start)
+                    hi = min(leaf.offset + leaf.size, end)
+                    bits = int.from_bytes(xor[lo - start : hi - start], "little")
+                    bits <<= 8 * (lo - leaf.offset)
+                    if not (bits >> leaf.bit_offset) & ((1 << leaf.bit_size) - 1):
+                        continue
+                changes.append(FieldChange(leaf, leaf.decode(old), leaf.decode(new)))
+                last_reported = i - 1
+        return changes
+
+
+def snapshots_from_files(
+    paths: List[str],
+) -> Iterator[Tuple[str, bytes, Optional[RamDump]]]:
+    for path in paths:
+        with open(path, "rb") as f:
+            yield path, f.read(), None
+
+
+def snapshots_from_dumps(
+    paths: List[str],
+    layouts: LayoutDatabase,
+    symbols: dict,
+    expression: Optional[str],
+    address: Optional[int],
+    size: int,
+) -> Iterator[Tuple[str, memoryview, RamDump]]:
+    for path in paths:
+        dump = RamDump(path, layouts, symbols)
+        if expression is not None:
+            view = evaluate(dump, expression)
+            if not isinstance(view, View):
+                raise ValueError(f"expression '{expression}' is not an aggregate")
+            address = view.address
+        offset = dump.offset(address, size)
+        yield path, dump.buffer[offset : offset + size], dump
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Find changed struct fields between successive snapshots"
+    )
+    parser.add_argument(
+        "-v",
+        "--version",
+        choices=VERSIONS,
+        type=str.upper,
+        default="NA",
+        help="EoS version",
+    )
+    parser.add_argument(
+        "--layouts-dir",
+        type=Path,
+        default=LAYOUTS_DIR,
+        help="directory containing the layout databases generated by"
+        + " `make layouts` in the headers directory",
+    )
+    parser.add_argument(
+        "-t",
+        "--type",
+        help='struct type of the snapshots (e.g., "struct dungeon"); inferred from'
+        + " the expression if not given",
+    )
+    location = parser.add_mutually_exclusive_group(required=True)
+    location.add_argument(
+        "-e",
+        "--expression",
+        help="ramdump.py expression locating the struct within RAM dumps",
+    )
+    location.add_argument(
+        "-a",
+        "--address",
+        type=lambda x: int(x, 0),
+        help="address of the struct within RAM dumps",
+    )
+    location.add_argument(
+        "--raw",
+        action="store_true",
+        help="snapshots are files containing just the struct",
+    )
+    parser.add_argument("snapshot", nargs="+", help="snapshot files, in order")
+    args = parser.parse_args()
+
+    layouts = load_layouts(args.version, args.layouts_dir)
+    symbols = load_data_symbols(args.version) if args.expression else {}
+    type_name = args.type
+    if type_name is None:
+        if args.expression is None:
+            parser.error("--type is required without --expression")
+        with RamDump(args.snapshot[0], layouts, symbols) as dump:
+            view = evaluate(dump, args.expression)
+            type_name = view.type_name() if isinstance(view, View) else None
+        if type_name is None:
+            parser.error(f"expression '{args.expression}' is not an aggregate")
+    flat = FlatLayout(layouts, type_name)
+
+    snapshots: Iterator[Tuple[str, Buffer, Optional[RamDump]]]
+    if args.raw:
+        snapshots = snapshots_from_files(args.snapshot)
+    else:
+        snapshots = snapshots_from_dumps(
+            args.snapshot, layouts, symbols, args.expression, args.address, flat.size
+        )
+
+    prev: Optional[Tuple[str, Buffer, Optional[RamDump]]] = None
+    for current in snapshots:
+        if prev is not None:
+            changes = flat.diff(prev[1], current[1])
+            print(f"{prev[0]} -> {current[0]}: {len(changes)} changed field(s)")
+            for change in changes:
+                print(f"  {change}")
+            if prev[2] is not None:
+                prev[1].release()
+                prev[2].close()
+        prev = current
+    if prev is not None and prev[2] is not None:
+        prev[1].release()
+        prev[2].close()
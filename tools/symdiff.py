@@ -17,7 +17,8 @@ following conflict-resolution procedure is followed:
     1. Give priority to better matches, defined by the number of matching
        addresses, and whether or not the symbol names match.
     2. If there are conflicting matches of the same quality, compute a maximum
-       cardinality matching for the collection of symbols in contention.
+       cardinality matching for the collection of symbols in contention, using
+       the Hopcroft-Karp algorithm.
 
 By default, the `symdiff.py` will ignore certain "unimportant" changes to
 symbols. This includes changes to symbol descriptions, and when symbols are
@@ -25,23 +26,35 @@ moved between subregions but kept within the same top-level block. These
 changes can be included in the diff with the `--descriptions` and
 `--subregion-resolution` flags, respectively.
 
+With the `--log` flag, `symdiff.py` instead walks a whole revision range
+(following first parents) and reports the history of individual symbols across
+it. Only symbol tables whose file contents changed between neighboring commits
+are reloaded and re-paired, and the results are stored in a persistent symbol
+history index within the git directory. Subsequent queries over the same range
+(or an extension of it) reuse the index rather than walking the history again.
+The `--symbol` flag restricts the output to the history of symbols that have
+ever had a given name.
+
 Example usage:
 
 python3 symdiff.py
 python3 symdiff.py HEAD~5 HEAD~2 -- </path/to/arm9.yml> </path/to/overlay29.yml>
 python3 symdiff.py -sdv <tag name, commit hash, or branch name>
+python3 symdiff.py --log HEAD~100..HEAD -- </path/to/overlay29.yml>
+python3 symdiff.py -v --log HEAD --symbol DungeonRandInt
 """
 
 import argparse
 import collections
 import difflib
+import itertools
 from io import StringIO
+import json
 from pathlib import Path
 import subprocess
 import sys
 from typing import (
     cast,
-    Deque,
     Dict,
     Iterable,
     List,
@@ -57,6 +70,8 @@ import ansi
 
 REPO_ROOT: Path = Path(__file__).resolve().parent.parent
 SYMBOL_DIR: Path = REPO_ROOT / "symbols"
+# Use the LibYAML-based loader if it's available, since it's much faster
+YAML_LOADER = getattr(yaml, "CSafeLoader", yaml.SafeLoader)
 
 
 def git_cmd(args: List[str]) -> str:
@@ -522,9 +537,17 @@ class SymbolList(list):
             for version, addrs in s.address.items():
                 for addr in addrs:
                     for i_base in base_addr_to_idx.get((version, addr), []):
-                        match_list.setdefault(i_base, MatchRank()).n_matches += 1
+                        # Avoid setdefault() so a MatchRank is only constructed
+                        # for new candidates; this loop is hot for big tables
+                        rank = match_list.get(i_base)
+                        if rank is None:
+                            rank = match_list[i_base] = MatchRank()
+                        rank.n_matches += 1
             for i_base in base_name_to_idx.get(s.name, []):
-                match_list.setdefault(i_base, MatchRank()).matching_name = True
+                rank = match_list.get(i_base)
+                if rank is None:
+                    rank = match_list[i_base] = MatchRank()
+                rank.matching_name = True
 
         # Aggregate the match list entries by match rank
         matches_by_rank: Dict[Tuple[int, bool], Dict[int, List[int]]] = {}
@@ -548,9 +571,9 @@ class SymbolList(list):
     ) -> List[Tuple[int, int]]:
         """
         Computes a maximum cardinality matching for a bipartite graph using
-        the Ford-Fulkerson algorithm with breadth-first search.
+        the Hopcroft-Karp algorithm, which runs in O(E * sqrt(V)) time.
 
-        See: https://en.wikipedia.org/wiki/Maximum_cardinality_matching
+        See: https://en.wikipedia.org/wiki/Hopcroft%E2%80%93Karp_algorithm
 
         Args:
             edges (Dict[int, List[int]]): Graph edges, as described by the
@@ -563,68 +586,103 @@ class SymbolList(list):
             List[Tuple[int, int]]: node pairs in a maximum cardinality matching
                 in the form (left node, right node)
         """
-        # The edges that are currently assigned to the matching, keyed by the
-        # "right" nodes in the bipartite graph for quick lookup. Note that
-        # while the algorithm deals with directed edges, the actual matching
-        # has undirected edges
-        matching_reverse_edges: Dict[int, int] = {}
-        for i in edges:
-            # Hard-coded fast path; edges[i] will always have at least one
-            # element, and  in the vast majority of cases there should be no
-            # conflicts
-            if edges[i][0] not in matching_reverse_edges:
-                matching_reverse_edges[edges[i][0]] = i
-                continue
-
-            def update_matching(reverse_edges: Dict[int, int]):
-                """
-                Search for paths using breadth-first search, and update the
-                matching in reverse_edges if a valid path is found.
-                """
-
-                # The "left-to-right" edges in BFS's current search paths, but
-                # keyed in reverse (by the right nodes in the bipartite graph).
-                # This dict serves a double purpose, allowing us to keep track
-                # of which nodes have been visited and also keep track of the
-                # path itself, so that we can later update reverse_edges.
-                path_right_parents: Dict[int, int] = {}
-                # The "right-to-left" edges in BFS's current search paths, but
-                # keyed in reverse (by the left nodes in the bipartite graph).
-                # This dict is only needed to recover the full path once BFS
-                # succeeds.
-                path_left_parents: Dict[int, int] = {}
-                start_node_queue: Deque[int] = collections.deque([i])
-                while start_node_queue:
-                    start = start_node_queue.popleft()
-                    for end in edges[start]:
-                        if end in path_right_parents:
-                            # Already visited this node; skip it
+        # Relabel the nodes on both sides with contiguous integers, and store
+        # the adjacency lists in compressed sparse row form. Left node u has
+        # neighbors adj[adj_start[u]:adj_start[u + 1]].
+        left_nodes: List[int] = list(edges)
+        right_nodes: List[int] = list(
+            dict.fromkeys(j for i in left_nodes for j in edges[i])
+        )
+        right_labels: Dict[int, int] = {j: r for r, j in enumerate(right_nodes)}
+        adj: List[int] = [right_labels[j] for i in left_nodes for j in edges[i]]
+        adj_start: List[int] = [0]
+        adj_start += itertools.accumulate(len(edges[i]) for i in left_nodes)
+        n_left = len(left_nodes)
+
+        # The matching, stored from both sides. -1 means unmatched.
+        match_left: List[int] = [-1] * n_left
+        match_right: List[int] = [-1] * len(right_nodes)
+        # Greedy initial matching. In the vast majority of cases there should
+        # be no conflicts, and this will already be a maximum matching.
+        n_matched = 0
+        for u in range(n_left):
+            for r in adj[adj_start[u] : adj_start[u + 1]]:
+                if match_right[r] < 0:
+                    match_left[u] = r
+                    match_right[r] = u
+                    n_matched += 1
+                    break
+
+        inf = n_left + 1
+        dist: List[int] = [inf] * n_left
+        while n_matched < min(n_left, len(right_nodes)):
+            # Breadth-first search from all free left nodes, partitioning the
+            # left nodes into layers by the length of the shortest alternating
+            # path from a free left node. Stop at the first layer where a free
+            # right node is reachable, since augmenting paths must be shortest.
+            queue: List[int] = []
+            for u in range(n_left):
+                if match_left[u] < 0:
+                    dist[u] = 0
+                    queue.append(u)
+                else:
+                    dist[u] = inf
+            limit = inf
+            for u in queue:
+                if dist[u] >= limit:
+                    break
+                d = dist[u] + 1
+                for r in adj[adj_start[u] : adj_start[u + 1]]:
+                    v = match_right[r]
+                    if v < 0:
+                        limit = d
+                    elif dist[v] == inf:
+                        dist[v] = d
+                        queue.append(v)
+            if limit == inf:
+                # No augmenting paths left
+                break
+
+            # Find a maximal set of vertex-disjoint shortest augmenting paths
+            # with depth-first search over the layered graph, and flip the
+            # matching along each of them. The search is iterative to avoid
+            # hitting the recursion limit on long paths. next_edge[u] tracks
+            # the next edge of left node u to explore, so each edge is visited
+            # at most once per phase.
+            next_edge = adj_start[:-1]
+            for root in range(n_left):
+                if match_left[root] >= 0:
+                    continue
+                stack: List[int] = [root]
+                while stack:
+                    u = stack[-1]
+                    if next_edge[u] == adj_start[u + 1]:
+                        # Dead end; prune this node for the rest of the phase
+                        dist[u] = inf
+                        stack.pop()
+                        continue
+                    r = adj[next_edge[u]]
+                    next_edge[u] += 1
+                    v = match_right[r]
+                    if v < 0:
+                        if dist[u] + 1 != limit:
                             continue
-                        if end not in reverse_edges:
-                            # Node is free; Trace back along this path, update
-                            # the matching, and return
-                            reverse_edges[end] = start
-                            while start in path_left_parents:
-                                end = path_left_parents[start]
-                                # This should always exist
-                                start = path_right_parents[end]
-                                reverse_edges[end] = start
-                            return
-                        # This node already has an edge in the matching.
-                        # Traverse the edge from left to right and record the
-                        # reverse edge for later, then backtrack along the old
-                        # edge from right to left.
-                        path_right_parents[end] = start
-                        path_left_parents[reverse_edges[end]] = end
-                        start_node_queue.append(reverse_edges[end])
-                # There's nothing to pair node i with in the matching
-
-            # Try to make room for node i in the matching by shuffling edges
-            # around
-            update_matching(matching_reverse_edges)
-        # Since we've been storing the matching edges in reverse, we need to
-        # flip the order in the output
-        return [(i, j) for j, i in matching_reverse_edges.items()]
+                        # Found an augmenting path. Each node on the stack is
+                        # rematched to the right node it was last explored
+                        # through.
+                        for w in stack:
+                            r = adj[next_edge[w] - 1]
+                            match_left[w] = r
+                            match_right[r] = w
+                            dist[w] = inf
+                        n_matched += 1
+                        break
+                    elif dist[v] == dist[u] + 1 and dist[v] < limit:
+                        stack.append(v)
+
+        return [
+            (left_nodes[u], right_nodes[r]) for u, r in enumerate(match_left) if r >= 0
+        ]
 
     def locate_pairs(
         self, base: "SymbolList"
@@ -771,7 +829,7 @@ class SymbolTable:
         self.blocks: Dict[str, SymbolBlock] = {}
         try:
             with open_file_at_revision(path, revision) as f:
-                contents = yaml.safe_load(f)
+                contents = yaml.load(f, Loader=YAML_LOADER)
             self.valid = True
         except FileNotFoundError:
             # This file doesn't exist in the given revision; mark it as invalid
@@ -821,7 +879,7 @@ class SymbolTable:
                 sub_path = subregions.pop()
                 try:
                     with open_file_at_revision(sub_path, revision) as f:
-                        sub_contents = yaml.safe_load(f)
+                        sub_contents = yaml.load(f, Loader=YAML_LOADER)
                 except FileNotFoundError:
                     continue
                 process_subregion(sub_path, sub_contents)
@@ -978,6 +1036,362 @@ def get_modified_paths(base: str, target: Optional[str]) -> List[Path]:
     return sorted(SYMBOL_DIR / t for t in tables)
 
 
+def get_table_blobs(revision: str) -> Dict[str, Dict[str, str]]:
+    """
+    Get the git blob hashes of all symbol table files at a given revision,
+    grouped by the top-level table they belong to.
+
+    Args:
+        revision (str): git revision
+
+    Returns:
+        Dict[str, Dict[str, str]]: mapping of {top-level table name ->
+            {file path -> blob hash}}, with table names relative to the
+            symbols directory and file paths relative to the repository root
+    """
+    tables: Dict[str, Dict[str, str]] = {}
+    for line in git_cmd(["ls-tree", "-r", revision, "--", "symbols"]).splitlines():
+        # Lines are in the format "<mode> <type> <hash>\t<path>"
+        info, path_str = line.split("\t", 1)
+        path = Path(path_str)
+        if path.suffix != ".yml":
+            continue
+        table = Path(path.relative_to("symbols").parts[0]).with_suffix(".yml")
+        tables.setdefault(table.as_posix(), {})[path_str] = info.split()[2]
+    return tables
+
+
+class SymbolHistoryIndex:
+    """
+    Persistent index of the histories of individual symbols over a linear
+    sequence of revisions.
+
+    Symbols are paired up between neighboring revisions with
+    SymbolList.locate_pairs, and each chain of paired symbols (a "lineage") is
+    assigned an integer ID. The history of each lineage is stored as a list of
+    events in the form {"c": commit index, "t": event type, "s": symbol state},
+    where the event type is "+" for an addition, "-" for a deletion, or "*" for
+    a modification. Deletion events have no symbol state.
+
+    The index is built incrementally. For each new revision, only symbol tables
+    with at least one file blob that differs from the previous revision are
+    loaded and paired.
+    """
+
+    FORMAT_VERSION = 1
+
+    def __init__(self, path: Path):
+        self.path = path
+        # Indexed commit hashes, in order
+        self.commits: List[str] = []
+        # Event lists, indexed by lineage ID
+        self.histories: List[List[Dict]] = []
+        # State of each symbol table as of the last indexed commit, in the
+        # form {table name -> {"blobs": {file path -> blob hash},
+        # "ids": {block name -> {"functions": [IDs], "data": [IDs]}}}}
+        self.tip: Dict[str, Dict] = {}
+        try:
+            with path.open("r") as f:
+                contents = json.load(f)
+            if contents.get("format_version") == SymbolHistoryIndex.FORMAT_VERSION:
+                self.commits = contents["commits"]
+                self.histories = contents["histories"]
+                self.tip = contents["tip"]
+        except (FileNotFoundError, json.JSONDecodeError):
+            pass
+
+    @staticmethod
+    def default_path(first_commit: str) -> Path:
+        """
+        Get the default index file path for a commit sequence starting at the
+        given commit. Index files are stored within the git directory.
+        """
+        git_dir = Path(git_cmd(["rev-parse", "--absolute-git-dir"]).strip())
+        return git_dir / "symdiff" / f"history-{first_commit}.json"
+
+    def save(self):
+        self.path.parent.mkdir(parents=True, exist_ok=True)
+        with self.path.open("w") as f:
+            json.dump(
+                {
+                    "format_version": SymbolHistoryIndex.FORMAT_VERSION,
+                    "commits": self.commits,
+                    "histories": self.histories,
+                    "tip": self.tip,
+                },
+                f,
+                separators=(",", ":"),
+            )
+
+    @staticmethod
+    def symbol_state(symbol: Symbol) -> Dict:
+        return {
+            "name": symbol.name,
+            "file": symbol.file.as_posix(),
+            "block": symbol.blockname,
+            "address": symbol.address,
+            "length": symbol.length,
+        }
+
+    @staticmethod
+    def state_symbol(state: Dict) -> Symbol:
+        return Symbol(Path(state["file"]), state["block"], state)
+
+    def _add_lineage(self, commit_idx: int, symbol: Symbol) -> int:
+        self.histories.append(
+            [{"c": commit_idx, "t": "+", "s": self.symbol_state(symbol)}]
+        )
+        return len(self.histories) - 1
+
+    def _index_symbol_list(
+        self,
+        commit_idx: int,
+        old_symbols: SymbolList,
+        old_ids: List[int],
+        new_symbols: SymbolList,
+    ) -> List[int]:
+        """
+        Record the events between two revisions of a symbol list, and return
+        the lineage IDs of the symbols in the new revision.
+        """
+        pairs, unpaired_new_idxs, unpaired_old_idxs = new_symbols.locate_pairs(
+            old_symbols
+        )
+        new_ids: List[int] = [-1] * len(new_symbols)
+        for i, j in pairs:
+            new_ids[i] = old_ids[j]
+            state = self.symbol_state(new_symbols[i])
+            if state != self.symbol_state(old_symbols[j]):
+                self.histories[new_ids[i]].append(
+                    {"c": commit_idx, "t": "*", "s": state}
+                )
+        for i in unpaired_new_idxs:
+            new_ids[i] = self._add_lineage(commit_idx, new_symbols[i])
+        for j in unpaired_old_idxs:
+            self.histories[old_ids[j]].append({"c": commit_idx, "t": "-"})
+        return new_ids
+
+    def _index_table(
+        self,
+        commit_idx: int,
+        old_table: Optional[SymbolTable],
+        old_ids: Dict[str, Dict[str, List[int]]],
+        new_table: Optional[SymbolTable],
+    ) -> Dict[str, Dict[str, List[int]]]:
+        """
+        Record the events between two revisions of a symbol table, and return
+        the lineage IDs of the symbols in the new revision. Either revision of
+        the table may be None if the table doesn't exist.
+        """
+        old_blocks = old_table.blocks if old_table is not None else {}
+        new_blocks = new_table.blocks if new_table is not None else {}
+        empty_block = SymbolBlock(SymbolList(), SymbolList())
+        new_ids: Dict[str, Dict[str, List[int]]] = {}
+        for bname in list(new_blocks) + [b for b in old_blocks if b not in new_blocks]:
+            old_block = old_blocks.get(bname, empty_block)
+            new_block = new_blocks.get(bname, empty_block)
+            block_ids = {
+                "functions": self._index_symbol_list(
+                    commit_idx,
+                    old_block.functions,
+                    old_ids.get(bname, {}).get("functions", []),
+                    new_block.functions,
+                ),
+                "data": self._index_symbol_list(
+                    commit_idx,
+                    old_block.data,
+                    old_ids.get(bname, {}).get("data", []),
+                    new_block.data,
+                ),
+            }
+            if bname in new_blocks:
+                new_ids[bname] = block_ids
+        return new_ids
+
+    def update(self, commits: List[str], verbose: bool = False):
+        """Extend the index to cover the given sequence of commits.
+
+        If the already indexed commits are a prefix of the given sequence, only
+        the remaining commits are processed. Otherwise, the index is rebuilt
+        from scratch.
+
+        Args:
+            commits (List[str]): full commit hashes, in chronological order
+            verbose (bool, optional): whether or not to print progress to
+                stderr. Defaults to False.
+        """
+        if self.commits != commits[: len(self.commits)]:
+            self.commits = []
+            self.histories = []
+            self.tip = {}
+
+        # Tables as of the last processed commit, loaded lazily
+        prev_tables: Dict[str, SymbolTable] = {}
+        for commit_idx in range(len(self.commits), len(commits)):
+            commit = commits[commit_idx]
+            if verbose:
+                print(
+                    f"[{commit_idx + 1}/{len(commits)}] indexing {commit}",
+                    file=sys.stderr,
+                )
+            blobs = get_table_blobs(commit)
+            new_tip: Dict[str, Dict] = {}
+            for table in sorted(set(blobs) | set(self.tip)):
+                old_tip = self.tip.get(table)
+                if old_tip is not None and old_tip["blobs"] == blobs.get(table):
+                    # Unchanged since the last revision
+                    new_tip[table] = old_tip
+                    continue
+
+                old_table = None
+                if old_tip is not None:
+                    old_table = prev_tables.get(table)
+                    if old_table is None:
+                        old_table = SymbolTable(
+                            SYMBOL_DIR / table, revision=self.commits[-1]
+                        )
+                new_table = None
+                if table in blobs:
+                    new_table = SymbolTable(SYMBOL_DIR / table, revision=commit)
+                    prev_tables[table] = new_table
+                else:
+                    prev_tables.pop(table, None)
+
+                ids = self._index_table(
+                    commit_idx,
+                    old_table,
+                    old_tip["ids"] if old_tip is not None else {},
+                    new_table,
+                )
+                if new_table is not None:
+                    new_tip[table] = {"blobs": blobs[table], "ids": ids}
+            self.commits.append(commit)
+            self.tip = new_tip
+
+    def lineages(self, name: Optional[str] = None) -> List[int]:
+        """
+        Get the IDs of all lineages, or the IDs of lineages with a symbol that
+        has ever had the given name.
+        """
+        return [
+            i
+            for i, history in enumerate(self.histories)
+            if name is None
+            or any(e["t"] != "-" and e["s"]["name"] == name for e in history)
+        ]
+
+    def commit_diffs(
+        self, lineages: List[int], relocation: bool = False
+    ) -> Dict[int, SymbolTableDiff]:
+        """Reconstruct per-commit diffs for the given lineages.
+
+        Args:
+            lineages (List[int]): lineage IDs to include
+            relocation (bool, optional): whether or not to count symbol
+                relocations as "modifications" in the diff. Defaults to False.
+
+        Returns:
+            Dict[int, SymbolTableDiff]: mapping of {commit index -> diff
+                relative to the previous commit}, for nonempty diffs
+        """
+        diffs: Dict[int, SymbolTableDiff] = {}
+        for lineage in lineages:
+            prev: Optional[Symbol] = None
+            for event in self.histories[lineage]:
+                diff = diffs.setdefault(event["c"], SymbolTableDiff())
+                if event["t"] == "+":
+                    prev = self.state_symbol(event["s"])
+                    diff.added.append(prev.path())
+                elif event["t"] == "-":
+                    diff.deleted.append(cast(Symbol, prev).path())
+                else:
+                    symbol = self.state_symbol(event["s"])
+                    symdiff = symbol.diff(cast(Symbol, prev))
+                    if symdiff.is_nonempty(relocation):
+                        diff.modified.append(symdiff)
+                    prev = symbol
+        return {c: d for c, d in sorted(diffs.items()) if d}
+
+
+def print_symbol_log(
+    rev_range: str,
+    paths: List[Path],
+    *,
+    symbol_name: Optional[str] = None,
+    verbose: bool = False,
+    subregion_resolution: bool = False,
+    index_path: Optional[Path] = None,
+):
+    """Print the history of symbols over a revision range.
+
+    Args:
+        rev_range (str): revision range, either in the form <base>..<target>,
+            or a single revision for the full history up to that revision
+        paths (List[Path]): paths to top-level symbol table files by which to
+            filter the output. All files are included if empty.
+        symbol_name (Optional[str], optional): only print the history of
+            symbols that have ever had this name. Defaults to None.
+        verbose (bool, optional): whether or not to print symbol diff details
+            as part of the history. Defaults to False.
+        subregion_resolution (bool, optional): whether or not to count a symbol
+            moving between subregions within the same top-level block as a
+            "modification" in the history. Defaults to False.
+        index_path (Optional[Path], optional): path to the symbol history index
+            file. Defaults to a file within the git directory.
+    """
+    base: Optional[str] = None
+    if ".." in rev_range:
+        sep = "..." if "..." in rev_range else ".."
+        base = rev_range.split(sep, 1)[0] or "HEAD"
+    commits: List[str] = []
+    if base is not None:
+        commits.append(git_cmd(["rev-parse", f"{base}^{{commit}}"]).strip())
+    commits += git_cmd(
+        ["rev-list", "--reverse", "--first-parent", rev_range]
+    ).split()
+    if not commits:
+        return
+
+    index = SymbolHistoryIndex(
+        index_path
+        if index_path is not None
+        else SymbolHistoryIndex.default_path(commits[0])
+    )
+    n_indexed = len(index.commits)
+    index.update(commits, verbose=verbose)
+    if len(index.commits) != n_indexed:
+        index.save()
+
+    tables: Set[str] = {
+        p.resolve().relative_to(SYMBOL_DIR).as_posix() for p in paths
+    }
+
+    def in_tables(path: SymbolPath) -> bool:
+        # Symbol file paths are relative to the symbols directory, and may be
+        # subregion files
+        table = Path(path.file.parts[0]).with_suffix(".yml").as_posix()
+        return not tables or table in tables
+
+    diffs = index.commit_diffs(index.lineages(symbol_name), subregion_resolution)
+    preceding_newline = False
+    for commit_idx, diff in diffs.items():
+        if base is not None and commit_idx == 0:
+            # The base revision isn't part of the range
+            continue
+        diff = SymbolTableDiff(
+            added=[p for p in diff.added if in_tables(p)],
+            deleted=[p for p in diff.deleted if in_tables(p)],
+            modified=[d for d in diff.modified if in_tables(d.path)],
+        )
+        if not diff:
+            continue
+        if preceding_newline:
+            print()
+        ansi.print(ansi.BOLD + ansi.YELLOW, f"commit {index.commits[commit_idx]}")
+        diff.summary(verbose)
+        preceding_newline = True
+
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(
         description="Compare Git revisions of the pmdsky-debug symbol tables.",
@@ -1003,6 +1417,25 @@ if __name__ == "__main__":
         action="store_true",
         help="count symbol description changes as a modification",
     )
+    parser.add_argument(
+        "-l",
+        "--log",
+        metavar="RANGE",
+        help=(
+            "print the history of symbols over a revision range"
+            + " (<base>..<target>, or a single revision for its full history)"
+        ),
+    )
+    parser.add_argument(
+        "--symbol",
+        metavar="NAME",
+        help="with --log, only print the history of symbols that have ever had this name",
+    )
+    parser.add_argument(
+        "--index",
+        type=Path,
+        help="with --log, path to the symbol history index file",
+    )
     parser.add_argument(
         "base", nargs="?", default="HEAD", help="base revision against which to compare"
     )
@@ -1037,6 +1470,37 @@ if __name__ == "__main__":
     except ValueError:
         args = parser.parse_args()
 
+    if args.log is not None:
+        if args.base != "HEAD" or args.target is not None:
+            parser.print_usage()
+            raise SystemExit("fatal: --log does not take revision arguments")
+        nonsymbol_paths: List[Path] = []
+        for path in args.path:
+            try:
+                path.resolve().relative_to(SYMBOL_DIR)
+            except ValueError:
+                nonsymbol_paths.append(path)
+        if nonsymbol_paths:
+            path_list_str = ", ".join(f"'{p}'" for p in nonsymbol_paths)
+            raise SystemExit(
+                f"error: paths outside of symbols directory: {path_list_str}"
+            )
+        try:
+            print_symbol_log(
+                args.log,
+                args.path,
+                symbol_name=args.symbol,
+                verbose=args.verbose,
+                subregion_resolution=args.subregion_resolution,
+                index_path=args.index,
+            )
+        except subprocess.CalledProcessError as e:
+            raise SystemExit(e.stderr.decode().strip())
+        sys.exit(0)
+    elif args.symbol is not None or args.index is not None:
+        parser.print_usage()
+        raise SystemExit("fatal: --symbol and --index require --log")
+
     # git diff supports commit range syntax (a..b and a...b), so we should too.
     # But having args.base being a range would break other things, so
     # explicitly convert the commit range to a base and target revision.
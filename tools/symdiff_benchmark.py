@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+
+"""
+`symdiff_benchmark.py` is a benchmark for the symbol pairing algorithm used by
+`symdiff.py`, run on large synthetic symbol lists.
+
+Each scenario generates a base symbol list and a target symbol list that
+simulates a kind of large-scale change to the symbol tables, and times
+`SymbolList.locate_pairs` (which includes building the match graph and
+computing maximum cardinality matchings for each match rank group). The
+scenarios are:
+    - rename: every symbol is renamed, but addresses are unchanged
+    - split: symbols are reshuffled into a new order and some addresses are
+      shifted, like when a block is split into subregions
+    - conflict: every symbol shares its address with a handful of random
+      other symbols, resulting in very large groups of conflicting matches
+
+Example usage:
+
+python3 symdiff_benchmark.py
+python3 symdiff_benchmark.py -n 50000 -s conflict
+"""
+
+import argparse
+from pathlib import Path
+import random
+import time
+from typing import Callable, Dict, List, Tuple
+
+from symdiff import Symbol, SymbolList
+
+BENCH_FILE = Path("benchmark.yml")
+BENCH_BLOCK = "benchmark"
+
+
+def make_symbol(name: str, addrs: Dict[str, List[int]]) -> Symbol:
+    return Symbol(BENCH_FILE, BENCH_BLOCK, {"name": name, "address": addrs})
+
+
+def scenario_rename(n: int, rng: random.Random) -> Tuple[SymbolList, SymbolList]:
+    base = [make_symbol(f"Func{i}", {"NA": [0x2000000 + 4 * i]}) for i in range(n)]
+    target = [
+        make_symbol(f"Renamed{i}", {"NA": [0x2000000 + 4 * i]}) for i in range(n)
+    ]
+    return SymbolList(target), SymbolList(base)
+
+
+def scenario_split(n: int, rng: random.Random) -> Tuple[SymbolList, SymbolList]:
+    base = [
+        make_symbol(f"Func{i}", {"NA": [0x2000000 + 4 * i], "EU": [0x2000100 + 4 * i]})
+        for i in range(n)
+    ]
+    target = []
+    for i in rng.sample(range(n), n):
+        addrs = {"NA": [0x2000000 + 4 * i], "EU": [0x2000100 + 4 * i]}
+        if rng.random() < 0.25:
+            # Shift the EU address, which collides with a neighboring symbol
+            addrs["EU"] = [addrs["EU"][0] + 4]
+        target.append(make_symbol(f"Func{i}", addrs))
+    return SymbolList(target), SymbolList(base)
+
+
+def scenario_conflict(n: int, rng: random.Random) -> Tuple[SymbolList, SymbolList]:
+    # Pool of addresses that's smaller than the number of symbols, so that
+    # many symbols share each address
+    pool = max(n // 4, 1)
+    base = [
+        make_symbol(
+            f"Func{i}",
+            {"NA": [0x2000000 + 4 * a for a in rng.sample(range(pool), 3)]},
+        )
+        for i in range(n)
+    ]
+    target = [
+        make_symbol(f"Renamed{i}", {"NA": [0x2000000 + 4 * rng.randrange(pool)]})
+        for i in range(n)
+    ]
+    return SymbolList(target), SymbolList(base)
+
+
+SCENARIOS: Dict[str, Callable[[int, random.Random], Tuple[SymbolList, SymbolList]]] = {
+    "rename": scenario_rename,
+    "split": scenario_split,
+    "conflict": scenario_conflict,
+}
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Benchmark the symdiff.py symbol pairing algorithm"
+    )
+    parser.add_argument(
+        "-n",
+        "--symbols",
+        type=int,
+        default=50000,
+        help="number of symbols in each synthetic symbol list",
+    )
+    parser.add_argument(
+        "-s",
+        "--scenario",
+        choices=SCENARIOS.keys(),
+        action="append",
+        help="scenario to run (defaults to all scenarios)",
+    )
+    parser.add_argument("--seed", type=int, default=0, help="random seed")
+    args = parser.parse_args()
+
+    for name in args.scenario or SCENARIOS:
+        target, base = SCENARIOS[name](args.symbols, random.Random(args.seed))
+        start = time.perf_counter()
+        pairs, unpaired_target, unpaired_base = target.locate_pairs(base)
+        elapsed = time.perf_counter() - start
+        print(
+            f"{name}: {len(pairs)} pair(s), {len(unpaired_target)} addition(s),"
+            + f" {len(unpaired_base)} deletion(s) in {elapsed:.3f} s"
+        )
@@ -0,0 +1,513 @@
+#!/usr/bin/env python3
+
+"""
+`text_layout.py` is a library and command line utility for checking the layout
+of the strings in EoS string tables (MESSAGE/text_*.str) on the host, the way
+they'd be preprocessed and displayed in a dialogue box, for translation QA.
+
+Strings are first expanded like PreprocessString does with a `struct
+preprocessor_args`: lowercase tags such as [string:0], [value:1:3],
+[kind:0], [item:0], [hero] or [speaker] (the last one only if the
+show_speaker flag of `struct preprocessor_flags` is set) are replaced with
+values, and uppercase tags are left for the dialogue box to interpret while
+it's typing the text out (see `struct dialogue_display_state`). Values for the
+lowercase tags come from a context file; tags without a value expand to
+worst-case placeholders (10 wide characters for names and strings, and as many
+digits as the tag allows for numbers), so that the checks are conservative.
+The expanded string must fit in the 1024-byte string_data buffer of `struct
+dialogue_box`.
+
+The expanded string is then laid out in pages of lines: [C] starts a new page,
+newlines and [R] start a new line, [CLUM_SET:x] moves to column x (in pixels),
+[M:...] symbols have a fixed width and other uppercase tags have no width.
+Each character's width comes from a width table (a JSON file mapping
+characters to widths, with a default width for everything else), since the
+font's metrics aren't read from the ROM here. The game doesn't wrap lines by
+itself, so lines that are too wide and pages with too many lines are reported,
+along with unknown tags and [CS:x] color tags that aren't reset with [CR]. The
+`show` command prints a string's layout, and can suggest a greedy wrap at
+spaces.
+
+A string table starts with a table of 32-bit offsets to null-terminated
+strings, the first of which also marks the end of the table. The table is
+memory-mapped, and strings are processed as bytes: tags are matched with a
+compiled regular expression and line widths are measured by translating the
+bytes of each line into widths and summing them, so no per-character objects
+are created. Only single-byte text encodings (the NA and EU text files) are
+supported.
+
+Checks are run in parallel over ranges of string IDs. With --cache, the hash
+of every string (and of the settings) is kept along with its results, so
+later runs only re-check the strings whose source changed.
+
+Example usage:
+
+python3 text_layout.py check /path/to/rom/MESSAGE/text_e.str
+python3 text_layout.py check text_e.str --context context.json \
+    --widths widths.json --cache text_e.cache.json -j 8
+python3 text_layout.py show text_e.str 4567 --wrap
+"""
+
+import argparse
+import hashlib
+import json
+import mmap
+import os
+import re
+import struct
+import time
+from typing import Dict, List, NamedTuple, Optional, Sequence, Tuple, Union
+
+from worker_pool import WorkerPool, add_jobs_argument, worker_state
+
+# Capacity of dialogue_box::string_data, including the null terminator
+STRING_CAPACITY = 1024
+DEFAULT_ENCODING = "cp1252"
+DEFAULT_CHAR_WIDTH = 6
+DEFAULT_SYMBOL_WIDTH = 12
+DEFAULT_BOX_WIDTH = 224
+DEFAULT_LINES_PER_PAGE = 3
+# Placeholders for lowercase tags without a value in the context
+PLACEHOLDER_NAME = "W" * 10
+PLACEHOLDER_DIGITS = 5
+TAG_REGEX = re.compile(rb"\[([A-Za-z_]+)((?::[^\]:]*)*)\]")
+# Layout tags, handled by the dialogue box rather than PreprocessString
+DISPLAY_TAGS = {
+    b"C",
+    b"CLUM_SET",
+    b"CR",
+    b"CS",
+    b"FT",
+    b"K",
+    b"M",
+    b"R",
+    b"STE",
+    b"STS",
+    b"TR",
+    b"TS",
+    b"W",
+}
+# Lowercase tags that PreprocessString replaces
+NAME_TAGS = {
+    b"dungeon",
+    b"hero",
+    b"item",
+    b"kind",
+    b"monster",
+    b"move",
+    b"partner",
+    b"speaker",
+    b"string",
+    b"team",
+}
+
+
+class LayoutConfig(NamedTuple):
+    box_width: int = DEFAULT_BOX_WIDTH
+    lines_per_page: int = DEFAULT_LINES_PER_PAGE
+    symbol_width: int = DEFAULT_SYMBOL_WIDTH
+    show_speaker: bool = True
+    encoding: str = DEFAULT_ENCODING
+    # Width of each byte value, in pixels
+    widths: bytes = bytes([DEFAULT_CHAR_WIDTH]) * 256
+    # Tag name -> value, or list of values indexed by the tag's first argument
+    context: Dict[str, Union[str, List[str]]] = {}
+
+    def digest(self) -> str:
+        return hashlib.blake2b(
+            repr(tuple(self)).encode(), digest_size=16
+        ).hexdigest()
+
+
+def width_table(
+    widths: Dict[str, int],
+    default: int = DEFAULT_CHAR_WIDTH,
+    encoding: str = DEFAULT_ENCODING,
+) -> bytes:
+    """Build a table of the width of each byte value."""
+    table = bytearray([default]) * 256
+    for char, width in widths.items():
+        for byte in char.encode(encoding):
+            table[byte] = width
+    for control in b"\0\n\r":
+        table[control] = 0
+    return bytes(table)
+
+
+class Issue(NamedTuple):
+    string_id: int
+    kind: str
+    message: str
+
+
+class StringTable:
+    """A memory-mapped string table file."""
+
+    def __init__(self, path: Union[str, os.PathLike]):
+        with open(path, "rb") as f:
+            self.memory = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        (first,) = struct.unpack_from("<I", self.memory, 0)
+        self.offsets = struct.unpack_from(f"<{first // 4}I", self.memory, 0)
+        # The last offset may point to the end of the file rather than a string
+        if self.offsets and self.offsets[-1] >= len(self.memory):
+            self.offsets = self.offsets[:-1]
+
+    def close(self):
+        self.memory.close()
+
+    def __enter__(self) -> "StringTable":
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __len__(self) -> int:
+        return len(self.offsets)
+
+    def __getitem__(self, string_id: int) -> bytes:
+        start = self.offsets[string_id]
+        end = self.memory.find(b"\0", start)
+        return self.memory[start : end if end >= 0 else len(self.memory)]
+
+
+def preprocess(text: bytes, config: LayoutConfig) -> Tuple[bytes, List[str]]:
+    """Expand lowercase tags like PreprocessString.
+
+    Returns:
+        Tuple[bytes, List[str]]: expanded string, and the unknown tags
+    """
+    unknown: List[str] = []
+    context = config.context
+
+    def expand(m: "re.Match[bytes]") -> bytes:
+        name = m.group(1)
+        if name in DISPLAY_TAGS:
+            return m.group(0)
+        args = m.group(2).split(b":")[1:]
+        key = name.decode("ascii")
+        if name == b"speaker" and not config.show_speaker:
+            return b""
+        if name == b"value":
+            value = context.get(key)
+            index = int(args[0]) if args and args[0].isdigit() else 0
+            if isinstance(value, list) and index < len(value):
+                return value[index].encode(config.encoding)
+            digits = int(args[1]) if len(args) > 1 and args[1].isdigit() else 0
+            return b"8" * max(digits, PLACEHOLDER_DIGITS)
+        if name in NAME_TAGS:
+            value = context.get(key)
+            if isinstance(value, list):
+                index = int(args[0]) if args and args[0].isdigit() else 0
+                value = value[index] if index < len(value) else None
+            if value is None:
+                value = PLACEHOLDER_NAME
+            return value.encode(config.encoding)
+        unknown.append(m.group(0).decode(config.encoding))
+        return m.group(0)
+
+    return TAG_REGEX.sub(expand, text), unknown
+
+
+class Line(NamedTuple):
+    page: int
+    line: int
+    width: int
+    text: bytes
+
+
+def layout(text: bytes, config: LayoutConfig) -> List[Line]:
+    """Lay out an expanded string into pages of lines."""
+    lines: List[Line] = []
+    page = line = x = start = 0
+    widths = config.widths
+
+    def break_line(end: int, resume: int, new_page: bool = False):
+        nonlocal page, line, x, start
+        lines.append(Line(page, line, x, text[start:end]))
+        if new_page:
+            page += 1
+            line = 0
+        else:
+            line += 1
+        x = 0
+        start = resume
+
+    def add_text(pos: int, end: int):
+        nonlocal x
+        newline = text.find(b"\n", pos, end)
+        while newline >= 0:
+            x += sum(text[pos:newline].translate(widths))
+            break_line(newline, newline + 1)
+            pos = newline + 1
+            newline = text.find(b"\n", pos, end)
+        x += sum(text[pos:end].translate(widths))
+
+    pos = 0
+    for m in TAG_REGEX.finditer(text):
+        add_text(pos, m.start())
+        pos = m.end()
+        name = m.group(1)
+        if name == b"R":
+            break_line(m.start(), pos)
+        elif name == b"C":
+            break_line(m.start(), pos, new_page=True)
+        elif name == b"CLUM_SET":
+            arg = m.group(2)[1:]
+            if arg.isdigit():
+                x = int(arg)
+        elif name == b"M":
+            x += config.symbol_width
+    add_text(pos, len(text))
+    lines.append(Line(page, line, x, text[start:]))
+    return lines
+
+
+def check(string_id: int, text: bytes, config: LayoutConfig) -> List[Issue]:
+    """Preprocess and lay out a string, and report any problems."""
+    issues = []
+    expanded, unknown = preprocess(text, config)
+    for tag in unknown:
+        issues.append(Issue(string_id, "unknown-tag", f"unknown tag {tag}"))
+    if len(expanded) + 1 > STRING_CAPACITY:
+        issues.append(
+            Issue(
+                string_id,
+                "overflow",
+                f"expands to {len(expanded) + 1} bytes (max {STRING_CAPACITY})",
+            )
+        )
+    colors = 0
+    for m in TAG_REGEX.finditer(expanded):
+        if m.group(1) == b"CS":
+            colors += 1
+        elif m.group(1) == b"CR":
+            colors = 0
+    if colors:
+        issues.append(Issue(string_id, "color", "[CS] without a matching [CR]"))
+    for line in layout(expanded, config):
+        if line.width > config.box_width:
+            issues.append(
+                Issue(
+                    string_id,
+                    "width",
+                    f"page {line.page} line {line.line} is {line.width} px wide"
+                    + f" (max {config.box_width})",
+                )
+            )
+        if line.line == config.lines_per_page:
+            issues.append(
+                Issue(
+                    string_id,
+                    "lines",
+                    f"page {line.page} has more than {config.lines_per_page} lines",
+                )
+            )
+    return issues
+
+
+def wrap(text: bytes, config: LayoutConfig) -> bytes:
+    """Greedily rewrap plain text at spaces to fit the box width.
+
+    Tags are kept in place and measured as expanded, and existing line and page
+    breaks are kept.
+    """
+    out = bytearray()
+    x = 0
+    space = config.widths[ord(" ")]
+    for m in re.finditer(rb"\[[^\]]*\]|\n| |[^ \n\[]+|\[", text):
+        token = m.group(0)
+        if token in (b"\n", b"[R]", b"[C]"):
+            out += token
+            x = 0
+        elif token == b" ":
+            out += token
+            x += space
+        else:
+            width = sum(preprocess(token, config)[0].translate(config.widths))
+            if token.startswith(b"[M:"):
+                width = config.symbol_width
+            if x and x + width > config.box_width:
+                if out.endswith(b" "):
+                    del out[-1]
+                out += b"\n"
+                x = 0
+            out += token
+            x += width
+    return bytes(out)
+
+
+def string_hash(text: bytes) -> str:
+    return hashlib.blake2b(text, digest_size=8).hexdigest()
+
+
+def _setup_checker(path: str, config: LayoutConfig) -> Tuple[StringTable, LayoutConfig]:
+    return StringTable(path), config
+
+
+def _check_task(string_ids: Sequence[int]) -> Dict[int, List[Issue]]:
+    table, config = worker_state()
+    return {i: check(i, table[i], config) for i in string_ids}
+
+
+def check_table(
+    path: Union[str, os.PathLike],
+    config: LayoutConfig,
+    cache_path: Optional[Union[str, os.PathLike]] = None,
+    jobs: Optional[int] = None,
+    chunk_size: int = 2048,
+) -> Tuple[Dict[int, List[Issue]], int]:
+    """Check every string of a string table in parallel.
+
+    If a cache file is given, only the strings whose hash changed since the
+    last run (or all of them if the settings changed) are re-checked, and the
+    cache is updated.
+
+    Returns:
+        Tuple[Dict[int, List[Issue]], int]: issues of each string, and the
+            number of strings that were checked
+    """
+    with StringTable(path) as table:
+        hashes = [string_hash(table[i]) for i in range(len(table))]
+    cached: Dict[int, Tuple[str, List[Issue]]] = {}
+    digest = config.digest()
+    if cache_path is not None and os.path.exists(cache_path):
+        with open(cache_path) as f:
+            data = json.load(f)
+        if data.get("config") == digest:
+            cached = {
+                int(i): (h, [Issue(*issue) for issue in issues])
+                for i, (h, issues) in data["strings"].items()
+            }
+    results: Dict[int, List[Issue]] = {}
+    todo = []
+    for i, h in enumerate(hashes):
+        if i in cached and cached[i][0] == h:
+            results[i] = cached[i][1]
+        else:
+            todo.append(i)
+    if todo:
+        chunks = [todo[i : i + chunk_size] for i in range(0, len(todo), chunk_size)]
+        with WorkerPool(jobs, _setup_checker, (str(path), config)) as executor:
+            for chunk_results in executor.map(_check_task, chunks):
+                results.update(chunk_results)
+    if cache_path is not None:
+        with open(cache_path, "w") as f:
+            json.dump(
+                {
+                    "config": digest,
+                    "strings": {
+                        str(i): [hashes[i], [list(issue) for issue in results[i]]]
+                        for i in range(len(hashes))
+                    },
+                },
+                f,
+            )
+    return results, len(todo)
+
+
+def load_config(args: argparse.Namespace) -> LayoutConfig:
+    widths = {}
+    if args.widths:
+        with open(args.widths, encoding="utf-8") as f:
+            widths = json.load(f)
+    context = {}
+    if args.context:
+        with open(args.context, encoding="utf-8") as f:
+            context = json.load(f)
+    return LayoutConfig(
+        args.box_width,
+        args.lines,
+        args.symbol_width,
+        not args.no_speaker,
+        args.encoding,
+        width_table(widths, args.char_width, args.encoding),
+        context,
+    )
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Check the layout of strings in EoS string tables"
+    )
+    parser.add_argument(
+        "--context", help="JSON file with values for lowercase tags"
+    )
+    parser.add_argument(
+        "--widths", help="JSON file mapping characters to widths in pixels"
+    )
+    parser.add_argument(
+        "--char-width",
+        type=int,
+        default=DEFAULT_CHAR_WIDTH,
+        help="width of characters missing from the width table",
+    )
+    parser.add_argument(
+        "--symbol-width",
+        type=int,
+        default=DEFAULT_SYMBOL_WIDTH,
+        help="width of [M:...] symbols",
+    )
+    parser.add_argument(
+        "--box-width",
+        type=int,
+        default=DEFAULT_BOX_WIDTH,
+        help="width of a line of the text box, in pixels",
+    )
+    parser.add_argument(
+        "--lines",
+        type=int,
+        default=DEFAULT_LINES_PER_PAGE,
+        help="number of lines per page",
+    )
+    parser.add_argument(
+        "--no-speaker",
+        action="store_true",
+        help="clear the show_speaker preprocessor flag",
+    )
+    parser.add_argument(
+        "--encoding", default=DEFAULT_ENCODING, help="text encoding (single-byte)"
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    check_parser = subparsers.add_parser("check", help="check every string")
+    check_parser.add_argument(
+        "--cache", help="cache file, to only re-check strings that changed"
+    )
+    add_jobs_argument(check_parser)
+    check_parser.add_argument("file", help="string table")
+
+    show_parser = subparsers.add_parser("show", help="show the layout of a string")
+    show_parser.add_argument(
+        "--wrap", action="store_true", help="suggest a wrap at spaces"
+    )
+    show_parser.add_argument("file", help="string table")
+    show_parser.add_argument("string_id", type=int, help="string ID")
+    args = parser.parse_args()
+
+    config = load_config(args)
+    if args.command == "check":
+        start = time.perf_counter()
+        results, checked = check_table(args.file, config, args.cache, args.jobs)
+        elapsed = time.perf_counter() - start
+        issues = [issue for i in sorted(results) for issue in results[i]]
+        for issue in issues:
+            print(f"{issue.string_id:6}: [{issue.kind}] {issue.message}")
+        print(
+            f"{len(issues)} issues in {len(results)} strings"
+            + f" ({checked} checked in {elapsed:.2f} s)"
+        )
+    elif args.command == "show":
+        with StringTable(args.file) as table:
+            text = table[args.string_id]
+        expanded, _ = preprocess(text, config)
+        for line in layout(expanded, config):
+            mark = "!" if line.width > config.box_width else " "
+            print(
+                f"{mark} page {line.page} line {line.line} ({line.width:3} px):"
+                + f" {line.text.decode(config.encoding)}"
+            )
+        for issue in check(args.string_id, text, config):
+            print(f"[{issue.kind}] {issue.message}")
+        if args.wrap:
+            print("Suggested wrap:")
+            print(wrap(text, config).decode(config.encoding))
@@ -0,0 +1,509 @@
+#!/usr/bin/env python3
+
+"""
+`wan_animation.py` is a library and command line utility for playing back WAN
+sprite animations on the host, the way `struct animation_control` does in the
+game, for bulk replays of cutscenes and dungeon turns without an emulator.
+
+The game keeps one animation_control per animated sprite. Setting an
+animation (SetAndPlayAnimationForAnimationControl) points it at the first
+frame of an animation in an animation group of a WAN sprite and loads it
+(LoadAnimationFrameAndIncrementInAnimationControl): the frame's duration,
+frame ID, sprite offset and shadow offset are copied into the control, and
+the frame's flag is ORed into anim_frame_flag_sum. When the duration runs out,
+SwitchAnimationControlToNextFrame loads the next frame; at the end of the
+animation (a frame with a duration of 0), it jumps back to the frame at the
+group's loop_start, counted from the first frame of the animation. The
+palette bank is carried along to select the palette of 4bpp fragments.
+
+Here, the frames of every animation of every loaded sprite are flattened into
+one table of parallel arrays (AnimationTable), and the state of all the
+animation controls is kept in a structure of arrays (AnimationEngine): the
+sequence each instance plays, its cursor into the frame table, the tick at
+which its current frame ends, its position, palette bank and flag sum.
+Stepping doesn't count down every instance's duration: instances are bucketed
+by the tick at which their frame ends (a timing wheel), so each tick only
+touches the instances that switch frames. Sprite placements (frame ID and
+screen position of the sprite and its shadow) are produced for all instances
+at once.
+
+Assumptions that haven't been checked against the game: durations are in
+frames of 1/60 s (one tick each), a loop_start past the end of an animation
+restarts it from its first frame, and non-looping instances stop on their
+last frame.
+
+A replay script is a JSON object:
+    {
+        "sprites": [{"file": "monster.bin", "entry": 25}, {"file": "x.wan"}],
+        "ticks": 120,
+        "instances": [
+            {"sprite": 0, "group": 0, "animation": 2, "x": 100, "y": 80,
+             "palette_bank": 0, "loop": true, "start": 0, "elapsed": 0}
+        ],
+        "events": [{"tick": 60, "instance": 0, "group": 5, "animation": 2}]
+    }
+and the replay prints one JSON line of placements per tick.
+
+Example usage:
+
+python3 wan_animation.py info sprite.wan
+python3 wan_animation.py play -g 0 -a 2 -t 60 sprite.wan
+python3 wan_animation.py replay script.json > placements.jsonl
+python3 wan_animation.py bench -n 5000 -t 600 -e 25 -e 26 monster.bin
+"""
+
+import argparse
+from array import array
+from collections import defaultdict
+import json
+import os
+from pathlib import Path
+import random
+import time
+from typing import Dict, List, NamedTuple, Optional, Sequence, Tuple, Union
+
+from wan_sprites import WanFile, load_wan
+
+
+class Placement(NamedTuple):
+    """Where to draw an instance's sprite on a given tick."""
+
+    instance: int
+    frame_id: int
+    x: int
+    y: int
+    shadow_x: int
+    shadow_y: int
+    palette_bank: int
+    # anim_frame_flag_sum
+    flags: int
+
+
+class AnimationTable:
+    """The animation frames of a set of WAN sprites, flattened into arrays.
+
+    Each animation of each animation group is a sequence: a run of
+    consecutive frames in the table, with the index of the frame to loop back
+    to.
+    """
+
+    def __init__(self):
+        self.duration = array("H")
+        self.flag = array("B")
+        self.frame_id = array("H")
+        self.offset_x = array("h")
+        self.offset_y = array("h")
+        self.shadow_x = array("h")
+        self.shadow_y = array("h")
+        self.sequence_start = array("I")
+        self.sequence_length = array("I")
+        self.sequence_loop = array("I")
+        # (sprite, animation group, animation) -> sequence
+        self.sequences: Dict[Tuple[int, int, int], int] = {}
+        self.nb_sprites = 0
+
+    def add_sprite(self, wan: WanFile) -> int:
+        """Add the animations of a sprite, and return its index in the table."""
+        sprite = self.nb_sprites
+        self.nb_sprites += 1
+        for group_id in range(wan.nb_animation_groups):
+            group = wan.animation_group(group_id)
+            for animation_id, frames in enumerate(group.animations):
+                start = len(self.duration)
+                for frame in frames:
+                    self.duration.append(frame.duration)
+                    self.flag.append(frame.flag)
+                    self.frame_id.append(frame.frame_id)
+                    self.offset_x.append(frame.offset_x)
+                    self.offset_y.append(frame.offset_y)
+                    self.shadow_x.append(frame.shadow_offset_x)
+                    self.shadow_y.append(frame.shadow_offset_y)
+                loop = group.loop_start if group.loop_start < len(frames) else 0
+                self.sequences[(sprite, group_id, animation_id)] = len(
+                    self.sequence_start
+                )
+                self.sequence_start.append(start)
+                self.sequence_length.append(len(frames))
+                self.sequence_loop.append(start + loop)
+        return sprite
+
+    def sequence(self, sprite: int, group_id: int, animation_id: int) -> int:
+        key = (sprite, group_id, animation_id)
+        if key not in self.sequences:
+            raise KeyError(
+                f"sprite {sprite} has no animation {animation_id} in group {group_id}"
+            )
+        return self.sequences[key]
+
+    def total_duration(self, sequence: int) -> int:
+        start = self.sequence_start[sequence]
+        return sum(self.duration[start : start + self.sequence_length[sequence]])
+
+
+class AnimationEngine:
+    """Plays back animations for many animation_control instances at once."""
+
+    def __init__(self, table: AnimationTable):
+        self.table = table
+        self.tick = 0
+        self.sequence = array("I")
+        self.cursor = array("I")
+        # Tick at which the current frame ends
+        self.deadline = array("I")
+        self.x = array("h")
+        self.y = array("h")
+        self.palette_bank = array("B")
+        self.flag_sum = array("I")
+        self.loop = array("B")
+        self.playing = array("B")
+        # Instances by the tick at which their frame ends. Entries are left
+        # behind when an instance's animation changes, and ignored when their
+        # tick doesn't match the instance's deadline.
+        self._wheel: Dict[int, List[int]] = defaultdict(list)
+
+    def __len__(self) -> int:
+        return len(self.sequence)
+
+    def spawn(
+        self,
+        sequence: int,
+        x: int = 0,
+        y: int = 0,
+        palette_bank: int = 0,
+        loop: bool = True,
+        elapsed: int = 0,
+    ) -> int:
+        """Create an instance and start playing an animation on it."""
+        instance = len(self.sequence)
+        for column in (self.sequence, self.cursor, self.deadline, self.flag_sum):
+            column.append(0)
+        self.x.append(x)
+        self.y.append(y)
+        self.palette_bank.append(palette_bank)
+        self.loop.append(loop)
+        self.playing.append(0)
+        self.play(instance, sequence, elapsed=elapsed)
+        return instance
+
+    def play(
+        self,
+        instance: int,
+        sequence: int,
+        loop: Optional[bool] = None,
+        elapsed: int = 0,
+    ):
+        """Switch an instance to another animation, like
+        SetAndPlayAnimationForAnimationControl.
+
+        If elapsed is nonzero, the animation starts as if it had been playing
+        for that many ticks.
+        """
+        t = self.table
+        self.sequence[instance] = sequence
+        self.flag_sum[instance] = 0
+        if loop is not None:
+            self.loop[instance] = loop
+        start = t.sequence_start[sequence]
+        end = start + t.sequence_length[sequence]
+        self.cursor[instance] = start
+        self.playing[instance] = 0
+        if start == end:
+            return
+        cursor = start
+        if elapsed:
+            total = t.total_duration(sequence)
+            if elapsed >= total:
+                if not self.loop[instance]:
+                    self.flag_sum[instance] = _or_all(t.flag[start:end])
+                    self.cursor[instance] = end - 1
+                    return
+                loop_start = t.sequence_loop[sequence]
+                self.flag_sum[instance] = _or_all(t.flag[start:end])
+                elapsed = (elapsed - total) % sum(t.duration[loop_start:end])
+                cursor = loop_start
+            while elapsed >= t.duration[cursor]:
+                elapsed -= t.duration[cursor]
+                self.flag_sum[instance] |= t.flag[cursor]
+                cursor += 1
+        self._load_frame(instance, cursor, elapsed)
+
+    def _load_frame(self, instance: int, cursor: int, elapsed: int = 0):
+        """Like LoadAnimationFrameAndIncrementInAnimationControl."""
+        self.cursor[instance] = cursor
+        self.flag_sum[instance] |= self.table.flag[cursor]
+        deadline = self.tick + self.table.duration[cursor] - elapsed
+        self.deadline[instance] = deadline
+        self.playing[instance] = 1
+        self._wheel[deadline].append(instance)
+
+    def step(self, ticks: int = 1) -> int:
+        """Advance all instances, and return the number of frame switches."""
+        table = self.table
+        switches = 0
+        for _ in range(ticks):
+            self.tick += 1
+            due = self._wheel.pop(self.tick, None)
+            if due is None:
+                continue
+            for instance in due:
+                if self.deadline[instance] != self.tick or not self.playing[instance]:
+                    continue
+                # Like SwitchAnimationControlToNextFrame
+                sequence = self.sequence[instance]
+                cursor = self.cursor[instance] + 1
+                end = table.sequence_start[sequence] + table.sequence_length[sequence]
+                if cursor >= end:
+                    if not self.loop[instance]:
+                        self.playing[instance] = 0
+                        continue
+                    cursor = table.sequence_loop[sequence]
+                self._load_frame(instance, cursor)
+                switches += 1
+        return switches
+
+    def move(self, instance: int, x: int, y: int):
+        self.x[instance] = x
+        self.y[instance] = y
+
+    def placements(self) -> List[Placement]:
+        """Get the placement of every instance's sprite on the current tick."""
+        t = self.table
+        return [
+            Placement(
+                i,
+                t.frame_id[c],
+                x + t.offset_x[c],
+                y + t.offset_y[c],
+                x + t.shadow_x[c],
+                y + t.shadow_y[c],
+                bank,
+                flags,
+            )
+            for i, (s, c, x, y, bank, flags) in enumerate(
+                zip(
+                    self.sequence,
+                    self.cursor,
+                    self.x,
+                    self.y,
+                    self.palette_bank,
+                    self.flag_sum,
+                )
+            )
+            if t.sequence_length[s]
+        ]
+
+
+def _or_all(values: Sequence[int]) -> int:
+    result = 0
+    for value in values:
+        result |= value
+    return result
+
+
+def load_sprites(
+    table: AnimationTable,
+    path: Union[str, os.PathLike],
+    entries: Sequence[Optional[int]] = (None,),
+) -> List[int]:
+    """Add WAN files, or WAN entries of a Pack archive, to an animation table."""
+    sprites = []
+    for entry in entries:
+        sprites.append(table.add_sprite(WanFile(load_wan(path, entry))))
+    return sprites
+
+
+def replay(script: dict, base_dir: Union[str, os.PathLike] = "."):
+    """Run a replay script (see the module description).
+
+    Yields:
+        List[Placement]: placements on each tick
+    """
+    table = AnimationTable()
+    for sprite in script["sprites"]:
+        load_sprites(table, Path(base_dir) / sprite["file"], [sprite.get("entry")])
+    engine = AnimationEngine(table)
+    spawns = defaultdict(list)
+    for index, spec in enumerate(script.get("instances", [])):
+        spawns[spec.get("start", 0)].append((index, spec))
+    events = defaultdict(list)
+    for event in script.get("events", []):
+        events[event["tick"]].append(event)
+    # Instance in the script -> instance in the engine
+    ids: Dict[int, int] = {}
+    for tick in range(script["ticks"]):
+        if tick:
+            engine.step()
+        for index, spec in spawns.get(tick, []):
+            ids[index] = engine.spawn(
+                table.sequence(
+                    spec["sprite"], spec.get("group", 0), spec.get("animation", 0)
+                ),
+                spec.get("x", 0),
+                spec.get("y", 0),
+                spec.get("palette_bank", 0),
+                spec.get("loop", True),
+                spec.get("elapsed", 0),
+            )
+        for event in events.get(tick, []):
+            index = event["instance"]
+            instance = ids[index]
+            if "x" in event or "y" in event:
+                engine.move(
+                    instance,
+                    event.get("x", engine.x[instance]),
+                    event.get("y", engine.y[instance]),
+                )
+            if "group" in event or "animation" in event:
+                sprite = event.get("sprite", script["instances"][index]["sprite"])
+                engine.play(
+                    instance,
+                    table.sequence(
+                        sprite, event.get("group", 0), event.get("animation", 0)
+                    ),
+                    event.get("loop"),
+                )
+        yield engine.placements()
+
+
+def bench(
+    table: AnimationTable, instances: int, ticks: int, placements: bool, seed: int
+) -> Tuple[float, int]:
+    """Step random animations, and return the elapsed time and frame switches."""
+    rng = random.Random(seed)
+    sequences = [
+        s for s in range(len(table.sequence_start)) if table.sequence_length[s]
+    ]
+    engine = AnimationEngine(table)
+    # Desynchronize the instances, as if they were spawned at different times
+    for _ in range(instances):
+        sequence = rng.choice(sequences)
+        engine.spawn(
+            sequence,
+            rng.randrange(256),
+            rng.randrange(192),
+            elapsed=rng.randrange(table.total_duration(sequence)),
+        )
+    switches = 0
+    start = time.perf_counter()
+    for _ in range(ticks):
+        switches += engine.step()
+        if placements:
+            engine.placements()
+    return time.perf_counter() - start, switches
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Play back WAN sprite animations like animation_control"
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    info_parser = subparsers.add_parser(
+        "info", help="list the animations of a WAN sprite"
+    )
+    info_parser.add_argument(
+        "-e",
+        "--entry",
+        type=lambda x: int(x, 0),
+        help="Pack archive entry (if the file is a Pack archive)",
+    )
+    info_parser.add_argument("file", help="WAN file or Pack archive")
+
+    play_parser = subparsers.add_parser(
+        "play", help="print the placements of one animation on each tick"
+    )
+    play_parser.add_argument(
+        "-e",
+        "--entry",
+        type=lambda x: int(x, 0),
+        help="Pack archive entry (if the file is a Pack archive)",
+    )
+    play_parser.add_argument(
+        "-g", "--group", type=int, default=0, help="animation group"
+    )
+    play_parser.add_argument(
+        "-a", "--animation", type=int, default=0, help="animation in the group"
+    )
+    play_parser.add_argument(
+        "-t", "--ticks", type=int, default=60, help="number of ticks to play"
+    )
+    play_parser.add_argument(
+        "--no-loop", action="store_true", help="stop on the last frame"
+    )
+    play_parser.add_argument("file", help="WAN file or Pack archive")
+
+    replay_parser = subparsers.add_parser(
+        "replay", help="run a replay script and print placements as JSON lines"
+    )
+    replay_parser.add_argument("script", help="replay script (JSON)")
+
+    bench_parser = subparsers.add_parser(
+        "bench", help="measure how many animations can be stepped per second"
+    )
+    bench_parser.add_argument(
+        "-e",
+        "--entry",
+        type=lambda x: int(x, 0),
+        action="append",
+        help="Pack archive entry to load (can be repeated)",
+    )
+    bench_parser.add_argument(
+        "-n", "--instances", type=int, default=5000, help="number of instances"
+    )
+    bench_parser.add_argument(
+        "-t", "--ticks", type=int, default=600, help="number of ticks to step"
+    )
+    bench_parser.add_argument(
+        "--placements",
+        action="store_true",
+        help="also compute all placements on every tick",
+    )
+    bench_parser.add_argument("--seed", type=int, default=0, help="random seed")
+    bench_parser.add_argument("file", help="WAN file or Pack archive")
+    args = parser.parse_args()
+
+    if args.command == "info":
+        table = AnimationTable()
+        load_sprites(table, args.file, [args.entry])
+        for (_, group_id, animation_id), sequence in table.sequences.items():
+            start = table.sequence_start[sequence]
+            length = table.sequence_length[sequence]
+            print(
+                f"group {group_id:3}, animation {animation_id}: {length} frames,"
+                + f" {table.total_duration(sequence)} ticks,"
+                + f" loops to frame {table.sequence_loop[sequence] - start}"
+            )
+    elif args.command == "play":
+        table = AnimationTable()
+        load_sprites(table, args.file, [args.entry])
+        engine = AnimationEngine(table)
+        engine.spawn(
+            table.sequence(0, args.group, args.animation), loop=not args.no_loop
+        )
+        for tick in range(args.ticks):
+            if tick:
+                engine.step()
+            for p in engine.placements():
+                print(
+                    f"{tick:5}: frame {p.frame_id:4} at ({p.x}, {p.y}),"
+                    + f" shadow at ({p.shadow_x}, {p.shadow_y}), flags 0x{p.flags:X}"
+                )
+    elif args.command == "replay":
+        with open(args.script) as f:
+            script = json.load(f)
+        for placements in replay(script, Path(args.script).parent):
+            print(json.dumps([p._asdict() for p in placements]))
+    elif args.command == "bench":
+        table = AnimationTable()
+        load_sprites(table, args.file, args.entry or [None])
+        if not any(table.sequence_length):
+            parser.error("no animations to play")
+        elapsed, switches = bench(
+            table, args.instances, args.ticks, args.placements, args.seed
+        )
+        stepped = args.instances * args.ticks
+        print(
+            f"{args.instances} instances, {args.ticks} ticks: {elapsed:.3f} s,"
+            + f" {switches} frame switches"
+            + f" ({stepped / elapsed:,.0f} animations stepped/s)"
+        )
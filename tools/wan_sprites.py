@@ -0,0 +1,477 @@
+#!/usr/bin/env python3
+
+"""
+`wan_sprites.py` is a library and command line utility for decoding WAN
+sprites (see `types/files/wan.h` in the C headers) and rendering their
+animation groups into texture atlases, like the ones the game loads into its
+wan_table with LoadWanTableEntryFromPack.
+
+A WAN file is a SIR0 container (see `sir0.py`) whose content header is
+`struct wan_header`. It points to:
+    - `struct wan_animation_header`, with the frame table (pointers to lists
+      of fragments), the animation groups (`struct wan_animation_group`, each
+      a list of animations, each a sequence of `struct wan_animation_frame`
+      terminated by a frame with a duration of 0) and the body part offsets
+    - `struct wan_image_header`, with the image table (`fragments_bytes_store`:
+      pointers to lists of 12-byte chunks, each a pointer to pixel data, or 0
+      for a run of transparent pixels, and a length in bytes; the list is
+      terminated by a null chunk) and the palettes (`struct wan_palettes`:
+      `struct rgba` colors in banks of 16)
+The length of the frame table isn't stored anywhere; it's recovered from the
+SIR0 pointer offset list.
+
+Each fragment of a frame is 10 bytes: the image index (-1 reuses tiles that
+are already in VRAM, and isn't drawn here), a tile number, and the 3 OAM
+attributes, which give the signed offset (10 bits for y, 9 for x), the shape
+and size (as for DS OAM entries), the flips, the color mode, the palette bank,
+and whether the fragment is the last one of the frame. Image pixels are 4bpp
+(or 8bpp) and stored as 8x8 tiles. Earlier fragments are drawn on top of later
+ones.
+
+The file is decoded in place from its buffer: fragments and animation frames
+are unpacked on the fly rather than built into objects up-front, and each
+image is decoded once per palette bank and cached. Pixels are expanded and
+palettes applied a whole buffer at a time (see `rgba.py`). Rendering is
+parallelized with a pool of processes, by sprite, or by animation group when
+rendering a single sprite; each worker keeps the sprite it's working on
+loaded.
+
+WAN files can be read directly or from the entries of a Pack archive (such as
+MONSTER/monster.bin), and compressed AT entries are decompressed first.
+
+Example usage:
+
+python3 wan_sprites.py info sprite.wan
+python3 wan_sprites.py info -e 25 /path/to/rom/MONSTER/monster.bin
+python3 wan_sprites.py render -e 25 -e 26 /path/to/rom/MONSTER/monster.bin -o out/
+python3 wan_sprites.py render -g 0 -g 5 sprite.wan -o out/
+"""
+
+import argparse
+import json
+import os
+from pathlib import Path
+import struct
+import time
+from typing import Dict, Iterator, List, NamedTuple, Optional, Tuple, Union
+
+from at_compression import decompress, is_at
+from pack_archive import PackArchive
+from rgba import (
+    BANK_TABLES,
+    Color,
+    blit,
+    channel_tables,
+    expand_4bpp,
+    flip,
+    shelf_pack,
+    to_rgba,
+    untile,
+    write_png,
+)
+from sir0 import MAGIC, Sir0
+from worker_pool import WorkerPool, add_jobs_argument, worker_state
+
+HEADER_FORMAT = "<IIH"
+ANIMATION_HEADER_FORMAT = "<IIIHH4xH2x"
+IMAGE_HEADER_FORMAT = "<IIH?xHH"
+PALETTES_FORMAT = "<IHHHBBI"
+ANIMATION_GROUP_FORMAT = "<IHH"
+ANIMATION_FRAME_FORMAT = "<BBHhhhh"
+ANIMATION_FRAME_SIZE = struct.calcsize(ANIMATION_FRAME_FORMAT)
+FRAGMENT_FORMAT = "<hHHHH"
+FRAGMENT_SIZE = struct.calcsize(FRAGMENT_FORMAT)
+IMAGE_CHUNK_FORMAT = "<IHHI"
+IMAGE_CHUNK_SIZE = struct.calcsize(IMAGE_CHUNK_FORMAT)
+TILE_SIZE = 8
+
+# Fragment dimensions, by OAM shape and size
+FRAGMENT_SIZES = (
+    ((8, 8), (16, 16), (32, 32), (64, 64)),
+    ((16, 8), (32, 8), (32, 16), (64, 32)),
+    ((8, 16), (8, 32), (16, 32), (32, 64)),
+)
+
+
+class Fragment(NamedTuple):
+    image_index: int
+    tile_num: int
+    attr0: int
+    attr1: int
+    attr2: int
+
+    @property
+    def size(self) -> Tuple[int, int]:
+        return FRAGMENT_SIZES[(self.attr0 >> 14) % 3][self.attr1 >> 14]
+
+    @property
+    def x(self) -> int:
+        return (self.attr1 & 0x1FF) - ((self.attr1 & 0x100) << 1)
+
+    @property
+    def y(self) -> int:
+        return (self.attr0 & 0x3FF) - ((self.attr0 & 0x200) << 1)
+
+    @property
+    def h_flip(self) -> bool:
+        return bool(self.attr1 & 0x1000)
+
+    @property
+    def v_flip(self) -> bool:
+        return bool(self.attr1 & 0x2000)
+
+    @property
+    def is_last(self) -> bool:
+        return bool(self.attr1 & 0x800)
+
+    @property
+    def is_256_color(self) -> bool:
+        return bool(self.attr0 & 0x2000)
+
+    @property
+    def palette(self) -> int:
+        return self.attr2 >> 12
+
+
+class AnimationFrame(NamedTuple):
+    """Mirrors struct wan_animation_frame."""
+
+    duration: int
+    flag: int
+    frame_id: int
+    offset_x: int
+    offset_y: int
+    shadow_offset_x: int
+    shadow_offset_y: int
+
+
+class AnimationGroup(NamedTuple):
+    """Mirrors struct wan_animation_group, with the animations decoded."""
+
+    animations: List[List[AnimationFrame]]
+    loop_start: int
+
+
+class RenderedFrame(NamedTuple):
+    width: int
+    height: int
+    # Position of the sprite origin within the frame
+    origin_x: int
+    origin_y: int
+    # One palette index per pixel, 0 being transparent
+    indexes: bytearray
+
+
+class WanFile:
+    """A WAN sprite, decoded in place from a buffer."""
+
+    def __init__(self, data: Union[bytes, memoryview]):
+        self.data = data
+        self.sir0 = Sir0(data)
+        anim_header, image_header, self.sprite_type = struct.unpack_from(
+            HEADER_FORMAT, data, self.sir0.content
+        )
+        if anim_header:
+            (
+                frames,
+                _,
+                animations,
+                self.nb_animation_groups,
+                _,
+                _,
+            ) = struct.unpack_from(ANIMATION_HEADER_FORMAT, data, anim_header)
+            self.frames = self.sir0.pointer_table(frames)
+        else:
+            animations = self.nb_animation_groups = 0
+            self.frames = []
+        self.animations_offset = animations
+        images, palettes, _, self.is_256_color, _, nb_images = struct.unpack_from(
+            IMAGE_HEADER_FORMAT, data, image_header
+        )
+        self.images = list(struct.unpack_from(f"<{nb_images}I", data, images))
+        self.palette = self._read_palette(palettes) if palettes else []
+        self.tables = channel_tables(self.palette)
+        self._image_cache: Dict[Tuple[int, int, int, int, bool], bytes] = {}
+
+    def _read_palette(self, offset: int) -> List[Color]:
+        colors, _, nb_color, _, _, _, _ = struct.unpack_from(
+            PALETTES_FORMAT, self.data, offset
+        )
+        # The colors are stored just before the palette header, so the space
+        # between them gives the number of colors in all banks
+        count = (offset - colors) // 4 if 0 < colors < offset else nb_color
+        count = min(count, 256)
+        return [
+            (r, g, b, 0xFF)
+            for r, g, b, _ in struct.iter_unpack(
+                "<4B", self.data[colors : colors + 4 * count]
+            )
+        ]
+
+    def fragments(self, frame_id: int) -> Iterator[Fragment]:
+        """Iterate over the fragments of a frame."""
+        offset = self.frames[frame_id]
+        while offset:
+            fragment = Fragment(*struct.unpack_from(FRAGMENT_FORMAT, self.data, offset))
+            yield fragment
+            if fragment.is_last:
+                return
+            offset += FRAGMENT_SIZE
+
+    def animation_group(self, group_id: int) -> AnimationGroup:
+        pointer, length, loop_start = struct.unpack_from(
+            ANIMATION_GROUP_FORMAT, self.data, self.animations_offset + 8 * group_id
+        )
+        animations = []
+        if pointer:
+            for sequence in struct.unpack_from(f"<{length}I", self.data, pointer):
+                frames = []
+                while sequence:
+                    frame = AnimationFrame(
+                        *struct.unpack_from(ANIMATION_FRAME_FORMAT, self.data, sequence)
+                    )
+                    if frame.duration == 0:
+                        break
+                    frames.append(frame)
+                    sequence += ANIMATION_FRAME_SIZE
+                animations.append(frames)
+        return AnimationGroup(animations, loop_start)
+
+    def image_bytes(self, image_index: int) -> bytes:
+        """Assemble the pixel data of an image from its chunks."""
+        chunks = []
+        offset = self.images[image_index]
+        while True:
+            pixels, length, _, _ = struct.unpack_from(
+                IMAGE_CHUNK_FORMAT, self.data, offset
+            )
+            if not pixels and not length:
+                break
+            chunks.append(
+                self.data[pixels : pixels + length] if pixels else bytes(length)
+            )
+            offset += IMAGE_CHUNK_SIZE
+        return b"".join(chunks)
+
+    def image(self, fragment: Fragment) -> bytes:
+        """Decode the image of a fragment into rows of palette indexes."""
+        width, height = fragment.size
+        is_256 = fragment.is_256_color or self.is_256_color
+        bank = 0 if is_256 else fragment.palette % max(1, len(self.palette) // 16)
+        key = (fragment.image_index, width, height, bank, is_256)
+        cached = self._image_cache.get(key)
+        if cached is not None:
+            return cached
+        pixels = self.image_bytes(fragment.image_index)
+        if is_256:
+            indexes = untile(pixels, width, height, TILE_SIZE, TILE_SIZE)
+        else:
+            indexes = untile(expand_4bpp(pixels), width, height, TILE_SIZE, TILE_SIZE)
+            if bank:
+                indexes = indexes.translate(BANK_TABLES[bank])
+        self._image_cache[key] = bytes(indexes)
+        return self._image_cache[key]
+
+    def render_frame(self, frame_id: int) -> RenderedFrame:
+        """Render a frame into palette indexes."""
+        fragments = [f for f in self.fragments(frame_id) if f.image_index >= 0]
+        if not fragments:
+            return RenderedFrame(1, 1, 0, 0, bytearray(1))
+        left = min(f.x for f in fragments)
+        top = min(f.y for f in fragments)
+        width = max(f.x + f.size[0] for f in fragments) - left
+        height = max(f.y + f.size[1] for f in fragments) - top
+        canvas = bytearray(width * height)
+        for fragment in reversed(fragments):
+            w, h = fragment.size
+            pixels = flip(self.image(fragment), w, h, fragment.h_flip, fragment.v_flip)
+            blit(canvas, width, pixels, w, fragment.x - left, fragment.y - top)
+        return RenderedFrame(width, height, -left, -top, canvas)
+
+
+class Atlas(NamedTuple):
+    width: int
+    height: int
+    rgba: bytearray
+    metadata: dict
+
+
+def render_group(wan: WanFile, group_id: int) -> Atlas:
+    """Render every frame used by an animation group into a texture atlas.
+
+    The metadata maps each frame ID to its rectangle in the atlas and its
+    origin, and lists the frames of each animation in the group.
+    """
+    group = wan.animation_group(group_id)
+    frame_ids = sorted({f.frame_id for a in group.animations for f in a})
+    frames = [wan.render_frame(frame_id) for frame_id in frame_ids]
+    positions, width, height = shelf_pack([(f.width, f.height) for f in frames])
+    canvas = bytearray(width * height)
+    for frame, (x, y) in zip(frames, positions):
+        blit(canvas, width, frame.indexes, frame.width, x, y)
+    metadata = {
+        "frames": {
+            str(frame_id): {
+                "x": x,
+                "y": y,
+                "width": frame.width,
+                "height": frame.height,
+                "origin_x": frame.origin_x,
+                "origin_y": frame.origin_y,
+            }
+            for frame_id, frame, (x, y) in zip(frame_ids, frames, positions)
+        },
+        "loop_start": group.loop_start,
+        "animations": [[f._asdict() for f in a] for a in group.animations],
+    }
+    return Atlas(width, height, to_rgba(canvas, wan.tables), metadata)
+
+
+def load_wan(path: Union[str, os.PathLike], entry: Optional[int] = None) -> bytes:
+    """Load a WAN file, or a WAN entry of a Pack archive, decompressing it."""
+    if entry is None:
+        data = Path(path).read_bytes()
+    else:
+        with PackArchive(path) as archive:
+            data = bytes(archive[entry])
+    return decompress(data) if is_at(data) else data
+
+
+def _render_task(task: Tuple[str, Optional[int], Optional[List[int]], str]) -> int:
+    path, entry, groups, prefix = task
+    # Each worker keeps the sprite it's rendering, for the next groups
+    sprites: Dict[Tuple[str, Optional[int]], Optional[WanFile]] = worker_state()
+    if (path, entry) not in sprites:
+        sprites.clear()
+        data = load_wan(path, entry)
+        # Not a sprite (e.g., an empty Pack archive entry)
+        sprites[(path, entry)] = WanFile(data) if data.startswith(MAGIC) else None
+    wan = sprites[(path, entry)]
+    if wan is None:
+        return 0
+    if groups is None:
+        groups = list(range(wan.nb_animation_groups))
+    count = 0
+    for group_id in groups:
+        if group_id >= wan.nb_animation_groups:
+            continue
+        atlas = render_group(wan, group_id)
+        write_png(f"{prefix}_{group_id:02}.png", atlas.width, atlas.height, atlas.rgba)
+        with open(f"{prefix}_{group_id:02}.json", "w") as f:
+            json.dump(atlas.metadata, f, indent=1)
+        count += 1
+    return count
+
+
+def render_all(
+    path: Union[str, os.PathLike],
+    entries: List[Optional[int]],
+    output_dir: Union[str, os.PathLike],
+    groups: Optional[List[int]] = None,
+    jobs: Optional[int] = None,
+) -> int:
+    """Render animation groups of WAN sprites in parallel.
+
+    Each group is written to <output_dir>/<name>_<group>.png, with its metadata
+    in a .json file of the same name. Work is split by sprite, or by animation
+    group if there's only one sprite.
+
+    Args:
+        path (Union[str, os.PathLike]): WAN file or Pack archive
+        entries (List[Optional[int]]): Pack archive entries to render, or
+            [None] for a WAN file
+        output_dir (Union[str, os.PathLike]): output directory
+        groups (Optional[List[int]]): animation groups to render (defaults to
+            all of them)
+        jobs (Optional[int]): number of worker processes (defaults to the CPU
+            count)
+
+    Returns:
+        int: number of atlases written
+    """
+    os.makedirs(output_dir, exist_ok=True)
+    path = str(path)
+    tasks = []
+    for entry in entries:
+        prefix = os.path.join(
+            output_dir, Path(path).stem if entry is None else f"{entry:04}"
+        )
+        if len(entries) > 1:
+            tasks.append((path, entry, groups, prefix))
+            continue
+        if groups is None:
+            groups = list(range(WanFile(load_wan(path, entry)).nb_animation_groups))
+        tasks += [(path, entry, [group_id], prefix) for group_id in groups]
+    with WorkerPool(jobs, dict) as executor:
+        return sum(executor.map(_render_task, tasks, chunksize=4))
+
+
+def print_info(wan: WanFile):
+    print(f"sprite type: {wan.sprite_type}")
+    print(f"256 colors: {wan.is_256_color}")
+    print(f"palette: {len(wan.palette)} colors")
+    print(f"images: {len(wan.images)}")
+    print(f"frames: {len(wan.frames)}")
+    print(f"animation groups: {wan.nb_animation_groups}")
+    for group_id in range(wan.nb_animation_groups):
+        group = wan.animation_group(group_id)
+        lengths = ", ".join(str(len(a)) for a in group.animations)
+        print(f"  {group_id:3}: {len(group.animations)} animations ({lengths} frames)")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Decode WAN sprites and render them into texture atlases"
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    info_parser = subparsers.add_parser("info", help="summarize a WAN sprite")
+    info_parser.add_argument(
+        "-e",
+        "--entry",
+        type=lambda x: int(x, 0),
+        help="Pack archive entry (if the file is a Pack archive)",
+    )
+    info_parser.add_argument("file", help="WAN file or Pack archive")
+
+    render_parser = subparsers.add_parser(
+        "render", help="render animation groups into texture atlases"
+    )
+    render_parser.add_argument(
+        "-e",
+        "--entry",
+        type=lambda x: int(x, 0),
+        action="append",
+        help="Pack archive entry to render (can be repeated; defaults to all"
+        + " entries if the file is a Pack archive)",
+    )
+    render_parser.add_argument(
+        "-g",
+        "--group",
+        type=int,
+        action="append",
+        help="animation group to render (can be repeated; defaults to all)",
+    )
+    add_jobs_argument(render_parser)
+    render_parser.add_argument(
+        "-o", "--output-dir", required=True, help="output directory"
+    )
+    render_parser.add_argument("file", help="WAN file or Pack archive")
+    args = parser.parse_args()
+
+    if args.command == "info":
+        print_info(WanFile(load_wan(args.file, args.entry)))
+    elif args.command == "render":
+        entries: List[Optional[int]] = args.entry
+        if entries is None:
+            with open(args.file, "rb") as f:
+                head = f.read(5)
+            if head.startswith(MAGIC) or is_at(head):
+                entries = [None]
+            else:
+                with PackArchive(args.file) as archive:
+                    entries = list(range(len(archive)))
+        start = time.perf_counter()
+        count = render_all(args.file, entries, args.output_dir, args.group, args.jobs)
+        elapsed = time.perf_counter() - start
+        print(f"Rendered {count} animation groups in {elapsed:.2f} s")
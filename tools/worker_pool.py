@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+
+"""
+`worker_pool.py` is a library of helpers for the tools that process many files
+(or many entries of a file) in parallel on the host.
+
+WorkerPool is a ProcessPoolExecutor whose worker processes each call a setup
+function once when they start, to do the expensive, read-only work that every
+task needs (loading the layout databases, opening an archive, reading a
+sample bank...). Its result is kept in the worker's per-process state and
+returned by worker_state(), so tasks only have to pickle the arguments that
+differ from one task to the next. Task functions must be defined at the top
+level of a module, so that they can be pickled.
+
+Example usage:
+
+def _setup(path: str) -> Kaomado:
+    return Kaomado(path)
+
+def _export_task(task) -> int:
+    return export(worker_state(), *task)
+
+with WorkerPool(args.jobs, _setup, (path,)) as executor:
+    total = sum(executor.map(_export_task, tasks))
+"""
+
+import argparse
+from concurrent.futures import ProcessPoolExecutor
+from typing import Any, Callable, Optional, Tuple
+
+# Per-process state of the current worker, as returned by the setup function
+_worker_state: Any = None
+
+
+def _init_worker(setup: Callable[..., Any], args: Tuple[Any, ...]):
+    global _worker_state
+    _worker_state = setup(*args)
+
+
+def worker_state() -> Any:
+    """Return the state of the current worker process.
+
+    This must be called in a process of a WorkerPool that has a setup function.
+    """
+    return _worker_state
+
+
+class WorkerPool(ProcessPoolExecutor):
+    """A process pool whose workers are set up once when they start."""
+
+    def __init__(
+        self,
+        jobs: Optional[int] = None,
+        setup: Optional[Callable[..., Any]] = None,
+        args: Tuple[Any, ...] = (),
+    ):
+        """
+        Args:
+            jobs (Optional[int]): number of worker processes (defaults to the
+                CPU count)
+            setup (Optional[Callable[..., Any]]): picklable function called
+                with args in each worker process, whose result is returned by
+                worker_state()
+            args (Tuple[Any, ...]): arguments of the setup function
+        """
+        if setup is None:
+            super().__init__(jobs)
+        else:
+            super().__init__(jobs, initializer=_init_worker, initargs=(setup, args))
+
+
+def add_jobs_argument(parser: argparse.ArgumentParser):
+    """Add the -j/--jobs option, for the number of worker processes."""
+    parser.add_argument(
+        "-j",
+        "--jobs",
+        type=int,
+        help="number of worker processes (defaults to the CPU count)",
+    )
@@ -0,0 +1,508 @@
+#!/usr/bin/env python3
+
+"""
+`wte_textures.py` is a library and command line utility for converting WTE
+textures (see `struct wte_header` in the C headers), such as the ones used by
+the dungeon mode GUI and the fog, to RGBA images.
+
+A WTE file is a SIR0 container (see `sir0.py`) whose content header is
+`struct wte_header`. The texture parameters mirror the DS TEXIMAGE_PARAM
+register: the texture is (8 << smult) pixels wide, (8 << tmult) pixels high,
+and in one of the DS texel formats (enum texture_format):
+    - A3I5: 5-bit palette index and 3-bit alpha per byte
+    - 4COLOR, 16COLOR, 256COLOR: 2, 4 or 8-bit palette indexes, with the
+      first pixel in the lowest bits
+    - COMPRESSED: 4x4 texel blocks, each with 2-bit texel codes (one byte per
+      row) and a 16-bit palette index word (palette offset in pairs of colors
+      in bits 0-13, and the mode in bits 14-15). The index words are assumed
+      to directly follow the texel blocks in the texture data, since WTE files
+      have no separate slot for them.
+    - A5I3: 3-bit palette index and 5-bit alpha per byte
+    - DIRECT: 16-bit colors (15-bit RGB, with bit 15 set if opaque)
+The palette is an array of `struct rgba`. Color 0 of the paletted formats
+(4COLOR, 16COLOR and 256COLOR) is treated as transparent by default, as the
+game draws them.
+
+Only the area given by `texture_bounds` is converted. Decoding works a row at
+a time (a block row for COMPRESSED), and each row is converted with
+`bytes.translate()` lookup tables built once per texture from the palette and
+the format (one per output channel, indexed directly by the texel byte), and
+with bitwise operations on big integers to combine DIRECT color fields, so
+that the per-pixel work happens in native code.
+
+The `batch` command finds every WTE file in an extracted ROM filesystem (both
+standalone files and, optionally compressed, entries of the Pack archives) and
+converts them all in parallel.
+
+Example usage:
+
+python3 wte_textures.py info texture.wte
+python3 wte_textures.py convert texture.wte texture.png
+python3 wte_textures.py convert -e 0x3F4 /path/to/rom/DUNGEON/dungeon.bin gui.png
+python3 wte_textures.py batch /path/to/rom -o textures/
+"""
+
+import argparse
+import enum
+import os
+from pathlib import Path
+import struct
+import time
+from typing import Iterator, List, NamedTuple, Optional, Sequence, Tuple, Union
+
+from at_compression import decompress, is_at
+from pack_archive import PackArchive
+from rgba import Color, write_png
+from sir0 import MAGIC as SIR0_MAGIC, Sir0
+from worker_pool import WorkerPool, add_jobs_argument
+
+SIGNATURE = b"WTE\x00"
+HEADER_FORMAT = "<4sIIH2xhhhhIH2x"
+
+
+class TextureFormat(enum.IntEnum):
+    """Mirrors enum texture_format."""
+
+    NONE = 0
+    A3I5 = 1
+    COLOR_4 = 2
+    COLOR_16 = 3
+    COLOR_256 = 4
+    COMPRESSED = 5
+    A5I3 = 6
+    DIRECT = 7
+
+
+# Bits per pixel of each format
+FORMAT_BPP = {
+    TextureFormat.A3I5: 8,
+    TextureFormat.COLOR_4: 2,
+    TextureFormat.COLOR_16: 4,
+    TextureFormat.COLOR_256: 8,
+    TextureFormat.COMPRESSED: 2,
+    TextureFormat.A5I3: 8,
+    TextureFormat.DIRECT: 16,
+}
+
+
+class WteHeader(NamedTuple):
+    """Mirrors struct wte_header, with the texture parameters unpacked."""
+
+    texture: int
+    texture_size: int
+    width: int
+    height: int
+    format: TextureFormat
+    repeat_x: bool
+    repeat_y: bool
+    bounds: Tuple[int, int, int, int]
+    palette: int
+    color_amt: int
+
+    @classmethod
+    def unpack_from(cls, data: Union[bytes, memoryview], offset: int) -> "WteHeader":
+        (
+            signature,
+            texture,
+            texture_size,
+            params,
+            x,
+            y,
+            w,
+            h,
+            palette,
+            color_amt,
+        ) = struct.unpack_from(HEADER_FORMAT, data, offset)
+        if signature != SIGNATURE:
+            raise ValueError(f"not a WTE file: signature {signature!r}")
+        return cls(
+            texture,
+            texture_size,
+            8 << (params & 7),
+            8 << ((params >> 3) & 7),
+            TextureFormat((params >> 8) & 7),
+            bool(params & 0x800),
+            bool(params & 0x1000),
+            (x, y, w, h),
+            palette,
+            color_amt,
+        )
+
+
+def is_wte(data: Union[bytes, memoryview]) -> bool:
+    if bytes(data[:4]) != SIR0_MAGIC or len(data) < 16:
+        return False
+    (content,) = struct.unpack_from("<I", data, 4)
+    return bytes(data[content : content + 4]) == SIGNATURE
+
+
+def _scale_table(bits: int) -> List[int]:
+    """Scale each value with a given number of bits to 8 bits."""
+    top = (1 << bits) - 1
+    return [(v * 255 + top // 2) // top for v in range(1 << bits)]
+
+
+SCALE_3 = _scale_table(3)
+SCALE_5 = _scale_table(5)
+SCALE_5_TABLE = bytes(SCALE_5 + [0] * (256 - 32))
+
+
+def texel_tables(
+    fmt: TextureFormat, palette: Sequence[Color], transparent_0: bool
+) -> List[bytes]:
+    """Build the lookup tables from texel bytes (or indexes) to RGBA channels.
+
+    For A3I5 and A5I3, the tables are indexed by the texel byte; for the other
+    paletted formats, they're indexed by palette index.
+    """
+    tables = [bytearray(256) for _ in range(4)]
+
+    def color(index: int) -> Color:
+        return palette[index] if index < len(palette) else (0, 0, 0, 0xFF)
+
+    for b in range(256):
+        if fmt == TextureFormat.A3I5:
+            rgb, alpha = color(b & 0x1F), SCALE_3[b >> 5]
+        elif fmt == TextureFormat.A5I3:
+            rgb, alpha = color(b & 7), SCALE_5[b >> 3]
+        else:
+            rgb = color(b)
+            alpha = 0 if b == 0 and transparent_0 else 0xFF
+        for channel in range(3):
+            tables[channel][b] = rgb[channel]
+        tables[3][b] = alpha
+    return [bytes(table) for table in tables]
+
+
+# Tables to expand packed texels into one byte per pixel (first pixel lowest)
+def _field_tables(bits: int) -> List[bytes]:
+    mask = (1 << bits) - 1
+    return [
+        bytes((b >> shift) & mask for b in range(256)) for shift in range(0, 8, bits)
+    ]
+
+
+FIELDS_2BPP = _field_tables(2)
+FIELDS_4BPP = _field_tables(4)
+# DIRECT color fields, from the low and high bytes of each texel
+DIRECT_R = bytes(b & 0x1F for b in range(256))
+DIRECT_G_LOW = bytes(b >> 5 for b in range(256))
+DIRECT_G_HIGH = bytes((b & 3) << 3 for b in range(256))
+DIRECT_B = bytes((b >> 2) & 0x1F for b in range(256))
+DIRECT_A = bytes(0xFF if b & 0x80 else 0 for b in range(256))
+
+
+def _interleave(channels: Sequence[bytes]) -> bytearray:
+    out = bytearray(4 * len(channels[0]))
+    for i, channel in enumerate(channels):
+        out[i::4] = channel
+    return out
+
+
+class TexelDecoder:
+    """
+    Converts a DS texture in a buffer to RGBA, a row at a time.
+
+    For COMPRESSED textures, the palette index words are read from
+    index_offset, which defaults to directly after the texel blocks.
+    """
+
+    def __init__(
+        self,
+        data: Union[bytes, memoryview],
+        offset: int,
+        width: int,
+        height: int,
+        fmt: TextureFormat,
+        palette: Sequence[Color],
+        transparent_0: bool = True,
+        index_offset: Optional[int] = None,
+    ):
+        self.data = data
+        self.offset = offset
+        self.width = width
+        self.height = height
+        self.format = fmt
+        self.palette = palette
+        self.tables = texel_tables(fmt, palette, transparent_0)
+        if index_offset is None:
+            index_offset = offset + width * height // 4
+        self.index_offset = index_offset
+
+    def _texel_row(self, y: int) -> bytes:
+        stride = self.width * FORMAT_BPP[self.format] // 8
+        start = self.offset + y * stride
+        row = bytes(self.data[start : start + stride])
+        return row + bytes(stride - len(row))
+
+    def _row(self, y: int) -> bytearray:
+        """Convert a full row of a non-COMPRESSED texture to RGBA."""
+        fmt = self.format
+        row = self._texel_row(y)
+        if fmt == TextureFormat.DIRECT:
+            low, high = row[0::2], row[1::2]
+            # The green fields can't carry into each other, so they can be
+            # added all at once
+            g = (
+                int.from_bytes(low.translate(DIRECT_G_LOW), "little")
+                + int.from_bytes(high.translate(DIRECT_G_HIGH), "little")
+            ).to_bytes(len(low), "little")
+            return _interleave(
+                [
+                    low.translate(DIRECT_R).translate(SCALE_5_TABLE),
+                    g.translate(SCALE_5_TABLE),
+                    high.translate(DIRECT_B).translate(SCALE_5_TABLE),
+                    high.translate(DIRECT_A),
+                ]
+            )
+        if fmt in (TextureFormat.COLOR_4, TextureFormat.COLOR_16):
+            fields = FIELDS_2BPP if fmt == TextureFormat.COLOR_4 else FIELDS_4BPP
+            indexes = bytearray(len(row) * len(fields))
+            for i, table in enumerate(fields):
+                indexes[i :: len(fields)] = row.translate(table)
+            row = bytes(indexes)
+        return _interleave([row.translate(table) for table in self.tables])
+
+    def _block_rows(self, block_y: int) -> List[bytearray]:
+        """Convert a row of 4x4 blocks of a COMPRESSED texture to RGBA."""
+        blocks_per_row = self.width // 4
+        texels_start = self.offset + 4 * block_y * blocks_per_row
+        texels = self.data[texels_start : texels_start + 4 * blocks_per_row]
+        indexes_start = self.index_offset + 2 * block_y * blocks_per_row
+        indexes = self.data[indexes_start : indexes_start + 2 * blocks_per_row]
+        rows = [bytearray(4 * self.width) for _ in range(4)]
+        for bx in range(blocks_per_row):
+            if 4 * bx + 4 > len(texels) or 2 * bx + 2 > len(indexes):
+                break
+            (word,) = struct.unpack_from("<H", indexes, 2 * bx)
+            colors = self._block_colors(word)
+            for ty in range(4):
+                codes = texels[4 * bx + ty]
+                out = rows[ty]
+                for tx in range(4):
+                    o = 4 * (4 * bx + tx)
+                    out[o : o + 4] = colors[(codes >> (2 * tx)) & 3]
+        return rows
+
+    def _block_colors(self, word: int) -> List[bytes]:
+        base = 2 * (word & 0x3FFF)
+        mode = word >> 14
+
+        def color(i: int) -> Color:
+            index = base + i
+            return self.palette[index] if index < len(self.palette) else (0, 0, 0, 0)
+
+        c0, c1 = color(0), color(1)
+        clear = (0, 0, 0, 0)
+        if mode == 0:
+            colors = [c0, c1, color(2), clear]
+        elif mode == 1:
+            colors = [c0, c1, tuple((a + b) // 2 for a, b in zip(c0, c1)), clear]
+        elif mode == 2:
+            colors = [c0, c1, color(2), color(3)]
+        else:
+            colors = [
+                c0,
+                c1,
+                tuple((5 * a + 3 * b) // 8 for a, b in zip(c0, c1)),
+                tuple((3 * a + 5 * b) // 8 for a, b in zip(c0, c1)),
+            ]
+        return [bytes(c) for c in colors]
+
+    def rows(self, x: int, y: int, w: int, h: int) -> Iterator[bytes]:
+        """Convert an area of the texture to RGBA, one row at a time."""
+        if self.format == TextureFormat.NONE:
+            for _ in range(h):
+                yield bytes(4 * w)
+        elif self.format == TextureFormat.COMPRESSED:
+            for block_y in range(y // 4, (y + h + 3) // 4):
+                for ty, row in enumerate(self._block_rows(block_y)):
+                    if y <= 4 * block_y + ty < y + h:
+                        yield bytes(row[4 * x : 4 * (x + w)])
+        else:
+            for row_y in range(y, y + h):
+                yield bytes(self._row(row_y)[4 * x : 4 * (x + w)])
+
+    def to_rgba(self) -> bytes:
+        """Convert the whole texture to RGBA."""
+        return b"".join(self.rows(0, 0, self.width, self.height))
+
+
+class WteTexture:
+    """A WTE texture, decoded from a buffer."""
+
+    def __init__(self, data: Union[bytes, memoryview], transparent_0: bool = True):
+        self.header = WteHeader.unpack_from(data, Sir0(data).content)
+        h = self.header
+        self.palette = [
+            (r, g, b, 0xFF)
+            for r, g, b, _ in struct.iter_unpack(
+                "<4B", data[h.palette : h.palette + 4 * h.color_amt]
+            )
+        ]
+        self.decoder = TexelDecoder(
+            data, h.texture, h.width, h.height, h.format, self.palette, transparent_0
+        )
+
+    @property
+    def bounds(self) -> Tuple[int, int, int, int]:
+        """The area to convert, clipped to the texture."""
+        x, y, w, h = self.header.bounds
+        width, height = self.header.width, self.header.height
+        if w <= 0 or h <= 0:
+            return 0, 0, width, height
+        x = min(max(x, 0), width)
+        y = min(max(y, 0), height)
+        return x, y, min(w, width - x), min(h, height - y)
+
+    def rows(self) -> Iterator[bytes]:
+        """Convert the texture to RGBA, one row at a time, within its bounds."""
+        return self.decoder.rows(*self.bounds)
+
+    def to_rgba(self) -> Tuple[int, int, bytes]:
+        """Convert the texture to RGBA within its bounds.
+
+        Returns:
+            Tuple[int, int, bytes]: width, height and RGBA data
+        """
+        _, _, w, h = self.bounds
+        return w, h, b"".join(self.rows())
+
+
+def load_file(path: Union[str, os.PathLike], entry: Optional[int] = None) -> bytes:
+    """Load a file, or an entry of a Pack archive, decompressing it."""
+    if entry is None:
+        data = Path(path).read_bytes()
+    else:
+        with PackArchive(path) as archive:
+            data = bytes(archive[entry])
+    return decompress(data) if is_at(data) else data
+
+
+def find_wte_files(rom_dir: Union[str, os.PathLike]) -> List[Tuple[str, Optional[int]]]:
+    """Find every WTE file in an extracted ROM filesystem.
+
+    Returns:
+        List[Tuple[str, Optional[int]]]: path of each WTE file, with the index
+            of the entry within the file if it's a Pack archive
+    """
+    found: List[Tuple[str, Optional[int]]] = []
+    for path in sorted(Path(rom_dir).rglob("*")):
+        if not path.is_file():
+            continue
+        with open(path, "rb") as f:
+            head = f.read(16)
+        if head.startswith(SIR0_MAGIC):
+            if is_wte(path.read_bytes()):
+                found.append((str(path), None))
+        elif path.suffix == ".bin" and head[:4] == bytes(4) and len(head) == 16:
+            try:
+                archive = PackArchive(path)
+            except ValueError:
+                continue
+            with archive:
+                for i in range(len(archive)):
+                    entry = archive[i]
+                    if entry[:4] == SIR0_MAGIC or is_at(entry):
+                        if is_wte(decompress(entry) if is_at(entry) else entry):
+                            found.append((str(path), i))
+                    entry.release()
+    return found
+
+
+def convert(
+    path: Union[str, os.PathLike],
+    output: Union[str, os.PathLike],
+    entry: Optional[int] = None,
+    transparent_0: bool = True,
+):
+    """Convert a WTE file (or a WTE entry of a Pack archive) to a PNG."""
+    texture = WteTexture(load_file(path, entry), transparent_0)
+    width, height, rgba = texture.to_rgba()
+    write_png(str(output), width, height, rgba)
+
+
+def _convert_task(task: Tuple[str, Optional[int], str, bool]) -> str:
+    path, entry, output, transparent_0 = task
+    convert(path, output, entry, transparent_0)
+    return output
+
+
+def convert_all(
+    rom_dir: Union[str, os.PathLike],
+    output_dir: Union[str, os.PathLike],
+    transparent_0: bool = True,
+    jobs: Optional[int] = None,
+) -> int:
+    """Convert every WTE file in an extracted ROM filesystem in parallel.
+
+    Each texture is written to <output_dir> under its path within the ROM
+    filesystem, with the entry index appended for Pack archive entries.
+
+    Returns:
+        int: number of textures converted
+    """
+    tasks = []
+    for path, entry in find_wte_files(rom_dir):
+        name = Path(path).relative_to(rom_dir)
+        suffix = "" if entry is None else f"_{entry:04}"
+        output = Path(output_dir) / name.parent / f"{name.stem}{suffix}.png"
+        output.parent.mkdir(parents=True, exist_ok=True)
+        tasks.append((path, entry, str(output), transparent_0))
+    with WorkerPool(jobs) as executor:
+        return len(list(executor.map(_convert_task, tasks)))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Convert WTE textures to PNGs")
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    def add_source_args(subparser: argparse.ArgumentParser):
+        subparser.add_argument(
+            "-e",
+            "--entry",
+            type=lambda x: int(x, 0),
+            help="Pack archive entry (if the file is a Pack archive)",
+        )
+        subparser.add_argument("file", help="WTE file or Pack archive")
+
+    info_parser = subparsers.add_parser("info", help="print the header of a WTE file")
+    add_source_args(info_parser)
+
+    convert_parser = subparsers.add_parser("convert", help="convert a WTE file")
+    add_source_args(convert_parser)
+    convert_parser.add_argument("output", help="output PNG")
+
+    batch_parser = subparsers.add_parser(
+        "batch", help="convert every WTE file in a ROM filesystem in parallel"
+    )
+    add_jobs_argument(batch_parser)
+    batch_parser.add_argument(
+        "-o", "--output-dir", required=True, help="output directory"
+    )
+    batch_parser.add_argument("rom_dir", help="extracted ROM filesystem")
+
+    for subparser in (convert_parser, batch_parser):
+        subparser.add_argument(
+            "--opaque-color-0",
+            action="store_true",
+            help="draw color 0 of paletted textures instead of treating it as"
+            + " transparent",
+        )
+    args = parser.parse_args()
+
+    if args.command == "info":
+        texture = WteTexture(load_file(args.file, args.entry))
+        for field, value in texture.header._asdict().items():
+            if isinstance(value, enum.Enum):
+                value = value.name
+            print(f"{field}: {value}")
+    elif args.command == "convert":
+        convert(args.file, args.output, args.entry, not args.opaque_color_0)
+    elif args.command == "batch":
+        start = time.perf_counter()
+        count = convert_all(
+            args.rom_dir, args.output_dir, not args.opaque_color_0, args.jobs
+        )
+        elapsed = time.perf_counter() - start
+        print(f"Converted {count} textures in {elapsed:.2f} s")